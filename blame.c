@@ -6,6 +6,9 @@
 #include "diffcore.h"
 #include "tag.h"
 #include "blame.h"
+#include "lockfile.h"
+#include "quote.h"
+#include "dir.h"
 
 void blame_origin_decref(struct blame_origin *o)
 {
@@ -1540,6 +1543,387 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 		free(sg_origin);
 }
 
+/*
+ * The blame cache.
+ *
+ * When sb->use_cache is set, the blame of a whole file at a commit is
+ * kept in $GIT_DIR/blame-cache once it has been found, and when the
+ * lines of an origin are about to be passed to its parents, they are
+ * blamed according to its cached blame instead if it has one.  Each
+ * file is named after the commit, the path and the options that change
+ * how blame is assigned, and records the blob and then the entries,
+ * sorted by lno, each followed by the previous origin of its suspect if
+ * it has one:
+ *
+ *	blob <blob>
+ *	<commit> <s_lno> <lno> <num_lines> <path>
+ *	previous <commit> <path>
+ *
+ * Line numbers are 0-based and the paths are quoted as needed.
+ *
+ * The blame of a line does not depend on where the walk started from,
+ * so the cached blame of a file can be reused for the lines that reach
+ * it from any descendant.  That is not true of moves and copies, which
+ * are looked for a group of lines at a time, so the cache is not used
+ * when looking for them.
+ */
+struct cached_blame {
+	struct commit *commit;
+	char *path;
+	int s_lno, lno, num_lines;
+	struct commit *previous;
+	char *previous_path;
+};
+
+static int blame_cache_usable(struct blame_scoreboard *sb, int opt)
+{
+	return sb->use_cache &&
+		!(opt & (PICKAXE_BLAME_MOVE | PICKAXE_BLAME_COPY));
+}
+
+static char *blame_cache_path(struct blame_scoreboard *sb, int opt,
+			      struct commit *commit, const char *path)
+{
+	struct strbuf key = STRBUF_INIT;
+	unsigned char hash[GIT_SHA1_RAWSZ];
+	git_SHA_CTX ctx;
+	const char *hex;
+
+	strbuf_addf(&key, "%s %s%c%d %d %u %u %d %d %d",
+		    oid_to_hex(&commit->object.oid), path, '\0',
+		    opt, sb->xdl_opts, sb->move_score, sb->copy_score,
+		    sb->no_whole_file_rename, sb->revs->first_parent_only,
+		    sb->revs->diffopt.flags.allow_textconv);
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, key.buf, key.len);
+	git_SHA1_Final(hash, &ctx);
+	strbuf_release(&key);
+
+	hex = sha1_to_hex(hash);
+	return git_pathdup("blame-cache/%.2s/%s", hex, hex + 2);
+}
+
+static void free_cached_blame(struct cached_blame *cached, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		free(cached[i].path);
+		free(cached[i].previous_path);
+	}
+	free(cached);
+}
+
+static struct commit *parse_cached_commit(const char *p, const char **end)
+{
+	struct object_id oid;
+	struct commit *commit;
+
+	if (parse_oid_hex(p, &oid, end) || *(*end)++ != ' ')
+		return NULL;
+	commit = lookup_commit(&oid);
+	if (!commit || parse_commit(commit))
+		return NULL;
+	return commit;
+}
+
+static int parse_cached_number(const char **p, int *n)
+{
+	char *end;
+
+	if (!isdigit(**p))
+		return -1;
+	*n = strtol(*p, &end, 10);
+	if (*end != ' ')
+		return -1;
+	*p = end + 1;
+	return 0;
+}
+
+static char *parse_cached_path(const char *p)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	if (*p != '"')
+		return xstrdup(p);
+	if (unquote_c_style(&path, p, NULL)) {
+		strbuf_release(&path);
+		return NULL;
+	}
+	return strbuf_detach(&path, NULL);
+}
+
+/*
+ * Read the cached blame of the origin into *cached; returns the number
+ * of entries, or -1 if there is none or it does not match the blob.
+ */
+static int read_cached_blame(struct blame_scoreboard *sb, int opt,
+			     struct blame_origin *origin,
+			     struct cached_blame **cached)
+{
+	char *file = blame_cache_path(sb, opt, origin->commit, origin->path);
+	FILE *fp = fopen(file, "r");
+	struct strbuf line = STRBUF_INIT;
+	struct cached_blame *c = NULL;
+	int nr = 0, alloc = 0;
+	struct object_id oid;
+	const char *p;
+
+	if (!fp) {
+		free(file);
+		return -1;
+	}
+	if (strbuf_getline(&line, fp) == EOF ||
+	    !skip_prefix(line.buf, "blob ", &p) ||
+	    get_oid_hex(p, &oid) || oidcmp(&oid, &origin->blob_oid))
+		goto bad;
+
+	while (strbuf_getline(&line, fp) != EOF) {
+		struct cached_blame *e;
+
+		if (skip_prefix(line.buf, "previous ", &p)) {
+			e = nr ? &c[nr - 1] : NULL;
+			if (!e || e->previous ||
+			    !(e->previous = parse_cached_commit(p, &p)) ||
+			    !(e->previous_path = parse_cached_path(p)))
+				goto bad;
+			continue;
+		}
+
+		ALLOC_GROW(c, nr + 1, alloc);
+		e = &c[nr++];
+		memset(e, 0, sizeof(*e));
+		if (!(e->commit = parse_cached_commit(line.buf, &p)) ||
+		    parse_cached_number(&p, &e->s_lno) ||
+		    parse_cached_number(&p, &e->lno) ||
+		    parse_cached_number(&p, &e->num_lines) ||
+		    !(e->path = parse_cached_path(p)))
+			goto bad;
+		/* the entries must cover the file in order */
+		if (e->num_lines <= 0 ||
+		    e->lno != (nr > 1 ? e[-1].lno + e[-1].num_lines : 0))
+			goto bad;
+	}
+	if (!nr)
+		goto bad;
+	fclose(fp);
+	/* keep the entries in use from being pruned by "git gc" */
+	utime(file, NULL);
+	free(file);
+	strbuf_release(&line);
+	*cached = c;
+	return nr;
+
+bad:
+	fclose(fp);
+	free(file);
+	strbuf_release(&line);
+	free_cached_blame(c, nr);
+	return -1;
+}
+
+/*
+ * Blame the lines of the origin according to its cached blame, if it
+ * has one; returns 1 if it did.
+ */
+static int blame_from_cache(struct blame_scoreboard *sb,
+			    struct blame_origin *origin, int opt)
+{
+	struct cached_blame *cached;
+	struct blame_entry *e, *next, *found = NULL;
+	int nr, i;
+
+	if (!blame_cache_usable(sb, opt) ||
+	    is_null_oid(&origin->commit->object.oid) ||
+	    fill_blob_sha1_and_mode(origin))
+		return 0;
+	nr = read_cached_blame(sb, opt, origin, &cached);
+	if (nr < 0)
+		return 0;
+	for (e = origin->suspects; e; e = e->next)
+		if (cached[nr - 1].lno + cached[nr - 1].num_lines <
+		    e->s_lno + e->num_lines) {
+			free_cached_blame(cached, nr);
+			return 0;
+		}
+
+	for (e = origin->suspects; e; e = next) {
+		int start = e->s_lno, end = e->s_lno + e->num_lines;
+		int lo = 0, hi = nr;
+
+		/* find the first cached entry that ends after start */
+		while (lo < hi) {
+			int mid = lo + (hi - lo) / 2;
+			if (cached[mid].lno + cached[mid].num_lines <= start)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (i = lo; i < nr && cached[i].lno < end; i++) {
+			struct cached_blame *c = &cached[i];
+			int from = c->lno < start ? start : c->lno;
+			int to = c->lno + c->num_lines;
+			struct blame_entry *n = xcalloc(1, sizeof(*n));
+
+			if (end < to)
+				to = end;
+			n->lno = e->lno + from - start;
+			n->s_lno = c->s_lno + from - c->lno;
+			n->num_lines = to - from;
+			/*
+			 * The walk may come across these origins later on
+			 * and expects them to know their blobs.
+			 */
+			n->suspect = get_origin(c->commit, c->path);
+			fill_blob_sha1_and_mode(n->suspect);
+			if (c->previous && !n->suspect->previous) {
+				n->suspect->previous =
+					get_origin(c->previous, c->previous_path);
+				fill_blob_sha1_and_mode(n->suspect->previous);
+			}
+			n->next = found;
+			found = n;
+		}
+		next = e->next;
+		blame_origin_decref(e->suspect);
+		free(e);
+	}
+	origin->suspects = NULL;
+	free_cached_blame(cached, nr);
+
+	/* These are all final */
+	for (e = found; e; e = next) {
+		struct commit *commit = e->suspect->commit;
+
+		next = e->next;
+		e->suspect->guilty = 1;
+		/* treat root commit as boundary, like assign_blame() */
+		if (!commit->parents && !sb->show_root)
+			commit->object.flags |= UNINTERESTING;
+		if (sb->found_guilty_entry)
+			sb->found_guilty_entry(e, sb->found_guilty_entry_data);
+		e->next = sb->ent;
+		sb->ent = e;
+	}
+	return 1;
+}
+
+static int compare_blame_lno(const void *a_, const void *b_)
+{
+	const struct blame_entry *a = *(const struct blame_entry **)a_;
+	const struct blame_entry *b = *(const struct blame_entry **)b_;
+
+	return a->lno - b->lno;
+}
+
+static void write_cached_blame(struct blame_scoreboard *sb, int opt)
+{
+	struct lock_file lock = LOCK_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct blame_origin *final;
+	struct blame_entry *e, **ents;
+	int nr = 0, num_lines = 0, i;
+	char *file;
+
+	if (sb->reverse || is_null_oid(&sb->final->object.oid))
+		return;
+	for (e = sb->ent; e; e = e->next) {
+		nr++;
+		num_lines += e->num_lines;
+	}
+	if (!nr || num_lines != sb->num_lines)
+		return; /* only some of the lines were blamed */
+
+	file = blame_cache_path(sb, opt, sb->final, sb->path);
+	if (file_exists(file) || safe_create_leading_directories(file) ||
+	    hold_lock_file_for_update(&lock, file, 0) < 0) {
+		free(file);
+		return;
+	}
+
+	final = get_origin(sb->final, sb->path);
+	fill_blob_sha1_and_mode(final);
+	strbuf_addf(&buf, "blob %s\n", oid_to_hex(&final->blob_oid));
+	blame_origin_decref(final);
+
+	ALLOC_ARRAY(ents, nr);
+	for (i = 0, e = sb->ent; e; e = e->next)
+		ents[i++] = e;
+	QSORT(ents, nr, compare_blame_lno);
+	for (i = 0; i < nr; i++) {
+		struct blame_origin *suspect = ents[i]->suspect;
+
+		strbuf_addf(&buf, "%s %d %d %d ",
+			    oid_to_hex(&suspect->commit->object.oid),
+			    ents[i]->s_lno, ents[i]->lno, ents[i]->num_lines);
+		quote_c_style(suspect->path, &buf, NULL, 0);
+		strbuf_addch(&buf, '\n');
+		if (suspect->previous) {
+			strbuf_addf(&buf, "previous %s ",
+				    oid_to_hex(&suspect->previous->commit->object.oid));
+			quote_c_style(suspect->previous->path, &buf, NULL, 0);
+			strbuf_addch(&buf, '\n');
+		}
+	}
+	if (write_in_full(get_lock_file_fd(&lock), buf.buf, buf.len) < 0 ||
+	    commit_lock_file(&lock))
+		rollback_lock_file(&lock);
+	free(ents);
+	strbuf_release(&buf);
+	free(file);
+}
+
+/*
+ * Remove the cached blames that have not been written or used since
+ * the expiry time, and the directories left empty, the cache's own
+ * included.
+ */
+void prune_blame_cache(timestamp_t expire)
+{
+	struct strbuf path = STRBUF_INIT;
+	DIR *dir;
+	struct dirent *e;
+	size_t base_len;
+
+	dir = opendir(git_path("blame-cache"));
+	if (!dir)
+		return;
+	strbuf_addstr(&path, git_path("blame-cache/"));
+	base_len = path.len;
+	while ((e = readdir(dir))) {
+		DIR *subdir;
+		struct dirent *f;
+		size_t dir_len;
+
+		if (is_dot_or_dotdot(e->d_name))
+			continue;
+		strbuf_setlen(&path, base_len);
+		strbuf_addstr(&path, e->d_name);
+		subdir = opendir(path.buf);
+		if (!subdir)
+			continue;
+		strbuf_addch(&path, '/');
+		dir_len = path.len;
+		while ((f = readdir(subdir))) {
+			struct stat st;
+
+			if (is_dot_or_dotdot(f->d_name))
+				continue;
+			strbuf_setlen(&path, dir_len);
+			strbuf_addstr(&path, f->d_name);
+			if (!lstat(path.buf, &st) && st.st_mtime < expire)
+				unlink_or_warn(path.buf);
+		}
+		closedir(subdir);
+		strbuf_setlen(&path, dir_len - 1);
+		rmdir(path.buf);
+	}
+	closedir(dir);
+	strbuf_setlen(&path, base_len - 1);
+	rmdir(path.buf);
+	strbuf_release(&path);
+}
+
 /*
  * The main loop -- while we have blobs with lines whose true origin
  * is still unknown, pick one blob, and allow its lines to pass blames
@@ -1572,9 +1956,10 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		parse_commit(commit);
 		if (sb->reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
-		     !(revs->max_age != -1 && commit->date < revs->max_age)))
-			pass_blame(sb, suspect, opt);
-		else {
+		     !(revs->max_age != -1 && commit->date < revs->max_age))) {
+			if (!blame_from_cache(sb, suspect, opt))
+				pass_blame(sb, suspect, opt);
+		} else {
 			commit->object.flags |= UNINTERESTING;
 			if (commit->object.parsed)
 				mark_parents_uninteresting(commit);
@@ -1606,6 +1991,9 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		if (sb->debug) /* sanity */
 			sanity_check_refcnt(sb);
 	}
+
+	if (blame_cache_usable(sb, opt))
+		write_cached_blame(sb, opt);
 }
 
 static const char *get_next_line(const char *start, const char *end)
@@ -141,6 +141,8 @@ struct blame_scoreboard {
 	int xdl_opts;
 	int no_whole_file_rename;
 	int debug;
+	/* reuse and record whole-file blames in $GIT_DIR/blame-cache */
+	int use_cache;
 
 	/* callbacks */
 	void(*on_sanity_fail)(struct blame_scoreboard *, int);
@@ -165,6 +167,7 @@ extern void blame_coalesce(struct blame_scoreboard *sb);
 extern void blame_sort_final(struct blame_scoreboard *sb);
 extern unsigned blame_entry_score(struct blame_scoreboard *sb, struct blame_entry *e);
 extern void assign_blame(struct blame_scoreboard *sb, int opt);
+extern void prune_blame_cache(timestamp_t expire);
 extern const char *blame_nth_line(struct blame_scoreboard *sb, long lno);
 
 extern void init_scoreboard(struct blame_scoreboard *sb);
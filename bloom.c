@@ -0,0 +1,203 @@
+#include "cache.h"
+#include "bloom.h"
+#include "commit.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "string-list.h"
+
+#define BITS_PER_WORD 8
+
+static const uint32_t seed_value0 = 0x293ae76f;
+static const uint32_t seed_value1 = 0x7e646e2c;
+
+static inline uint32_t rotate_left(uint32_t value, int count)
+{
+	return (value << count) | (value >> ((sizeof(value) * 8) - count));
+}
+
+static inline uint32_t get_le32_bytes(const unsigned char *p)
+{
+	return (uint32_t)p[0] |
+	       ((uint32_t)p[1] << 8) |
+	       ((uint32_t)p[2] << 16) |
+	       ((uint32_t)p[3] << 24);
+}
+
+uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	const uint32_t r1 = 15;
+	const uint32_t r2 = 13;
+	const uint32_t m = 5;
+	const uint32_t n = 0xe6546b64;
+	uint32_t k1 = 0;
+	size_t i, len4 = len / sizeof(uint32_t);
+
+	for (i = 0; i < len4; i++) {
+		uint32_t k = get_le32_bytes(p + 4 * i);
+
+		k *= c1;
+		k = rotate_left(k, r1);
+		k *= c2;
+
+		seed ^= k;
+		seed = rotate_left(seed, r2) * m + n;
+	}
+
+	p += 4 * len4;
+	switch (len & 3) {
+	case 3:
+		k1 ^= (uint32_t)p[2] << 16;
+		/* fallthrough */
+	case 2:
+		k1 ^= (uint32_t)p[1] << 8;
+		/* fallthrough */
+	case 1:
+		k1 ^= (uint32_t)p[0];
+		k1 *= c1;
+		k1 = rotate_left(k1, r1);
+		k1 *= c2;
+		seed ^= k1;
+		break;
+	}
+
+	seed ^= (uint32_t)len;
+	seed ^= (seed >> 16);
+	seed *= 0x85ebca6b;
+	seed ^= (seed >> 13);
+	seed *= 0xc2b2ae35;
+	seed ^= (seed >> 16);
+
+	return seed;
+}
+
+void fill_bloom_key(const char *data, size_t len,
+		    struct bloom_key *key,
+		    const struct bloom_filter_settings *settings)
+{
+	uint32_t i;
+	uint32_t hash0 = murmur3_seeded(seed_value0, data, len);
+	uint32_t hash1 = murmur3_seeded(seed_value1, data, len);
+
+	ALLOC_ARRAY(key->hashes, settings->num_hashes);
+	for (i = 0; i < settings->num_hashes; i++)
+		key->hashes[i] = hash0 + i * hash1;
+}
+
+void clear_bloom_key(struct bloom_key *key)
+{
+	FREE_AND_NULL(key->hashes);
+}
+
+static void add_key_to_filter(const struct bloom_key *key,
+			      struct bloom_filter *filter,
+			      const struct bloom_filter_settings *settings)
+{
+	uint64_t mod = (uint64_t)filter->len * BITS_PER_WORD;
+	uint32_t i;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t pos = key->hashes[i] % mod;
+
+		filter->data[pos / BITS_PER_WORD] |= 1 << (pos % BITS_PER_WORD);
+	}
+}
+
+int bloom_filter_contains(const struct bloom_filter *filter,
+			  const struct bloom_key *key,
+			  const struct bloom_filter_settings *settings)
+{
+	uint64_t mod = (uint64_t)filter->len * BITS_PER_WORD;
+	uint32_t i;
+
+	if (!mod)
+		return 0;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t pos = key->hashes[i] % mod;
+
+		if (!(filter->data[pos / BITS_PER_WORD] &
+		      (1 << (pos % BITS_PER_WORD))))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Add "path" and each of its leading directories to "paths".
+ */
+static void add_changed_path(struct string_list *paths, const char *path)
+{
+	const char *slash;
+
+	string_list_insert(paths, path);
+	for (slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+		char *dir = xmemdupz(path, slash - path);
+
+		string_list_insert(paths, dir);
+		free(dir);
+	}
+}
+
+void compute_bloom_filter(struct commit *c,
+			  struct bloom_filter *filter,
+			  const struct bloom_filter_settings *settings)
+{
+	struct string_list paths = STRING_LIST_INIT_DUP;
+	struct diff_options diffopt;
+	int i, too_many = 0;
+
+	if (parse_commit(c))
+		die(_("unable to parse commit %s"), oid_to_hex(&c->object.oid));
+
+	diff_setup(&diffopt);
+	diffopt.flags.recursive = 1;
+	diffopt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&diffopt);
+
+	if (c->parents) {
+		struct commit *parent = c->parents->item;
+
+		if (parse_commit(parent))
+			die(_("unable to parse commit %s"),
+			    oid_to_hex(&parent->object.oid));
+		diff_tree_oid(&parent->tree->object.oid, &c->tree->object.oid,
+			      "", &diffopt);
+	} else {
+		diff_tree_oid(NULL, &c->tree->object.oid, "", &diffopt);
+	}
+
+	if (diff_queued_diff.nr > BLOOM_FILTER_MAX_CHANGED_PATHS)
+		too_many = 1;
+	for (i = 0; !too_many && i < diff_queued_diff.nr; i++) {
+		add_changed_path(&paths, diff_queued_diff.queue[i]->two->path);
+		if (paths.nr > BLOOM_FILTER_MAX_CHANGED_PATHS)
+			too_many = 1;
+	}
+	diff_flush(&diffopt);
+
+	if (too_many) {
+		filter->len = 1;
+		filter->data = xmalloc(1);
+		filter->data[0] = 0xff;
+	} else {
+		filter->len = (paths.nr * settings->bits_per_entry +
+			       BITS_PER_WORD - 1) / BITS_PER_WORD;
+		filter->data = filter->len ? xcalloc(filter->len, 1) : NULL;
+
+		for (i = 0; i < paths.nr; i++) {
+			struct bloom_key key;
+
+			fill_bloom_key(paths.items[i].string,
+				       strlen(paths.items[i].string),
+				       &key, settings);
+			add_key_to_filter(&key, filter, settings);
+			clear_bloom_key(&key);
+		}
+	}
+
+	string_list_clear(&paths, 0);
+}
@@ -0,0 +1,74 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+struct commit;
+
+/*
+ * Changed-path Bloom filters record, for each commit, which paths
+ * differ between the commit and its first parent (or the empty tree
+ * for a root commit).  The leading directories of every changed path
+ * are included, so that "git log -- dir" can use them as well.
+ *
+ * A filter answers "definitely not changed" or "maybe changed";
+ * revision walks use it to skip the tree diff in the first case.
+ */
+struct bloom_filter_settings {
+	/* version of the hash function used to compute the filters */
+	uint32_t hash_version;
+
+	/* number of bits set in the filter for each path */
+	uint32_t num_hashes;
+
+	/* number of bits in the filter per changed path */
+	uint32_t bits_per_entry;
+};
+
+#define DEFAULT_BLOOM_FILTER_SETTINGS { 1, 7, 10 }
+
+/*
+ * Commits changing more paths than this (leading directories
+ * included) get a filter with every bit set, which always answers
+ * "maybe".
+ */
+#define BLOOM_FILTER_MAX_CHANGED_PATHS 512
+
+struct bloom_filter {
+	unsigned char *data;
+	size_t len;
+};
+
+/*
+ * The bit positions for one path, computed once and checked against
+ * the filters of many commits.
+ */
+struct bloom_key {
+	uint32_t *hashes;
+};
+
+/*
+ * 32-bit Murmur3 hash of "data", starting from "seed".
+ */
+extern uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len);
+
+extern void fill_bloom_key(const char *data, size_t len,
+			   struct bloom_key *key,
+			   const struct bloom_filter_settings *settings);
+extern void clear_bloom_key(struct bloom_key *key);
+
+/*
+ * Return 1 if the path of "key" may be in "filter", and 0 if it is
+ * definitely not.
+ */
+extern int bloom_filter_contains(const struct bloom_filter *filter,
+				 const struct bloom_key *key,
+				 const struct bloom_filter_settings *settings);
+
+/*
+ * Compute the changed-path filter of "c" against its first parent.
+ * The caller owns filter->data, which is NULL if nothing changed.
+ */
+extern void compute_bloom_filter(struct commit *c,
+				 struct bloom_filter *filter,
+				 const struct bloom_filter_settings *settings);
+
+#endif
@@ -23,6 +23,7 @@
 #include "dir.h"
 #include "progress.h"
 #include "blame.h"
+#include "refs.h"
 
 static char blame_usage[] = N_("git blame [<options>] [<rev-opts>] [<rev>] [--] <file>");
 
@@ -46,6 +47,7 @@ static int xdl_opts;
 static int abbrev = -1;
 static int no_whole_file_rename;
 static int show_progress;
+static int use_blame_cache;
 
 static struct date_mode blame_date_mode = { DATE_ISO8601 };
 static size_t blame_date_width;
@@ -601,6 +603,10 @@ static int git_blame_config(const char *var, const char *value, void *cb)
 			*output_option &= ~OUTPUT_SHOW_EMAIL;
 		return 0;
 	}
+	if (!strcmp(var, "blame.cache")) {
+		use_blame_cache = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "blame.date")) {
 		if (!value)
 			return config_error_nonbool(var);
@@ -616,6 +622,47 @@ static int git_blame_config(const char *var, const char *value, void *cb)
 	return git_default_config(var, value, cb);
 }
 
+static int has_commit_graft(const struct commit_graft *graft, void *cb_data)
+{
+	return 1;
+}
+
+static int has_replace_ref(const char *refname, const struct object_id *oid,
+			   int flags, void *cb_data)
+{
+	return 1;
+}
+
+/*
+ * The blame cache relies on the history of the file being the same
+ * every time, which it is not when we are told to stop digging early
+ * or are given the ancestry to use, nor when the clone is shallow or
+ * commits are grafted or replaced, and on the lines being the same,
+ * which they may not be with textconv.
+ */
+static int can_use_blame_cache(struct rev_info *revs, const char *revs_file,
+			       const char *path)
+{
+	struct userdiff_driver *driver;
+	int i;
+
+	if (reverse || revs_file || is_repository_shallow() ||
+	    revs->max_age != -1)
+		return 0;
+	prepare_commit_graft();
+	if (for_each_commit_graft(has_commit_graft, NULL))
+		return 0;
+	if (check_replace_refs && for_each_replace_ref(has_replace_ref, NULL))
+		return 0;
+	for (i = 0; i < revs->pending.nr; i++)
+		if (revs->pending.objects[i].item->flags & UNINTERESTING)
+			return 0;
+	driver = userdiff_find_by_path(path);
+	if (revs->diffopt.flags.allow_textconv && driver && driver->textconv)
+		return 0;
+	return 1;
+}
+
 static int blame_copy_callback(const struct option *option, const char *arg, int unset)
 {
 	int *opt = option->value;
@@ -864,6 +911,8 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	sb.revs = &revs;
 	sb.contents_from = contents_from;
 	sb.reverse = reverse;
+	sb.use_cache = use_blame_cache &&
+		can_use_blame_cache(&revs, revs_file, path);
 	setup_scoreboard(&sb, path, &o);
 	lno = sb.num_lines;
 
@@ -0,0 +1,109 @@
+#include "builtin.h"
+#include "config.h"
+#include "parallel-checkout.h"
+#include "parse-options.h"
+#include "pkt-line.h"
+
+/*
+ * A worker process for parallel checkout (see parallel-checkout.c).
+ * It reads the entries to write from stdin, one packet each, until a
+ * flush packet, then writes them and reports the outcome of each one
+ * on stdout, followed by a flush packet.
+ */
+
+static void packet_to_pc_item(const char *buffer, int len,
+			      struct parallel_checkout_item *pc_item)
+{
+	const struct pc_item_fixed_portion *fixed_portion;
+	const char *name;
+	struct cache_entry *ce;
+
+	if (len < sizeof(*fixed_portion))
+		die("BUG: checkout worker received too short item (got %d bytes)",
+		    len);
+
+	fixed_portion = (const struct pc_item_fixed_portion *)buffer;
+	if (len - sizeof(*fixed_portion) != fixed_portion->name_len)
+		die("BUG: checkout worker received corrupted item");
+	name = buffer + sizeof(*fixed_portion);
+
+	ce = xcalloc(1, cache_entry_size(fixed_portion->name_len));
+	ce->ce_mode = fixed_portion->ce_mode;
+	ce->ce_namelen = fixed_portion->name_len;
+	oidcpy(&ce->oid, &fixed_portion->oid);
+	memcpy(ce->name, name, fixed_portion->name_len);
+
+	memset(pc_item, 0, sizeof(*pc_item));
+	pc_item->ce = ce;
+	pc_item->ca.crlf_action = fixed_portion->crlf_action;
+	pc_item->ca.ident = fixed_portion->ident;
+	pc_item->id = fixed_portion->id;
+}
+
+static void report_result(const struct parallel_checkout_item *pc_item)
+{
+	struct pc_item_result res;
+
+	memset(&res, 0, sizeof(res));
+	res.id = pc_item->id;
+	res.status = pc_item->status;
+	if (pc_item->status == PC_ITEM_WRITTEN)
+		res.st = pc_item->st;
+
+	packet_write(1, (const char *)&res, sizeof(res));
+}
+
+static void worker_loop(void)
+{
+	struct parallel_checkout_item *items = NULL;
+	size_t i, nr = 0, alloc = 0;
+
+	/*
+	 * Read everything before writing anything, so that the main
+	 * process can send all the items without reading our results.
+	 */
+	while (1) {
+		int len = packet_read(0, NULL, NULL, packet_buffer,
+				      sizeof(packet_buffer), 0);
+		if (!len)
+			break;
+
+		ALLOC_GROW(items, nr + 1, alloc);
+		packet_to_pc_item(packet_buffer, len, &items[nr++]);
+	}
+
+	for (i = 0; i < nr; i++) {
+		write_pc_item(&items[i]);
+		report_result(&items[i]);
+		free(items[i].ce);
+	}
+
+	packet_flush(1);
+	free(items);
+}
+
+static const char * const checkout_worker_usage[] = {
+	N_("git checkout--worker"),
+	NULL
+};
+
+int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
+{
+	struct option checkout_worker_options[] = {
+		OPT_END()
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(checkout_worker_usage,
+				   checkout_worker_options);
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, checkout_worker_options,
+			     checkout_worker_usage, 0);
+	if (argc > 0)
+		usage_with_options(checkout_worker_usage,
+				   checkout_worker_options);
+
+	worker_loop();
+	return 0;
+}
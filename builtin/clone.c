@@ -26,6 +26,7 @@
 #include "run-command.h"
 #include "connected.h"
 #include "packfile.h"
+#include "argv-array.h"
 
 /*
  * Overall FIXMEs:
@@ -885,6 +886,7 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 
 	struct refspec *refspec;
 	const char *fetch_pattern;
+	struct argv_array ref_prefixes = ARGV_ARRAY_INIT;
 
 	packet_trace_identity("clone");
 	argc = parse_options(argc, argv, prefix, builtin_clone_options,
@@ -1104,7 +1106,14 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	if (transport->smart_options && !deepen)
 		transport->smart_options->check_self_contained_and_connected = 1;
 
-	refs = transport_get_remote_refs(transport);
+	refspec_ref_prefixes(refspec, 1, &ref_prefixes);
+	if (option_branch)
+		expand_ref_prefix(&ref_prefixes, option_branch);
+	if (!option_no_tags)
+		argv_array_push(&ref_prefixes, "refs/tags/");
+	argv_array_push(&ref_prefixes, "HEAD");
+
+	refs = transport_get_remote_refs(transport, &ref_prefixes);
 
 	if (refs) {
 		mapped_refs = wanted_peer_refs(refs, refspec);
@@ -1197,5 +1206,6 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	junk_mode = JUNK_LEAVE_ALL;
 
 	free(refspec);
+	argv_array_clear(&ref_prefixes);
 	return err;
 }
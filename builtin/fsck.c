@@ -16,6 +16,7 @@
 #include "streaming.h"
 #include "decorate.h"
 #include "packfile.h"
+#include "promisor-remote.h"
 
 #define REACHABLE 0x0001
 #define SEEN      0x0002
@@ -123,6 +124,15 @@ static int fsck_error_func(struct fsck_options *o,
 
 static struct object_array pending;
 
+/*
+ * A filtered clone leaves blobs out, to be fetched from the promisor
+ * remote when needed, so those are not errors.
+ */
+static int is_promised(struct object *obj)
+{
+	return obj->type == OBJ_BLOB && has_promisor_remote();
+}
+
 static int mark_object(struct object *obj, int type, void *data, struct fsck_options *options)
 {
 	struct object *parent = data;
@@ -150,7 +160,7 @@ static int mark_object(struct object *obj, int type, void *data, struct fsck_opt
 		return 0;
 	obj->flags |= REACHABLE;
 	if (!(obj->flags & HAS_OBJ)) {
-		if (parent && !has_object_file(&obj->oid)) {
+		if (parent && !is_promised(obj) && !has_object_file(&obj->oid)) {
 			printf("broken link from %7s %s\n",
 				 printable_type(parent), describe_object(parent));
 			printf("              to %7s %s\n",
@@ -210,6 +220,8 @@ static void check_reachable_object(struct object *obj)
 	if (!(obj->flags & HAS_OBJ)) {
 		if (has_sha1_pack(obj->oid.hash))
 			return; /* it is in pack - forget about it */
+		if (is_promised(obj))
+			return;
 		printf("missing %s %s\n", printable_type(obj),
 			describe_object(obj));
 		errors_found |= ERROR_REACHABLE;
@@ -661,6 +673,7 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 
 	errors_found = 0;
 	check_replace_refs = 0;
+	fetch_if_missing = 0;
 
 	argc = parse_options(argc, argv, prefix, fsck_opts, fsck_usage, 0);
 
@@ -20,6 +20,7 @@
 #include "argv-array.h"
 #include "commit.h"
 #include "packfile.h"
+#include "blame.h"
 
 #define FAILED_RUN "failed to run %s"
 
@@ -39,6 +40,8 @@ static timestamp_t gc_log_expire_time;
 static const char *gc_log_expire = "1.day.ago";
 static const char *prune_expire = "2.weeks.ago";
 static const char *prune_worktrees_expire = "3.months.ago";
+static timestamp_t blame_cache_expire_time;
+static const char *blame_cache_expire = "2.weeks.ago";
 
 static struct argv_array pack_refs_cmd = ARGV_ARRAY_INIT;
 static struct argv_array reflog = ARGV_ARRAY_INIT;
@@ -125,6 +128,7 @@ static void gc_config(void)
 	git_config_get_expiry("gc.pruneexpire", &prune_expire);
 	git_config_get_expiry("gc.worktreepruneexpire", &prune_worktrees_expire);
 	git_config_get_expiry("gc.logexpiry", &gc_log_expire);
+	git_config_get_expiry("gc.blamecacheexpire", &blame_cache_expire);
 
 	git_config(git_default_config, NULL);
 }
@@ -379,6 +383,10 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 	gc_config();
 	if (parse_expiry_date(gc_log_expire, &gc_log_expire_time))
 		die(_("Failed to parse gc.logexpiry value %s"), gc_log_expire);
+	if (blame_cache_expire &&
+	    parse_expiry_date(blame_cache_expire, &blame_cache_expire_time))
+		die(_("Failed to parse gc.blameCacheExpire value %s"),
+		    blame_cache_expire);
 
 	if (pack_refs < 0)
 		pack_refs = !is_bare_repository();
@@ -472,6 +480,9 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 	if (run_command_v_opt(rerere.argv, RUN_GIT_CMD))
 		return error(FAILED_RUN, rerere.argv[0]);
 
+	if (blame_cache_expire)
+		prune_blame_cache(blame_cache_expire_time);
+
 	report_garbage = report_pack_garbage;
 	reprepare_packed_git();
 	if (pack_garbage.nr > 0)
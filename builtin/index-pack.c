@@ -13,9 +13,10 @@
 #include "streaming.h"
 #include "thread-utils.h"
 #include "packfile.h"
+#include "list.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] [--[no-]rev-index] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -74,6 +75,63 @@ static int ref_deltas_alloc;
 static int nr_resolved_deltas;
 static int nr_threads;
 
+/*
+ * Local objects a thin pack has deltas against, while the deltas
+ * depending on them are being resolved and before they are appended
+ * to the pack; see fix_unresolved_deltas().
+ */
+static struct object_entry *thin_bases;
+static int nr_thin_bases;
+
+/*
+ * The thin bases are deflated by the thread that first reads them,
+ * ready to be appended, as long as they fit in the memory budget.
+ */
+struct deflated_base {
+	void *data;
+	unsigned long size;
+};
+static struct deflated_base *deflated_bases;
+static size_t deflated_bases_used;
+
+/* How much delta base data each thread may keep inflated */
+static size_t base_cache_limit;
+
+/*
+ * When the pack is read from the standard input, the threads resolve
+ * the ofs-deltas whose bases have been received while the rest of the
+ * pack is still coming in; see queue_received_deltas().
+ */
+enum stream_state {
+	STREAM_NONE,	/* left to resolve_deltas() */
+	STREAM_QUEUED,	/* ready, being resolved or waiting for its base */
+	STREAM_DONE
+};
+
+struct streamed_delta {
+	int base;		/* object number of the ofs-delta base */
+	int first_child;	/* deltas waiting for this one to be resolved */
+	int next_sibling;
+	enum stream_state state;
+};
+static struct streamed_delta *streamed;
+static int stream_deltas;
+
+/*
+ * Objects inflated while the pack is being received, so that the
+ * deltas arriving after them do not have to read them back.
+ */
+struct stream_cache_entry {
+	struct hashmap_entry ent;
+	struct list_head lru;
+	int obj_no;
+	void *data;
+	unsigned long size;
+};
+static struct hashmap stream_cache;
+static LIST_HEAD(stream_cache_lru);
+static size_t stream_cache_used;
+
 static int from_stdin;
 static int strict;
 static int do_fsck_object;
@@ -122,6 +180,18 @@ static pthread_mutex_t type_cas_mutex;
 #define type_cas_lock()		lock_mutex(&type_cas_mutex)
 #define type_cas_unlock()	unlock_mutex(&type_cas_mutex)
 
+static pthread_mutex_t stream_cache_mutex;
+#define stream_cache_lock()	lock_mutex(&stream_cache_mutex)
+#define stream_cache_unlock()	unlock_mutex(&stream_cache_mutex)
+
+static pthread_cond_t stream_cond;
+static int *ready_deltas;
+static int nr_ready_deltas;
+static int nr_streaming;
+static int nr_received;
+static int input_done;
+static int stream_progress;
+
 static pthread_key_t key;
 
 static inline void lock_mutex(pthread_mutex_t *mutex)
@@ -146,6 +216,8 @@ static void init_thread(void)
 	pthread_mutex_init(&counter_mutex, NULL);
 	pthread_mutex_init(&work_mutex, NULL);
 	pthread_mutex_init(&type_cas_mutex, NULL);
+	pthread_mutex_init(&stream_cache_mutex, NULL);
+	pthread_cond_init(&stream_cond, NULL);
 	if (show_stat)
 		pthread_mutex_init(&deepest_delta_mutex, NULL);
 	pthread_key_create(&key, NULL);
@@ -169,6 +241,8 @@ static void cleanup_thread(void)
 	pthread_mutex_destroy(&counter_mutex);
 	pthread_mutex_destroy(&work_mutex);
 	pthread_mutex_destroy(&type_cas_mutex);
+	pthread_mutex_destroy(&stream_cache_mutex);
+	pthread_cond_destroy(&stream_cond);
 	if (show_stat)
 		pthread_mutex_destroy(&deepest_delta_mutex);
 	for (i = 0; i < nr_threads; i++)
@@ -194,6 +268,9 @@ static void cleanup_thread(void)
 #define type_cas_lock()
 #define type_cas_unlock()
 
+#define stream_cache_lock()
+#define stream_cache_unlock()
+
 #endif
 
 
@@ -400,7 +477,7 @@ static void prune_base_data(struct base_data *retain)
 	struct base_data *b;
 	struct thread_local *data = get_thread_data();
 	for (b = data->base_cache;
-	     data->base_cache_used > delta_base_cache_limit && b;
+	     data->base_cache_used > base_cache_limit && b;
 	     b = b->child) {
 		if (b->data && b != retain)
 			free_base_data(b);
@@ -616,6 +693,184 @@ static void *get_data_from_pack(struct object_entry *obj)
 	return unpack_data(obj, NULL, NULL);
 }
 
+static void *deflate_object(const void *in, unsigned long size,
+			    unsigned long *deflated_size)
+{
+	git_zstream stream;
+	unsigned long maxsize;
+	void *out;
+	int status;
+
+	git_deflate_init(&stream, zlib_compression_level);
+	maxsize = git_deflate_bound(&stream, size);
+	out = xmalloc(maxsize);
+
+	stream.next_in = (void *)in;
+	stream.avail_in = size;
+	stream.next_out = out;
+	stream.avail_out = maxsize;
+	while ((status = git_deflate(&stream, Z_FINISH)) == Z_OK)
+		; /* nothing */
+	if (status != Z_STREAM_END)
+		die(_("unable to deflate appended object (%d)"), status);
+	*deflated_size = stream.total_out;
+	git_deflate_end(&stream);
+	return out;
+}
+
+static int is_thin_base(const struct object_entry *obj)
+{
+	return thin_bases && obj >= thin_bases && obj < thin_bases + nr_thin_bases;
+}
+
+/*
+ * Read a base of a thin pack from the local object store, as it is
+ * not in the pack (yet).
+ */
+static void *get_thin_base_data(const struct object_entry *obj)
+{
+	const unsigned char *sha1 = obj->idx.oid.hash;
+	enum object_type type;
+	unsigned long size;
+	void *data;
+
+	read_lock();
+	data = read_sha1_file(sha1, &type, &size);
+	read_unlock();
+	if (!data || type != obj->real_type || size != obj->size ||
+	    check_sha1_signature(sha1, data, size, typename(type)))
+		die(_("local object %s is corrupt"), sha1_to_hex(sha1));
+	return data;
+}
+
+static void *read_thin_base(struct object_entry *obj)
+{
+	struct deflated_base *d = &deflated_bases[obj - thin_bases];
+	void *data = get_thin_base_data(obj);
+	int full;
+
+	if (d->data)
+		return data;
+	counter_lock();
+	full = deflated_bases_used >= base_cache_limit * nr_threads;
+	counter_unlock();
+	if (full)
+		return data;
+
+	d->data = deflate_object(data, obj->size, &d->size);
+	counter_lock();
+	deflated_bases_used += d->size;
+	counter_unlock();
+	return data;
+}
+
+static int stream_cache_cmp(const void *unused_cmp_data,
+			    const void *va, const void *vb,
+			    const void *keydata)
+{
+	const struct stream_cache_entry *a = va, *b = vb;
+	const int *obj_no = keydata;
+
+	return a->obj_no != (obj_no ? *obj_no : b->obj_no);
+}
+
+static void *stream_cache_get(int obj_no, unsigned long *size)
+{
+	struct stream_cache_entry *ent;
+	void *data = NULL;
+
+	if (!stream_cache.cmpfn)
+		return NULL;
+	stream_cache_lock();
+	ent = hashmap_get_from_hash(&stream_cache, obj_no, &obj_no);
+	if (ent) {
+		list_del(&ent->lru);
+		list_add_tail(&ent->lru, &stream_cache_lru);
+		data = xmemdupz(ent->data, ent->size);
+		*size = ent->size;
+	}
+	stream_cache_unlock();
+	return data;
+}
+
+static void release_stream_cache_entry(struct stream_cache_entry *ent)
+{
+	hashmap_remove(&stream_cache, ent, NULL);
+	list_del(&ent->lru);
+	stream_cache_used -= ent->size;
+	free(ent->data);
+	free(ent);
+}
+
+/* Cache an object, taking ownership of its data. */
+static void stream_cache_add(int obj_no, void *data, unsigned long size)
+{
+	size_t limit = base_cache_limit * nr_threads;
+	struct stream_cache_entry *ent;
+	struct list_head *lru, *tmp;
+
+	if (size > limit) {
+		free(data);
+		return;
+	}
+	ent = xmalloc(sizeof(*ent));
+	ent->obj_no = obj_no;
+	ent->data = data;
+	ent->size = size;
+	hashmap_entry_init(ent, obj_no);
+
+	stream_cache_lock();
+	stream_cache_used += size;
+	list_for_each_safe(lru, tmp, &stream_cache_lru) {
+		struct stream_cache_entry *f =
+			list_entry(lru, struct stream_cache_entry, lru);
+		if (stream_cache_used <= limit)
+			break;
+		release_stream_cache_entry(f);
+	}
+	list_add_tail(&ent->lru, &stream_cache_lru);
+	hashmap_add(&stream_cache, ent);
+	stream_cache_unlock();
+}
+
+static void clear_stream_cache(void)
+{
+	struct list_head *lru, *tmp;
+
+	list_for_each_safe(lru, tmp, &stream_cache_lru)
+		release_stream_cache_entry(list_entry(lru,
+				struct stream_cache_entry, lru));
+	hashmap_free(&stream_cache, 0);
+}
+
+/*
+ * Inflate an object of the pack, or one of the deltas resolved while
+ * the pack was received, rebuilding it from its chain of ofs-delta
+ * bases unless it is still cached.
+ */
+static void *get_streamed_data(int obj_no, unsigned long *size)
+{
+	struct object_entry *obj = &objects[obj_no];
+	unsigned long base_size;
+	void *data, *base, *raw;
+
+	data = stream_cache_get(obj_no, size);
+	if (data)
+		return data;
+	if (!is_delta_type(obj->type)) {
+		*size = obj->size;
+		return get_data_from_pack(obj);
+	}
+	base = get_streamed_data(streamed[obj_no].base, &base_size);
+	raw = get_data_from_pack(obj);
+	data = patch_delta(base, base_size, raw, obj->size, size);
+	free(raw);
+	free(base);
+	if (!data)
+		bad_object(obj->idx.offset, _("failed to apply delta"));
+	return data;
+}
+
 static int compare_ofs_delta_bases(off_t offset1, off_t offset2,
 				   enum object_type type1,
 				   enum object_type type2)
@@ -880,7 +1135,7 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
  *
  * The first one in find_unresolved_deltas() traverses down from
  * parent node to children, deflating nodes along the way. However,
- * memory for deflated nodes is limited by delta_base_cache_limit, so
+ * memory for deflated nodes is limited by base_cache_limit, so
  * at some point parent node's deflated content may be freed.
  *
  * The second walker is this function, which goes from current node up
@@ -889,11 +1144,11 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
  * needs to apply delta.
  *
  * In the worst case scenario, parent node is no longer deflated because
- * we're running out of delta_base_cache_limit; we need to re-deflate
+ * we're running out of base_cache_limit; we need to re-deflate
  * parents, possibly up to the top base.
  *
  * All deflated objects here are subject to be freed if we exceed
- * delta_base_cache_limit, just like in find_unresolved_deltas(), we
+ * base_cache_limit, just like in find_unresolved_deltas(), we
  * just need to make sure the last node is not freed.
  */
 static void *get_base_data(struct base_data *c)
@@ -903,14 +1158,23 @@ static void *get_base_data(struct base_data *c)
 		struct base_data **delta = NULL;
 		int delta_nr = 0, delta_alloc = 0;
 
-		while (is_delta_type(c->obj->type) && !c->data) {
+		/*
+		 * The top base is usually not a delta, unless it was
+		 * resolved while the pack was being received.
+		 */
+		while (c->base && !c->data) {
 			ALLOC_GROW(delta, delta_nr + 1, delta_alloc);
 			delta[delta_nr++] = c;
 			c = c->base;
 		}
 		if (!delta_nr) {
-			c->data = get_data_from_pack(obj);
-			c->size = obj->size;
+			if (is_thin_base(obj)) {
+				c->data = read_thin_base(obj);
+				c->size = obj->size;
+			} else {
+				c->data = get_streamed_data(obj - objects,
+							    &c->size);
+			}
 			get_thread_data()->base_cache_used += c->size;
 			prune_base_data(c);
 		}
@@ -1008,34 +1272,47 @@ static struct base_data *find_unresolved_deltas_1(struct base_data *base,
 		link_base_data(prev_base, base);
 	}
 
-	if (base->ref_first <= base->ref_last) {
+	while (base->ref_first <= base->ref_last) {
 		struct object_entry *child = objects + ref_deltas[base->ref_first].obj_no;
-		struct base_data *result = alloc_base_data();
+		struct base_data *result = NULL;
 
-		if (!compare_and_swap_type(&child->real_type, OBJ_REF_DELTA,
-					   base->obj->real_type))
+		if (compare_and_swap_type(&child->real_type, OBJ_REF_DELTA,
+					  base->obj->real_type)) {
+			result = alloc_base_data();
+			resolve_delta(child, base, result);
+		} else if (!nr_thin_bases) {
 			die("BUG: child->real_type != OBJ_REF_DELTA");
-
-		resolve_delta(child, base, result);
+		}
+		/*
+		 * Otherwise the base is both in the thin pack and local, and
+		 * whoever got to this delta first has resolved it already.
+		 */
 		if (base->ref_first == base->ref_last && base->ofs_last == -1)
 			free_base_data(base);
 
 		base->ref_first++;
-		return result;
+		if (result)
+			return result;
 	}
 
-	if (base->ofs_first <= base->ofs_last) {
+	while (base->ofs_first <= base->ofs_last) {
 		struct object_entry *child = objects + ofs_deltas[base->ofs_first].obj_no;
-		struct base_data *result = alloc_base_data();
-
-		assert(child->real_type == OBJ_OFS_DELTA);
-		child->real_type = base->obj->real_type;
-		resolve_delta(child, base, result);
+		struct base_data *result = NULL;
+
+		if (child->real_type == OBJ_OFS_DELTA) {
+			child->real_type = base->obj->real_type;
+			result = alloc_base_data();
+			resolve_delta(child, base, result);
+		} else if (!streamed) {
+			die("BUG: child->real_type != OBJ_OFS_DELTA");
+		}
+		/* Otherwise it was resolved while the pack was received. */
 		if (base->ofs_first == base->ofs_last)
 			free_base_data(base);
 
 		base->ofs_first++;
-		return result;
+		if (result)
+			return result;
 	}
 
 	unlink_base_data(base);
@@ -1079,6 +1356,17 @@ static int compare_ref_delta_entry(const void *a, const void *b)
 	return hashcmp(delta_a->sha1, delta_b->sha1);
 }
 
+/*
+ * Whether the deltas of the pack are to be looked for from this object:
+ * it is either not a delta, or was resolved while the pack was received.
+ */
+static int is_delta_root(int obj_no)
+{
+	if (!is_delta_type(objects[obj_no].type))
+		return 1;
+	return streamed && streamed[obj_no].state == STREAM_DONE;
+}
+
 static void resolve_base(struct object_entry *obj)
 {
 	struct base_data *base_obj = alloc_base_data();
@@ -1098,7 +1386,7 @@ static void *threaded_second_pass(void *data)
 		counter_unlock();
 		work_lock();
 		while (nr_dispatched < nr_objects &&
-		       is_delta_type(objects[nr_dispatched].type))
+		       !is_delta_root(nr_dispatched))
 			nr_dispatched++;
 		if (nr_dispatched >= nr_objects) {
 			work_unlock();
@@ -1111,6 +1399,196 @@ static void *threaded_second_pass(void *data)
 	}
 	return NULL;
 }
+
+static void *threaded_thin_pass(void *data)
+{
+	set_thread_data(data);
+	for (;;) {
+		int i;
+		counter_lock();
+		display_progress(progress, nr_resolved_deltas);
+		counter_unlock();
+		work_lock();
+		if (nr_dispatched >= nr_thin_bases) {
+			work_unlock();
+			break;
+		}
+		i = nr_dispatched++;
+		work_unlock();
+
+		resolve_base(&thin_bases[i]);
+	}
+	return NULL;
+}
+
+static void start_threads(void *(*fn)(void *))
+{
+	int i;
+
+	nr_dispatched = 0;
+	init_thread();
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&thread_data[i].thread, NULL,
+					 fn, thread_data + i);
+		if (ret)
+			die(_("unable to create thread: %s"),
+			    strerror(ret));
+	}
+}
+
+static void join_threads(void)
+{
+	int i;
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+	cleanup_thread();
+}
+
+static void run_threads(void *(*fn)(void *))
+{
+	start_threads(fn);
+	join_threads();
+}
+
+static void resolve_streamed_delta(int obj_no)
+{
+	struct object_entry *obj = &objects[obj_no];
+	struct object_entry *base_obj = &objects[streamed[obj_no].base];
+	struct base_data base, result;
+
+	memset(&base, 0, sizeof(base));
+	memset(&result, 0, sizeof(result));
+	base.obj = base_obj;
+	base.data = get_streamed_data(streamed[obj_no].base, &base.size);
+	/* large blobs only get their real_type once they are hashed */
+	obj->real_type = is_delta_type(base_obj->type) ?
+			 base_obj->real_type : base_obj->type;
+	resolve_delta(obj, &base, &result);
+	free(base.data);
+	stream_cache_add(obj_no, result.data, result.size);
+}
+
+static void *threaded_stream_pass(void *data)
+{
+	set_thread_data(data);
+	for (;;) {
+		int i, child;
+
+		work_lock();
+		while (!nr_ready_deltas && !(input_done && !nr_streaming))
+			pthread_cond_wait(&stream_cond, &work_mutex);
+		if (!nr_ready_deltas) {
+			work_unlock();
+			break;
+		}
+		i = ready_deltas[--nr_ready_deltas];
+		nr_streaming++;
+		work_unlock();
+
+		resolve_streamed_delta(i);
+
+		work_lock();
+		streamed[i].state = STREAM_DONE;
+		for (child = streamed[i].first_child; child >= 0;
+		     child = streamed[child].next_sibling)
+			ready_deltas[nr_ready_deltas++] = child;
+		nr_streaming--;
+		if (streamed[i].first_child >= 0 ||
+		    (input_done && !nr_streaming))
+			pthread_cond_broadcast(&stream_cond);
+		work_unlock();
+
+		counter_lock();
+		if (stream_progress)
+			display_progress(progress, nr_resolved_deltas);
+		counter_unlock();
+	}
+	return NULL;
+}
+
+static void start_streaming(void)
+{
+	ALLOC_ARRAY(streamed, nr_objects);
+	ALLOC_ARRAY(ready_deltas, nr_objects);
+	hashmap_init(&stream_cache, stream_cache_cmp, NULL, 0);
+	start_threads(threaded_stream_pass);
+	set_thread_data(&nothread_data);
+}
+
+/*
+ * Hand the ofs-deltas that are entirely on disk by now, among the
+ * first "nr" objects, to the threads, or have them wait for their
+ * base if it is a delta that is not resolved yet.  The ones based on
+ * a ref-delta are left to resolve_deltas().
+ */
+static void queue_received_deltas(int nr)
+{
+	off_t on_disk = consumed_bytes - input_offset;
+	int queued = 0;
+
+	if (nr_received >= nr || objects[nr_received + 1].idx.offset > on_disk)
+		return;
+
+	work_lock();
+	for (; nr_received < nr; nr_received++) {
+		int i = nr_received, base = streamed[i].base;
+
+		if (objects[i + 1].idx.offset > on_disk)
+			break;
+		if (base < 0)
+			continue;
+		if (!is_delta_type(objects[base].type) ||
+		    streamed[base].state == STREAM_DONE) {
+			ready_deltas[nr_ready_deltas++] = i;
+			queued = 1;
+		} else if (streamed[base].state == STREAM_QUEUED) {
+			streamed[i].next_sibling = streamed[base].first_child;
+			streamed[base].first_child = i;
+		} else {
+			continue;
+		}
+		streamed[i].state = STREAM_QUEUED;
+	}
+	if (queued)
+		pthread_cond_broadcast(&stream_cond);
+	work_unlock();
+}
+
+static void finish_streaming(void)
+{
+	work_lock();
+	input_done = 1;
+	pthread_cond_broadcast(&stream_cond);
+	work_unlock();
+
+	counter_lock();
+	stream_progress = 1;
+	counter_unlock();
+
+	join_threads();
+	clear_stream_cache();
+	FREE_AND_NULL(ready_deltas);
+	stream_deltas = 0;
+}
+
+/* Find the base of an ofs-delta among the objects received before it. */
+static int find_ofs_delta_base(off_t offset, int nr)
+{
+	int first = 0, last = nr;
+
+	while (first < last) {
+		int next = first + (last - first) / 2;
+
+		if (objects[next].idx.offset == offset)
+			return next;
+		if (offset < objects[next].idx.offset)
+			last = next;
+		else
+			first = next + 1;
+	}
+	return -1;
+}
 #endif
 
 /*
@@ -1130,12 +1608,26 @@ static void parse_pack_objects(unsigned char *sha1)
 		progress = start_progress(
 				from_stdin ? _("Receiving objects") : _("Indexing objects"),
 				nr_objects);
+#ifndef NO_PTHREADS
+	if (stream_deltas)
+		start_streaming();
+#endif
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 		void *data = unpack_raw_entry(obj, &ofs_delta->offset,
 					      ref_delta_sha1,
 					      obj->idx.oid.hash);
 		obj->real_type = obj->type;
+#ifndef NO_PTHREADS
+		if (stream_deltas) {
+			struct streamed_delta *s = &streamed[i];
+			s->base = obj->type != OBJ_OFS_DELTA ? -1 :
+				  find_ofs_delta_base(ofs_delta->offset, i);
+			s->first_child = -1;
+			s->state = STREAM_NONE;
+			queue_received_deltas(i);
+		}
+#endif
 		if (obj->type == OBJ_OFS_DELTA) {
 			nr_ofs_deltas++;
 			ofs_delta->obj_no = i;
@@ -1152,7 +1644,10 @@ static void parse_pack_objects(unsigned char *sha1)
 		} else
 			sha1_object(data, NULL, obj->size, obj->type,
 				    &obj->idx.oid);
-		free(data);
+		if (stream_deltas && data && !is_delta_type(obj->type))
+			stream_cache_add(i, data, obj->size);
+		else
+			free(data);
 		display_progress(progress, i+1);
 	}
 	objects[i].idx.offset = consumed_bytes;
@@ -1160,6 +1655,10 @@ static void parse_pack_objects(unsigned char *sha1)
 
 	/* Check pack integrity */
 	flush();
+#ifndef NO_PTHREADS
+	if (stream_deltas)
+		queue_received_deltas(nr_objects);
+#endif
 	git_SHA1_Final(sha1, &input_ctx);
 	if (hashcmp(fill(20), sha1))
 		die(_("pack is corrupted (SHA1 mismatch)"));
@@ -1197,31 +1696,25 @@ static void resolve_deltas(void)
 {
 	int i;
 
-	if (!nr_ofs_deltas && !nr_ref_deltas)
+	if ((nr_ofs_deltas || nr_ref_deltas) &&
+	    (verbose || show_resolving_progress))
+		progress = start_progress(_("Resolving deltas"),
+					  nr_ref_deltas + nr_ofs_deltas);
+
+#ifndef NO_PTHREADS
+	if (stream_deltas)
+		finish_streaming();
+#endif
+	if (nr_resolved_deltas == nr_ofs_deltas + nr_ref_deltas)
 		return;
 
 	/* Sort deltas by base SHA1/offset for fast searching */
 	QSORT(ofs_deltas, nr_ofs_deltas, compare_ofs_delta_entry);
 	QSORT(ref_deltas, nr_ref_deltas, compare_ref_delta_entry);
 
-	if (verbose || show_resolving_progress)
-		progress = start_progress(_("Resolving deltas"),
-					  nr_ref_deltas + nr_ofs_deltas);
-
 #ifndef NO_PTHREADS
-	nr_dispatched = 0;
 	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS")) {
-		init_thread();
-		for (i = 0; i < nr_threads; i++) {
-			int ret = pthread_create(&thread_data[i].thread, NULL,
-						 threaded_second_pass, thread_data + i);
-			if (ret)
-				die(_("unable to create thread: %s"),
-				    strerror(ret));
-		}
-		for (i = 0; i < nr_threads; i++)
-			pthread_join(thread_data[i].thread, NULL);
-		cleanup_thread();
+		run_threads(threaded_second_pass);
 		return;
 	}
 #endif
@@ -1229,7 +1722,7 @@ static void resolve_deltas(void)
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 
-		if (is_delta_type(obj->type))
+		if (!is_delta_root(i))
 			continue;
 		resolve_base(obj);
 		display_progress(progress, nr_resolved_deltas);
@@ -1286,32 +1779,9 @@ static void conclude_pack(int fix_thin_pack, const char *curr_pack, unsigned cha
 		    nr_ofs_deltas + nr_ref_deltas - nr_resolved_deltas);
 }
 
-static int write_compressed(struct sha1file *f, void *in, unsigned int size)
-{
-	git_zstream stream;
-	int status;
-	unsigned char outbuf[4096];
-
-	git_deflate_init(&stream, zlib_compression_level);
-	stream.next_in = in;
-	stream.avail_in = size;
-
-	do {
-		stream.next_out = outbuf;
-		stream.avail_out = sizeof(outbuf);
-		status = git_deflate(&stream, Z_FINISH);
-		sha1write(f, outbuf, sizeof(outbuf) - stream.avail_out);
-	} while (status == Z_OK);
-
-	if (status != Z_STREAM_END)
-		die(_("unable to deflate appended object (%d)"), status);
-	size = stream.total_out;
-	git_deflate_end(&stream);
-	return size;
-}
-
 static struct object_entry *append_obj_to_pack(struct sha1file *f,
-			       const unsigned char *sha1, void *buf,
+			       const unsigned char *sha1,
+			       const void *deflated, unsigned long deflated_size,
 			       unsigned long size, enum object_type type)
 {
 	struct object_entry *obj = &objects[nr_objects++];
@@ -1328,75 +1798,149 @@ static struct object_entry *append_obj_to_pack(struct sha1file *f,
 	header[n++] = c;
 	crc32_begin(f);
 	sha1write(f, header, n);
+	sha1write(f, deflated, deflated_size);
 	obj[0].size = size;
 	obj[0].hdr_size = n;
 	obj[0].type = type;
 	obj[0].real_type = type;
-	obj[1].idx.offset = obj[0].idx.offset + n;
-	obj[1].idx.offset += write_compressed(f, buf, size);
+	obj[1].idx.offset = obj[0].idx.offset + n + deflated_size;
 	obj[0].idx.crc32 = crc32_end(f);
 	sha1flush(f);
 	hashcpy(obj->idx.oid.hash, sha1);
 	return obj;
 }
 
-static int delta_pos_compare(const void *_a, const void *_b)
+/*
+ * Collect the local objects that the unresolved deltas of a thin pack
+ * are based on, once each.  Only their type and size are looked up
+ * here; the data is read when the deltas are resolved.
+ */
+static void find_thin_bases(void)
 {
-	struct ref_delta_entry *a = *(struct ref_delta_entry **)_a;
-	struct ref_delta_entry *b = *(struct ref_delta_entry **)_b;
-	return a->obj_no - b->obj_no;
+	int i, j;
+
+	ALLOC_ARRAY(thin_bases, nr_ref_deltas);
+	nr_thin_bases = 0;
+	for (i = 0; i < nr_ref_deltas; i = j) {
+		const unsigned char *sha1 = ref_deltas[i].sha1;
+		struct object_entry *base = &thin_bases[nr_thin_bases];
+		struct object_info oi = OBJECT_INFO_INIT;
+		enum object_type type;
+		int unresolved = 0;
+
+		for (j = i; j < nr_ref_deltas && !hashcmp(ref_deltas[j].sha1, sha1); j++)
+			if (objects[ref_deltas[j].obj_no].real_type == OBJ_REF_DELTA)
+				unresolved = 1;
+		if (!unresolved)
+			continue;
+
+		oi.typep = &type;
+		oi.sizep = &base->size;
+		if (sha1_object_info_extended(sha1, &oi, 0) < 0)
+			continue;
+		memset(&base->idx, 0, sizeof(base->idx));
+		hashcpy(base->idx.oid.hash, sha1);
+		base->hdr_size = 0;
+		base->type = base->real_type = type;
+		nr_thin_bases++;
+	}
 }
 
-static void fix_unresolved_deltas(struct sha1file *f)
+static void resolve_thin_bases(void)
 {
-	struct ref_delta_entry **sorted_by_pos;
 	int i;
 
-	/*
-	 * Since many unresolved deltas may well be themselves base objects
-	 * for more unresolved deltas, we really want to include the
-	 * smallest number of base objects that would cover as much delta
-	 * as possible by picking the
-	 * trunc deltas first, allowing for other deltas to resolve without
-	 * additional base objects.  Since most base objects are to be found
-	 * before deltas depending on them, a good heuristic is to start
-	 * resolving deltas in the same order as their position in the pack.
-	 */
-	ALLOC_ARRAY(sorted_by_pos, nr_ref_deltas);
-	for (i = 0; i < nr_ref_deltas; i++)
-		sorted_by_pos[i] = &ref_deltas[i];
-	QSORT(sorted_by_pos, nr_ref_deltas, delta_pos_compare);
+#ifndef NO_PTHREADS
+	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS")) {
+		run_threads(threaded_thin_pass);
+		return;
+	}
+#endif
 
-	for (i = 0; i < nr_ref_deltas; i++) {
-		struct ref_delta_entry *d = sorted_by_pos[i];
-		enum object_type type;
-		struct base_data *base_obj = alloc_base_data();
+	for (i = 0; i < nr_thin_bases; i++) {
+		resolve_base(&thin_bases[i]);
+		display_progress(progress, nr_resolved_deltas);
+	}
+}
 
-		if (objects[d->obj_no].real_type != OBJ_REF_DELTA)
-			continue;
-		base_obj->data = read_sha1_file(d->sha1, &type, &base_obj->size);
-		if (!base_obj->data)
+static int compare_thin_base(const void *sha1, const void *base)
+{
+	return hashcmp(sha1, ((const struct object_entry *)base)->idx.oid.hash);
+}
+
+/*
+ * Resolving the deltas may have turned up some of the local bases in
+ * the pack itself: a local object can also be sent as a delta whose
+ * own base is local.  Mark those, as they must not be appended.
+ */
+static void find_thin_bases_in_pack(int nr_objects_initial, char *in_pack)
+{
+	int i;
+
+	for (i = 0; i < nr_objects_initial; i++) {
+		struct object_entry *base;
+
+		if (!is_delta_type(objects[i].type) ||
+		    is_delta_type(objects[i].real_type))
 			continue;
+		base = bsearch(objects[i].idx.oid.hash, thin_bases, nr_thin_bases,
+			       sizeof(*thin_bases), compare_thin_base);
+		if (base)
+			in_pack[base - thin_bases] = 1;
+	}
+}
 
-		if (check_sha1_signature(d->sha1, base_obj->data,
-				base_obj->size, typename(type)))
-			die(_("local object %s is corrupt"), sha1_to_hex(d->sha1));
-		base_obj->obj = append_obj_to_pack(f, d->sha1,
-					base_obj->data, base_obj->size, type);
-		find_unresolved_deltas(base_obj);
-		display_progress(progress, nr_resolved_deltas);
+/*
+ * Deltas against the local bases are resolved first, in parallel,
+ * reading the bases from the object store (and deflating them while
+ * at it).  Only then are the bases that were needed appended to the
+ * pack, one at a time.
+ */
+static void fix_unresolved_deltas(struct sha1file *f)
+{
+	int i, nr_objects_initial = nr_objects;
+	char *in_pack;
+
+	find_thin_bases();
+	deflated_bases = xcalloc(nr_thin_bases, sizeof(*deflated_bases));
+	deflated_bases_used = 0;
+	resolve_thin_bases();
+
+	in_pack = xcalloc(nr_thin_bases, 1);
+	find_thin_bases_in_pack(nr_objects_initial, in_pack);
+	for (i = 0; i < nr_thin_bases; i++) {
+		struct object_entry *base = &thin_bases[i];
+		struct deflated_base *d = &deflated_bases[i];
+
+		if (in_pack[i]) {
+			free(d->data);
+			continue;
+		}
+		if (!d->data) {
+			void *data = get_thin_base_data(base);
+			d->data = deflate_object(data, base->size, &d->size);
+			free(data);
+		}
+		append_obj_to_pack(f, base->idx.oid.hash, d->data, d->size,
+				   base->size, base->real_type);
+		free(d->data);
 	}
-	free(sorted_by_pos);
+	free(in_pack);
+	FREE_AND_NULL(deflated_bases);
+	FREE_AND_NULL(thin_bases);
+	nr_thin_bases = 0;
 }
 
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
+		  const char *final_rev_index_name, const char *curr_rev_index_name,
 		  const char *keep_name, const char *keep_msg,
 		  unsigned char *sha1)
 {
 	const char *report = "pack";
 	struct strbuf pack_name = STRBUF_INIT;
 	struct strbuf index_name = STRBUF_INIT;
+	struct strbuf rev_index_name = STRBUF_INIT;
 	struct strbuf keep_name_buf = STRBUF_INIT;
 	int err;
 
@@ -1440,6 +1984,16 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	} else if (from_stdin)
 		chmod(final_pack_name, 0444);
 
+	if (curr_rev_index_name) {
+		if (final_rev_index_name != curr_rev_index_name) {
+			if (!final_rev_index_name)
+				final_rev_index_name = odb_pack_name(&rev_index_name, sha1, "rev");
+			if (finalize_object_file(curr_rev_index_name, final_rev_index_name))
+				die(_("cannot store reverse index file"));
+		} else
+			chmod(final_rev_index_name, 0444);
+	}
+
 	if (final_index_name != curr_index_name) {
 		if (!final_index_name)
 			final_index_name = odb_pack_name(&index_name, sha1, "idx");
@@ -1471,10 +2025,38 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	}
 
 	strbuf_release(&index_name);
+	strbuf_release(&rev_index_name);
 	strbuf_release(&pack_name);
 	strbuf_release(&keep_name_buf);
 }
 
+static uint64_t total_ram(void)
+{
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	if (pages > 0 && page_size > 0)
+		return (uint64_t)pages * page_size;
+#endif
+	return 0;
+}
+
+/*
+ * Every thread keeps its own cache of inflated delta bases, each up
+ * to core.deltaBaseCacheLimit, but all of them together should not
+ * take more than a quarter of the memory of the machine.
+ */
+static void set_base_cache_limit(void)
+{
+	uint64_t budget = total_ram() / 4;
+	int threads = nr_threads > 1 ? nr_threads : 1;
+
+	base_cache_limit = delta_base_cache_limit;
+	if (budget && base_cache_limit > budget / threads)
+		base_cache_limit = budget / threads;
+}
+
 static int git_index_pack_config(const char *k, const char *v, void *cb)
 {
 	struct pack_idx_option *opts = cb;
@@ -1485,6 +2067,13 @@ static int git_index_pack_config(const char *k, const char *v, void *cb)
 			die(_("bad pack.indexversion=%"PRIu32), opts->version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			opts->flags |= WRITE_REV;
+		else
+			opts->flags &= ~WRITE_REV;
+		return 0;
+	}
 	if (!strcmp(k, "pack.threads")) {
 		nr_threads = git_config_int(k, v);
 		if (nr_threads < 0)
@@ -1630,10 +2219,12 @@ static const char *derive_filename(const char *pack_name, const char *suffix,
 int cmd_index_pack(int argc, const char **argv, const char *prefix)
 {
 	int i, fix_thin_pack = 0, verify = 0, stat_only = 0;
-	const char *curr_index;
+	const char *curr_index, *curr_rev_index = NULL;
 	const char *index_name = NULL, *pack_name = NULL;
+	const char *rev_index_name = NULL;
 	const char *keep_name = NULL, *keep_msg = NULL;
 	struct strbuf index_name_buf = STRBUF_INIT,
+		      rev_index_name_buf = STRBUF_INIT,
 		      keep_name_buf = STRBUF_INIT;
 	struct pack_idx_entry **idx_objects;
 	struct pack_idx_option opts;
@@ -1645,6 +2236,7 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		usage(index_pack_usage);
 
 	check_replace_refs = 0;
+	fetch_if_missing = 0;
 	fsck_options.walk = mark_link;
 
 	reset_pack_idx_option(&opts);
@@ -1708,6 +2300,10 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 				show_resolving_progress = 1;
 			} else if (!strcmp(arg, "--report-end-of-input")) {
 				report_end_of_input = 1;
+			} else if (!strcmp(arg, "--rev-index")) {
+				opts.flags |= WRITE_REV;
+			} else if (!strcmp(arg, "--no-rev-index")) {
+				opts.flags &= ~WRITE_REV;
 			} else if (!strcmp(arg, "-o")) {
 				if (index_name || (i+1) >= argc)
 					usage(index_pack_usage);
@@ -1743,24 +2339,44 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		index_name = derive_filename(pack_name, ".idx", &index_name_buf);
 	if (keep_msg && !keep_name && pack_name)
 		keep_name = derive_filename(pack_name, ".keep", &keep_name_buf);
+	if (index_name && (opts.flags & WRITE_REV)) {
+		size_t len;
+		if (!strip_suffix(index_name, ".idx", &len))
+			die(_("index file name '%s' does not end with '.idx'"),
+			    index_name);
+		strbuf_add(&rev_index_name_buf, index_name, len);
+		strbuf_addstr(&rev_index_name_buf, ".rev");
+		rev_index_name = rev_index_name_buf.buf;
+	}
 
 	if (verify) {
 		if (!index_name)
 			die(_("--verify with no packfile name given"));
 		read_idx_option(&opts, index_name);
 		opts.flags |= WRITE_IDX_VERIFY | WRITE_IDX_STRICT;
+		opts.flags &= ~WRITE_REV;
+		rev_index_name = NULL;
 	}
 	if (strict)
 		opts.flags |= WRITE_IDX_STRICT;
 
 #ifndef NO_PTHREADS
 	if (!nr_threads) {
-		nr_threads = online_cpus();
-		/* An experiment showed that more threads does not mean faster */
-		if (nr_threads > 3)
-			nr_threads = 3;
+		/*
+		 * Hyperthreads do not help much with inflating and
+		 * hashing; past a couple dozen threads the read lock
+		 * is the bottleneck.
+		 */
+		nr_threads = online_cpus() / 2;
+		if (nr_threads < 1)
+			nr_threads = 1;
+		if (nr_threads > 20)
+			nr_threads = 20;
 	}
+	if (from_stdin && (nr_threads > 1 || getenv("GIT_FORCE_THREADS")))
+		stream_deltas = 1;
 #endif
+	set_base_cache_limit();
 
 	curr_pack = open_pack_file(pack_name);
 	parse_pack_header();
@@ -1775,6 +2391,7 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	conclude_pack(fix_thin_pack, curr_pack, pack_sha1);
 	free(ofs_deltas);
 	free(ref_deltas);
+	free(streamed);
 	if (strict)
 		foreign_nr = check_objects();
 
@@ -1785,22 +2402,29 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	for (i = 0; i < nr_objects; i++)
 		idx_objects[i] = &objects[i].idx;
 	curr_index = write_idx_file(index_name, idx_objects, nr_objects, &opts, pack_sha1);
+	if (opts.flags & WRITE_REV)
+		curr_rev_index = write_rev_file(rev_index_name, idx_objects,
+						nr_objects, pack_sha1);
 	free(idx_objects);
 
 	if (!verify)
 		final(pack_name, curr_pack,
 		      index_name, curr_index,
+		      rev_index_name, curr_rev_index,
 		      keep_name, keep_msg,
 		      pack_sha1);
 	else
 		close(input_fd);
 	free(objects);
 	strbuf_release(&index_name_buf);
+	strbuf_release(&rev_index_name_buf);
 	strbuf_release(&keep_name_buf);
 	if (pack_name == NULL)
 		free((void *) curr_pack);
 	if (index_name == NULL)
 		free((void *) curr_index);
+	if (rev_index_name == NULL)
+		free((void *) curr_rev_index);
 
 	/*
 	 * Let the caller know this pack is not self contained
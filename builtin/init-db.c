@@ -23,6 +23,7 @@
 static int init_is_bare_repository = 0;
 static int init_shared_repository = -1;
 static const char *init_db_template_dir;
+static const char *init_ref_storage_format;
 
 static void copy_templates_1(struct strbuf *path, struct strbuf *template,
 			     DIR *dir)
@@ -223,6 +224,27 @@ static int create_default_files(const char *template_path,
 	safe_create_dir(git_path("refs"), 1);
 	adjust_shared_perm(git_path("refs"));
 
+	/*
+	 * Look for an existing HEAD before the refs backend had a chance
+	 * to create one.
+	 */
+	path = git_path_buf(&buf, "HEAD");
+	reinit = (!access(path, R_OK)
+		  || readlink(path, junk, sizeof(junk)-1) != -1);
+
+	if (init_ref_storage_format) {
+		const char *current = repository_format_ref_storage ?
+			repository_format_ref_storage : "files";
+
+		if (reinit && strcmp(current, init_ref_storage_format))
+			die(_("attempt to reinitialize repository with different ref storage format"));
+		if (!reinit && strcmp(init_ref_storage_format, "files")) {
+			free(repository_format_ref_storage);
+			repository_format_ref_storage =
+				xstrdup(init_ref_storage_format);
+		}
+	}
+
 	if (refs_init_db(&err))
 		die("failed to set up refs db: %s", err.buf);
 
@@ -230,18 +252,23 @@ static int create_default_files(const char *template_path,
 	 * Create the default symlink from ".git/HEAD" to the "master"
 	 * branch, if it does not exist yet.
 	 */
-	path = git_path_buf(&buf, "HEAD");
-	reinit = (!access(path, R_OK)
-		  || readlink(path, junk, sizeof(junk)-1) != -1);
 	if (!reinit) {
 		if (create_symref("HEAD", "refs/heads/master", NULL) < 0)
 			exit(1);
 	}
 
-	/* This forces creation of new config file */
+	/*
+	 * This forces creation of new config file. Repositories using
+	 * a ref storage extension need version 1, so that older
+	 * versions of git refuse to touch them.
+	 */
 	xsnprintf(repo_version_string, sizeof(repo_version_string),
-		  "%d", GIT_REPO_VERSION);
+		  "%d", repository_format_ref_storage ?
+		  GIT_REPO_VERSION_READ : GIT_REPO_VERSION);
 	git_config_set("core.repositoryformatversion", repo_version_string);
+	if (repository_format_ref_storage)
+		git_config_set("extensions.refstorage",
+			       repository_format_ref_storage);
 
 	/* Check filemode trustability */
 	path = git_path_buf(&buf, "config");
@@ -455,7 +482,7 @@ static int shared_callback(const struct option *opt, const char *arg, int unset)
 }
 
 static const char *const init_db_usage[] = {
-	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [<directory>]"),
+	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [--ref-format=<format>] [<directory>]"),
 	NULL
 };
 
@@ -484,11 +511,17 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 		OPT_BIT('q', "quiet", &flags, N_("be quiet"), INIT_DB_QUIET),
 		OPT_STRING(0, "separate-git-dir", &real_git_dir, N_("gitdir"),
 			   N_("separate git dir from working tree")),
+		OPT_STRING(0, "ref-format", &init_ref_storage_format, N_("format"),
+			   N_("specify the ref storage format (files or reftable)")),
 		OPT_END()
 	};
 
 	argc = parse_options(argc, argv, prefix, init_db_options, init_db_usage, 0);
 
+	if (init_ref_storage_format &&
+	    !ref_storage_backend_exists(init_ref_storage_format))
+		die(_("unknown ref storage format '%s'"), init_ref_storage_format);
+
 	if (real_git_dir && !is_absolute_path(real_git_dir))
 		real_git_dir = real_pathdup(real_git_dir, 1);
 
@@ -4,8 +4,12 @@
 #include "blob.h"
 #include "exec_cmd.h"
 #include "merge-blobs.h"
+#include "merge-ort.h"
+#include "quote.h"
 
-static const char merge_tree_usage[] = "git merge-tree <base-tree> <branch1> <branch2>";
+static const char merge_tree_usage[] =
+"git merge-tree --write-tree [--name-only] <branch1> <branch2>\n"
+"   or: git merge-tree <base-tree> <branch1> <branch2>";
 
 struct merge_list {
 	struct merge_list *next;
@@ -25,7 +29,7 @@ static void add_merge_entry(struct merge_list *entry)
 	merge_result_end = &entry->next;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base);
+static void trivial_merge_trees(struct tree_desc t[3], const char *base);
 
 static const char *explanation(struct merge_list *entry)
 {
@@ -219,7 +223,7 @@ static void unresolved_directory(const struct traverse_info *info,
 	buf2 = fill_tree_descriptor(t + 2, ENTRY_OID(n + 2));
 #undef ENTRY_OID
 
-	merge_trees(t, newbase);
+	trivial_merge_trees(t, newbase);
 
 	free(buf0);
 	free(buf1);
@@ -336,7 +340,7 @@ static int threeway_callback(int n, unsigned long mask, unsigned long dirmask, s
 	return mask;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base)
+static void trivial_merge_trees(struct tree_desc t[3], const char *base)
 {
 	struct traverse_info info;
 
@@ -358,18 +362,96 @@ static void *get_tree_descriptor(struct tree_desc *desc, const char *rev)
 	return buf;
 }
 
+static struct commit *get_commit(const char *name)
+{
+	struct commit *commit = get_merge_parent(name);
+
+	if (!commit)
+		die(_("could not resolve ref '%s'"), name);
+	return commit;
+}
+
+/*
+ * Print the merged tree, then, if there are conflicts, the stages of
+ * the conflicted files and the conflict messages after an empty line.
+ */
+static int real_merge(const char *branch1, const char *branch2, int name_only)
+{
+	struct merge_options opt;
+	struct merge_result result;
+	const char *last_path = NULL;
+	int i, clean;
+
+	init_merge_options(&opt);
+	opt.branch1 = branch1;
+	opt.branch2 = branch2;
+
+	merge_incore_recursive(&opt, NULL, get_commit(branch1),
+			       get_commit(branch2), &result);
+	if (result.clean < 0)
+		die(_("failure to merge"));
+
+	printf("%s\n", oid_to_hex(&result.tree->object.oid));
+	clean = result.clean;
+	if (!clean) {
+		for (i = 0; i < result.conflicts_nr; i++) {
+			struct merge_conflict *c = &result.conflicts[i];
+			int stage;
+
+			/* a path may have more than one conflict */
+			if (last_path && !strcmp(last_path, c->path))
+				continue;
+			last_path = c->path;
+			if (name_only) {
+				write_name_quoted(c->path, stdout, '\n');
+				continue;
+			}
+			for (stage = 0; stage < 3; stage++) {
+				if (!c->stages[stage].mode)
+					continue;
+				printf("%06o %s %d\t", c->stages[stage].mode,
+				       oid_to_hex(&c->stages[stage].oid), stage + 1);
+				write_name_quoted(c->path, stdout, '\n');
+			}
+		}
+		putchar('\n');
+		for (i = 0; i < result.conflicts_nr; i++)
+			printf("%s\n", result.conflicts[i].message);
+	}
+	merge_result_release(&result);
+	return !clean;
+}
+
 int cmd_merge_tree(int argc, const char **argv, const char *prefix)
 {
 	struct tree_desc t[3];
 	void *buf1, *buf2, *buf3;
 
+	if (argc > 1 && !strcmp(argv[1], "--write-tree")) {
+		int name_only = 0;
+
+		argc--;
+		argv++;
+		while (argc > 1 && starts_with(argv[1], "--")) {
+			if (!strcmp(argv[1], "--name-only"))
+				name_only = 1;
+			else
+				usage(merge_tree_usage);
+			argc--;
+			argv++;
+		}
+		if (argc != 3)
+			usage(merge_tree_usage);
+		return real_merge(argv[1], argv[2], name_only);
+	}
+
 	if (argc != 4)
 		usage(merge_tree_usage);
 
 	buf1 = get_tree_descriptor(t+0, argv[1]);
 	buf2 = get_tree_descriptor(t+1, argv[2]);
 	buf3 = get_tree_descriptor(t+2, argv[3]);
-	merge_trees(t, "");
+	trivial_merge_trees(t, "");
 	free(buf1);
 	free(buf2);
 	free(buf3);
@@ -28,6 +28,8 @@
 #include "argv-array.h"
 #include "mru.h"
 #include "packfile.h"
+#include "delta-islands.h"
+#include "promisor-remote.h"
 
 static const char *pack_usage[] = {
 	N_("git pack-objects --stdout [<options>...] [< <ref-list> | < <object-list>]"),
@@ -66,13 +68,16 @@ static int pack_to_stdout;
 static int num_preferred_base;
 static struct progress *progress_state;
 
+static int allow_pack_reuse = 1;
 static struct packed_git *reuse_packfile;
 static uint32_t reuse_packfile_objects;
-static off_t reuse_packfile_offset;
+static struct bitmap *reuse_packfile_bitmap;
 
 static int use_bitmap_index_default = 1;
 static int use_bitmap_index = -1;
+static int use_delta_islands;
 static int write_bitmap_index;
+static int write_bitmap_layer;
 static uint16_t write_bitmap_options;
 
 static unsigned long delta_cache_size = 0;
@@ -86,6 +91,7 @@ static struct list_objects_filter_options filter_options;
 enum missing_action {
 	MA_ERROR = 0,    /* fail if any missing objects are encountered */
 	MA_ALLOW_ANY,    /* silently allow ALL missing objects */
+	MA_ALLOW_PROMISOR, /* silently allow missing blobs a remote promised */
 };
 static enum missing_action arg_missing_action;
 static show_object_fn fn_show_object;
@@ -366,7 +372,7 @@ static off_t write_reuse_object(struct sha1file *f, struct object_entry *entry,
 {
 	struct packed_git *p = entry->in_pack;
 	struct pack_window *w_curs = NULL;
-	struct revindex_entry *revidx;
+	int pos;
 	off_t offset;
 	enum object_type type = entry->type;
 	off_t datalen;
@@ -381,10 +387,11 @@ static off_t write_reuse_object(struct sha1file *f, struct object_entry *entry,
 					      type, entry->size);
 
 	offset = entry->in_pack_offset;
-	revidx = find_pack_revindex(p, offset);
-	datalen = revidx[1].offset - offset;
+	pos = find_revindex_position(p, offset);
+	datalen = pack_pos_to_offset(p, pos + 1) - offset;
 	if (!pack_to_stdout && p->index_version > 1 &&
-	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+	    check_pack_crc(p, &w_curs, offset, datalen,
+			   pack_pos_to_index(p, pos))) {
 		error("bad packed object CRC for %s",
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
@@ -731,57 +738,173 @@ static struct object_entry **compute_write_order(void)
 	return wo;
 }
 
-static off_t write_reused_pack(struct sha1file *f)
+/*
+ * Objects copied verbatim from the reused pack land at a smaller
+ * offset in our output than they had in the pack, by the total size
+ * of the objects skipped before them.  We record that shift for each
+ * run of objects so that OFS_DELTA offsets can be patched.
+ */
+struct reused_chunk {
+	/* The offset of the first object of this chunk in the original pack. */
+	off_t original;
+	/* How much to subtract from an original offset to get the new one. */
+	off_t difference;
+};
+
+static struct reused_chunk *reused_chunks;
+static int reused_chunks_nr;
+static int reused_chunks_alloc;
+
+static void record_reused_object(off_t where, off_t offset)
 {
-	unsigned char buffer[8192];
-	off_t to_write, total;
-	int fd;
+	if (reused_chunks_nr &&
+	    reused_chunks[reused_chunks_nr - 1].difference == offset)
+		return;
 
-	if (!is_pack_valid(reuse_packfile))
-		die("packfile is invalid: %s", reuse_packfile->pack_name);
+	ALLOC_GROW(reused_chunks, reused_chunks_nr + 1, reused_chunks_alloc);
+	reused_chunks[reused_chunks_nr].original = where;
+	reused_chunks[reused_chunks_nr].difference = offset;
+	reused_chunks_nr++;
+}
+
+/*
+ * Binary search to find the chunk that "where" is in. Note that we're
+ * not looking for an exact match, just the first chunk that contains
+ * it (which implicitly ends at the start of the next chunk).
+ */
+static off_t find_reused_offset(off_t where)
+{
+	int lo = 0, hi = reused_chunks_nr;
+	while (lo < hi) {
+		int mi = lo + ((hi - lo) / 2);
+		if (where == reused_chunks[mi].original)
+			return reused_chunks[mi].difference;
+		if (where < reused_chunks[mi].original)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+
+	/*
+	 * The first chunk starts at zero, so we can't have gone below
+	 * there.
+	 */
+	assert(lo);
+	return reused_chunks[lo - 1].difference;
+}
+
+static void write_reused_pack_one(size_t pos, struct sha1file *out,
+				  struct pack_window **w_curs)
+{
+	off_t offset, next, cur;
+	enum object_type type;
+	unsigned long size;
+
+	offset = pack_pos_to_offset(reuse_packfile, pos);
+	next = pack_pos_to_offset(reuse_packfile, pos + 1);
 
-	fd = git_open(reuse_packfile->pack_name);
-	if (fd < 0)
-		die_errno("unable to open packfile for reuse: %s",
-			  reuse_packfile->pack_name);
+	record_reused_object(offset, offset - out->total - out->offset);
 
-	if (lseek(fd, sizeof(struct pack_header), SEEK_SET) == -1)
-		die_errno("unable to seek in reused packfile");
+	cur = offset;
+	type = unpack_object_header(reuse_packfile, w_curs, &cur, &size);
+	assert(type >= 0);
 
-	if (reuse_packfile_offset < 0)
-		reuse_packfile_offset = reuse_packfile->pack_size - 20;
+	if (type == OBJ_OFS_DELTA) {
+		off_t base_offset;
+		off_t fixup;
 
-	total = to_write = reuse_packfile_offset - sizeof(struct pack_header);
+		base_offset = get_delta_base(reuse_packfile, w_curs, &cur,
+					     type, offset);
+		assert(base_offset != 0);
 
-	while (to_write) {
-		int read_pack = xread(fd, buffer, sizeof(buffer));
+		/* See if we need to rewrite the offset... */
+		fixup = find_reused_offset(offset) -
+			find_reused_offset(base_offset);
 
-		if (read_pack <= 0)
-			die_errno("unable to read from reused packfile");
+		if (fixup) {
+			unsigned char header[MAX_PACK_OBJECT_HEADER];
+			unsigned char ofs_header[10];
+			unsigned i, len, ofs_len;
+			off_t ofs = offset - base_offset - fixup;
 
-		if (read_pack > to_write)
-			read_pack = to_write;
+			len = encode_in_pack_object_header(header, sizeof(header),
+							   OBJ_OFS_DELTA, size);
 
-		sha1write(f, buffer, read_pack);
-		to_write -= read_pack;
+			i = sizeof(ofs_header) - 1;
+			ofs_header[i] = ofs & 127;
+			while (ofs >>= 7)
+				ofs_header[--i] = 128 | (--ofs & 127);
+
+			ofs_len = sizeof(ofs_header) - i;
+
+			sha1write(out, header, len);
+			sha1write(out, ofs_header + i, ofs_len);
+			copy_pack_data(out, reuse_packfile, w_curs,
+				       cur, next - cur);
+			return;
+		}
+
+		/* ...otherwise we have no fixup, and can write it verbatim */
+	}
+
+	copy_pack_data(out, reuse_packfile, w_curs, offset, next - offset);
+}
+
+static size_t write_reused_pack_verbatim(struct sha1file *out,
+					 struct pack_window **w_curs)
+{
+	size_t pos = 0;
+
+	while (pos < reuse_packfile_bitmap->word_alloc &&
+	       reuse_packfile_bitmap->words[pos] == (eword_t)~0)
+		pos++;
+
+	if (pos) {
+		off_t to_write;
+
+		written = (pos * BITS_IN_EWORD);
+		to_write = pack_pos_to_offset(reuse_packfile, written)
+			- sizeof(struct pack_header);
+
+		/* We're recording one chunk, not one object. */
+		record_reused_object(sizeof(struct pack_header), 0);
+		sha1flush(out);
+		copy_pack_data(out, reuse_packfile, w_curs,
+			       sizeof(struct pack_header), to_write);
 
-		/*
-		 * We don't know the actual number of objects written,
-		 * only how many bytes written, how many bytes total, and
-		 * how many objects total. So we can fake it by pretending all
-		 * objects we are writing are the same size. This gives us a
-		 * smooth progress meter, and at the end it matches the true
-		 * answer.
-		 */
-		written = reuse_packfile_objects *
-				(((double)(total - to_write)) / total);
 		display_progress(progress_state, written);
 	}
+	return pos;
+}
+
+static off_t write_reused_pack(struct sha1file *f)
+{
+	off_t start = f->total + f->offset;
+	size_t i = 0;
+	uint32_t offset;
+	struct pack_window *w_curs = NULL;
+
+	if (!is_pack_valid(reuse_packfile))
+		die("packfile is invalid: %s", reuse_packfile->pack_name);
+
+	i = write_reused_pack_verbatim(f, &w_curs);
+
+	for (; i < reuse_packfile_bitmap->word_alloc; ++i) {
+		eword_t word = reuse_packfile_bitmap->words[i];
+		size_t pos = (i * BITS_IN_EWORD);
+
+		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
+			if ((word >> offset) == 0)
+				break;
+
+			offset += ewah_bit_ctz64(word >> offset);
+			write_reused_pack_one(pos + offset, f, &w_curs);
+			display_progress(progress_state, ++written);
+		}
+	}
 
-	close(fd);
-	written = reuse_packfile_objects;
-	display_progress(progress_state, written);
-	return reuse_packfile_offset - sizeof(struct pack_header);
+	unuse_pack(&w_curs);
+	return f->total + f->offset - start;
 }
 
 static const char no_split_warning[] = N_(
@@ -834,9 +957,9 @@ static void write_pack_file(void)
 		 * If so, rewrite it like in fast-import
 		 */
 		if (pack_to_stdout) {
-			sha1close(f, oid.hash, CSUM_CLOSE);
+			sha1close(f, oid.hash, CSUM_HASH_IN_STREAM | CSUM_CLOSE);
 		} else if (nr_written == nr_remaining) {
-			sha1close(f, oid.hash, CSUM_FSYNC);
+			sha1close(f, oid.hash, CSUM_HASH_IN_STREAM | CSUM_FSYNC | CSUM_CLOSE);
 		} else {
 			int fd = sha1close(f, oid.hash, 0);
 			fixup_pack_header_footer(fd, oid.hash, pack_tmp_name,
@@ -1081,6 +1204,27 @@ static const char no_closure_warning[] = N_(
 "disabling bitmap writing, as some objects are not being packed"
 );
 
+/*
+ * When writing a bitmap layer, the objects covered by the bitmaps below
+ * it are left out of the pack.
+ */
+static int in_bitmap_base(const struct object_id *oid)
+{
+	return write_bitmap_layer && bitmap_base_position(oid->hash) >= 0;
+}
+
+/*
+ * Stop the walk at the commits covered by the bitmaps a layer is written
+ * on, as all they reach is covered too.
+ */
+static int stop_at_bitmap_base(struct commit *commit, void *data)
+{
+	if (!in_bitmap_base(&commit->object.oid))
+		return 1;
+	commit->object.flags |= UNINTERESTING;
+	return 0;
+}
+
 static int add_object_entry(const struct object_id *oid, enum object_type type,
 			    const char *name, int exclude)
 {
@@ -1088,6 +1232,9 @@ static int add_object_entry(const struct object_id *oid, enum object_type type,
 	off_t found_offset = 0;
 	uint32_t index_pos;
 
+	if (in_bitmap_base(oid))
+		return 0;
+
 	if (have_duplicate_entry(oid, exclude, &index_pos))
 		return 0;
 
@@ -1460,17 +1607,18 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				int base_pos = find_revindex_position(p, ofs);
+				if (base_pos < 0)
 					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
+				base_ref = nth_packed_object_sha1(p,
+						pack_pos_to_index(p, base_pos));
 			}
 			entry->in_pack_header_size = used + used_0;
 			break;
 		}
 
-		if (base_ref && (base_entry = packlist_find(&to_pack, base_ref, NULL))) {
+		if (base_ref && (base_entry = packlist_find(&to_pack, base_ref, NULL)) &&
+		    in_same_island(&entry->idx.oid, &base_entry->idx.oid)) {
 			/*
 			 * If base_ref was set above that means we wish to
 			 * reuse delta data, and we even found that base
@@ -1757,6 +1905,11 @@ static int type_size_sort(const void *_a, const void *_b)
 		return -1;
 	if (a->preferred_base < b->preferred_base)
 		return 1;
+	if (use_delta_islands) {
+		int island_cmp = island_delta_cmp(&a->idx.oid, &b->idx.oid);
+		if (island_cmp)
+			return island_cmp;
+	}
 	if (a->size > b->size)
 		return -1;
 	if (a->size < b->size)
@@ -1826,6 +1979,14 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (trg_entry->type != src_entry->type)
 		return -1;
 
+	/*
+	 * A base outside one of the islands of the target would make
+	 * the target unusable as-is in a pack served for that island.
+	 */
+	if (use_delta_islands &&
+	    !in_same_island(&trg_entry->idx.oid, &src_entry->idx.oid))
+		return 0;
+
 	/*
 	 * We do not bother to try a delta that we discarded on an
 	 * earlier try, but only when reusing delta data.  Note that
@@ -2348,6 +2509,26 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 #define ll_find_deltas(l, s, w, d, p)	find_deltas(l, &s, w, d, p)
 #endif
 
+/*
+ * Is the object going into the pack, either as an entry of its own or
+ * among those copied verbatim from the pack the bitmaps are for?
+ */
+static int obj_is_packed(const struct object_id *oid)
+{
+	off_t offset;
+	int pos;
+
+	if (packlist_find(&to_pack, oid->hash, NULL))
+		return 1;
+	if (!reuse_packfile_bitmap)
+		return 0;
+	offset = find_pack_entry_one(oid->hash, reuse_packfile);
+	if (!offset)
+		return 0;
+	pos = find_revindex_position(reuse_packfile, offset);
+	return pos >= 0 && bitmap_get(reuse_packfile_bitmap, pos);
+}
+
 static void add_tag_chain(const struct object_id *oid)
 {
 	struct tag *tag;
@@ -2359,7 +2540,7 @@ static void add_tag_chain(const struct object_id *oid)
 	 * it was included via bitmaps, we would not have parsed it
 	 * previously).
 	 */
-	if (packlist_find(&to_pack, oid->hash, NULL))
+	if (obj_is_packed(oid))
 		return;
 
 	tag = lookup_tag(oid);
@@ -2383,7 +2564,7 @@ static int add_ref_tag(const char *path, const struct object_id *oid, int flag,
 
 	if (starts_with(path, "refs/tags/") && /* is a tag? */
 	    !peel_ref(path, &peeled)    && /* peelable? */
-	    packlist_find(&to_pack, peeled.hash, NULL))      /* object packed? */
+	    obj_is_packed(&peeled))           /* object packed? */
 		add_tag_chain(oid);
 	return 0;
 }
@@ -2487,6 +2668,24 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		else
 			write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
 	}
+	if (!strcmp(k, "pack.writebitmaplookuptable")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_LOOKUP_TABLE;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
+		return 0;
+	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_REV;
+		else
+			pack_idx_opts.flags &= ~WRITE_REV;
+		return 0;
+	}
+	if (!strcmp(k, "pack.allowpackreuse")) {
+		allow_pack_reuse = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index_default = git_config_bool(k, v);
 		return 0;
@@ -2553,8 +2752,11 @@ static void show_commit(struct commit *commit, void *data)
 	add_object_entry(&commit->object.oid, OBJ_COMMIT, NULL, 0);
 	commit->object.flags |= OBJECT_ADDED;
 
-	if (write_bitmap_index)
+	if (write_bitmap_index && !in_bitmap_base(&commit->object.oid))
 		index_commit_for_bitmap(commit);
+
+	if (use_delta_islands)
+		propagate_island_marks(commit);
 }
 
 static void show_object(struct object *obj, const char *name, void *data)
@@ -2562,6 +2764,21 @@ static void show_object(struct object *obj, const char *name, void *data)
 	add_preferred_base_object(name);
 	add_object_entry(&obj->oid, obj->type, name, 0);
 	obj->flags |= OBJECT_ADDED;
+
+	if (use_delta_islands && obj->type == OBJ_TREE) {
+		const char *p;
+		unsigned depth;
+		struct object_entry *ent;
+
+		/* the empty string is a root tree, which is depth 0 */
+		depth = *name ? 1 : 0;
+		for (p = strchr(name, '/'); p; p = strchr(p + 1, '/'))
+			depth++;
+
+		ent = packlist_find(&to_pack, obj->oid.hash, NULL);
+		if (ent && depth > ent->tree_depth)
+			ent->tree_depth = depth;
+	}
 }
 
 static void show_object__ma_allow_any(struct object *obj, const char *name, void *data)
@@ -2578,6 +2795,21 @@ static void show_object__ma_allow_any(struct object *obj, const char *name, void
 	show_object(obj, name, data);
 }
 
+static void show_object__ma_allow_promisor(struct object *obj, const char *name, void *data)
+{
+	assert(arg_missing_action == MA_ALLOW_PROMISOR);
+
+	/*
+	 * Blobs are all a filtered clone leaves out, so those are the
+	 * only objects we can take to be promised when they are missing.
+	 */
+	if (obj->type == OBJ_BLOB && has_promisor_remote() &&
+	    !has_object_file(&obj->oid))
+		return;
+
+	show_object(obj, name, data);
+}
+
 static int option_parse_missing_action(const struct option *opt,
 				       const char *arg, int unset)
 {
@@ -2592,10 +2824,18 @@ static int option_parse_missing_action(const struct option *opt,
 
 	if (!strcmp(arg, "allow-any")) {
 		arg_missing_action = MA_ALLOW_ANY;
+		fetch_if_missing = 0;
 		fn_show_object = show_object__ma_allow_any;
 		return 0;
 	}
 
+	if (!strcmp(arg, "allow-promisor")) {
+		arg_missing_action = MA_ALLOW_PROMISOR;
+		fetch_if_missing = 0;
+		fn_show_object = show_object__ma_allow_promisor;
+		return 0;
+	}
+
 	die(_("invalid value for --missing"));
 	return 0;
 }
@@ -2654,6 +2894,8 @@ static void add_objects_in_unpacked_packs(struct rev_info *revs)
 
 		if (!p->pack_local || p->pack_keep)
 			continue;
+		if (write_bitmap_layer && bitmap_has_pack(p))
+			continue;
 		if (open_pack_index(p))
 			die("cannot open pack index");
 
@@ -2781,7 +3023,8 @@ static void loosen_unused_packed_objects(struct rev_info *revs)
  */
 static int pack_options_allow_reuse(void)
 {
-	return pack_to_stdout &&
+	return allow_pack_reuse &&
+	       pack_to_stdout &&
 	       allow_ofs_delta &&
 	       !ignore_packed_keep &&
 	       (!local || !have_non_local_packs) &&
@@ -2790,14 +3033,14 @@ static int pack_options_allow_reuse(void)
 
 static int get_object_list_from_bitmap(struct rev_info *revs)
 {
-	if (prepare_bitmap_walk(revs) < 0)
+	if (prepare_bitmap_walk(revs, &filter_options) < 0)
 		return -1;
 
 	if (pack_options_allow_reuse() &&
 	    !reuse_partial_packfile_from_bitmap(
 			&reuse_packfile,
 			&reuse_packfile_objects,
-			&reuse_packfile_offset)) {
+			&reuse_packfile_bitmap)) {
 		assert(reuse_packfile_objects);
 		nr_result += reuse_packfile_objects;
 		display_progress(progress_state, nr_result);
@@ -2861,6 +3104,12 @@ static void get_object_list(int ac, const char **av)
 	if (use_bitmap_index && !get_object_list_from_bitmap(&revs))
 		return;
 
+	if (use_delta_islands)
+		load_delta_islands(progress);
+
+	if (write_bitmap_layer)
+		revs.include_check = stop_at_bitmap_base;
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(&revs, show_edge);
@@ -2871,6 +3120,9 @@ static void get_object_list(int ac, const char **av)
 				      show_commit, fn_show_object, NULL,
 				      NULL);
 
+	if (use_delta_islands)
+		resolve_tree_islands(progress, &to_pack);
+
 	if (unpack_unreachable_expiration) {
 		revs.ignore_missing_links = 1;
 		if (add_unseen_recent_objects_to_traversal(&revs,
@@ -3005,6 +3257,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("use a bitmap index if available to speed up counting objects")),
 		OPT_BOOL(0, "write-bitmap-index", &write_bitmap_index,
 			 N_("write a bitmap index together with the pack index")),
+		OPT_BOOL(0, "write-bitmap-layer", &write_bitmap_layer,
+			 N_("write a bitmap index for the objects not covered by existing bitmaps")),
+		OPT_BOOL(0, "delta-islands", &use_delta_islands,
+			 N_("respect islands during delta compression")),
 		OPT_PARSE_LIST_OBJECTS_FILTER(&filter_options),
 		{ OPTION_CALLBACK, 0, "missing", NULL, N_("action"),
 		  N_("handling for missing objects"), PARSE_OPT_NONEG,
@@ -3054,6 +3310,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		argv_array_push(&rp, "--unpacked");
 	}
 
+	/* islands are passed from each commit to its parents */
+	if (use_delta_islands)
+		argv_array_push(&rp, "--topo-order");
+
 	if (!reuse_object)
 		reuse_delta = 0;
 	if (pack_compression_level == -1)
@@ -3088,7 +3348,6 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (filter_options.choice) {
 		if (!pack_to_stdout)
 			die("cannot use --filter without --stdout.");
-		use_bitmap_index = 0;
 	}
 
 	/*
@@ -3106,12 +3365,21 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (use_bitmap_index < 0)
 		use_bitmap_index = use_bitmap_index_default;
 
+	if (write_bitmap_layer)
+		write_bitmap_index = 1;
+
 	/* "hard" reasons not to use bitmaps; these just won't work at all */
 	if (!use_internal_rev_list || (!pack_to_stdout && write_bitmap_index) || is_repository_shallow())
 		use_bitmap_index = 0;
+	if (use_delta_islands)
+		use_bitmap_index = 0;
 
 	if (pack_to_stdout || !rev_list_all)
 		write_bitmap_index = 0;
+	/* without bitmaps to stack onto, write them in full */
+	if (write_bitmap_layer &&
+	    (!write_bitmap_index || bitmap_writer_init_layer() < 0))
+		write_bitmap_layer = 0;
 
 	if (progress && all_progress_implied)
 		progress = 2;
@@ -3160,7 +3428,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	write_pack_file();
 	if (progress)
 		fprintf(stderr, "Total %"PRIu32" (delta %"PRIu32"),"
-			" reused %"PRIu32" (delta %"PRIu32")\n",
-			written, written_delta, reused, reused_delta);
+			" reused %"PRIu32" (delta %"PRIu32"),"
+			" pack-reused %"PRIu32"\n",
+			written, written_delta, reused, reused_delta,
+			reuse_packfile_objects);
 	return 0;
 }
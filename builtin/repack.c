@@ -8,10 +8,13 @@
 #include "strbuf.h"
 #include "string-list.h"
 #include "argv-array.h"
+#include "midx.h"
+#include "promisor-remote.h"
 
 static int delta_base_offset = 1;
 static int pack_kept_objects = -1;
 static int write_bitmaps;
+static int use_delta_islands;
 static char *packdir, *packtmp;
 
 static const char *const git_repack_usage[] = {
@@ -19,12 +22,6 @@ static const char *const git_repack_usage[] = {
 	NULL
 };
 
-static const char incremental_bitmap_conflict_error[] = N_(
-"Incremental repacks are incompatible with bitmap indexes.  Use\n"
-"--no-write-bitmap-index or disable the pack.writebitmaps configuration."
-);
-
-
 static int repack_config(const char *var, const char *value, void *cb)
 {
 	if (!strcmp(var, "repack.usedeltabaseoffset")) {
@@ -40,6 +37,10 @@ static int repack_config(const char *var, const char *value, void *cb)
 		write_bitmaps = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "repack.usedeltaislands")) {
+		use_delta_islands = git_config_bool(var, value);
+		return 0;
+	}
 	return git_default_config(var, value, cb);
 }
 
@@ -83,9 +84,11 @@ static void remove_pack_on_signal(int signo)
 
 /*
  * Adds all packs hex strings to the fname list, which do not
- * have a corresponding .keep file.
+ * have a corresponding .keep file (nor a .bitmap file, if
+ * skip_bitmapped is set).
  */
-static void get_non_kept_pack_filenames(struct string_list *fname_list)
+static void get_non_kept_pack_filenames(struct string_list *fname_list,
+					int skip_bitmapped)
 {
 	DIR *dir;
 	struct dirent *e;
@@ -101,7 +104,9 @@ static void get_non_kept_pack_filenames(struct string_list *fname_list)
 
 		fname = xmemdupz(e->d_name, len);
 
-		if (!file_exists(mkpath("%s/%s.keep", packdir, fname)))
+		if (!file_exists(mkpath("%s/%s.keep", packdir, fname)) &&
+		    !(skip_bitmapped &&
+		      file_exists(mkpath("%s/%s.bitmap", packdir, fname))))
 			string_list_append_nodup(fname_list, fname);
 		else
 			free(fname);
@@ -111,7 +116,7 @@ static void get_non_kept_pack_filenames(struct string_list *fname_list)
 
 static void remove_redundant_pack(const char *dir_name, const char *base_name)
 {
-	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap"};
+	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap", ".rev"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -139,6 +144,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		{".pack"},
 		{".idx"},
 		{".bitmap", 1},
+		{".rev", 1},
 	};
 	struct child_process cmd = CHILD_PROCESS_INIT;
 	struct string_list_item *item;
@@ -182,6 +188,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("pass --local to git-pack-objects")),
 		OPT_BOOL('b', "write-bitmap-index", &write_bitmaps,
 				N_("write bitmap index")),
+		OPT_BOOL('i', "delta-islands", &use_delta_islands,
+				N_("pass --delta-islands to git-pack-objects")),
 		OPT_STRING(0, "unpack-unreachable", &unpack_unreachable, N_("approxidate"),
 				N_("with -A, do not loosen objects older than this")),
 		OPT_BOOL('k', "keep-unreachable", &keep_unreachable,
@@ -216,9 +224,6 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (pack_kept_objects < 0)
 		pack_kept_objects = write_bitmaps;
 
-	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE))
-		die(_(incremental_bitmap_conflict_error));
-
 	packdir = mkpathdup("%s/pack", get_object_directory());
 	packtmp = mkpathdup("%s/.tmp-%d-pack", packdir, (int)getpid());
 
@@ -248,9 +253,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		argv_array_pushf(&cmd.args, "--no-reuse-object");
 	if (write_bitmaps)
 		argv_array_push(&cmd.args, "--write-bitmap-index");
+	if (use_delta_islands)
+		argv_array_push(&cmd.args, "--delta-islands");
+	if (has_promisor_remote())
+		argv_array_push(&cmd.args, "--missing=allow-promisor");
 
 	if (pack_everything & ALL_INTO_ONE) {
-		get_non_kept_pack_filenames(&existing_packs);
+		get_non_kept_pack_filenames(&existing_packs, 0);
 
 		if (existing_packs.nr && delete_redundant) {
 			if (unpack_unreachable) {
@@ -268,6 +277,15 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				argv_array_push(&cmd.env_array, "GIT_REF_PARANOIA=1");
 			}
 		}
+	} else if (write_bitmaps) {
+		/*
+		 * Pack what the existing bitmaps do not cover, with a
+		 * bitmap layer on top of them; the packs that have no
+		 * bitmap are replaced by the new one.
+		 */
+		argv_array_push(&cmd.args, "--write-bitmap-layer");
+		argv_array_push(&cmd.args, "--keep-unreachable");
+		get_non_kept_pack_filenames(&existing_packs, 1);
 	} else {
 		argv_array_push(&cmd.args, "--unpacked");
 		argv_array_push(&cmd.args, "--incremental");
@@ -412,6 +430,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 
 	if (delete_redundant) {
 		int opts = 0;
+		int midx_cleared = 0;
 		string_list_sort(&names);
 		for_each_string_list_item(item, &existing_packs) {
 			char *sha1;
@@ -419,8 +438,14 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 			if (len < 40)
 				continue;
 			sha1 = item->string + len - 40;
-			if (!string_list_has_string(&names, sha1))
-				remove_redundant_pack(packdir, item->string);
+			if (string_list_has_string(&names, sha1))
+				continue;
+			/* The multi-pack-index would refer to a deleted pack. */
+			if (!midx_cleared) {
+				clear_midx_file(get_object_directory());
+				midx_cleared = 1;
+			}
+			remove_redundant_pack(packdir, item->string);
 		}
 		if (!quiet && isatty(2))
 			opts |= PRUNE_PACKED_VERBOSE;
@@ -509,6 +509,7 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 	struct object_id oid;
 
 	check_replace_refs = 0;
+	fetch_if_missing = 0;
 
 	git_config(git_default_config, NULL);
 
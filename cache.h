@@ -345,7 +345,8 @@ struct index_state {
 	struct split_index *split_index;
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
-		 initialized : 1;
+		 initialized : 1,
+		 sparse_index : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
 	unsigned char sha1[20];
@@ -816,10 +817,29 @@ extern char *git_replace_ref_base;
 extern int fsync_object_files;
 extern int core_preload_index;
 extern int core_apply_sparse_checkout;
+extern int core_sparse_checkout_cone;
+
+/*
+ * Commands that can work with sparse directory entries in the index
+ * clear this before reading the index; for everybody else a sparse
+ * index is expanded as soon as it is read.
+ */
+extern int command_requires_full_index;
+
+/*
+ * Should a missing object be fetched from a promisor remote when it is
+ * looked up?  Commands that write objects received from a remote (and
+ * so must not recurse into another fetch) clear this.
+ */
+extern int fetch_if_missing;
+
+extern int core_commit_graph;
+extern int core_multi_pack_index;
 extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
 extern const char *core_fsmonitor;
+extern int core_use_builtin_fsmonitor;
 
 /*
  * Include broken refs in all ref iterations, which will
@@ -905,10 +925,13 @@ extern int grafts_replace_parents;
 #define GIT_REPO_VERSION 0
 #define GIT_REPO_VERSION_READ 1
 extern int repository_format_precious_objects;
+/* The ref storage backend named by extensions.refStorage, or NULL: */
+extern char *repository_format_ref_storage;
 
 struct repository_format {
 	int version;
 	int precious_objects;
+	char *ref_storage;
 	int is_bare;
 	int hash_algo;
 	char *work_tree;
@@ -1214,6 +1237,12 @@ static inline void *read_sha1_file(const unsigned char *sha1, enum object_type *
  */
 extern const unsigned char *do_lookup_replace_object(const unsigned char *sha1);
 
+/*
+ * Read the replace refs into memory.  Afterwards check_replace_refs
+ * is cleared if the repository has no replacements at all.
+ */
+extern void prepare_replace_object(void);
+
 /*
  * If object sha1 should be replaced, return the replacement object's
  * name (replaced recursively, if necessary).  The return value is
@@ -1544,6 +1573,9 @@ struct checkout {
 extern int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath);
 extern void enable_delayed_checkout(struct checkout *state);
 extern int finish_delayed_checkout(struct checkout *state);
+/* Record the stat data of the file just written for ce in the index. */
+extern void update_ce_after_write(const struct checkout *state,
+				  struct cache_entry *ce, struct stat *st);
 
 struct cache_def {
 	struct strbuf path;
@@ -1639,9 +1671,14 @@ extern struct packed_git {
 	unsigned pack_local:1,
 		 pack_keep:1,
 		 freshened:1,
-		 do_not_close:1;
+		 do_not_close:1,
+		 multi_pack_index:1;
 	unsigned char sha1[20];
 	struct revindex_entry *revindex;
+	/* reverse index mapped from the ".rev" file, see pack-revindex.h */
+	const uint32_t *revindex_data;
+	const void *revindex_map;
+	size_t revindex_size;
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
 } *packed_git;
@@ -1776,6 +1813,8 @@ struct object_info {
 #define OBJECT_INFO_SKIP_CACHED 4
 /* Do not retry packed storage after checking packed and loose storage */
 #define OBJECT_INFO_QUICK 8
+/* Do not ask a promisor remote for the object if it is missing */
+#define OBJECT_INFO_SKIP_FETCH_OBJECT 16
 extern int sha1_object_info_extended(const unsigned char *, struct object_info *, unsigned flags);
 
 /* Dumb servers support */
@@ -1863,6 +1902,8 @@ extern void *alloc_tag_node(void);
 extern void *alloc_object_node(void);
 extern void alloc_report(void);
 extern unsigned int alloc_commit_index(void);
+struct commit;
+extern void init_commit_node(struct commit *c);
 
 /* pkt-line.c */
 void packet_trace_identity(const char *prog);
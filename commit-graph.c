@@ -0,0 +1,1299 @@
+#include "cache.h"
+#include "config.h"
+#include "lockfile.h"
+#include "pack.h"
+#include "packfile.h"
+#include "commit.h"
+#include "object.h"
+#include "refs.h"
+#include "revision.h"
+#include "sha1-lookup.h"
+#include "csum-file.h"
+#include "commit-graph.h"
+#include "bloom.h"
+
+#define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_LARGEEDGES 0x45444745 /* "EDGE" */
+#define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
+#define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
+#define GRAPH_MAX_CHUNKS 6
+
+#define GRAPH_DATA_WIDTH 36
+
+#define GRAPH_VERSION_1 0x1
+#define GRAPH_VERSION GRAPH_VERSION_1
+
+#define GRAPH_OID_VERSION_SHA1 1
+#define GRAPH_OID_LEN_SHA1 GIT_SHA1_RAWSZ
+#define GRAPH_OID_VERSION GRAPH_OID_VERSION_SHA1
+#define GRAPH_OID_LEN GRAPH_OID_LEN_SHA1
+
+#define GRAPH_OCTOPUS_EDGES_NEEDED 0x80000000
+#define GRAPH_PARENT_MISSING 0x7fffffff
+#define GRAPH_EDGE_LAST_MASK 0x7fffffff
+#define GRAPH_PARENT_NONE 0x70000000
+
+#define GRAPH_LAST_EDGE 0x80000000
+
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_FANOUT_SIZE (4 * 256)
+#define GRAPH_BLOOM_DATA_HEADER_SIZE (3 * 4)
+#define GRAPH_CHUNKLOOKUP_WIDTH 12
+#define GRAPH_MIN_SIZE (GRAPH_HEADER_SIZE + 4 * GRAPH_CHUNKLOOKUP_WIDTH \
+			+ GRAPH_FANOUT_SIZE + GRAPH_OID_LEN)
+
+char *get_commit_graph_filename(const char *obj_dir)
+{
+	return xstrfmt("%s/info/commit-graph", obj_dir);
+}
+
+static struct commit_graph *alloc_commit_graph(void)
+{
+	struct commit_graph *g = xcalloc(1, sizeof(*g));
+	g->graph_fd = -1;
+
+	return g;
+}
+
+struct commit_graph *load_commit_graph_one(const char *graph_file)
+{
+	void *graph_map;
+	const unsigned char *data, *chunk_lookup;
+	size_t graph_size;
+	struct stat st;
+	uint32_t i;
+	struct commit_graph *graph;
+	int fd = git_open(graph_file);
+	uint64_t last_chunk_offset;
+	uint32_t last_chunk_id;
+	uint32_t graph_signature;
+	unsigned char graph_version, hash_version;
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	graph_size = xsize_t(st.st_size);
+
+	if (graph_size < GRAPH_MIN_SIZE) {
+		close(fd);
+		die("graph file %s is too small", graph_file);
+	}
+	graph_map = xmmap(NULL, graph_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	data = (const unsigned char *)graph_map;
+
+	graph_signature = get_be32(data);
+	if (graph_signature != GRAPH_SIGNATURE) {
+		error("graph signature %X does not match signature %X",
+		      graph_signature, GRAPH_SIGNATURE);
+		goto cleanup_fail;
+	}
+
+	graph_version = *(unsigned char*)(data + 4);
+	if (graph_version != GRAPH_VERSION) {
+		error("graph version %X does not match version %X",
+		      graph_version, GRAPH_VERSION);
+		goto cleanup_fail;
+	}
+
+	hash_version = *(unsigned char*)(data + 5);
+	if (hash_version != GRAPH_OID_VERSION) {
+		error("hash version %X does not match version %X",
+		      hash_version, GRAPH_OID_VERSION);
+		goto cleanup_fail;
+	}
+
+	graph = alloc_commit_graph();
+
+	graph->hash_len = GRAPH_OID_LEN;
+	graph->num_chunks = *(unsigned char*)(data + 6);
+	graph->graph_fd = fd;
+	graph->data = graph_map;
+	graph->data_len = graph_size;
+
+	last_chunk_id = 0;
+	last_chunk_offset = 8;
+	chunk_lookup = data + 8;
+	for (i = 0; i < graph->num_chunks; i++) {
+		uint32_t chunk_id;
+		uint64_t chunk_offset;
+		int chunk_repeated = 0;
+
+		if (chunk_lookup + GRAPH_CHUNKLOOKUP_WIDTH >
+		    data + graph_size - GRAPH_OID_LEN) {
+			error("chunk lookup table extends past end of graph file");
+			goto free_and_return;
+		}
+
+		chunk_id = get_be32(chunk_lookup + 0);
+		chunk_offset = get_be64(chunk_lookup + 4);
+
+		chunk_lookup += GRAPH_CHUNKLOOKUP_WIDTH;
+
+		if (chunk_offset > graph_size - GRAPH_OID_LEN) {
+			error("improper chunk offset %08x%08x",
+			      (uint32_t)(chunk_offset >> 32),
+			      (uint32_t)chunk_offset);
+			goto free_and_return;
+		}
+
+		switch (chunk_id) {
+		case GRAPH_CHUNKID_OIDFANOUT:
+			if (graph->chunk_oid_fanout)
+				chunk_repeated = 1;
+			else
+				graph->chunk_oid_fanout = (uint32_t*)(data + chunk_offset);
+			break;
+
+		case GRAPH_CHUNKID_OIDLOOKUP:
+			if (graph->chunk_oid_lookup)
+				chunk_repeated = 1;
+			else
+				graph->chunk_oid_lookup = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_DATA:
+			if (graph->chunk_commit_data)
+				chunk_repeated = 1;
+			else
+				graph->chunk_commit_data = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_LARGEEDGES:
+			if (graph->chunk_large_edges)
+				chunk_repeated = 1;
+			else
+				graph->chunk_large_edges = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_BLOOMINDEXES:
+			if (graph->chunk_bloom_indexes)
+				chunk_repeated = 1;
+			else
+				graph->chunk_bloom_indexes = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_BLOOMDATA:
+			if (graph->chunk_bloom_data)
+				chunk_repeated = 1;
+			else
+				graph->chunk_bloom_data = data + chunk_offset;
+			break;
+		}
+
+		if (chunk_repeated) {
+			error("chunk id %08x appears multiple times", chunk_id);
+			goto free_and_return;
+		}
+
+		if (last_chunk_id == GRAPH_CHUNKID_OIDLOOKUP)
+			graph->num_commits = (chunk_offset - last_chunk_offset)
+					     / graph->hash_len;
+		if (last_chunk_id == GRAPH_CHUNKID_BLOOMDATA)
+			graph->bloom_data_len = chunk_offset - last_chunk_offset;
+
+		last_chunk_id = chunk_id;
+		last_chunk_offset = chunk_offset;
+	}
+	if (last_chunk_id == GRAPH_CHUNKID_BLOOMDATA)
+		graph->bloom_data_len = graph_size - GRAPH_OID_LEN
+					- last_chunk_offset;
+
+	if (!graph->chunk_oid_fanout || !graph->chunk_oid_lookup ||
+	    !graph->chunk_commit_data) {
+		error("commit-graph %s is missing required chunks", graph_file);
+		goto free_and_return;
+	}
+
+	if (graph->chunk_bloom_indexes && graph->chunk_bloom_data &&
+	    graph->bloom_data_len >= GRAPH_BLOOM_DATA_HEADER_SIZE) {
+		const unsigned char *header = graph->chunk_bloom_data;
+
+		graph->bloom_settings.hash_version = get_be32(header);
+		graph->bloom_settings.num_hashes = get_be32(header + 4);
+		graph->bloom_settings.bits_per_entry = get_be32(header + 8);
+	}
+	/*
+	 * Filters written with an unknown hash function, or only half
+	 * of them, are useless; pretend they are not there.
+	 */
+	if (graph->bloom_settings.hash_version != 1 ||
+	    !graph->bloom_settings.num_hashes) {
+		graph->chunk_bloom_indexes = NULL;
+		graph->chunk_bloom_data = NULL;
+		graph->bloom_data_len = 0;
+	}
+
+	hashcpy(graph->oid.hash, data + graph_size - GRAPH_OID_LEN);
+
+	return graph;
+
+cleanup_fail:
+	munmap(graph_map, graph_size);
+	close(fd);
+	return NULL;
+
+free_and_return:
+	free_commit_graph(graph);
+	return NULL;
+}
+
+void free_commit_graph(struct commit_graph *g)
+{
+	if (!g)
+		return;
+	if (g->graph_fd >= 0) {
+		munmap((void *)g->data, g->data_len);
+		g->data = NULL;
+		close(g->graph_fd);
+	}
+	free(g);
+}
+
+/* global storage */
+static struct commit_graph *commit_graph = NULL;
+static int prepare_commit_graph_run_once = 0;
+
+static int commit_graft_found(const struct commit_graft *graft, void *cb_data)
+{
+	return 1;
+}
+
+/*
+ * Grafts, shallow boundaries and replace refs all change the parents
+ * a commit appears to have, which the graph file knows nothing about.
+ */
+static int commit_graph_compatible(void)
+{
+	if (check_replace_refs) {
+		prepare_replace_object();
+		if (check_replace_refs)
+			return 0;
+	}
+
+	prepare_commit_graft();
+	if (for_each_commit_graft(commit_graft_found, NULL) ||
+	    is_repository_shallow())
+		return 0;
+
+	return 1;
+}
+
+static void prepare_commit_graph_one(const char *obj_dir)
+{
+	char *graph_name;
+
+	if (commit_graph)
+		return;
+
+	graph_name = get_commit_graph_filename(obj_dir);
+	commit_graph = load_commit_graph_one(graph_name);
+
+	FREE_AND_NULL(graph_name);
+}
+
+static void prepare_commit_graph(void)
+{
+	if (prepare_commit_graph_run_once)
+		return;
+	prepare_commit_graph_run_once = 1;
+
+	if (!core_commit_graph || !commit_graph_compatible())
+		return;
+
+	prepare_commit_graph_one(get_object_directory());
+}
+
+int generation_numbers_enabled(void)
+{
+	uint32_t first_generation;
+	struct commit_graph *g;
+
+	if (!core_commit_graph)
+		return 0;
+
+	prepare_commit_graph();
+	g = commit_graph;
+
+	if (!g || !g->num_commits)
+		return 0;
+
+	first_generation = get_be32(g->chunk_commit_data +
+				    g->hash_len + 8) >> 2;
+
+	return !!first_generation;
+}
+
+void close_commit_graph(void)
+{
+	free_commit_graph(commit_graph);
+	commit_graph = NULL;
+	prepare_commit_graph_run_once = 0;
+}
+
+static int bsearch_graph(struct commit_graph *g, const struct object_id *oid,
+			 uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	hi = ntohl(g->chunk_oid_fanout[oid->hash[0]]);
+	lo = oid->hash[0] ? ntohl(g->chunk_oid_fanout[oid->hash[0] - 1]) : 0;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(oid->hash,
+				  g->chunk_oid_lookup + g->hash_len * mi);
+
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+static struct commit_list **insert_parent_or_die(struct commit_graph *g,
+						 uint64_t pos,
+						 struct commit_list **pptr)
+{
+	struct commit *c;
+	struct object_id oid;
+
+	if (pos >= g->num_commits)
+		die("invalid parent position %"PRIu64, pos);
+
+	hashcpy(oid.hash, g->chunk_oid_lookup + g->hash_len * pos);
+	c = lookup_commit(&oid);
+	if (!c)
+		die("could not find commit %s", oid_to_hex(&oid));
+	c->graph_pos = pos;
+	return &commit_list_insert(c, pptr)->next;
+}
+
+static void fill_commit_graph_info(struct commit *item, struct commit_graph *g,
+				   uint32_t pos)
+{
+	const unsigned char *commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+	item->graph_pos = pos;
+	item->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+}
+
+static int fill_commit_in_graph(struct commit *item, struct commit_graph *g,
+				uint32_t pos)
+{
+	struct object_id oid;
+	uint32_t edge_value;
+	uint32_t *parent_data_ptr;
+	uint64_t date_low, date_high;
+	struct commit_list **pptr;
+	const unsigned char *commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+
+	item->object.parsed = 1;
+	item->graph_pos = pos;
+
+	hashcpy(oid.hash, commit_data);
+	item->tree = lookup_tree(&oid);
+
+	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
+	date_low = get_be32(commit_data + g->hash_len + 12);
+	item->date = (timestamp_t)((date_high << 32) | date_low);
+
+	item->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+
+	pptr = &item->parents;
+
+	edge_value = get_be32(commit_data + g->hash_len);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 1;
+	pptr = insert_parent_or_die(g, edge_value, pptr);
+
+	edge_value = get_be32(commit_data + g->hash_len + 4);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 1;
+	if (!(edge_value & GRAPH_OCTOPUS_EDGES_NEEDED)) {
+		pptr = insert_parent_or_die(g, edge_value, pptr);
+		return 1;
+	}
+
+	parent_data_ptr = (uint32_t*)(g->chunk_large_edges +
+			  4 * (uint64_t)(edge_value & GRAPH_EDGE_LAST_MASK));
+	do {
+		edge_value = get_be32(parent_data_ptr);
+		pptr = insert_parent_or_die(g,
+					    edge_value & GRAPH_EDGE_LAST_MASK,
+					    pptr);
+		parent_data_ptr++;
+	} while (!(edge_value & GRAPH_LAST_EDGE));
+
+	return 1;
+}
+
+static int find_commit_in_graph(struct commit *item, struct commit_graph *g,
+				uint32_t *pos)
+{
+	if (item->graph_pos != COMMIT_NOT_FROM_GRAPH) {
+		*pos = item->graph_pos;
+		return 1;
+	}
+	return bsearch_graph(g, &item->object.oid, pos);
+}
+
+static int parse_commit_in_graph_one(struct commit_graph *g, struct commit *item)
+{
+	uint32_t pos;
+
+	if (item->object.parsed)
+		return 1;
+	if (find_commit_in_graph(item, g, &pos))
+		return fill_commit_in_graph(item, g, pos);
+	return 0;
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	if (!core_commit_graph)
+		return 0;
+	prepare_commit_graph();
+	if (commit_graph)
+		return parse_commit_in_graph_one(commit_graph, item);
+	return 0;
+}
+
+void load_commit_graph_info(struct commit *item)
+{
+	uint32_t pos;
+
+	if (!core_commit_graph)
+		return;
+	prepare_commit_graph();
+	if (commit_graph && find_commit_in_graph(item, commit_graph, &pos))
+		fill_commit_graph_info(item, commit_graph, pos);
+}
+
+const struct bloom_filter_settings *get_commit_graph_bloom_settings(void)
+{
+	if (!core_commit_graph)
+		return NULL;
+	prepare_commit_graph();
+	if (!commit_graph || !commit_graph->chunk_bloom_indexes)
+		return NULL;
+	return &commit_graph->bloom_settings;
+}
+
+static int load_bloom_filter_one(struct commit_graph *g, uint32_t pos,
+				 struct bloom_filter *filter)
+{
+	uint32_t start, end;
+
+	start = pos ? get_be32(g->chunk_bloom_indexes + 4 * (pos - 1)) : 0;
+	end = get_be32(g->chunk_bloom_indexes + 4 * pos);
+	if (start > end ||
+	    end > g->bloom_data_len - GRAPH_BLOOM_DATA_HEADER_SIZE)
+		return 0;
+
+	filter->data = (unsigned char *)g->chunk_bloom_data +
+		       GRAPH_BLOOM_DATA_HEADER_SIZE + start;
+	filter->len = end - start;
+	return 1;
+}
+
+int get_commit_graph_bloom_filter(struct commit *item,
+				  struct bloom_filter *filter)
+{
+	uint32_t pos;
+
+	if (!get_commit_graph_bloom_settings() ||
+	    !find_commit_in_graph(item, commit_graph, &pos))
+		return 0;
+	return load_bloom_filter_one(commit_graph, pos, filter);
+}
+
+static void write_graph_chunk_fanout(struct sha1file *f,
+				     struct commit **commits,
+				     int nr_commits)
+{
+	int i, count = 0;
+	struct commit **list = commits;
+
+	/*
+	 * Write the first-level table (the list is sorted,
+	 * but we use a 256-entry lookup to be able to avoid
+	 * having to do eight extra binary search iterations).
+	 */
+	for (i = 0; i < 256; i++) {
+		while (count < nr_commits) {
+			if ((*list)->object.oid.hash[0] != i)
+				break;
+			count++;
+			list++;
+		}
+
+		sha1write_be32(f, count);
+	}
+}
+
+static void write_graph_chunk_oids(struct sha1file *f, int hash_len,
+				   struct commit **commits, int nr_commits)
+{
+	struct commit **list = commits;
+	int count;
+	for (count = 0; count < nr_commits; count++, list++)
+		sha1write(f, (*list)->object.oid.hash, (int)hash_len);
+}
+
+static const unsigned char *commit_to_sha1(size_t index, void *table)
+{
+	struct commit **commits = table;
+	return commits[index]->object.oid.hash;
+}
+
+static void write_graph_chunk_data(struct sha1file *f, int hash_len,
+				   struct commit **commits, int nr_commits)
+{
+	struct commit **list = commits;
+	struct commit **last = commits + nr_commits;
+	uint32_t num_extra_edges = 0;
+
+	while (list < last) {
+		struct commit_list *parent;
+		int edge_value;
+		uint32_t packedDate[2];
+
+		parse_commit(*list);
+		sha1write(f, (*list)->tree->object.oid.hash, hash_len);
+
+		parent = (*list)->parents;
+
+		if (!parent)
+			edge_value = GRAPH_PARENT_NONE;
+		else {
+			edge_value = sha1_pos(parent->item->object.oid.hash,
+					      commits,
+					      nr_commits,
+					      commit_to_sha1);
+
+			if (edge_value < 0)
+				edge_value = GRAPH_PARENT_MISSING;
+		}
+
+		sha1write_be32(f, edge_value);
+
+		if (parent)
+			parent = parent->next;
+
+		if (!parent)
+			edge_value = GRAPH_PARENT_NONE;
+		else if (parent->next)
+			edge_value = GRAPH_OCTOPUS_EDGES_NEEDED | num_extra_edges;
+		else {
+			edge_value = sha1_pos(parent->item->object.oid.hash,
+					      commits,
+					      nr_commits,
+					      commit_to_sha1);
+			if (edge_value < 0)
+				edge_value = GRAPH_PARENT_MISSING;
+		}
+
+		sha1write_be32(f, edge_value);
+
+		if (edge_value & GRAPH_OCTOPUS_EDGES_NEEDED) {
+			do {
+				num_extra_edges++;
+				parent = parent->next;
+			} while (parent);
+		}
+
+		if (sizeof((*list)->date) > 4)
+			packedDate[0] = htonl(((*list)->date >> 32) & 0x3);
+		else
+			packedDate[0] = 0;
+
+		packedDate[0] |= htonl((*list)->generation << 2);
+
+		packedDate[1] = htonl((*list)->date);
+		sha1write(f, packedDate, 8);
+
+		list++;
+	}
+}
+
+static void write_graph_chunk_large_edges(struct sha1file *f,
+					  struct commit **commits,
+					  int nr_commits)
+{
+	struct commit **list = commits;
+	struct commit **last = commits + nr_commits;
+	struct commit_list *parent;
+
+	while (list < last) {
+		int num_parents = 0;
+		for (parent = (*list)->parents; num_parents < 3 && parent;
+		     parent = parent->next)
+			num_parents++;
+
+		if (num_parents <= 2) {
+			list++;
+			continue;
+		}
+
+		/* Since num_parents > 2, this initializer is safe. */
+		for (parent = (*list)->parents->next; parent; parent = parent->next) {
+			int edge_value = sha1_pos(parent->item->object.oid.hash,
+						  commits,
+						  nr_commits,
+						  commit_to_sha1);
+
+			if (edge_value < 0)
+				edge_value = GRAPH_PARENT_MISSING;
+			else if (!parent->next)
+				edge_value |= GRAPH_LAST_EDGE;
+
+			sha1write_be32(f, edge_value);
+		}
+
+		list++;
+	}
+}
+
+static void write_graph_chunk_bloom_indexes(struct sha1file *f,
+					    struct bloom_filter *filters,
+					    int nr_commits)
+{
+	uint32_t cur_pos = 0;
+	int i;
+
+	for (i = 0; i < nr_commits; i++) {
+		cur_pos += filters[i].len;
+		sha1write_be32(f, cur_pos);
+	}
+}
+
+static void write_graph_chunk_bloom_data(struct sha1file *f,
+					 struct bloom_filter *filters,
+					 int nr_commits,
+					 const struct bloom_filter_settings *settings)
+{
+	int i;
+
+	sha1write_be32(f, settings->hash_version);
+	sha1write_be32(f, settings->num_hashes);
+	sha1write_be32(f, settings->bits_per_entry);
+
+	for (i = 0; i < nr_commits; i++)
+		if (filters[i].len)
+			sha1write(f, filters[i].data, filters[i].len);
+}
+
+/*
+ * Compute the changed-path Bloom filters of "commits", reusing the ones
+ * of the current commit-graph when they were written the same way.
+ */
+static struct bloom_filter *compute_bloom_filters(struct commit **commits,
+						  int nr_commits,
+						  const struct bloom_filter_settings *settings,
+						  uint64_t *total_len)
+{
+	const struct bloom_filter_settings *old = get_commit_graph_bloom_settings();
+	struct bloom_filter *filters;
+	int i, reuse;
+
+	reuse = old &&
+		old->hash_version == settings->hash_version &&
+		old->num_hashes == settings->num_hashes &&
+		old->bits_per_entry == settings->bits_per_entry;
+
+	*total_len = 0;
+	filters = xcalloc(nr_commits, sizeof(*filters));
+	for (i = 0; i < nr_commits; i++) {
+		struct bloom_filter *filter = &filters[i];
+
+		if (reuse && get_commit_graph_bloom_filter(commits[i], filter))
+			filter->data = filter->len ?
+				xmemdupz(filter->data, filter->len) : NULL;
+		else
+			compute_bloom_filter(commits[i], filter, settings);
+
+		*total_len += filter->len;
+	}
+
+	if (*total_len > 0xffffffff)
+		die(_("changed-path Bloom filters are too large for the commit-graph"));
+	return filters;
+}
+
+static int commit_compare(const void *_a, const void *_b)
+{
+	const struct object_id *a = (const struct object_id *)_a;
+	const struct object_id *b = (const struct object_id *)_b;
+	return oidcmp(a, b);
+}
+
+struct packed_commit_list {
+	struct commit **list;
+	int nr;
+	int alloc;
+};
+
+struct packed_oid_list {
+	struct object_id *list;
+	int nr;
+	int alloc;
+};
+
+static int add_packed_commits(const struct object_id *oid,
+			      struct packed_git *pack,
+			      uint32_t pos,
+			      void *data)
+{
+	struct packed_oid_list *list = (struct packed_oid_list*)data;
+	enum object_type type;
+	off_t offset = nth_packed_object_offset(pack, pos);
+	struct object_info oi = OBJECT_INFO_INIT;
+
+	oi.typep = &type;
+	if (packed_object_info(pack, offset, &oi) < 0)
+		die("unable to get type of object %s", oid_to_hex(oid));
+
+	if (type != OBJ_COMMIT)
+		return 0;
+
+	ALLOC_GROW(list->list, list->nr + 1, list->alloc);
+	oidcpy(&(list->list[list->nr]), oid);
+	list->nr++;
+
+	return 0;
+}
+
+static void add_missing_parents(struct packed_oid_list *oids, struct commit *commit)
+{
+	struct commit_list *parent;
+	for (parent = commit->parents; parent; parent = parent->next) {
+		if (!(parent->item->object.flags & UNINTERESTING)) {
+			ALLOC_GROW(oids->list, oids->nr + 1, oids->alloc);
+			oidcpy(&oids->list[oids->nr], &(parent->item->object.oid));
+			oids->nr++;
+			parent->item->object.flags |= UNINTERESTING;
+		}
+	}
+}
+
+static void close_reachable(struct packed_oid_list *oids)
+{
+	int i;
+	struct commit *commit;
+
+	for (i = 0; i < oids->nr; i++) {
+		commit = lookup_commit(&oids->list[i]);
+		if (commit)
+			commit->object.flags |= UNINTERESTING;
+	}
+
+	/*
+	 * As this loop runs, oids->nr may grow, but not more
+	 * than the number of missing commits in the reachable
+	 * closure.
+	 */
+	for (i = 0; i < oids->nr; i++) {
+		commit = lookup_commit(&oids->list[i]);
+
+		if (commit && !parse_commit(commit))
+			add_missing_parents(oids, commit);
+	}
+
+	for (i = 0; i < oids->nr; i++) {
+		commit = lookup_commit(&oids->list[i]);
+
+		if (commit)
+			commit->object.flags &= ~UNINTERESTING;
+	}
+}
+
+static void compute_generation_numbers(struct packed_commit_list* commits)
+{
+	int i;
+	struct commit_list *list = NULL;
+
+	for (i = 0; i < commits->nr; i++) {
+		if (commits->list[i]->generation != GENERATION_NUMBER_INFINITY &&
+		    commits->list[i]->generation != GENERATION_NUMBER_ZERO)
+			continue;
+
+		commit_list_insert(commits->list[i], &list);
+		while (list) {
+			struct commit *current = list->item;
+			struct commit_list *parent;
+			int all_parents_computed = 1;
+			uint32_t max_generation = 0;
+
+			for (parent = current->parents; parent; parent = parent->next) {
+				if (parent->item->generation == GENERATION_NUMBER_INFINITY ||
+				    parent->item->generation == GENERATION_NUMBER_ZERO) {
+					all_parents_computed = 0;
+					commit_list_insert(parent->item, &list);
+					break;
+				} else if (parent->item->generation > max_generation) {
+					max_generation = parent->item->generation;
+				}
+			}
+
+			if (all_parents_computed) {
+				current->generation = max_generation + 1;
+				pop_commit(&list);
+
+				if (current->generation > GENERATION_NUMBER_MAX)
+					current->generation = GENERATION_NUMBER_MAX;
+			}
+		}
+	}
+}
+
+static int add_ref_to_list(const char *refname,
+			   const struct object_id *oid,
+			   int flags, void *cb_data)
+{
+	struct string_list *list = (struct string_list *)cb_data;
+
+	string_list_append(list, oid_to_hex(oid));
+	return 0;
+}
+
+void write_commit_graph_reachable(const char *obj_dir, int append,
+				  int changed_paths)
+{
+	struct string_list list = STRING_LIST_INIT_DUP;
+
+	for_each_ref(add_ref_to_list, &list);
+	write_commit_graph(obj_dir, NULL, &list, append, changed_paths);
+
+	string_list_clear(&list, 0);
+}
+
+void write_commit_graph(const char *obj_dir,
+			struct string_list *pack_indexes,
+			struct string_list *commit_hex,
+			int append, int changed_paths)
+{
+	struct packed_oid_list oids;
+	struct packed_commit_list commits;
+	struct sha1file *f;
+	uint32_t i, count_distinct = 0;
+	char *graph_name;
+	struct lock_file lk = LOCK_INIT;
+	uint32_t chunk_ids[GRAPH_MAX_CHUNKS + 1];
+	uint64_t chunk_sizes[GRAPH_MAX_CHUNKS];
+	uint64_t chunk_offsets[GRAPH_MAX_CHUNKS + 1];
+	int num_chunks;
+	int num_extra_edges;
+	struct commit_list *parent;
+	struct bloom_filter_settings bloom_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	struct bloom_filter *bloom_filters = NULL;
+	uint64_t bloom_filters_len = 0;
+
+	oids.nr = 0;
+	oids.alloc = approximate_object_count() / 4;
+
+	if (append) {
+		prepare_commit_graph_one(obj_dir);
+		if (commit_graph)
+			oids.alloc += commit_graph->num_commits;
+	}
+
+	if (oids.alloc < 1024)
+		oids.alloc = 1024;
+	ALLOC_ARRAY(oids.list, oids.alloc);
+
+	if (append && commit_graph) {
+		for (i = 0; i < commit_graph->num_commits; i++) {
+			const unsigned char *hash = commit_graph->chunk_oid_lookup +
+				commit_graph->hash_len * i;
+			hashcpy(oids.list[oids.nr++].hash, hash);
+		}
+	}
+
+	if (pack_indexes) {
+		struct strbuf packname = STRBUF_INIT;
+		int dirlen;
+		strbuf_addf(&packname, "%s/pack/", obj_dir);
+		dirlen = packname.len;
+		for (i = 0; i < pack_indexes->nr; i++) {
+			struct packed_git *p;
+			uint32_t pos;
+			strbuf_setlen(&packname, dirlen);
+			strbuf_addstr(&packname, pack_indexes->items[i].string);
+			p = add_packed_git(packname.buf, packname.len, 1);
+			if (!p)
+				die("error adding pack %s", packname.buf);
+			if (open_pack_index(p))
+				die("error opening index for %s", packname.buf);
+			for (pos = 0; pos < p->num_objects; pos++) {
+				struct object_id oid;
+				nth_packed_object_oid(&oid, p, pos);
+				add_packed_commits(&oid, p, pos, &oids);
+			}
+			close_pack(p);
+			free(p);
+		}
+		strbuf_release(&packname);
+	}
+
+	if (commit_hex) {
+		for (i = 0; i < commit_hex->nr; i++) {
+			const char *end;
+			struct object_id oid;
+			struct commit *result;
+
+			if (commit_hex->items[i].string &&
+			    parse_oid_hex(commit_hex->items[i].string, &oid, &end))
+				continue;
+
+			result = lookup_commit_reference_gently(&oid, 1);
+
+			if (result) {
+				ALLOC_GROW(oids.list, oids.nr + 1, oids.alloc);
+				oidcpy(&oids.list[oids.nr], &(result->object.oid));
+				oids.nr++;
+			}
+		}
+	}
+
+	if (!pack_indexes && !commit_hex)
+		for_each_packed_object(add_packed_commits, &oids, 0);
+
+	close_reachable(&oids);
+
+	QSORT(oids.list, oids.nr, commit_compare);
+
+	count_distinct = 1;
+	for (i = 1; i < oids.nr; i++) {
+		if (oidcmp(&oids.list[i-1], &oids.list[i]))
+			count_distinct++;
+	}
+
+	if (count_distinct >= GRAPH_PARENT_MISSING)
+		die(_("the commit graph format cannot write %d commits"), count_distinct);
+
+	commits.nr = 0;
+	commits.alloc = count_distinct;
+	ALLOC_ARRAY(commits.list, commits.alloc);
+
+	num_extra_edges = 0;
+	for (i = 0; i < oids.nr; i++) {
+		int num_parents = 0;
+		if (i > 0 && !oidcmp(&oids.list[i-1], &oids.list[i]))
+			continue;
+
+		commits.list[commits.nr] = lookup_commit(&oids.list[i]);
+		parse_commit(commits.list[commits.nr]);
+
+		for (parent = commits.list[commits.nr]->parents;
+		     parent; parent = parent->next)
+			num_parents++;
+
+		if (num_parents > 2)
+			num_extra_edges += num_parents - 1;
+
+		commits.nr++;
+	}
+
+	if (commits.nr >= GRAPH_PARENT_MISSING)
+		die(_("too many commits to write graph"));
+
+	compute_generation_numbers(&commits);
+
+	if (changed_paths)
+		bloom_filters = compute_bloom_filters(commits.list, commits.nr,
+						      &bloom_settings,
+						      &bloom_filters_len);
+
+	num_chunks = 0;
+	chunk_ids[num_chunks] = GRAPH_CHUNKID_OIDFANOUT;
+	chunk_sizes[num_chunks++] = GRAPH_FANOUT_SIZE;
+	chunk_ids[num_chunks] = GRAPH_CHUNKID_OIDLOOKUP;
+	chunk_sizes[num_chunks++] = GRAPH_OID_LEN * commits.nr;
+	chunk_ids[num_chunks] = GRAPH_CHUNKID_DATA;
+	chunk_sizes[num_chunks++] = (GRAPH_OID_LEN + 16) * commits.nr;
+	if (num_extra_edges) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_LARGEEDGES;
+		chunk_sizes[num_chunks++] = 4 * num_extra_edges;
+	}
+	if (bloom_filters) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMINDEXES;
+		chunk_sizes[num_chunks++] = 4 * commits.nr;
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMDATA;
+		chunk_sizes[num_chunks++] = GRAPH_BLOOM_DATA_HEADER_SIZE +
+					    bloom_filters_len;
+	}
+	chunk_ids[num_chunks] = 0;
+
+	chunk_offsets[0] = 8 + (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
+	for (i = 0; i < num_chunks; i++)
+		chunk_offsets[i + 1] = chunk_offsets[i] + chunk_sizes[i];
+
+	graph_name = get_commit_graph_filename(obj_dir);
+	if (safe_create_leading_directories(graph_name))
+		die_errno(_("unable to create leading directories of %s"),
+			  graph_name);
+
+	hold_lock_file_for_update(&lk, graph_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(lk.tempfile->fd, lk.tempfile->filename.buf);
+
+	sha1write_be32(f, GRAPH_SIGNATURE);
+
+	sha1write_u8(f, GRAPH_VERSION);
+	sha1write_u8(f, GRAPH_OID_VERSION);
+	sha1write_u8(f, num_chunks);
+	sha1write_u8(f, 0); /* unused padding byte */
+
+	for (i = 0; i <= num_chunks; i++) {
+		uint32_t chunk_write[3];
+
+		chunk_write[0] = htonl(chunk_ids[i]);
+		chunk_write[1] = htonl(chunk_offsets[i] >> 32);
+		chunk_write[2] = htonl(chunk_offsets[i] & 0xffffffff);
+		sha1write(f, chunk_write, 12);
+	}
+
+	write_graph_chunk_fanout(f, commits.list, commits.nr);
+	write_graph_chunk_oids(f, GRAPH_OID_LEN, commits.list, commits.nr);
+	write_graph_chunk_data(f, GRAPH_OID_LEN, commits.list, commits.nr);
+	write_graph_chunk_large_edges(f, commits.list, commits.nr);
+	if (bloom_filters) {
+		write_graph_chunk_bloom_indexes(f, bloom_filters, commits.nr);
+		write_graph_chunk_bloom_data(f, bloom_filters, commits.nr,
+					     &bloom_settings);
+	}
+
+	close_commit_graph();
+	sha1close(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+	commit_lock_file(&lk);
+
+	free(oids.list);
+	oids.alloc = 0;
+	oids.nr = 0;
+	free(graph_name);
+	if (bloom_filters) {
+		for (i = 0; i < commits.nr; i++)
+			free(bloom_filters[i].data);
+		free(bloom_filters);
+	}
+	free(commits.list);
+}
+
+static int verify_commit_graph_error;
+
+static void graph_report(const char *fmt, ...)
+{
+	va_list ap;
+
+	verify_commit_graph_error = 1;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+#define VERIFY_COMMIT_GRAPH_ERROR_HASH 2
+#define GENERATION_ZERO_EXISTS 1
+#define GENERATION_NUMBER_EXISTS 2
+
+int verify_commit_graph(struct commit_graph *g)
+{
+	uint32_t i, cur_fanout_pos = 0;
+	struct object_id prev_oid, cur_oid, checksum;
+	int generation_zero = 0;
+	git_SHA_CTX ctx;
+
+	if (!g) {
+		graph_report("no commit-graph file loaded");
+		return 1;
+	}
+
+	verify_commit_graph_error = 0;
+
+	if (!g->chunk_oid_fanout)
+		graph_report("commit-graph is missing the OID Fanout chunk");
+	if (!g->chunk_oid_lookup)
+		graph_report("commit-graph is missing the OID Lookup chunk");
+	if (!g->chunk_commit_data)
+		graph_report("commit-graph is missing the Commit Data chunk");
+
+	if (verify_commit_graph_error)
+		return verify_commit_graph_error;
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, g->data, g->data_len - g->hash_len);
+	git_SHA1_Final(checksum.hash, &ctx);
+	if (hashcmp(checksum.hash, g->data + g->data_len - g->hash_len)) {
+		graph_report(_("the commit-graph file has incorrect checksum and is likely corrupt"));
+		verify_commit_graph_error = VERIFY_COMMIT_GRAPH_ERROR_HASH;
+	}
+
+	for (i = 0; i < g->num_commits; i++) {
+		struct commit *graph_commit;
+
+		hashcpy(cur_oid.hash, g->chunk_oid_lookup + g->hash_len * i);
+
+		if (i && oidcmp(&prev_oid, &cur_oid) >= 0)
+			graph_report("commit-graph has incorrect OID order: %s then %s",
+				     oid_to_hex(&prev_oid),
+				     oid_to_hex(&cur_oid));
+
+		oidcpy(&prev_oid, &cur_oid);
+
+		while (cur_oid.hash[0] > cur_fanout_pos) {
+			uint32_t fanout_value = get_be32(g->chunk_oid_fanout + cur_fanout_pos);
+
+			if (i != fanout_value)
+				graph_report("commit-graph has incorrect fanout value: fanout[%d] = %u != %u",
+					     cur_fanout_pos, fanout_value, i);
+			cur_fanout_pos++;
+		}
+
+		graph_commit = lookup_commit(&cur_oid);
+		if (!graph_commit || !parse_commit_in_graph_one(g, graph_commit))
+			graph_report("failed to parse %s from commit-graph",
+				     oid_to_hex(&cur_oid));
+	}
+
+	while (cur_fanout_pos < 256) {
+		uint32_t fanout_value = get_be32(g->chunk_oid_fanout + cur_fanout_pos);
+
+		if (g->num_commits != fanout_value)
+			graph_report("commit-graph has incorrect fanout value: fanout[%d] = %u != %u",
+				     cur_fanout_pos, fanout_value, i);
+
+		cur_fanout_pos++;
+	}
+
+	if (g->chunk_bloom_indexes) {
+		uint32_t prev_end = 0;
+
+		for (i = 0; i < g->num_commits; i++) {
+			uint32_t end = get_be32(g->chunk_bloom_indexes + 4 * i);
+
+			if (end < prev_end ||
+			    end > g->bloom_data_len - GRAPH_BLOOM_DATA_HEADER_SIZE) {
+				graph_report("commit-graph has invalid Bloom filter index %u for commit %u",
+					     end, i);
+				break;
+			}
+			prev_end = end;
+		}
+	}
+
+	/* a bad checksum alone should not hide the details below */
+	if (verify_commit_graph_error & ~VERIFY_COMMIT_GRAPH_ERROR_HASH)
+		return verify_commit_graph_error;
+
+	for (i = 0; i < g->num_commits; i++) {
+		struct commit *graph_commit, odb_commit;
+		struct commit_list *graph_parents, *odb_parents;
+		uint32_t max_generation = 0;
+		enum object_type type;
+		unsigned long size;
+		void *buffer;
+
+		hashcpy(cur_oid.hash, g->chunk_oid_lookup + g->hash_len * i);
+
+		graph_commit = lookup_commit(&cur_oid);
+		buffer = read_sha1_file(cur_oid.hash, &type, &size);
+		if (!buffer || type != OBJ_COMMIT) {
+			graph_report("failed to parse %s from object database",
+				     oid_to_hex(&cur_oid));
+			free(buffer);
+			continue;
+		}
+		/*
+		 * Parse into a scratch commit that is not registered in
+		 * the object hash, so that the graph-backed copy survives.
+		 */
+		memset(&odb_commit, 0, sizeof(odb_commit));
+		init_commit_node(&odb_commit);
+		oidcpy(&odb_commit.object.oid, &cur_oid);
+		if (parse_commit_buffer(&odb_commit, buffer, size)) {
+			graph_report("failed to parse %s from object database",
+				     oid_to_hex(&cur_oid));
+			free(buffer);
+			continue;
+		}
+		free(buffer);
+
+		if (oidcmp(&graph_commit->tree->object.oid,
+			   &odb_commit.tree->object.oid))
+			graph_report("root tree OID for commit %s in commit-graph is %s != %s",
+				     oid_to_hex(&cur_oid),
+				     oid_to_hex(&graph_commit->tree->object.oid),
+				     oid_to_hex(&odb_commit.tree->object.oid));
+
+		graph_parents = graph_commit->parents;
+		odb_parents = odb_commit.parents;
+
+		while (graph_parents) {
+			if (odb_parents == NULL) {
+				graph_report("commit-graph parent list for commit %s is too long",
+					     oid_to_hex(&cur_oid));
+				break;
+			}
+
+			if (oidcmp(&graph_parents->item->object.oid, &odb_parents->item->object.oid))
+				graph_report("commit-graph parent for %s is %s != %s",
+					     oid_to_hex(&cur_oid),
+					     oid_to_hex(&graph_parents->item->object.oid),
+					     oid_to_hex(&odb_parents->item->object.oid));
+
+			if (graph_parents->item->generation > max_generation)
+				max_generation = graph_parents->item->generation;
+
+			graph_parents = graph_parents->next;
+			odb_parents = odb_parents->next;
+		}
+
+		if (odb_parents != NULL)
+			graph_report("commit-graph parent list for commit %s terminates early",
+				     oid_to_hex(&cur_oid));
+		free_commit_list(odb_commit.parents);
+
+		if (!graph_commit->generation) {
+			if (generation_zero == GENERATION_NUMBER_EXISTS)
+				graph_report("commit-graph has generation number zero for commit %s, but non-zero elsewhere",
+					     oid_to_hex(&cur_oid));
+			generation_zero = GENERATION_ZERO_EXISTS;
+		} else if (generation_zero == GENERATION_ZERO_EXISTS)
+			graph_report("commit-graph has non-zero generation number for commit %s, but zero elsewhere",
+				     oid_to_hex(&cur_oid));
+
+		if (generation_zero == GENERATION_ZERO_EXISTS)
+			continue;
+
+		/*
+		 * If one of our parents has generation GENERATION_NUMBER_MAX, then
+		 * our generation is also GENERATION_NUMBER_MAX. Decrement to avoid
+		 * extra logic in the following condition.
+		 */
+		if (max_generation == GENERATION_NUMBER_MAX)
+			max_generation--;
+
+		if (graph_commit->generation != max_generation + 1)
+			graph_report("commit-graph generation for commit %s is %u != %u",
+				     oid_to_hex(&cur_oid),
+				     graph_commit->generation,
+				     max_generation + 1);
+
+		if (graph_commit->date != odb_commit.date)
+			graph_report("commit date for commit %s in commit-graph is %"PRItime" != %"PRItime,
+				     oid_to_hex(&cur_oid),
+				     graph_commit->date,
+				     odb_commit.date);
+	}
+
+	return verify_commit_graph_error;
+}
@@ -0,0 +1,100 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include "git-compat-util.h"
+#include "string-list.h"
+#include "bloom.h"
+
+struct commit;
+
+extern char *get_commit_graph_filename(const char *obj_dir);
+
+/*
+ * Given a commit struct, try to fill the commit struct info, including:
+ *  1. tree object
+ *  2. date
+ *  3. parents.
+ *
+ * Returns 1 if and only if the commit was found in the packed graph.
+ *
+ * See parse_commit_buffer() for the fallback after this call.
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+/*
+ * It is possible that we loaded commit contents from the commit buffer,
+ * but we also want to ensure the commit-graph content is correctly
+ * checked and filled. Fill the graph_pos and generation members of
+ * the given commit.
+ */
+extern void load_commit_graph_info(struct commit *item);
+
+/*
+ * Return 1 if a commit-graph with generation numbers is in use, so
+ * that walks may rely on commit->generation to stop early.
+ */
+extern int generation_numbers_enabled(void);
+
+/*
+ * Return the settings of the changed-path Bloom filters in the
+ * commit-graph, or NULL if it has none.
+ */
+extern const struct bloom_filter_settings *get_commit_graph_bloom_settings(void);
+
+/*
+ * Point "filter" at the changed-path Bloom filter of "item" in the
+ * commit-graph, which must not be modified or freed.  Returns 1 if the
+ * graph has a filter for the commit, and 0 otherwise.
+ */
+extern int get_commit_graph_bloom_filter(struct commit *item,
+					 struct bloom_filter *filter);
+
+struct commit_graph {
+	int graph_fd;
+
+	const unsigned char *data;
+	size_t data_len;
+
+	unsigned char hash_len;
+	unsigned char num_chunks;
+	uint32_t num_commits;
+	struct object_id oid;
+
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_large_edges;
+	const unsigned char *chunk_bloom_indexes;
+	const unsigned char *chunk_bloom_data;
+	size_t bloom_data_len;
+
+	struct bloom_filter_settings bloom_settings;
+};
+
+extern struct commit_graph *load_commit_graph_one(const char *graph_file);
+
+/*
+ * Write a commit-graph file into "obj_dir" covering the commits named
+ * by "pack_indexes" (all commits in those packs), by "commit_hex" (the
+ * given commits and everything reachable from them), or every packed
+ * commit if both lists are NULL.  If "append" is set, the commits of an
+ * existing graph file are carried over.  If "changed_paths" is set,
+ * a changed-path Bloom filter is stored for every commit.
+ */
+extern void write_commit_graph(const char *obj_dir,
+			       struct string_list *pack_indexes,
+			       struct string_list *commit_hex,
+			       int append, int changed_paths);
+extern void write_commit_graph_reachable(const char *obj_dir, int append,
+					 int changed_paths);
+
+/*
+ * Check the integrity of a loaded commit-graph against the object
+ * database. Returns the number of errors found.
+ */
+extern int verify_commit_graph(struct commit_graph *g);
+
+extern void close_commit_graph(void);
+extern void free_commit_graph(struct commit_graph *);
+
+#endif
@@ -1228,6 +1228,21 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.sparsecheckoutcone")) {
+		core_sparse_checkout_cone = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.commitgraph")) {
+		core_commit_graph = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.multipackindex")) {
+		core_multi_pack_index = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.precomposeunicode")) {
 		precomposed_unicode = git_config_bool(var, value);
 		return 0;
@@ -2151,6 +2166,24 @@ int git_config_get_split_index(void)
 	return -1; /* default value */
 }
 
+int git_config_get_index_threads(void)
+{
+	int is_bool, val = 0;
+
+	val = git_env_ulong("GIT_TEST_INDEX_THREADS", 0);
+	if (val)
+		return val;
+
+	if (!git_config_get_bool_or_int("index.threads", &is_bool, &val)) {
+		if (is_bool)
+			return val ? 0 : 1;
+		else
+			return val;
+	}
+
+	return 0; /* auto */
+}
+
 int git_config_get_max_percent_split_change(void)
 {
 	int val = -1;
@@ -2168,6 +2201,15 @@ int git_config_get_max_percent_split_change(void)
 
 int git_config_get_fsmonitor(void)
 {
+#ifdef HAVE_FSMONITOR_DAEMON
+	if (!git_config_get_bool("core.usebuiltinfsmonitor",
+				 &core_use_builtin_fsmonitor) &&
+	    core_use_builtin_fsmonitor) {
+		core_fsmonitor = "git fsmonitor--daemon";
+		return 1;
+	}
+#endif
+
 	if (git_config_get_pathname("core.fsmonitor", &core_fsmonitor))
 		core_fsmonitor = getenv("GIT_FSMONITOR_TEST");
 
@@ -213,6 +213,7 @@ extern int git_config_get_pathname(const char *key, const char **dest);
 extern int git_config_get_untracked_cache(void);
 extern int git_config_get_split_index(void);
 extern int git_config_get_max_percent_split_change(void);
+extern int git_config_get_index_threads(void);
 extern int git_config_get_fsmonitor(void);
 
 /* This dies if the configured or default date is in the future */
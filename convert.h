@@ -7,6 +7,7 @@
 #include "string-list.h"
 
 struct index_state;
+struct convert_driver;
 
 enum safe_crlf {
 	SAFE_CRLF_FALSE = 0,
@@ -37,6 +38,32 @@ enum eol {
 #endif
 };
 
+enum crlf_action {
+	CRLF_UNDEFINED,
+	CRLF_BINARY,
+	CRLF_TEXT,
+	CRLF_TEXT_INPUT,
+	CRLF_TEXT_CRLF,
+	CRLF_AUTO,
+	CRLF_AUTO_INPUT,
+	CRLF_AUTO_CRLF
+};
+
+/*
+ * The conversion attributes of a path, as looked up by convert_attrs().
+ * The *_ca() functions below take them instead of a path to look up, so
+ * that they can be computed once (e.g. by the process holding the index)
+ * and applied elsewhere.
+ */
+struct conv_attrs {
+	struct convert_driver *drv;
+	enum crlf_action attr_action; /* What attr says */
+	enum crlf_action crlf_action; /* When no attr is set, use core.autocrlf */
+	int ident;
+};
+
+extern void convert_attrs(struct conv_attrs *ca, const char *path);
+
 enum ce_delay_state {
 	CE_NO_DELAY = 0,
 	CE_CAN_DELAY = 1,
@@ -69,6 +96,9 @@ extern int convert_to_git(const struct index_state *istate,
 			  struct strbuf *dst, enum safe_crlf checksafe);
 extern int convert_to_working_tree(const char *path, const char *src,
 				   size_t len, struct strbuf *dst);
+extern int convert_to_working_tree_ca(const struct conv_attrs *ca,
+				      const char *path, const char *src,
+				      size_t len, struct strbuf *dst);
 extern int async_convert_to_working_tree(const char *path, const char *src,
 					 size_t len, struct strbuf *dst,
 					 void *dco);
@@ -97,6 +127,8 @@ extern int would_convert_to_git_filter_fd(const char *path);
 struct stream_filter; /* opaque */
 
 extern struct stream_filter *get_stream_filter(const char *path, const unsigned char *);
+extern struct stream_filter *get_stream_filter_ca(const struct conv_attrs *ca,
+						  const unsigned char *);
 extern void free_stream_filter(struct stream_filter *);
 extern int is_null_stream_filter(struct stream_filter *);
 
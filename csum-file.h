@@ -27,8 +27,9 @@ extern void sha1file_checkpoint(struct sha1file *, struct sha1file_checkpoint *)
 extern int sha1file_truncate(struct sha1file *, struct sha1file_checkpoint *);
 
 /* sha1close flags */
-#define CSUM_CLOSE	1
-#define CSUM_FSYNC	2
+#define CSUM_CLOSE		1
+#define CSUM_FSYNC		2
+#define CSUM_HASH_IN_STREAM	4
 
 extern struct sha1file *sha1fd(int fd, const char *name);
 extern struct sha1file *sha1fd_check(const char *name);
@@ -50,4 +51,10 @@ static inline void sha1write_be32(struct sha1file *f, uint32_t data)
 	sha1write(f, &data, sizeof(data));
 }
 
+static inline void sha1write_be64(struct sha1file *f, uint64_t data)
+{
+	data = htonll(data);
+	sha1write(f, &data, sizeof(data));
+}
+
 #endif
@@ -0,0 +1,406 @@
+#include "cache.h"
+#include "config.h"
+#include "object.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "refs.h"
+#include "progress.h"
+#include "khash.h"
+#include "sha1-array.h"
+#include "string-list.h"
+#include "pack.h"
+#include "pack-objects.h"
+#include "delta-islands.h"
+
+/* oid => struct island_bitmap, for every object we know the islands of */
+static khash_sha1 *island_marks;
+static unsigned island_counter;
+
+/* island name => struct oid_array of its ref tips */
+static struct string_list remote_islands = STRING_LIST_INIT_DUP;
+
+static regex_t *island_regexes;
+static unsigned int island_regexes_alloc, island_regexes_nr;
+
+/*
+ * One bit per island.  Bitmaps are shared copy-on-write between an
+ * object and the objects it passed its marks on to, until one of them
+ * learns about an island the other is not in.
+ */
+struct island_bitmap {
+	uint32_t refcount;
+	uint32_t bits[FLEX_ARRAY];
+};
+
+static uint32_t island_bitmap_size;
+
+#define ISLAND_BITMAP_BLOCK(x) (x / 32)
+#define ISLAND_BITMAP_MASK(x) (1 << (x % 32))
+
+static struct island_bitmap *island_bitmap_new(const struct island_bitmap *old)
+{
+	size_t size = sizeof(struct island_bitmap) + (island_bitmap_size * 4);
+	struct island_bitmap *b = xcalloc(1, size);
+
+	if (old)
+		memcpy(b, old, size);
+
+	b->refcount = 1;
+	return b;
+}
+
+static void island_bitmap_or(struct island_bitmap *a,
+			     const struct island_bitmap *b)
+{
+	uint32_t i;
+
+	for (i = 0; i < island_bitmap_size; ++i)
+		a->bits[i] |= b->bits[i];
+}
+
+static int island_bitmap_is_subset(struct island_bitmap *self,
+				   struct island_bitmap *super)
+{
+	uint32_t i;
+
+	if (self == super)
+		return 1;
+
+	for (i = 0; i < island_bitmap_size; ++i) {
+		if ((self->bits[i] & super->bits[i]) != self->bits[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+static void island_bitmap_set(struct island_bitmap *self, uint32_t i)
+{
+	self->bits[ISLAND_BITMAP_BLOCK(i)] |= ISLAND_BITMAP_MASK(i);
+}
+
+static struct island_bitmap *get_island_marks(const struct object_id *oid)
+{
+	khiter_t pos;
+
+	if (!island_marks)
+		return NULL;
+	pos = kh_get_sha1(island_marks, oid->hash);
+	if (pos >= kh_end(island_marks))
+		return NULL;
+	return kh_value(island_marks, pos);
+}
+
+int in_same_island(const struct object_id *trg, const struct object_id *src)
+{
+	struct island_bitmap *trg_marks, *src_marks;
+
+	/* If we aren't using islands, assume everything goes together. */
+	if (!island_marks)
+		return 1;
+
+	/*
+	 * If the target is not in any island, it is not an important
+	 * object and can be a delta against anything.
+	 */
+	trg_marks = get_island_marks(trg);
+	if (!trg_marks)
+		return 1;
+
+	/* But nothing in an island may be a delta against such an object. */
+	src_marks = get_island_marks(src);
+	if (!src_marks)
+		return 0;
+
+	return island_bitmap_is_subset(trg_marks, src_marks);
+}
+
+int island_delta_cmp(const struct object_id *a, const struct object_id *b)
+{
+	struct island_bitmap *a_marks, *b_marks;
+
+	if (!island_marks)
+		return 0;
+
+	a_marks = get_island_marks(a);
+	b_marks = get_island_marks(b);
+
+	if (a_marks) {
+		if (!b_marks || !island_bitmap_is_subset(a_marks, b_marks))
+			return -1;
+	}
+	if (b_marks) {
+		if (!a_marks || !island_bitmap_is_subset(b_marks, a_marks))
+			return 1;
+	}
+
+	return 0;
+}
+
+static struct island_bitmap *create_or_get_island_marks(struct object *obj)
+{
+	khiter_t pos;
+	int hash_ret;
+
+	pos = kh_put_sha1(island_marks, obj->oid.hash, &hash_ret);
+	if (hash_ret)
+		kh_value(island_marks, pos) = island_bitmap_new(NULL);
+
+	return kh_value(island_marks, pos);
+}
+
+static void set_island_marks(struct object *obj, struct island_bitmap *marks)
+{
+	struct island_bitmap *b;
+	khiter_t pos;
+	int hash_ret;
+
+	pos = kh_put_sha1(island_marks, obj->oid.hash, &hash_ret);
+	if (hash_ret) {
+		/* We don't have one yet; share the marks we were given. */
+		marks->refcount++;
+		kh_value(island_marks, pos) = marks;
+		return;
+	}
+
+	/* Split a shared bitmap before adding to it. */
+	b = kh_value(island_marks, pos);
+	if (b == marks)
+		return;
+	if (b->refcount > 1) {
+		b->refcount--;
+		b = kh_value(island_marks, pos) = island_bitmap_new(b);
+	}
+	island_bitmap_or(b, marks);
+}
+
+static void mark_remote_island(struct oid_array *tips)
+{
+	int i;
+
+	for (i = 0; i < tips->nr; i++) {
+		struct island_bitmap *marks;
+		struct object *obj = parse_object(&tips->oid[i]);
+
+		if (!obj)
+			continue;
+
+		marks = create_or_get_island_marks(obj);
+		island_bitmap_set(marks, island_counter);
+
+		/* Tags belong to the island of what they point at, too. */
+		while (obj && obj->type == OBJ_TAG) {
+			obj = ((struct tag *)obj)->tagged;
+			if (obj) {
+				parse_object(&obj->oid);
+				marks = create_or_get_island_marks(obj);
+				island_bitmap_set(marks, island_counter);
+			}
+		}
+	}
+
+	island_counter++;
+}
+
+struct tree_islands_todo {
+	struct object_entry *entry;
+	unsigned int depth;
+};
+
+static int tree_depth_compare(const void *a, const void *b)
+{
+	const struct tree_islands_todo *todo_a = a;
+	const struct tree_islands_todo *todo_b = b;
+
+	return todo_a->depth - todo_b->depth;
+}
+
+void resolve_tree_islands(int progress, struct packing_data *to_pack)
+{
+	struct progress *progress_state = NULL;
+	struct tree_islands_todo *todo;
+	int nr = 0;
+	int i;
+
+	if (!island_marks)
+		return;
+
+	/*
+	 * Commits and tags have already been handled and passed their
+	 * marks on to the root trees.  Handle the trees from the root
+	 * down, so that the marks of a subtree reached through several
+	 * parents are complete before it passes them on.
+	 */
+	ALLOC_ARRAY(todo, to_pack->nr_objects);
+	for (i = 0; i < to_pack->nr_objects; i++) {
+		if (to_pack->objects[i].type == OBJ_TREE) {
+			todo[nr].entry = &to_pack->objects[i];
+			todo[nr].depth = to_pack->objects[i].tree_depth;
+			nr++;
+		}
+	}
+	QSORT(todo, nr, tree_depth_compare);
+
+	if (progress)
+		progress_state = start_progress(_("Propagating island marks"), nr);
+
+	for (i = 0; i < nr; i++) {
+		struct object_entry *ent = todo[i].entry;
+		struct island_bitmap *root_marks;
+		struct tree *tree;
+		struct tree_desc desc;
+		struct name_entry entry;
+
+		root_marks = get_island_marks(&ent->idx.oid);
+		if (!root_marks)
+			continue;
+
+		tree = lookup_tree(&ent->idx.oid);
+		if (!tree || parse_tree(tree) < 0)
+			die(_("bad tree object %s"), oid_to_hex(&ent->idx.oid));
+
+		init_tree_desc(&desc, tree->buffer, tree->size);
+		while (tree_entry(&desc, &entry)) {
+			struct object *obj;
+
+			if (S_ISGITLINK(entry.mode))
+				continue;
+
+			obj = lookup_object(entry.oid->hash);
+			if (!obj)
+				continue;
+
+			set_island_marks(obj, root_marks);
+		}
+
+		free_tree_buffer(tree);
+
+		display_progress(progress_state, i + 1);
+	}
+
+	stop_progress(&progress_state);
+	free(todo);
+}
+
+static int island_config_callback(const char *k, const char *v, void *cb)
+{
+	if (!strcmp(k, "pack.island")) {
+		struct strbuf re = STRBUF_INIT;
+
+		if (!v)
+			return config_error_nonbool(k);
+
+		ALLOC_GROW(island_regexes, island_regexes_nr + 1, island_regexes_alloc);
+
+		if (*v != '^')
+			strbuf_addch(&re, '^');
+		strbuf_addstr(&re, v);
+
+		if (regcomp(&island_regexes[island_regexes_nr], re.buf, REG_EXTENDED))
+			die(_("failed to load island regex for '%s': %s"), k, re.buf);
+
+		strbuf_release(&re);
+		island_regexes_nr++;
+		return 0;
+	}
+
+	return 0;
+}
+
+static void add_ref_to_island(const char *island_name, const struct object_id *oid)
+{
+	struct string_list_item *item;
+
+	item = string_list_insert(&remote_islands, island_name);
+	if (!item->util)
+		item->util = xcalloc(1, sizeof(struct oid_array));
+
+	oid_array_append(item->util, oid);
+}
+
+static int find_island_for_ref(const char *refname, const struct object_id *oid,
+			       int flags, void *data)
+{
+	/*
+	 * One more slot than the capture groups we support, so that
+	 * we can tell when a regex has too many.
+	 */
+	regmatch_t matches[16];
+	int i, m;
+	struct strbuf island_name = STRBUF_INIT;
+
+	/* walk backwards to get last-one-wins ordering */
+	for (i = island_regexes_nr - 1; i >= 0; i--) {
+		if (!regexec(&island_regexes[i], refname,
+			     ARRAY_SIZE(matches), matches, 0))
+			break;
+	}
+
+	if (i < 0)
+		return 0;
+
+	if (matches[ARRAY_SIZE(matches) - 1].rm_so != -1)
+		warning(_("island regex from config has "
+			  "too many capture groups (max=%d)"),
+			(int)ARRAY_SIZE(matches) - 2);
+
+	for (m = 1; m < ARRAY_SIZE(matches); m++) {
+		regmatch_t *match = &matches[m];
+
+		if (match->rm_so == -1)
+			continue;
+
+		if (island_name.len)
+			strbuf_addch(&island_name, '-');
+
+		strbuf_add(&island_name, refname + match->rm_so,
+			   match->rm_eo - match->rm_so);
+	}
+
+	add_ref_to_island(island_name.buf, oid);
+	strbuf_release(&island_name);
+	return 0;
+}
+
+void load_delta_islands(int progress)
+{
+	int i;
+
+	island_marks = kh_init_sha1();
+
+	git_config(island_config_callback, NULL);
+	for_each_ref(find_island_for_ref, NULL);
+
+	island_bitmap_size = (remote_islands.nr >> 5) + 1;
+	for (i = 0; i < remote_islands.nr; i++) {
+		struct oid_array *tips = remote_islands.items[i].util;
+
+		mark_remote_island(tips);
+		oid_array_clear(tips);
+	}
+	string_list_clear(&remote_islands, 1);
+
+	for (i = 0; i < island_regexes_nr; i++)
+		regfree(&island_regexes[i]);
+	FREE_AND_NULL(island_regexes);
+	island_regexes_nr = island_regexes_alloc = 0;
+
+	if (progress)
+		fprintf(stderr, _("Marked %d islands, done.\n"), island_counter);
+}
+
+void propagate_island_marks(struct commit *commit)
+{
+	struct island_bitmap *root_marks = get_island_marks(&commit->object.oid);
+	struct commit_list *p;
+
+	if (!root_marks)
+		return;
+
+	parse_commit(commit);
+	set_island_marks(&commit->tree->object, root_marks);
+	for (p = commit->parents; p; p = p->next)
+		set_island_marks(&p->item->object, root_marks);
+}
@@ -0,0 +1,49 @@
+#ifndef DELTA_ISLANDS_H
+#define DELTA_ISLANDS_H
+
+struct commit;
+struct object_id;
+struct packing_data;
+
+/*
+ * Delta islands group the refs of a repository (by the "pack.island"
+ * regexes) so that pack-objects never makes an object a delta against
+ * a base that is missing from one of the islands the object belongs
+ * to.  A pack served for any one island can then be reused verbatim.
+ */
+
+/*
+ * Read "pack.island" from the config and mark the ref tips with the
+ * island they belong to.  Must be called before the traversal.
+ */
+extern void load_delta_islands(int progress);
+
+/*
+ * Pass the islands of "commit" on to its root tree and its parents.
+ * Commits must be shown in topological order for this to reach every
+ * commit.
+ */
+extern void propagate_island_marks(struct commit *commit);
+
+/*
+ * Pass the islands of the trees in "to_pack" on to their entries,
+ * once the traversal is done.
+ */
+extern void resolve_tree_islands(int progress, struct packing_data *to_pack);
+
+/*
+ * Return 1 if "src" is in every island "trg" is in, so that "trg" may
+ * be stored as a delta against it.
+ */
+extern int in_same_island(const struct object_id *trg,
+			  const struct object_id *src);
+
+/*
+ * Sort objects in more islands before those they could be deltas
+ * against; returns 0 when neither is in a subset of the other's
+ * islands.
+ */
+extern int island_delta_cmp(const struct object_id *a,
+			    const struct object_id *b);
+
+#endif
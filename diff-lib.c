@@ -13,6 +13,7 @@
 #include "submodule.h"
 #include "dir.h"
 #include "fsmonitor.h"
+#include "sparse-index.h"
 
 /*
  * diff-files
@@ -492,6 +493,18 @@ static int diff_cache(struct rev_info *revs,
 	if (!tree)
 		return error("bad tree object %s",
 			     tree_name ? tree_name : oid_to_hex(tree_oid));
+
+	/*
+	 * A cached diff skips the sparse directories whose tree is
+	 * unchanged by way of the cache-tree; anything else needs to
+	 * look at the paths below them.
+	 */
+	if (the_index.sparse_index &&
+	    (!cached || revs->diffopt.flags.find_copies_harder ||
+	     revs->prune_data.nr ||
+	     !sparse_dirs_match_tree(&the_index, &tree->object.oid)))
+		ensure_full_index(&the_index);
+
 	memset(&opts, 0, sizeof(opts));
 	opts.head_idx = 1;
 	opts.index_only = cached;
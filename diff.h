@@ -17,6 +17,7 @@ struct userdiff_driver;
 struct oid_array;
 struct commit;
 struct combine_diff_path;
+struct rename_cache;
 
 typedef int (*pathchange_fn_t)(struct diff_options *options,
 		 struct combine_diff_path *path);
@@ -152,6 +153,8 @@ struct diff_options {
 	int needed_rename_limit;
 	int degraded_cc_to_c;
 	int show_rename_progress;
+	/* earlier rename detection results to reuse, see below */
+	struct rename_cache *rename_cache;
 	int dirstat_permille;
 	int setup;
 	int abbrev;
@@ -334,6 +337,21 @@ extern void diff_setup_done(struct diff_options *);
 extern void diffcore_std(struct diff_options *);
 extern void diffcore_fix_diff_index(struct diff_options *);
 
+/*
+ * A cache for the rename detection of diffcore, for when it is run
+ * over and over on mostly the same files, like it is by each of the
+ * merges of a sequencer replaying commits on the same upstream.  It
+ * keeps the renames found, to be reused when the very same sources
+ * and destinations are to be paired up with the same options again,
+ * and what was learned about the contents of each blob that had to be
+ * compared with others, so that the blobs do not need to be read and
+ * compared from scratch when some of the files differ.  Only files
+ * whose object names are known benefit from it, and only the renames
+ * (not copies) found are kept.
+ */
+extern struct rename_cache *rename_cache_new(void);
+extern void rename_cache_free(struct rename_cache *cache);
+
 #define COMMON_DIFF_OPTIONS_HELP \
 "\ncommon diff options:\n" \
 "  -z            output diff-raw with lines terminated with NUL.\n" \
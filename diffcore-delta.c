@@ -162,6 +162,24 @@ static struct spanhash_top *hash_chars(struct diff_filespec *one)
 	return hash;
 }
 
+void diffcore_fill_count_data(struct diff_filespec *one)
+{
+	if (!one->cnt_data)
+		one->cnt_data = hash_chars(one);
+}
+
+void *diffcore_copy_count_data(const void *cnt_data)
+{
+	const struct spanhash_top *top = cnt_data;
+	size_t size = st_add(sizeof(*top),
+			     st_mult(sizeof(struct spanhash),
+				     1 << top->alloc_log2));
+	void *copy = xmalloc(size);
+
+	memcpy(copy, top, size);
+	return copy;
+}
+
 int diffcore_count_changes(struct diff_filespec *src,
 			   struct diff_filespec *dst,
 			   void **src_count_p,
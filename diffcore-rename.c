@@ -6,6 +6,14 @@
 #include "diffcore.h"
 #include "hashmap.h"
 #include "progress.h"
+#include "config.h"
+#include "string-list.h"
+#include "oidmap.h"
+#include "userdiff.h"
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#include "thread-utils.h"
+#endif
 
 /* Table of rename/copy destinations */
 
@@ -105,6 +113,23 @@ static struct diff_rename_src *register_rename_src(struct diff_filepair *p)
 	return &(rename_src[first]);
 }
 
+static int find_rename_src(const char *path)
+{
+	int first = 0, last = rename_src_nr;
+
+	while (last > first) {
+		int next = (last + first) >> 1;
+		int cmp = strcmp(path, rename_src[next].p->one->path);
+		if (!cmp)
+			return next;
+		if (cmp < 0)
+			last = next;
+		else
+			first = next + 1;
+	}
+	return -1;
+}
+
 static int basename_same(struct diff_filespec *src, struct diff_filespec *dst)
 {
 	int src_len = strlen(src->path), dst_len = strlen(dst->path);
@@ -127,6 +152,27 @@ struct diff_score {
 	short name_score;
 };
 
+static int size_too_different(struct diff_filespec *src,
+			      struct diff_filespec *dst,
+			      int minimum_score)
+{
+	unsigned long max_size, delta_size, base_size;
+
+	max_size = ((src->size > dst->size) ? src->size : dst->size);
+	base_size = ((src->size < dst->size) ? src->size : dst->size);
+	delta_size = max_size - base_size;
+
+	/* We would not consider edits that change the file size so
+	 * drastically.  delta_size must be smaller than
+	 * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
+	 *
+	 * Note that base_size == 0 case is handled here already
+	 * and the final score computation below would not have a
+	 * divide-by-zero issue.
+	 */
+	return max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE;
+}
+
 static int estimate_similarity(struct diff_filespec *src,
 			       struct diff_filespec *dst,
 			       int minimum_score)
@@ -144,7 +190,7 @@ static int estimate_similarity(struct diff_filespec *src,
 	 * match than anything else; the destination does not even
 	 * call into this function in that case.
 	 */
-	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
+	unsigned long max_size, src_copied, literal_added;
 	int score;
 
 	/* We deal only with regular files.  Symlink renames are handled
@@ -155,39 +201,14 @@ static int estimate_similarity(struct diff_filespec *src,
 		return 0;
 
 	/*
-	 * Need to check that source and destination sizes are
-	 * filled in before comparing them.
-	 *
-	 * If we already have "cnt_data" filled in, we know it's
-	 * all good (avoid checking the size for zero, as that
-	 * is a possible size - we really should have a flag to
-	 * say whether the size is valid or not!)
+	 * prepare_rename_matrix() filled in the "cnt_data" of every file
+	 * that is worth comparing with another one, so that we do not
+	 * have to read anything here and can be run on several threads.
 	 */
-	if (!src->cnt_data &&
-	    diff_populate_filespec(src, CHECK_SIZE_ONLY))
-		return 0;
-	if (!dst->cnt_data &&
-	    diff_populate_filespec(dst, CHECK_SIZE_ONLY))
+	if (!src->cnt_data || !dst->cnt_data)
 		return 0;
 
-	max_size = ((src->size > dst->size) ? src->size : dst->size);
-	base_size = ((src->size < dst->size) ? src->size : dst->size);
-	delta_size = max_size - base_size;
-
-	/* We would not consider edits that change the file size so
-	 * drastically.  delta_size must be smaller than
-	 * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
-	 *
-	 * Note that base_size == 0 case is handled here already
-	 * and the final score computation below would not have a
-	 * divide-by-zero issue.
-	 */
-	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
-		return 0;
-
-	if (!src->cnt_data && diff_populate_filespec(src, 0))
-		return 0;
-	if (!dst->cnt_data && diff_populate_filespec(dst, 0))
+	if (size_too_different(src, dst, minimum_score))
 		return 0;
 
 	if (diffcore_count_changes(src, dst,
@@ -198,6 +219,7 @@ static int estimate_similarity(struct diff_filespec *src,
 	/* How similar are they?
 	 * what percentage of material in dst are from source?
 	 */
+	max_size = ((src->size > dst->size) ? src->size : dst->size);
 	if (!dst->size)
 		score = 0; /* should not happen */
 	else
@@ -386,6 +408,12 @@ static int too_many_rename_candidates(int num_create,
 
 	options->needed_rename_limit = 0;
 
+	/* Unless we look for copies, the sources already used are out */
+	if (options->detect_rename != DIFF_DETECT_COPY)
+		for (num_src = i = 0; i < rename_src_nr; i++)
+			if (!rename_src[i].p->one->rename_used)
+				num_src++;
+
 	/*
 	 * This basically does a test for the rename matrix not
 	 * growing larger than a "rename_limit" square matrix, ie:
@@ -440,16 +468,608 @@ static int find_renames(struct diff_score *mx, int dst_cnt, int minimum_score, i
 	return count;
 }
 
+struct rename_cache {
+	struct oidmap renames;
+	struct oidmap count_data;
+};
+
+/* The cache of the diffcore_rename() running, if any */
+static struct rename_cache *active_rename_cache;
+
+struct count_data_entry {
+	struct oidmap_entry entry;
+	void *cnt_data;
+};
+
+/*
+ * The "cnt_data" depends on whether the file is binary, which only
+ * the contents decide unless the attributes say otherwise.
+ */
+static int count_data_cacheable(struct diff_filespec *one)
+{
+	struct userdiff_driver *driver;
+
+	if (!active_rename_cache || !one->oid_valid)
+		return 0;
+	driver = userdiff_find_by_path(one->path);
+	return !driver || driver->binary == -1;
+}
+
+static void fill_count_data(struct diff_filespec *one)
+{
+	struct count_data_entry *e;
+	int cacheable;
+
+	if (one->cnt_data)
+		return;
+	cacheable = count_data_cacheable(one);
+	if (cacheable &&
+	    (e = oidmap_get(&active_rename_cache->count_data, &one->oid))) {
+		one->cnt_data = diffcore_copy_count_data(e->cnt_data);
+		return;
+	}
+
+	if (diff_populate_filespec(one, 0))
+		return;
+	diffcore_fill_count_data(one);
+	diff_free_filespec_blob(one);
+
+	if (cacheable) {
+		e = xmalloc(sizeof(*e));
+		oidcpy(&e->entry.oid, &one->oid);
+		e->cnt_data = diffcore_copy_count_data(one->cnt_data);
+		oidmap_put(&active_rename_cache->count_data, e);
+	}
+}
+
+static int has_size(struct diff_filespec *one)
+{
+	return S_ISREG(one->mode) &&
+		(one->cnt_data || !diff_populate_filespec(one, CHECK_SIZE_ONLY));
+}
+
+/*
+ * Is the source out of the running for the destinations left?  The
+ * unmodified ones are when "-C -C" was degraded to "-C", and unless
+ * we look for copies, so are the ones that were already used.
+ */
+static int skip_rename_src(int j, int skip_unmodified, int skip_used)
+{
+	struct diff_filepair *p = rename_src[j].p;
+
+	return (skip_unmodified && diff_unmodified_pair(p)) ||
+		(skip_used && p->one->rename_used);
+}
+
+/*
+ * Fill in the sizes, and then the "cnt_data", of the sources and of the
+ * destinations left to match, so that scoring the matrix does not read
+ * anything.  Only the files that are close enough in size to a file on
+ * the other side are read, and each of them only once.
+ */
+static void prepare_rename_matrix(const int *dst_rows, int dst_cnt,
+				  int minimum_score, int skip_unmodified,
+				  int skip_used)
+{
+	unsigned char *src_state, *dst_state;
+	int i, j;
+#define HAS_SIZE 1
+#define WANTED 2
+
+	src_state = xcalloc(rename_src_nr, 1);
+	dst_state = xcalloc(dst_cnt, 1);
+	for (j = 0; j < rename_src_nr; j++) {
+		if (skip_rename_src(j, skip_unmodified, skip_used))
+			continue;
+		if (has_size(rename_src[j].p->one))
+			src_state[j] = HAS_SIZE;
+	}
+	for (i = 0; i < dst_cnt; i++)
+		if (has_size(rename_dst[dst_rows[i]].two))
+			dst_state[i] = HAS_SIZE;
+
+	for (i = 0; i < dst_cnt; i++) {
+		struct diff_filespec *two = rename_dst[dst_rows[i]].two;
+
+		if (!dst_state[i])
+			continue;
+		for (j = 0; j < rename_src_nr; j++) {
+			if (!src_state[j] ||
+			    size_too_different(rename_src[j].p->one, two,
+					       minimum_score))
+				continue;
+			src_state[j] |= WANTED;
+			dst_state[i] |= WANTED;
+		}
+	}
+
+	for (j = 0; j < rename_src_nr; j++)
+		if (src_state[j] & WANTED)
+			fill_count_data(rename_src[j].p->one);
+	for (i = 0; i < dst_cnt; i++)
+		if (dst_state[i] & WANTED)
+			fill_count_data(rename_dst[dst_rows[i]].two);
+#undef HAS_SIZE
+#undef WANTED
+	free(src_state);
+	free(dst_state);
+}
+
+static const char *get_basename(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+/*
+ * Record the rename if the pair is similar enough; used for the pairs
+ * that the paths alone make likely, before the matrix is scored.  As
+ * the source then never gets compared against the other destinations,
+ * demand a score halfway between minimum_score and MAX_SCORE, so that
+ * a better match elsewhere is not lost to a mediocre one here.
+ */
+static int try_rename_pair(int dst_index, int src_index, int minimum_score)
+{
+	struct diff_filespec *one = rename_src[src_index].p->one;
+	struct diff_filespec *two = rename_dst[dst_index].two;
+	int score;
+
+	minimum_score += (MAX_SCORE - minimum_score) / 2;
+
+	if (!has_size(one) || !has_size(two) ||
+	    size_too_different(one, two, minimum_score))
+		return 0;
+	fill_count_data(one);
+	fill_count_data(two);
+	score = estimate_similarity(one, two, minimum_score);
+	if (score < minimum_score)
+		return 0;
+	record_rename_pair(dst_index, src_index, score);
+	return 1;
+}
+
+/*
+ * Can the source be paired by path alone?  A broken pair would only be
+ * joined back together, which is not for us to decide.
+ */
+static int guessable_rename_src(int j)
+{
+	struct diff_filepair *p = rename_src[j].p;
+	return !p->one->rename_used && !p->broken_pair;
+}
+
+static int basename_run_end(struct string_list *list, int i)
+{
+	int end = i + 1;
+
+	while (end < list->nr &&
+	       !strcmp(list->items[end].string, list->items[i].string))
+		end++;
+	return end;
+}
+
+/*
+ * Pair up the sources and destinations left that are the only ones of
+ * their basename on each side, when they are similar enough: a file
+ * moved to another directory is far more common than one taking the
+ * name of another file that went away.
+ */
+static int find_basename_renames(int minimum_score)
+{
+	struct string_list srcs = STRING_LIST_INIT_NODUP;
+	struct string_list dsts = STRING_LIST_INIT_NODUP;
+	int i, j, src_end, dst_end, renames = 0;
+
+	for (i = 0; i < rename_src_nr; i++)
+		if (guessable_rename_src(i))
+			string_list_append(&srcs,
+				get_basename(rename_src[i].p->one->path))->util =
+				(void *)(intptr_t)i;
+	for (i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].pair)
+			string_list_append(&dsts,
+				get_basename(rename_dst[i].two->path))->util =
+				(void *)(intptr_t)i;
+	string_list_sort(&srcs);
+	string_list_sort(&dsts);
+
+	/*
+	 * Walk the runs of each basename on both sides in step; the end
+	 * of a run is only looked for once we reach it, so that a long
+	 * run on one side is not scanned again for every run on the other.
+	 */
+	i = j = 0;
+	src_end = srcs.nr ? basename_run_end(&srcs, 0) : 0;
+	dst_end = dsts.nr ? basename_run_end(&dsts, 0) : 0;
+	while (i < srcs.nr && j < dsts.nr) {
+		int cmp = strcmp(srcs.items[i].string, dsts.items[j].string);
+
+		if (!cmp && src_end == i + 1 && dst_end == j + 1)
+			renames += try_rename_pair((intptr_t)dsts.items[j].util,
+						   (intptr_t)srcs.items[i].util,
+						   minimum_score);
+		if (cmp <= 0) {
+			i = src_end;
+			if (i < srcs.nr)
+				src_end = basename_run_end(&srcs, i);
+		}
+		if (cmp >= 0) {
+			j = dst_end;
+			if (j < dsts.nr)
+				dst_end = basename_run_end(&dsts, j);
+		}
+	}
+	string_list_clear(&srcs, 0);
+	string_list_clear(&dsts, 0);
+	return renames;
+}
+
+/*
+ * Guess from the renames found so far where each directory went: the
+ * one most of its moved files went to, if there is such a one.  The
+ * result is keyed by the new directory, with the old one as util, or
+ * NULL when several directories seem to have moved there.  Directory
+ * names keep their trailing slash; the top-level one is "".
+ */
+static void guess_dir_renames(struct string_list *dir_renames)
+{
+	struct string_list counts = STRING_LIST_INIT_DUP;
+	struct strbuf old_dir = STRBUF_INIT, new_dir = STRBUF_INIT;
+	int i, j;
+
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filepair *pair = rename_dst[i].pair;
+		struct string_list_item *item;
+		struct string_list *targets;
+
+		if (!pair)
+			continue;
+		strbuf_reset(&old_dir);
+		strbuf_add(&old_dir, pair->one->path,
+			   get_basename(pair->one->path) - pair->one->path);
+		strbuf_reset(&new_dir);
+		strbuf_add(&new_dir, pair->two->path,
+			   get_basename(pair->two->path) - pair->two->path);
+		if (!strcmp(old_dir.buf, new_dir.buf))
+			continue;
+
+		item = string_list_insert(&counts, old_dir.buf);
+		if (!item->util) {
+			targets = xmalloc(sizeof(*targets));
+			string_list_init(targets, 1);
+			item->util = targets;
+		}
+		item = string_list_insert(item->util, new_dir.buf);
+		item->util = (void *)((intptr_t)item->util + 1);
+	}
+
+	for (i = 0; i < counts.nr; i++) {
+		struct string_list *targets = counts.items[i].util;
+		struct string_list_item *best = NULL, *item;
+		int tie = 0;
+
+		for (j = 0; j < targets->nr; j++) {
+			intptr_t count = (intptr_t)targets->items[j].util;
+
+			if (!best || count > (intptr_t)best->util) {
+				best = &targets->items[j];
+				tie = 0;
+			} else if (count == (intptr_t)best->util) {
+				tie = 1;
+			}
+		}
+		if (!tie) {
+			item = string_list_lookup(dir_renames, best->string);
+			if (item) {
+				FREE_AND_NULL(item->util);
+			} else {
+				item = string_list_insert(dir_renames,
+							  best->string);
+				item->util = xstrdup(counts.items[i].string);
+			}
+		}
+		string_list_clear(targets, 0);
+		free(targets);
+	}
+	string_list_clear(&counts, 0);
+	strbuf_release(&old_dir);
+	strbuf_release(&new_dir);
+}
+
+/*
+ * Pair the destinations left with the source of the same name in the
+ * directory that seems to have moved to theirs, which is what tells
+ * apart the many files of a moved tree that share their basenames with
+ * files elsewhere.
+ */
+static int find_dir_guided_renames(int minimum_score)
+{
+	struct string_list dir_renames = STRING_LIST_INIT_DUP;
+	struct strbuf path = STRBUF_INIT;
+	int i, renames = 0;
+
+	guess_dir_renames(&dir_renames);
+	for (i = 0; dir_renames.nr && i < rename_dst_nr; i++) {
+		const char *name = get_basename(rename_dst[i].two->path);
+		struct string_list_item *item;
+		int src;
+
+		if (rename_dst[i].pair)
+			continue;
+		strbuf_reset(&path);
+		strbuf_add(&path, rename_dst[i].two->path,
+			   name - rename_dst[i].two->path);
+		item = string_list_lookup(&dir_renames, path.buf);
+		if (!item || !item->util)
+			continue;
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s%s", (char *)item->util, name);
+		src = find_rename_src(path.buf);
+		if (src < 0 || !guessable_rename_src(src))
+			continue;
+		renames += try_rename_pair(i, src, minimum_score);
+	}
+	string_list_clear(&dir_renames, 1);
+	strbuf_release(&path);
+	return renames;
+}
+
+struct rename_matrix {
+	struct diff_score *mx;
+	const int *dst_rows;
+	int dst_cnt;
+	int minimum_score;
+	int skip_unmodified;
+	int skip_used;
+	struct progress *progress;
+	uint64_t rows_done;
+};
+
+/* Fill in the best candidates for a row of the matrix */
+static void score_dst(struct rename_matrix *rm, int row)
+{
+	struct diff_score *m = &rm->mx[row * NUM_CANDIDATE_PER_DST];
+	int i = rm->dst_rows[row], j;
+	struct diff_filespec *two = rename_dst[i].two;
+
+	for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+		m[j].dst = -1;
+
+	for (j = 0; j < rename_src_nr; j++) {
+		struct diff_filespec *one = rename_src[j].p->one;
+		struct diff_score this_src;
+
+		if (skip_rename_src(j, rm->skip_unmodified, rm->skip_used))
+			continue;
+
+		this_src.score = estimate_similarity(one, two,
+						     rm->minimum_score);
+		this_src.name_score = basename_same(one, two);
+		this_src.dst = i;
+		this_src.src = j;
+		record_if_better(m, &this_src);
+	}
+}
+
+#ifndef NO_PTHREADS
+static pthread_mutex_t progress_mutex;
+
+struct score_thread_data {
+	pthread_t thread;
+	struct rename_matrix *rm;
+	int first, step;
+};
+
+static void *score_thread(void *data)
+{
+	struct score_thread_data *t = data;
+	struct rename_matrix *rm = t->rm;
+	int row;
+
+	for (row = t->first; row < rm->dst_cnt; row += t->step) {
+		score_dst(rm, row);
+		pthread_mutex_lock(&progress_mutex);
+		rm->rows_done++;
+		display_progress(rm->progress, rm->rows_done * rename_src_nr);
+		pthread_mutex_unlock(&progress_mutex);
+	}
+	return NULL;
+}
+#endif
+
+/*
+ * diff.renameThreads, or one thread per CPU; matrices too small to be
+ * worth starting threads for are scored on this one unless the
+ * configuration asks otherwise.
+ */
+static int rename_threads(int dst_cnt)
+{
+	int nr_threads;
+
+	if (git_config_get_int("diff.renamethreads", &nr_threads)) {
+		if ((uint64_t)dst_cnt * rename_src_nr < 10000)
+			return 1;
+		nr_threads = 0;
+	}
+	if (nr_threads <= 0)
+		nr_threads = online_cpus();
+	if (nr_threads > dst_cnt)
+		nr_threads = dst_cnt;
+	return nr_threads;
+}
+
+static void score_rename_matrix(struct rename_matrix *rm)
+{
+	int row;
+#ifndef NO_PTHREADS
+	int nr_threads = rename_threads(rm->dst_cnt);
+
+	if (nr_threads > 1) {
+		struct score_thread_data *threads;
+		int i;
+
+		pthread_mutex_init(&progress_mutex, NULL);
+		ALLOC_ARRAY(threads, nr_threads);
+		for (i = 0; i < nr_threads; i++) {
+			threads[i].rm = rm;
+			threads[i].first = i;
+			threads[i].step = nr_threads;
+			if (pthread_create(&threads[i].thread, NULL,
+					   score_thread, &threads[i]))
+				die(_("unable to create thread"));
+		}
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_join(threads[i].thread, NULL))
+				die(_("unable to join thread"));
+		free(threads);
+		pthread_mutex_destroy(&progress_mutex);
+		return;
+	}
+#endif
+	for (row = 0; row < rm->dst_cnt; row++) {
+		score_dst(rm, row);
+		display_progress(rm->progress,
+				 (uint64_t)(row + 1) * rename_src_nr);
+	}
+}
+
+struct cached_rename {
+	int dst, src;
+	int score;
+};
+
+struct rename_cache_entry {
+	struct oidmap_entry entry;
+	struct cached_rename *renames;
+	int nr;
+	int needed_rename_limit;
+};
+
+struct rename_cache *rename_cache_new(void)
+{
+	struct rename_cache *cache = xmalloc(sizeof(*cache));
+	oidmap_init(&cache->renames, 0);
+	oidmap_init(&cache->count_data, 0);
+	return cache;
+}
+
+void rename_cache_free(struct rename_cache *cache)
+{
+	struct oidmap_iter iter;
+	struct rename_cache_entry *e;
+	struct count_data_entry *c;
+
+	if (!cache)
+		return;
+	oidmap_iter_init(&cache->renames, &iter);
+	while ((e = oidmap_iter_next(&iter)))
+		free(e->renames);
+	oidmap_free(&cache->renames, 1);
+	oidmap_iter_init(&cache->count_data, &iter);
+	while ((c = oidmap_iter_next(&iter)))
+		free(c->cnt_data);
+	oidmap_free(&cache->count_data, 1);
+	free(cache);
+}
+
+static void hash_filespec_name(git_SHA_CTX *ctx, struct diff_filespec *one)
+{
+	git_SHA1_Update(ctx, one->path, strlen(one->path) + 1);
+	git_SHA1_Update(ctx, one->oid.hash, GIT_SHA1_RAWSZ);
+	git_SHA1_Update(ctx, &one->mode, sizeof(one->mode));
+}
+
+/*
+ * Name the rename detection about to be done by what it depends on:
+ * the options and the sources and destinations, which are sorted by
+ * path.  Returns -1 if it cannot be cached.
+ */
+static int rename_cache_key(struct diff_options *options, int minimum_score,
+			    struct object_id *key)
+{
+	git_SHA_CTX ctx;
+	int i, params[4];
+
+	if (options->detect_rename != DIFF_DETECT_RENAME)
+		return -1;
+	for (i = 0; i < rename_src_nr; i++)
+		if (!rename_src[i].p->one->oid_valid)
+			return -1;
+	for (i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].two->oid_valid)
+			return -1;
+
+	git_SHA1_Init(&ctx);
+	params[0] = minimum_score;
+	params[1] = options->rename_limit;
+	params[2] = rename_src_nr;
+	params[3] = rename_dst_nr;
+	git_SHA1_Update(&ctx, params, sizeof(params));
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filepair *p = rename_src[i].p;
+
+		hash_filespec_name(&ctx, p->one);
+		params[0] = rename_src[i].score;
+		params[1] = p->broken_pair;
+		params[2] = p->one->rename_used;
+		git_SHA1_Update(&ctx, params, 3 * sizeof(*params));
+	}
+	for (i = 0; i < rename_dst_nr; i++)
+		hash_filespec_name(&ctx, rename_dst[i].two);
+	git_SHA1_Final(key->hash, &ctx);
+	return 0;
+}
+
+static int reuse_cached_renames(struct diff_options *options,
+				const struct object_id *key)
+{
+	struct rename_cache_entry *e = oidmap_get(&options->rename_cache->renames,
+						  key);
+	int i;
+
+	if (!e)
+		return 0;
+	for (i = 0; i < e->nr; i++)
+		record_rename_pair(e->renames[i].dst, e->renames[i].src,
+				   e->renames[i].score);
+	options->needed_rename_limit = e->needed_rename_limit;
+	return 1;
+}
+
+static void cache_renames(struct diff_options *options,
+			  const struct object_id *key)
+{
+	struct rename_cache_entry *e = xcalloc(1, sizeof(*e));
+	int i, alloc = 0;
+
+	oidcpy(&e->entry.oid, key);
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filepair *pair = rename_dst[i].pair;
+
+		if (!pair)
+			continue;
+		ALLOC_GROW(e->renames, e->nr + 1, alloc);
+		e->renames[e->nr].dst = i;
+		e->renames[e->nr].src = find_rename_src(pair->one->path);
+		e->renames[e->nr].score = pair->score;
+		e->nr++;
+	}
+	e->needed_rename_limit = options->needed_rename_limit;
+	oidmap_put(&options->rename_cache->renames, e);
+}
+
 void diffcore_rename(struct diff_options *options)
 {
 	int detect_rename = options->detect_rename;
 	int minimum_score = options->rename_score;
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
-	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
+	struct rename_matrix rm;
+	struct object_id cache_key;
+	int cache_result = 0;
+	int *dst_rows;
+	int i, rename_count, skip_unmodified = 0, skip_used = 0;
 	int num_create, dst_cnt;
-	struct progress *progress = NULL;
 
 	if (!minimum_score)
 		minimum_score = DEFAULT_RENAME_SCORE;
@@ -499,6 +1119,14 @@ void diffcore_rename(struct diff_options *options)
 	if (rename_dst_nr == 0 || rename_src_nr == 0)
 		goto cleanup; /* nothing to do */
 
+	active_rename_cache = options->rename_cache;
+	if (options->rename_cache &&
+	    !rename_cache_key(options, minimum_score, &cache_key)) {
+		if (reuse_cached_renames(options, &cache_key))
+			goto cleanup;
+		cache_result = 1;
+	}
+
 	/*
 	 * We really want to cull the candidates list early
 	 * with cheap tests in order to avoid doing deltas.
@@ -509,9 +1137,20 @@ void diffcore_rename(struct diff_options *options)
 	if (minimum_score == MAX_SCORE)
 		goto cleanup;
 
+	/*
+	 * Unless we look for copies, a source goes to one destination
+	 * only, so before comparing everything with everything, pair
+	 * the files whose paths make it obvious where they went.
+	 */
+	if (detect_rename != DIFF_DETECT_COPY) {
+		skip_used = 1;
+		rename_count += find_basename_renames(minimum_score);
+		rename_count += find_dir_guided_renames(minimum_score);
+	}
+
 	/*
 	 * Calculate how many renames are left (but all the source
-	 * files still remain as options for rename/copies!)
+	 * files still remain as options for copies!)
 	 */
 	num_create = (rename_dst_nr - rename_count);
 
@@ -530,59 +1169,42 @@ void diffcore_rename(struct diff_options *options)
 		break;
 	}
 
+	ALLOC_ARRAY(dst_rows, num_create);
+	for (dst_cnt = i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].pair)
+			dst_rows[dst_cnt++] = i; /* not dealt with as an exact match */
+	prepare_rename_matrix(dst_rows, dst_cnt, minimum_score,
+			      skip_unmodified, skip_used);
+
+	memset(&rm, 0, sizeof(rm));
+	rm.mx = xcalloc(st_mult(NUM_CANDIDATE_PER_DST, num_create), sizeof(*rm.mx));
+	rm.dst_rows = dst_rows;
+	rm.dst_cnt = dst_cnt;
+	rm.minimum_score = minimum_score;
+	rm.skip_unmodified = skip_unmodified;
+	rm.skip_used = skip_used;
 	if (options->show_rename_progress) {
-		progress = start_delayed_progress(
+		rm.progress = start_delayed_progress(
 				_("Performing inexact rename detection"),
-				(uint64_t)rename_dst_nr * (uint64_t)rename_src_nr);
+				(uint64_t)dst_cnt * (uint64_t)rename_src_nr);
 	}
-
-	mx = xcalloc(st_mult(NUM_CANDIDATE_PER_DST, num_create), sizeof(*mx));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
-		if (rename_dst[i].pair)
-			continue; /* dealt with exact match already. */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(one, two,
-							     minimum_score);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
-		}
-		dst_cnt++;
-		display_progress(progress, (uint64_t)(i+1)*(uint64_t)rename_src_nr);
-	}
-	stop_progress(&progress);
+	score_rename_matrix(&rm);
+	stop_progress(&rm.progress);
+	free(dst_rows);
 
 	/* cost matrix sorted by most to least similar pair */
-	QSORT(mx, dst_cnt * NUM_CANDIDATE_PER_DST, score_compare);
+	QSORT(rm.mx, dst_cnt * NUM_CANDIDATE_PER_DST, score_compare);
 
-	rename_count += find_renames(mx, dst_cnt, minimum_score, 0);
+	rename_count += find_renames(rm.mx, dst_cnt, minimum_score, 0);
 	if (detect_rename == DIFF_DETECT_COPY)
-		rename_count += find_renames(mx, dst_cnt, minimum_score, 1);
-	free(mx);
+		rename_count += find_renames(rm.mx, dst_cnt, minimum_score, 1);
+	free(rm.mx);
 
  cleanup:
+	if (cache_result)
+		cache_renames(options, &cache_key);
+	active_rename_cache = NULL;
+
 	/* At this point, we have found some renames and copies and they
 	 * are recorded in rename_dst.  The original list is still in *q.
 	 */
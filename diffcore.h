@@ -138,6 +138,12 @@ void diff_debug_queue(const char *, struct diff_queue_struct *);
 #define diff_debug_queue(a,b) do { /* nothing */ } while (0)
 #endif
 
+/*
+ * Compute the "cnt_data" of a populated filespec, if it does not have
+ * one yet, so that diffcore_count_changes() does not need its contents.
+ */
+extern void diffcore_fill_count_data(struct diff_filespec *one);
+extern void *diffcore_copy_count_data(const void *cnt_data);
 extern int diffcore_count_changes(struct diff_filespec *src,
 				  struct diff_filespec *dst,
 				  void **src_count_p,
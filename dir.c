@@ -19,6 +19,7 @@
 #include "varint.h"
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
+#include "sparse-index.h"
 
 /*
  * Tells read_directory_recursive how a file or directory should be treated.
@@ -626,6 +627,220 @@ void parse_exclude_pattern(const char **pattern,
 	*patternlen = len;
 }
 
+/*
+ * An entry in the hashmaps of a cone-mode exclude_list: a directory
+ * name without leading or trailing slash.
+ */
+struct cone_dir_entry {
+	struct hashmap_entry ent;
+	size_t len;
+	char path[FLEX_ARRAY];
+};
+
+static int cone_dir_entry_cmp(const void *unused_cmp_data,
+			      const void *entry, const void *entry_or_key,
+			      const void *keydata)
+{
+	const struct cone_dir_entry *e1 = entry, *e2 = entry_or_key;
+	const char *path = keydata ? keydata : e2->path;
+
+	return e1->len != e2->len || fspathncmp(e1->path, path, e1->len);
+}
+
+static unsigned int cone_dir_hash(const char *path, size_t len)
+{
+	return ignore_case ? memihash(path, len) : memhash(path, len);
+}
+
+static int cone_dir_contains(struct hashmap *map, const char *path, size_t len)
+{
+	struct cone_dir_entry key;
+
+	if (!map->tablesize)
+		return 0;
+	hashmap_entry_init(&key, cone_dir_hash(path, len));
+	key.len = len;
+	return !!hashmap_get(map, &key, path);
+}
+
+static void cone_dir_add(struct hashmap *map, const char *path, size_t len)
+{
+	struct cone_dir_entry *e;
+
+	FLEX_ALLOC_MEM(e, path, path, len);
+	e->len = len;
+	hashmap_entry_init(e, cone_dir_hash(path, len));
+	hashmap_add(map, e);
+}
+
+static void cone_dir_remove(struct hashmap *map, const char *path, size_t len)
+{
+	struct cone_dir_entry key;
+
+	hashmap_entry_init(&key, cone_dir_hash(path, len));
+	key.len = len;
+	free(hashmap_remove(map, &key, path));
+}
+
+static void disable_cone_patterns(struct exclude_list *el)
+{
+	hashmap_free(&el->recursive_hashmap, 1);
+	hashmap_free(&el->parent_hashmap, 1);
+	el->use_cone_patterns = 0;
+	el->full_cone = 0;
+}
+
+/*
+ * Cone patterns (see "Sparse checkout" in git-read-tree(1)) consist of
+ * a slash and an asterisk to match everything, optionally followed by
+ * the same pattern negated for directories only, to leave just the
+ * top-level files; then "/dir/" to include everything below "dir",
+ * which may be narrowed down to the files directly in "dir" by
+ * following it with "!/dir/" plus an asterisk and a slash.  Record
+ * "x" in the hashmaps, or give up on cone matching if it is anything
+ * else.
+ */
+static void add_exclude_to_hashsets(struct exclude_list *el, struct exclude *x)
+{
+	struct strbuf dir = STRBUF_INIT;
+	const char *p = x->pattern, *end = x->pattern + x->patternlen;
+	int negative = x->flags & EXC_FLAG_NEGATIVE;
+
+	if (!el->use_cone_patterns)
+		return;
+	if (!el->recursive_hashmap.tablesize) {
+		hashmap_init(&el->recursive_hashmap, cone_dir_entry_cmp, NULL, 0);
+		hashmap_init(&el->parent_hashmap, cone_dir_entry_cmp, NULL, 0);
+	}
+
+	if (x->patternlen == 2 && !strncmp(p, "/*", 2)) {
+		if (!x->flags) {
+			el->full_cone = 1;
+			return;
+		}
+		if (x->flags == (EXC_FLAG_NEGATIVE | EXC_FLAG_MUSTBEDIR)) {
+			el->full_cone = 0;
+			return;
+		}
+	}
+
+	if (x->patternlen < 2 || *p != '/' || !(x->flags & EXC_FLAG_MUSTBEDIR))
+		goto not_cone;
+	if (negative) {
+		if (x->patternlen < 4 || strncmp(end - 2, "/*", 2))
+			goto not_cone;
+		end -= 2;
+	}
+
+	/* drop the leading slash and unescape; no wildcards allowed */
+	for (p++; p < end; p++) {
+		if (*p == '\\' && p + 1 < end)
+			p++;
+		else if (is_glob_special(*p))
+			goto not_cone;
+		strbuf_addch(&dir, *p);
+	}
+	if (!dir.len || dir.buf[dir.len - 1] == '/')
+		goto not_cone;
+
+	if (negative) {
+		/* narrows a preceding "/dir/" */
+		if (!cone_dir_contains(&el->recursive_hashmap, dir.buf, dir.len))
+			goto not_cone;
+		cone_dir_remove(&el->recursive_hashmap, dir.buf, dir.len);
+		cone_dir_add(&el->parent_hashmap, dir.buf, dir.len);
+	} else {
+		if (cone_dir_contains(&el->parent_hashmap, dir.buf, dir.len))
+			goto not_cone;
+		if (!cone_dir_contains(&el->recursive_hashmap, dir.buf, dir.len))
+			cone_dir_add(&el->recursive_hashmap, dir.buf, dir.len);
+	}
+	strbuf_release(&dir);
+	return;
+
+not_cone:
+	warning(_("unrecognized pattern: '%s%s%s'"), negative ? "!" : "",
+		x->pattern, x->flags & EXC_FLAG_MUSTBEDIR ? "/" : "");
+	warning(_("disabling cone pattern matching"));
+	strbuf_release(&dir);
+	disable_cone_patterns(el);
+}
+
+/*
+ * Every directory in the cone must have its parent directory listed
+ * with its immediate files, otherwise there would be no way to get
+ * from the top level down to it.
+ */
+static void verify_cone_shape(struct exclude_list *el)
+{
+	struct hashmap *maps[] = { &el->recursive_hashmap, &el->parent_hashmap };
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(maps); i++) {
+		struct hashmap_iter iter;
+		struct cone_dir_entry *e;
+
+		hashmap_iter_init(maps[i], &iter);
+		while ((e = hashmap_iter_next(&iter))) {
+			size_t len = e->len;
+
+			while (len && e->path[len - 1] != '/')
+				len--;
+			if (!len ||
+			    cone_dir_contains(&el->parent_hashmap, e->path,
+					      len - 1))
+				continue;
+			warning(_("the parent directory of '%s' is not in the cone"),
+				e->path);
+			warning(_("disabling cone pattern matching"));
+			disable_cone_patterns(el);
+			return;
+		}
+	}
+}
+
+/* Is any leading directory of "path" included recursively? */
+static int in_recursive_cone_dir(const char *path, int len,
+				 struct exclude_list *el)
+{
+	const char *slash;
+
+	for (slash = path; (slash = memchr(slash, '/', path + len - slash)); slash++)
+		if (cone_dir_contains(&el->recursive_hashmap, path, slash - path))
+			return 1;
+	return 0;
+}
+
+/*
+ * Match a path against cone patterns: every file at the top level,
+ * every file directly in a "parent" directory, and everything below
+ * a "recursive" directory is included.
+ */
+static int cone_path_match(const char *pathname, int pathlen,
+			   struct exclude_list *el)
+{
+	int len = pathlen;
+
+	if (el->full_cone || in_recursive_cone_dir(pathname, pathlen, el))
+		return 1;
+	while (len && pathname[len - 1] != '/')
+		len--;
+	if (!len)
+		return 1;
+	return cone_dir_contains(&el->parent_hashmap, pathname, len - 1);
+}
+
+int is_dir_in_cone(const char *dirname, int len, struct exclude_list *el)
+{
+	if (el->full_cone ||
+	    cone_dir_contains(&el->recursive_hashmap, dirname, len) ||
+	    in_recursive_cone_dir(dirname, len, el))
+		return 1;
+	if (cone_dir_contains(&el->parent_hashmap, dirname, len))
+		return -1;
+	return 0;
+}
+
 void add_exclude(const char *string, const char *base,
 		 int baselen, struct exclude_list *el, int srcpos)
 {
@@ -650,6 +865,7 @@ void add_exclude(const char *string, const char *base,
 	ALLOC_GROW(el->excludes, el->nr + 1, el->alloc);
 	el->excludes[el->nr++] = x;
 	x->el = el;
+	add_exclude_to_hashsets(el, x);
 }
 
 static int read_skip_worktree_file_from_index(const struct index_state *istate,
@@ -682,6 +898,7 @@ void clear_exclude_list(struct exclude_list *el)
 		free(el->excludes[i]);
 	free(el->excludes);
 	free(el->filebuf);
+	disable_cone_patterns(el);
 
 	memset(el, 0, sizeof(*el));
 }
@@ -885,6 +1102,8 @@ static int add_excludes_from_buffer(char *buf, size_t size,
 			entry = buf + i + 1;
 		}
 	}
+	if (el->use_cone_patterns)
+		verify_cone_shape(el);
 	return 0;
 }
 
@@ -1096,6 +1315,9 @@ int is_excluded_from_list(const char *pathname,
 			  struct exclude_list *el, struct index_state *istate)
 {
 	struct exclude *exclude;
+
+	if (el->use_cone_patterns)
+		return cone_path_match(pathname, pathlen, el);
 	exclude = last_exclude_matching_from_list(pathname, pathlen, basename,
 						  dtype, el, istate);
 	if (exclude)
@@ -1387,6 +1609,22 @@ static enum exist_status directory_exists_in_index(struct index_state *istate,
 {
 	int pos;
 
+	/*
+	 * A directory that is collapsed into a sparse directory entry
+	 * but still exists in the working tree has to be compared
+	 * path by path.
+	 */
+	if (istate->sparse_index) {
+		struct strbuf sparse_dir = STRBUF_INIT;
+
+		strbuf_add(&sparse_dir, dirname, len);
+		strbuf_addch(&sparse_dir, '/');
+		pos = index_name_pos(istate, sparse_dir.buf, sparse_dir.len);
+		if (pos >= 0 && S_ISSPARSEDIR(istate->cache[pos]->ce_mode))
+			ensure_full_index(istate);
+		strbuf_release(&sparse_dir);
+	}
+
 	if (ignore_case)
 		return directory_exists_in_index_icase(istate, dirname, len);
 
@@ -3,6 +3,7 @@
 
 /* See Documentation/technical/api-directory-listing.txt */
 
+#include "hashmap.h"
 #include "strbuf.h"
 
 struct dir_entry {
@@ -54,6 +55,23 @@ struct exclude_list {
 	const char *src;
 
 	struct exclude **excludes;
+
+	/*
+	 * A sparse-checkout file restricted to "cone" patterns (see
+	 * core.sparseCheckoutCone) is matched by looking up leading
+	 * directories in these hashmaps instead of trying every
+	 * pattern in turn.  use_cone_patterns is set by the caller
+	 * before the patterns are added, and cleared again if they
+	 * turn out not to have the cone shape.
+	 */
+	unsigned use_cone_patterns : 1,
+		 full_cone : 1;
+
+	/* directories whose whole contents are included */
+	struct hashmap recursive_hashmap;
+
+	/* directories whose immediate files are included */
+	struct hashmap parent_hashmap;
 };
 
 /*
@@ -232,6 +250,15 @@ extern int is_excluded_from_list(const char *pathname, int pathlen,
 				 const char *basename, int *dtype,
 				 struct exclude_list *el,
 				 struct index_state *istate);
+
+/*
+ * For an exclude_list with use_cone_patterns, decide about a whole
+ * directory (given without a trailing slash): 1 if everything below
+ * it matches, 0 if nothing does, -1 if the entries below it have to
+ * be matched one by one.
+ */
+extern int is_dir_in_cone(const char *dirname, int len,
+			  struct exclude_list *el);
 struct dir_entry *dir_add_ignored(struct dir_struct *dir,
 				  struct index_state *istate,
 				  const char *pathname, int len);
@@ -0,0 +1,520 @@
+#include "cache.h"
+#include "config.h"
+#include "tempfile.h"
+#include "unix-socket.h"
+#include "parse-options.h"
+#include "string-list.h"
+#include "dir.h"
+#include "fsmonitor.h"
+#include <sys/inotify.h>
+
+#define WATCH_MASK (IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF | \
+		    IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO | \
+		    IN_ONLYDIR | IN_EXCL_UNLINK)
+
+/* how many changes to remember before forgetting the older half */
+#define JOURNAL_MAX 100000
+
+/*
+ * How long a client may wait for us to catch up with the kernel before
+ * we answer "/"; a loaded machine can easily take a second.
+ */
+#define COOKIE_TIMEOUT_MS 5000
+
+/*
+ * The change journal: every path in the working tree that we have
+ * seen change, with the time at which we learned about it.  The times
+ * are non-decreasing.  A client asking about changes from before
+ * journal_start (when we started watching, or last had to forget
+ * something) is told that everything may have changed.
+ */
+struct journal_entry {
+	uint64_t time;
+	char *path;
+};
+static struct journal_entry *journal;
+static int journal_nr, journal_alloc;
+static uint64_t journal_start;
+
+static int inotify_fd = -1;
+
+/*
+ * The directory watched by each inotify watch descriptor, relative to
+ * the top of the working tree and with a trailing slash ("" for the
+ * top-level directory itself).
+ */
+static char **watch_dirs;
+static int watch_dirs_alloc;
+static int root_wd = -1;
+
+/*
+ * We stay out of the working tree, so that removing it is not kept
+ * from going through (and we get to know about it and exit).
+ */
+static const char *worktree;
+
+static const char *worktree_path(const char *path)
+{
+	static struct strbuf buf = STRBUF_INIT;
+
+	strbuf_reset(&buf);
+	strbuf_addf(&buf, "%s/%s", worktree, path);
+	return buf.buf;
+}
+
+/* the cookie files we create to find out when we have caught up */
+static const char *cookie_dir;
+static int cookie_wd = -1;
+static struct strbuf cookie_name = STRBUF_INIT;
+static int cookie_seen;
+
+static void record_change(const char *path, uint64_t now)
+{
+	struct journal_entry *e;
+
+	if (journal_nr >= JOURNAL_MAX) {
+		int i, drop = journal_nr / 2;
+
+		for (i = 0; i < drop; i++)
+			free(journal[i].path);
+		journal_start = journal[drop - 1].time + 1;
+		journal_nr -= drop;
+		MOVE_ARRAY(journal, journal + drop, journal_nr);
+	}
+
+	ALLOC_GROW(journal, journal_nr + 1, journal_alloc);
+	e = &journal[journal_nr++];
+	e->time = now;
+	e->path = xstrdup(path);
+}
+
+static void forget_everything(uint64_t now)
+{
+	int i;
+
+	for (i = 0; i < journal_nr; i++)
+		free(journal[i].path);
+	journal_nr = 0;
+	journal_start = now;
+}
+
+static void set_watch_dir(int wd, const char *dir)
+{
+	if (wd >= watch_dirs_alloc) {
+		int old_alloc = watch_dirs_alloc;
+
+		ALLOC_GROW(watch_dirs, wd + 1, watch_dirs_alloc);
+		memset(watch_dirs + old_alloc, 0,
+		       (watch_dirs_alloc - old_alloc) * sizeof(*watch_dirs));
+	}
+	free(watch_dirs[wd]);
+	watch_dirs[wd] = xstrdup(dir);
+}
+
+/*
+ * Watch "dir" (empty, or ending in a slash) and everything below it,
+ * recording every path found on the way if "now" is non-zero, for a
+ * directory that appeared after its parent was already watched.
+ */
+static void add_watches(struct strbuf *dir, uint64_t now)
+{
+	size_t len = dir->len;
+	struct dirent *de;
+	DIR *d;
+	int wd;
+
+	wd = inotify_add_watch(inotify_fd, worktree_path(dir->buf), WATCH_MASK);
+	if (wd < 0) {
+		if (errno == ENOENT || errno == ENOTDIR)
+			return; /* gone already; its parent tells us */
+		die_errno(_("unable to watch '%s'"), worktree_path(dir->buf));
+	}
+	set_watch_dir(wd, dir->buf);
+	if (!len)
+		root_wd = wd;
+
+	d = opendir(worktree_path(dir->buf));
+	if (!d)
+		return;
+	while ((de = readdir(d)) != NULL) {
+		int is_dir;
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		if (!len && !strcmp(de->d_name, ".git"))
+			continue;
+
+		strbuf_addstr(dir, de->d_name);
+		if (now)
+			record_change(dir->buf, now);
+		is_dir = DTYPE(de) == DT_DIR;
+		if (DTYPE(de) == DT_UNKNOWN) {
+			struct stat st;
+			is_dir = !lstat(worktree_path(dir->buf), &st) &&
+				 S_ISDIR(st.st_mode);
+		}
+		if (is_dir) {
+			strbuf_addch(dir, '/');
+			add_watches(dir, now);
+		}
+		strbuf_setlen(dir, len);
+	}
+	closedir(d);
+}
+
+/*
+ * Start over: some events were lost, or a directory moved away and
+ * took its watches (and the paths we know them by) along with it.
+ */
+static void rewatch(uint64_t now)
+{
+	struct strbuf dir = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < watch_dirs_alloc; i++) {
+		if (!watch_dirs[i])
+			continue;
+		inotify_rm_watch(inotify_fd, i);
+		FREE_AND_NULL(watch_dirs[i]);
+	}
+	root_wd = -1;
+	forget_everything(now);
+	add_watches(&dir, 0);
+	strbuf_release(&dir);
+}
+
+/* Returns 0 when the working tree went away and we should exit. */
+static int handle_event(const struct inotify_event *ev, uint64_t now)
+{
+	struct strbuf path = STRBUF_INIT;
+	const char *dir;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		rewatch(now);
+		return 1;
+	}
+
+	if (ev->wd == cookie_wd) {
+		/*
+		 * Our socket is kept open, and with it the directories
+		 * leading to it; we may never hear that the working tree
+		 * is gone, but we hear about the socket.
+		 */
+		if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+			return 0;
+		if ((ev->mask & IN_DELETE) && ev->len && !strcmp(ev->name, "ipc"))
+			return 0;
+		if ((ev->mask & IN_CREATE) && ev->len &&
+		    !strcmp(ev->name, cookie_name.buf))
+			cookie_seen = 1;
+		return 1;
+	}
+
+	if (ev->wd < 0 || ev->wd >= watch_dirs_alloc || !watch_dirs[ev->wd])
+		return 1;
+	dir = watch_dirs[ev->wd];
+
+	if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+		if (ev->wd == root_wd)
+			return 0;
+		if (ev->mask & IN_IGNORED)
+			FREE_AND_NULL(watch_dirs[ev->wd]);
+		/* otherwise the parent directory tells us about it */
+		return 1;
+	}
+
+	if (!ev->len || (!*dir && !strcmp(ev->name, ".git")))
+		return 1;
+
+	strbuf_addf(&path, "%s%s", dir, ev->name);
+	record_change(path.buf, now);
+	if (ev->mask & IN_ISDIR) {
+		if (ev->mask & IN_MOVED_FROM)
+			rewatch(now);
+		else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+			strbuf_addch(&path, '/');
+			add_watches(&path, now);
+		}
+	}
+	strbuf_release(&path);
+	return 1;
+}
+
+/* Read all pending events; returns 0 when we should exit. */
+static int handle_events(void)
+{
+	union {
+		struct inotify_event ev;
+		char buf[16384];
+	} u;
+
+	for (;;) {
+		ssize_t len = read(inotify_fd, u.buf, sizeof(u.buf));
+		uint64_t now;
+		char *p;
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 1;
+			die_errno(_("unable to read inotify events"));
+		}
+		if (!len)
+			return 1;
+
+		now = getnanotime();
+		for (p = u.buf; p < u.buf + len; ) {
+			const struct inotify_event *ev = (void *)p;
+
+			if (!handle_event(ev, now))
+				return 0;
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+}
+
+/*
+ * The kernel may still have events queued for changes that happened
+ * before the client asked.  Create a cookie file and read events until
+ * we see it; everything before it has been recorded then.
+ */
+static int sync_with_cookie(void)
+{
+	static int cookie_nr;
+	struct strbuf path = STRBUF_INIT;
+	uint64_t deadline;
+	int fd, ret = -1;
+
+	strbuf_reset(&cookie_name);
+	strbuf_addf(&cookie_name, "cookie-%d", ++cookie_nr);
+	strbuf_addf(&path, "%s/%s", cookie_dir, cookie_name.buf);
+	cookie_seen = 0;
+
+	fd = open(path.buf, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		warning_errno(_("unable to create '%s'"), path.buf);
+		goto out;
+	}
+	close(fd);
+
+	deadline = getnanotime() + COOKIE_TIMEOUT_MS * 1000000ULL;
+	while (!cookie_seen) {
+		struct pollfd pfd;
+		uint64_t now = getnanotime();
+
+		if (now >= deadline)
+			break;
+		pfd.fd = inotify_fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, (deadline - now) / 1000000 + 1) < 0 &&
+		    errno != EINTR)
+			die_errno("poll failed");
+		if (!handle_events())
+			exit(0);
+	}
+	if (cookie_seen)
+		ret = 0;
+	unlink(path.buf);
+out:
+	strbuf_release(&path);
+	return ret;
+}
+
+/*
+ * Answer with the token the client should ask with next time,
+ * followed by the paths that changed since "since", or "/" if we
+ * cannot tell; all NUL-terminated.
+ */
+static void answer_query(FILE *out, uint64_t since)
+{
+	struct string_list paths = STRING_LIST_INIT_NODUP;
+	uint64_t token = getnanotime();
+	int i;
+
+	fprintf(out, "%"PRIuMAX, (uintmax_t)token);
+	fputc('\0', out);
+
+	if (sync_with_cookie() || since < journal_start) {
+		fputs("/", out);
+		fputc('\0', out);
+		return;
+	}
+
+	for (i = journal_nr - 1; i >= 0 && journal[i].time >= since; i--)
+		string_list_append(&paths, journal[i].path);
+	string_list_sort(&paths);
+	string_list_remove_duplicates(&paths, 0);
+	for (i = 0; i < paths.nr; i++) {
+		fputs(paths.items[i].string, out);
+		fputc('\0', out);
+	}
+	string_list_clear(&paths, 0);
+}
+
+static void serve_one_client(FILE *in, FILE *out)
+{
+	struct strbuf line = STRBUF_INIT;
+	const char *p;
+
+	if (strbuf_getline_lf(&line, in) == EOF)
+		; /* ignore */
+	else if (skip_prefix(line.buf, "query ", &p))
+		answer_query(out, strtoumax(p, NULL, 10));
+	else if (!strcmp(line.buf, "stop"))
+		/*
+		 * The atexit() handler removes the socket before the
+		 * client sees EOF, see credential-cache--daemon.
+		 */
+		exit(0);
+	else
+		warning("fsmonitor client sent unknown request: %s", line.buf);
+
+	strbuf_release(&line);
+}
+
+static int serve_loop(int fd)
+{
+	struct pollfd pfd[2];
+
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = inotify_fd;
+	pfd[1].events = POLLIN;
+	if (poll(pfd, 2, -1) < 0) {
+		if (errno != EINTR)
+			die_errno("poll failed");
+		return 1;
+	}
+
+	if ((pfd[1].revents & POLLIN) && !handle_events())
+		return 0;
+
+	if (pfd[0].revents & POLLIN) {
+		int client, client2;
+		FILE *in, *out;
+
+		client = accept(fd, NULL, NULL);
+		if (client < 0) {
+			warning_errno("accept failed");
+			return 1;
+		}
+		client2 = dup(client);
+		if (client2 < 0) {
+			warning_errno("dup failed");
+			close(client);
+			return 1;
+		}
+
+		in = xfdopen(client, "r");
+		out = xfdopen(client2, "w");
+		serve_one_client(in, out);
+		fclose(in);
+		fclose(out);
+	}
+	return 1;
+}
+
+static void serve(const char *socket_path, int debug)
+{
+	struct strbuf dir = STRBUF_INIT;
+	int fd;
+
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0)
+		die_errno(_("unable to initialize inotify"));
+
+	if (mkdir(cookie_dir, 0700) < 0 && errno != EEXIST)
+		die_errno(_("unable to mkdir '%s'"), cookie_dir);
+	cookie_wd = inotify_add_watch(inotify_fd, cookie_dir,
+				      IN_CREATE | IN_DELETE |
+				      IN_DELETE_SELF | IN_MOVE_SELF);
+	if (cookie_wd < 0)
+		die_errno(_("unable to watch '%s'"), cookie_dir);
+
+	journal_start = getnanotime();
+	add_watches(&dir, 0);
+	strbuf_release(&dir);
+
+	fd = unix_stream_listen(socket_path);
+	if (fd < 0)
+		die_errno("unable to bind to '%s'", socket_path);
+
+	printf("ok\n");
+	fclose(stdout);
+	if (!debug) {
+		if (!freopen("/dev/null", "w", stderr))
+			die_errno("unable to point stderr to /dev/null");
+	}
+
+	while (serve_loop(fd))
+		; /* nothing */
+
+	close(fd);
+}
+
+static int send_stop(const char *socket_path)
+{
+	char buf[1];
+	int fd = unix_stream_connect(socket_path);
+
+	if (fd < 0)
+		return error(_("fsmonitor--daemon is not running"));
+	write_or_die(fd, "stop\n", 5);
+	shutdown(fd, SHUT_WR);
+	/* wait for it to go away */
+	while (read_in_full(fd, buf, sizeof(buf)) > 0)
+		; /* nothing */
+	close(fd);
+	return 0;
+}
+
+int cmd_main(int argc, const char **argv)
+{
+	struct tempfile *socket_file;
+	const char *socket_path;
+	int stop = 0, debug = 0, fd;
+	static const char *usage[] = {
+		"git-fsmonitor--daemon [--debug | --stop]",
+		NULL
+	};
+	const struct option options[] = {
+		OPT_BOOL(0, "stop", &stop,
+			 N_("stop the daemon for this working tree")),
+		OPT_BOOL(0, "debug", &debug,
+			 N_("print debugging messages to stderr")),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, NULL, options, usage, 0);
+	if (argc)
+		usage_with_options(usage, options);
+
+	setup_git_directory();
+	if (is_bare_repository())
+		die(_("fsmonitor--daemon requires a working tree"));
+	git_config(git_default_config, NULL);
+
+	worktree = get_git_work_tree();
+	cookie_dir = absolute_pathdup(git_path(FSMONITOR_DAEMON_DIR));
+	socket_path = absolute_pathdup(git_path(FSMONITOR_DAEMON_DIR "/ipc"));
+
+	if (stop)
+		return !!send_stop(socket_path);
+
+	/* somebody else got there first */
+	fd = unix_stream_connect(socket_path);
+	if (fd >= 0) {
+		close(fd);
+		printf("ok\n");
+		return 0;
+	}
+
+	if (chdir("/"))
+		die_errno(_("unable to chdir to '/'"));
+	socket_file = register_tempfile(socket_path);
+	serve(socket_path, debug);
+	delete_tempfile(&socket_file);
+
+	return 0;
+}
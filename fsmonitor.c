@@ -5,6 +5,7 @@
 #include "fsmonitor.h"
 #include "run-command.h"
 #include "strbuf.h"
+#include "unix-socket.h"
 
 #define INDEX_EXTENSION_VERSION	(1)
 #define HOOK_INTERFACE_VERSION	(1)
@@ -116,6 +117,77 @@ static int query_fsmonitor(int version, uint64_t last_update, struct strbuf *que
 	return capture_command(&cp, query_result, 1024);
 }
 
+#ifdef HAVE_FSMONITOR_DAEMON
+static int send_daemon_query(const char *socket, uint64_t since,
+			     struct strbuf *answer)
+{
+	struct strbuf request = STRBUF_INIT;
+	int fd = unix_stream_connect(socket);
+
+	if (fd < 0)
+		return -1;
+	strbuf_addf(&request, "query %"PRIuMAX"\n", (uintmax_t)since);
+	if (write_in_full(fd, request.buf, request.len) < 0 ||
+	    shutdown(fd, SHUT_WR) < 0 ||
+	    strbuf_read(answer, fd, 0) < 0) {
+		close(fd);
+		strbuf_release(&request);
+		return error_errno(_("unable to talk to fsmonitor--daemon"));
+	}
+	close(fd);
+	strbuf_release(&request);
+	return 0;
+}
+
+static int spawn_daemon(void)
+{
+	struct child_process daemon = CHILD_PROCESS_INIT;
+	const char *argv[] = { "git-fsmonitor--daemon", NULL };
+	char buf[128];
+	int r;
+
+	daemon.argv = argv;
+	daemon.no_stdin = 1;
+	daemon.out = -1;
+
+	if (start_command(&daemon))
+		return error(_("unable to start fsmonitor--daemon"));
+	r = read_in_full(daemon.out, buf, sizeof(buf));
+	close(daemon.out);
+	if (r != 3 || memcmp(buf, "ok\n", 3))
+		return error(_("fsmonitor--daemon did not start"));
+	return 0;
+}
+
+/*
+ * Ask the built-in daemon, starting it if needed, what changed since
+ * "since".  The answer starts with the token to use for the next
+ * query, which replaces *last_update; the rest is in the format the
+ * hook uses.
+ */
+static int query_fsmonitor_daemon(uint64_t since, uint64_t *last_update,
+				  struct strbuf *query_result)
+{
+	char *socket = git_pathdup(FSMONITOR_DAEMON_DIR "/ipc");
+	const char *token_end;
+	int ret = send_daemon_query(socket, since, query_result);
+
+	if (ret < 0 && (errno == ENOENT || errno == ECONNREFUSED) &&
+	    !spawn_daemon())
+		ret = send_daemon_query(socket, since, query_result);
+	free(socket);
+	if (ret < 0)
+		return -1;
+
+	token_end = memchr(query_result->buf, '\0', query_result->len);
+	if (!token_end || token_end == query_result->buf)
+		return error(_("bad answer from fsmonitor--daemon"));
+	*last_update = strtoumax(query_result->buf, NULL, 10);
+	strbuf_remove(query_result, 0, token_end - query_result->buf + 1);
+	return 0;
+}
+#endif
+
 static void fsmonitor_refresh_callback(struct index_state *istate, const char *name)
 {
 	int pos = index_name_pos(istate, name, strlen(name));
@@ -159,6 +231,17 @@ void refresh_fsmonitor(struct index_state *istate)
 	 * changes since that time, else assume everything is possibly dirty
 	 * and check it all.
 	 */
+#ifdef HAVE_FSMONITOR_DAEMON
+	if (core_use_builtin_fsmonitor) {
+		uint64_t start = last_update;
+
+		query_success = !query_fsmonitor_daemon(istate->fsmonitor_last_update,
+							&last_update, &query_result);
+		trace_performance_since(start, "fsmonitor--daemon query");
+		trace_printf_key(&trace_fsmonitor, "fsmonitor--daemon returned %s",
+			query_success ? "success" : "failure");
+	} else
+#endif
 	if (istate->fsmonitor_last_update) {
 		query_success = !query_fsmonitor(HOOK_INTERFACE_VERSION,
 			istate->fsmonitor_last_update, &query_result);
@@ -181,6 +264,9 @@ void refresh_fsmonitor(struct index_state *istate)
 		if (bol < query_result.len)
 			fsmonitor_refresh_callback(istate, buf + bol);
 	} else {
+		if (query_success)
+			trace_printf_key(&trace_fsmonitor,
+					 "fsmonitor invalidated all entries");
 		/* Mark all entries invalid */
 		for (i = 0; i < istate->cache_nr; i++)
 			istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
@@ -3,6 +3,13 @@
 
 extern struct trace_key trace_fsmonitor;
 
+/*
+ * The directory in $GIT_DIR where the built-in fsmonitor daemon keeps
+ * its socket ("ipc") and the cookie files it uses to synchronize with
+ * the kernel.
+ */
+#define FSMONITOR_DAEMON_DIR "fsmonitor--daemon"
+
 /*
  * Read the fsmonitor index extension and (if configured) restore the
  * CE_FSMONITOR_VALID state.
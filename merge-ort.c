@@ -0,0 +1,934 @@
+/*
+ * A three-way merge of trees that does not use the index or the
+ * working tree.
+ *
+ * The three trees are walked together, and any directory that only one
+ * side changed (or that both sides changed the same way) is taken whole
+ * without being read.  Every other path gets an entry in a list sorted
+ * by path, which is resolved in place; renames that the other side
+ * cares about are detected first, so that their destinations are walked
+ * rather than taken whole.  The merged blobs and trees are written to
+ * the object store, and the conflicts are returned in a list instead of
+ * being recorded in the index.
+ */
+#include "cache.h"
+#include "merge-ort.h"
+#include "commit.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "blob.h"
+#include "xdiff-interface.h"
+#include "ll-merge.h"
+#include "submodule.h"
+#include "string-list.h"
+
+/*
+ * A path of the merge: a file, or a directory taken whole from one side,
+ * in which case its path ends with a slash.
+ */
+struct merge_entry {
+	/* the files at this path in the merge base, side1 and side2 */
+	struct merge_version stages[3];
+	/* where the stages come from, if not from this path (renames) */
+	const char *stage_paths[3];
+	struct merge_version result;
+	unsigned resolved:1;
+};
+
+/* A rename on one side whose source the other side changed */
+struct merge_rename {
+	char *src, *dst;
+	struct merge_version base, renamed;
+	int side;
+	unsigned processed:1;
+};
+
+struct merge_state {
+	struct merge_options *opt;
+	struct merge_result *result;
+	struct tree *trees[3];
+
+	/* path -> struct merge_entry, sorted once the trees are walked */
+	struct string_list paths;
+
+	/* leading directories of rename destinations, walked rather than taken */
+	struct string_list expand_dirs;
+
+	struct merge_rename *renames;
+	int renames_nr, renames_alloc;
+	/* source path -> index in renames, for the renames of side2 */
+	struct string_list side2_renames;
+};
+
+static const char *side_label(struct merge_state *state, int side)
+{
+	switch (side) {
+	case 0:
+		return state->opt->ancestor;
+	case 1:
+		return state->opt->branch1;
+	default:
+		return state->opt->branch2;
+	}
+}
+
+static int same_version(const struct merge_version *a,
+			const struct merge_version *b)
+{
+	return a->mode == b->mode && (!a->mode || !oidcmp(&a->oid, &b->oid));
+}
+
+static void version_from_entry(struct merge_version *v,
+			       const struct name_entry *n)
+{
+	if (n->oid) {
+		oidcpy(&v->oid, n->oid);
+		v->mode = n->mode;
+	} else {
+		oidclr(&v->oid);
+		v->mode = 0;
+	}
+}
+
+static struct merge_entry *find_entry(struct merge_state *state,
+				      const char *path)
+{
+	struct string_list_item *item = string_list_lookup(&state->paths, path);
+	return item ? item->util : NULL;
+}
+
+static void add_leading_dirs(struct string_list *dirs, const char *path)
+{
+	const char *slash;
+
+	for (slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+		char *dir = xmemdupz(path, slash - path);
+		string_list_append(dirs, dir);
+		free(dir);
+	}
+}
+
+__attribute__((format (printf, 5, 6)))
+static void add_conflict(struct merge_state *state,
+			 enum merge_conflict_type type,
+			 const char *path,
+			 const struct merge_version stages[3],
+			 const char *fmt, ...)
+{
+	struct merge_result *result = state->result;
+	struct merge_conflict *conflict;
+	struct strbuf msg = STRBUF_INIT;
+	va_list ap;
+
+	ALLOC_GROW(result->conflicts, result->conflicts_nr + 1,
+		   result->conflicts_alloc);
+	conflict = &result->conflicts[result->conflicts_nr++];
+	conflict->type = type;
+	conflict->path = xstrdup(path);
+	memcpy(conflict->stages, stages, sizeof(conflict->stages));
+
+	va_start(ap, fmt);
+	strbuf_vaddf(&msg, fmt, ap);
+	va_end(ap);
+	conflict->message = strbuf_detach(&msg, NULL);
+}
+
+static void add_flattened_path(struct strbuf *out, const char *s)
+{
+	size_t i = out->len;
+	strbuf_addstr(out, s);
+	for (; i < out->len; i++)
+		if (out->buf[i] == '/')
+			out->buf[i] = '_';
+}
+
+/* A new path for a file that cannot stay where it is: "<path>~<branch>" */
+static char *unique_path(struct merge_state *state, const char *path,
+			 const char *branch)
+{
+	struct strbuf newpath = STRBUF_INIT;
+	int suffix = 0;
+	size_t base_len;
+
+	strbuf_addf(&newpath, "%s~", path);
+	add_flattened_path(&newpath, branch);
+	base_len = newpath.len;
+	while (string_list_has_string(&state->paths, newpath.buf)) {
+		strbuf_setlen(&newpath, base_len);
+		strbuf_addf(&newpath, "_%d", suffix++);
+	}
+	return strbuf_detach(&newpath, NULL);
+}
+
+static struct merge_entry *add_resolved_entry(struct merge_state *state,
+					      const char *path,
+					      const struct merge_version *v)
+{
+	struct merge_entry *entry = xcalloc(1, sizeof(*entry));
+
+	entry->result = *v;
+	entry->resolved = 1;
+	string_list_insert(&state->paths, path)->util = entry;
+	return entry;
+}
+
+/*
+ * Finding the renames
+ */
+
+static void detect_renames(struct merge_state *state, int side)
+{
+	struct merge_options *opt = state->opt;
+	struct diff_options diff_opts;
+	int i, other = 3 - side;
+
+	diff_setup(&diff_opts);
+	diff_opts.flags.recursive = 1;
+	diff_opts.flags.rename_empty = 0;
+	diff_opts.detect_rename = DIFF_DETECT_RENAME;
+	diff_opts.rename_limit = opt->merge_rename_limit >= 0 ? opt->merge_rename_limit :
+				 opt->diff_rename_limit >= 0 ? opt->diff_rename_limit :
+				 1000;
+	diff_opts.rename_score = opt->rename_score;
+	diff_opts.show_rename_progress = opt->show_rename_progress;
+	diff_opts.rename_cache = opt->rename_cache;
+	diff_opts.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&diff_opts);
+	diff_tree_oid(&state->trees[0]->object.oid,
+		      &state->trees[side]->object.oid, "", &diff_opts);
+	diffcore_std(&diff_opts);
+	if (diff_opts.needed_rename_limit > opt->needed_rename_limit)
+		opt->needed_rename_limit = diff_opts.needed_rename_limit;
+
+	for (i = 0; i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *pair = diff_queued_diff.queue[i];
+		struct merge_version other_src;
+		struct merge_rename *re;
+
+		if (pair->status != 'R')
+			continue;
+
+		/*
+		 * If the other side left the source alone, the rename is
+		 * a deletion and an addition like any other.
+		 */
+		if (get_tree_entry(state->trees[other]->object.oid.hash,
+				   pair->one->path, other_src.oid.hash,
+				   &other_src.mode))
+			other_src.mode = 0;
+		if (other_src.mode == pair->one->mode &&
+		    !oidcmp(&other_src.oid, &pair->one->oid))
+			continue;
+
+		ALLOC_GROW(state->renames, state->renames_nr + 1,
+			   state->renames_alloc);
+		re = &state->renames[state->renames_nr++];
+		memset(re, 0, sizeof(*re));
+		re->src = xstrdup(pair->one->path);
+		re->dst = xstrdup(pair->two->path);
+		oidcpy(&re->base.oid, &pair->one->oid);
+		re->base.mode = pair->one->mode;
+		oidcpy(&re->renamed.oid, &pair->two->oid);
+		re->renamed.mode = pair->two->mode;
+		re->side = side;
+		add_leading_dirs(&state->expand_dirs, re->dst);
+	}
+	diff_flush(&diff_opts);
+}
+
+/*
+ * Walking the trees
+ */
+
+static int collect_merge_info(struct merge_state *state, const char *base,
+			      const struct object_id *oids[3]);
+
+static int collect_callback(int n, unsigned long mask, unsigned long dirmask,
+			    struct name_entry *names, struct traverse_info *info)
+{
+	struct merge_state *state = info->data;
+	struct merge_version v[3], files[3];
+	const struct merge_version *take = NULL;
+	struct strbuf path = STRBUF_INIT;
+	const struct name_entry *p;
+	int i, len, has_file = 0, ret = mask;
+
+	for (i = 0; i < 3; i++) {
+		version_from_entry(&v[i], &names[i]);
+		if (v[i].mode && !S_ISDIR(v[i].mode)) {
+			files[i] = v[i];
+			has_file = 1;
+		} else {
+			memset(&files[i], 0, sizeof(files[i]));
+		}
+	}
+
+	for (p = names; !p->oid; p++)
+		; /* at least one of them is there */
+	len = traverse_path_len(info, p);
+	strbuf_grow(&path, len);
+	make_traverse_path(path.buf, info, p);
+	strbuf_setlen(&path, len);
+
+	if (!dirmask || !string_list_has_string(&state->expand_dirs, path.buf)) {
+		if (same_version(&v[1], &v[2]))
+			take = &v[1];
+		else if (same_version(&v[0], &v[1]))
+			take = &v[2];
+		else if (same_version(&v[0], &v[2]))
+			take = &v[1];
+	}
+
+	if (take) {
+		struct merge_entry *entry;
+
+		if (!take->mode)
+			goto out; /* deleted */
+		if (S_ISDIR(take->mode))
+			strbuf_addch(&path, '/');
+		entry = xcalloc(1, sizeof(*entry));
+		memcpy(entry->stages, files, sizeof(files));
+		entry->result = *take;
+		entry->resolved = 1;
+		string_list_append(&state->paths, path.buf)->util = entry;
+		goto out;
+	}
+
+	if (dirmask) {
+		const struct object_id *oids[3];
+
+		for (i = 0; i < 3; i++)
+			oids[i] = (dirmask & (1ul << i)) ? names[i].oid : NULL;
+		if (collect_merge_info(state, path.buf, oids) < 0)
+			ret = -1;
+	}
+	if (has_file) {
+		struct merge_entry *entry = xcalloc(1, sizeof(*entry));
+		memcpy(entry->stages, files, sizeof(files));
+		string_list_append(&state->paths, path.buf)->util = entry;
+	}
+
+out:
+	strbuf_release(&path);
+	return ret;
+}
+
+static int collect_merge_info(struct merge_state *state, const char *base,
+			      const struct object_id *oids[3])
+{
+	struct tree_desc t[3];
+	void *buf[3];
+	struct traverse_info info;
+	int i, ret;
+
+	setup_traverse_info(&info, base);
+	info.fn = collect_callback;
+	info.data = state;
+
+	for (i = 0; i < 3; i++)
+		buf[i] = fill_tree_descriptor(t + i, oids[i]);
+	ret = traverse_trees(3, t, &info);
+	for (i = 0; i < 3; i++)
+		free(buf[i]);
+	return ret;
+}
+
+/*
+ * Resolving the paths
+ */
+
+static void process_renames(struct merge_state *state)
+{
+	int i;
+
+	for (i = 0; i < state->renames_nr; i++) {
+		struct merge_rename *re = &state->renames[i], *re2 = NULL;
+		int side = re->side, other = 3 - side;
+		struct merge_entry *src, *dst;
+
+		if (re->processed)
+			continue;
+		re->processed = 1;
+
+		if (side == 1) {
+			struct string_list_item *item =
+				string_list_lookup(&state->side2_renames, re->src);
+			if (item)
+				re2 = &state->renames[(intptr_t)item->util];
+		}
+
+		dst = find_entry(state, re->dst);
+		if (!dst)
+			die("BUG: no merge entry for rename destination %s", re->dst);
+		src = find_entry(state, re->src);
+
+		if (re2) {
+			struct merge_entry *dst2;
+
+			re2->processed = 1;
+			if (!strcmp(re->dst, re2->dst)) {
+				/* renamed the same way: merge the contents there */
+				dst->stages[0] = re->base;
+				dst->stage_paths[0] = re->src;
+				dst->resolved = 0;
+				continue;
+			}
+
+			dst2 = find_entry(state, re2->dst);
+			if (!dst2)
+				die("BUG: no merge entry for rename destination %s",
+				    re2->dst);
+			dst->result = re->renamed;
+			dst->resolved = 1;
+			dst2->result = re2->renamed;
+			dst2->resolved = 1;
+
+			memset(dst->stages, 0, sizeof(dst->stages));
+			dst->stages[0] = re->base;
+			dst->stages[1] = re->renamed;
+			add_conflict(state, MERGE_CONFLICT_RENAME_RENAME, re->dst,
+				     dst->stages,
+				     _("CONFLICT (rename/rename): Rename \"%s\"->\"%s\" in branch \"%s\" rename \"%s\"->\"%s\" in \"%s\""),
+				     re->src, re->dst, side_label(state, 1),
+				     re2->src, re2->dst, side_label(state, 2));
+			memset(dst2->stages, 0, sizeof(dst2->stages));
+			dst2->stages[0] = re2->base;
+			dst2->stages[2] = re2->renamed;
+			add_conflict(state, MERGE_CONFLICT_RENAME_RENAME, re2->dst,
+				     dst2->stages,
+				     _("CONFLICT (rename/rename): Rename \"%s\"->\"%s\" in branch \"%s\" rename \"%s\"->\"%s\" in \"%s\""),
+				     re->src, re->dst, side_label(state, 1),
+				     re2->src, re2->dst, side_label(state, 2));
+			continue;
+		}
+
+		if (!src || !src->stages[other].mode) {
+			dst->result = re->renamed;
+			dst->resolved = 1;
+			memset(dst->stages, 0, sizeof(dst->stages));
+			dst->stages[0] = re->base;
+			dst->stages[side] = re->renamed;
+			add_conflict(state, MERGE_CONFLICT_RENAME_DELETE, re->dst,
+				     dst->stages,
+				     _("CONFLICT (rename/delete): %s deleted in %s and renamed to %s in %s. Version %s of %s left in tree."),
+				     re->src, side_label(state, other),
+				     re->dst, side_label(state, side),
+				     side_label(state, side), re->dst);
+			continue;
+		}
+
+		if (dst->stages[other].mode) {
+			/* the other side added something where we renamed to */
+			char *new_path = unique_path(state, re->dst,
+						     side_label(state, other));
+			struct merge_version stages[3];
+
+			add_resolved_entry(state, new_path, &dst->stages[other]);
+			memset(stages, 0, sizeof(stages));
+			stages[other] = dst->stages[other];
+			add_conflict(state, MERGE_CONFLICT_RENAME_ADD, new_path,
+				     stages,
+				     _("CONFLICT (rename/add): Rename %s->%s in %s. %s added in %s; moved it to %s."),
+				     re->src, re->dst, side_label(state, side),
+				     re->dst, side_label(state, other), new_path);
+			free(new_path);
+			dst = find_entry(state, re->dst);
+		}
+
+		/* the other side modified the source: merge it into the destination */
+		dst->stages[0] = re->base;
+		dst->stage_paths[0] = re->src;
+		dst->stages[other] = src->stages[other];
+		dst->stage_paths[other] = re->src;
+		dst->resolved = 0;
+
+		memset(&src->result, 0, sizeof(src->result));
+		src->resolved = 1;
+	}
+}
+
+static int merge_3way(struct merge_state *state, const char *path,
+		      struct merge_entry *entry, mmbuffer_t *result_buf)
+{
+	struct merge_options *opt = state->opt;
+	mmfile_t orig, src1, src2;
+	struct ll_merge_options ll_opts = {0};
+	char *labels[3];
+	int i, merge_status, renamed = 0;
+
+	ll_opts.renormalize = opt->renormalize;
+	ll_opts.xdl_opts = opt->xdl_opts;
+
+	if (opt->call_depth) {
+		ll_opts.virtual_ancestor = 1;
+		ll_opts.variant = 0;
+	} else {
+		switch (opt->recursive_variant) {
+		case MERGE_RECURSIVE_OURS:
+			ll_opts.variant = XDL_MERGE_FAVOR_OURS;
+			break;
+		case MERGE_RECURSIVE_THEIRS:
+			ll_opts.variant = XDL_MERGE_FAVOR_THEIRS;
+			break;
+		default:
+			ll_opts.variant = 0;
+			break;
+		}
+	}
+
+	for (i = 0; i < 3; i++)
+		if (entry->stage_paths[i])
+			renamed = 1;
+	for (i = 0; i < 3; i++) {
+		const char *label = side_label(state, i);
+		if (!label)
+			labels[i] = NULL;
+		else if (renamed)
+			labels[i] = xstrfmt("%s:%s", label, entry->stage_paths[i] ?
+					    entry->stage_paths[i] : path);
+		else
+			labels[i] = xstrdup(label);
+	}
+
+	read_mmblob(&orig, &entry->stages[0].oid);
+	read_mmblob(&src1, &entry->stages[1].oid);
+	read_mmblob(&src2, &entry->stages[2].oid);
+
+	merge_status = ll_merge(result_buf, path, &orig, labels[0],
+				&src1, labels[1], &src2, labels[2], &ll_opts);
+
+	for (i = 0; i < 3; i++)
+		free(labels[i]);
+	free(orig.ptr);
+	free(src1.ptr);
+	free(src2.ptr);
+	return merge_status;
+}
+
+static int merge_contents(struct merge_state *state, const char *path,
+			  struct merge_entry *entry)
+{
+	struct merge_version *o = &entry->stages[0];
+	struct merge_version *a = &entry->stages[1];
+	struct merge_version *b = &entry->stages[2];
+	struct merge_version *result = &entry->result;
+	enum merge_conflict_type type = o->mode ? MERGE_CONFLICT_CONTENT :
+					MERGE_CONFLICT_ADD_ADD;
+	int clean = 1;
+
+	if ((S_IFMT & a->mode) != (S_IFMT & b->mode)) {
+		/* keep the regular file, if there is one */
+		int side = S_ISREG(a->mode) || !S_ISREG(b->mode) ? 1 : 2;
+
+		*result = entry->stages[side];
+		add_conflict(state, MERGE_CONFLICT_FILE_TYPE, path, entry->stages,
+			     _("CONFLICT (file type): %s has different types in %s and %s; keeping the one from %s"),
+			     path, side_label(state, 1), side_label(state, 2),
+			     side_label(state, side));
+		return 0;
+	}
+
+	if (a->mode == b->mode || a->mode == o->mode)
+		result->mode = b->mode;
+	else {
+		result->mode = a->mode;
+		if (b->mode != o->mode)
+			clean = 0;
+	}
+
+	if (!oidcmp(&a->oid, &b->oid) || !oidcmp(&a->oid, &o->oid))
+		oidcpy(&result->oid, &b->oid);
+	else if (!oidcmp(&b->oid, &o->oid))
+		oidcpy(&result->oid, &a->oid);
+	else if (S_ISREG(a->mode)) {
+		mmbuffer_t result_buf;
+		int merge_status;
+
+		merge_status = merge_3way(state, path, entry, &result_buf);
+		if (merge_status < 0 || !result_buf.ptr)
+			return error(_("failed to execute internal merge"));
+		if (write_sha1_file(result_buf.ptr, result_buf.size,
+				    blob_type, result->oid.hash)) {
+			free(result_buf.ptr);
+			return error(_("unable to add %s to database"), path);
+		}
+		free(result_buf.ptr);
+		if (merge_status)
+			clean = 0;
+	} else if (S_ISGITLINK(a->mode)) {
+		if (!merge_submodule(&result->oid, path, &o->oid, &a->oid,
+				     &b->oid, !state->opt->call_depth)) {
+			type = MERGE_CONFLICT_SUBMODULE;
+			clean = 0;
+		}
+	} else if (S_ISLNK(a->mode)) {
+		oidcpy(&result->oid, &a->oid);
+		clean = 0;
+	} else
+		die("BUG: unsupported object type in the tree");
+
+	if (clean)
+		return 0;
+	if (type == MERGE_CONFLICT_ADD_ADD)
+		add_conflict(state, type, path, entry->stages,
+			     _("CONFLICT (add/add): Merge conflict in %s"), path);
+	else if (type == MERGE_CONFLICT_SUBMODULE)
+		add_conflict(state, type, path, entry->stages,
+			     _("CONFLICT (submodule): Merge conflict in %s"), path);
+	else
+		add_conflict(state, type, path, entry->stages,
+			     _("CONFLICT (content): Merge conflict in %s"), path);
+	return 0;
+}
+
+static int process_entry(struct merge_state *state, const char *path,
+			 struct merge_entry *entry)
+{
+	struct merge_version *o = &entry->stages[0];
+	struct merge_version *a = &entry->stages[1];
+	struct merge_version *b = &entry->stages[2];
+
+	entry->resolved = 1;
+	if (same_version(a, b))
+		entry->result = *a;
+	else if (same_version(o, a))
+		entry->result = *b;
+	else if (same_version(o, b))
+		entry->result = *a;
+	else if (!a->mode || !b->mode) {
+		int side = a->mode ? 1 : 2;
+
+		entry->result = entry->stages[side];
+		add_conflict(state, MERGE_CONFLICT_MODIFY_DELETE, path,
+			     entry->stages,
+			     _("CONFLICT (modify/delete): %s deleted in %s and modified in %s. Version %s of %s left in tree."),
+			     path, side_label(state, 3 - side),
+			     side_label(state, side), side_label(state, side),
+			     path);
+	} else
+		return merge_contents(state, path, entry);
+	return 0;
+}
+
+/*
+ * A file cannot stay where the merge left a directory: move it aside
+ * to "<path>~<branch>".
+ */
+static void resolve_df_conflicts(struct merge_state *state)
+{
+	struct string_list dirs = STRING_LIST_INIT_DUP;
+	struct string_list moved = STRING_LIST_INIT_DUP;
+	int i, j;
+
+	for (i = 0; i < state->paths.nr; i++) {
+		struct merge_entry *entry = state->paths.items[i].util;
+		if (entry->result.mode)
+			add_leading_dirs(&dirs, state->paths.items[i].string);
+	}
+	string_list_sort(&dirs);
+	string_list_remove_duplicates(&dirs, 0);
+
+	for (i = 0; i < state->paths.nr; i++) {
+		const char *path = state->paths.items[i].string;
+		struct merge_entry *entry = state->paths.items[i].util;
+		int side;
+		char *new_path;
+
+		if (!entry->result.mode || S_ISDIR(entry->result.mode) ||
+		    !string_list_has_string(&dirs, path))
+			continue;
+
+		side = same_version(&entry->result, &entry->stages[2]) ? 2 : 1;
+		new_path = unique_path(state, path, side_label(state, side));
+		for (j = 0; j < state->result->conflicts_nr; j++) {
+			struct merge_conflict *c = &state->result->conflicts[j];
+			if (!strcmp(c->path, path)) {
+				free(c->path);
+				c->path = xstrdup(new_path);
+			}
+		}
+		add_conflict(state, MERGE_CONFLICT_DIRECTORY_FILE, new_path,
+			     entry->stages,
+			     _("CONFLICT (directory/file): There is a directory with name %s in %s. Adding %s as %s"),
+			     path, side_label(state, 3 - side), path, new_path);
+		string_list_append(&moved, new_path)->util = entry;
+		free(new_path);
+	}
+
+	for (i = 0; i < moved.nr; i++) {
+		struct merge_entry *entry = moved.items[i].util;
+		add_resolved_entry(state, moved.items[i].string, &entry->result);
+		memset(&entry->result, 0, sizeof(entry->result));
+	}
+	string_list_clear(&moved, 0);
+	string_list_clear(&dirs, 0);
+}
+
+/*
+ * Writing the result
+ */
+
+struct merged_tree_entry {
+	const char *name;
+	int len;
+	unsigned mode;
+	const struct object_id *oid;
+};
+
+static int merged_tree_entry_cmp(const void *a_, const void *b_)
+{
+	const struct merged_tree_entry *a = a_, *b = b_;
+	return base_name_compare(a->name, a->len, a->mode,
+				 b->name, b->len, b->mode);
+}
+
+/*
+ * Write the tree of the paths starting with "base" (which is empty or
+ * ends with a slash) from position *pos, and move *pos past them.
+ * Returns the number of entries of the tree, which is not written when
+ * it is empty.
+ */
+static int write_merged_tree(struct string_list *paths, int *pos,
+			     const char *base, size_t base_len,
+			     struct object_id *oid)
+{
+	struct merged_tree_entry *entries = NULL;
+	struct object_id *subtrees = NULL;
+	int nr = 0, alloc = 0, subtrees_nr = 0, subtrees_alloc = 0, i;
+	struct strbuf buf = STRBUF_INIT;
+
+	while (*pos < paths->nr) {
+		struct string_list_item *item = &paths->items[*pos];
+		struct merge_entry *entry = item->util;
+		const char *name = item->string + base_len;
+		const char *slash;
+
+		if (strncmp(item->string, base, base_len))
+			break;
+		slash = strchr(name, '/');
+		if (slash && slash[1]) {
+			struct object_id sub;
+
+			if (!write_merged_tree(paths, pos, item->string,
+					       slash + 1 - item->string, &sub))
+				continue;
+			ALLOC_GROW(subtrees, subtrees_nr + 1, subtrees_alloc);
+			oidcpy(&subtrees[subtrees_nr++], &sub);
+			ALLOC_GROW(entries, nr + 1, alloc);
+			entries[nr].name = name;
+			entries[nr].len = slash - name;
+			entries[nr].mode = S_IFDIR;
+			entries[nr].oid = NULL; /* set below */
+			nr++;
+			continue;
+		}
+
+		(*pos)++;
+		if (!entry->result.mode)
+			continue;
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].name = name;
+		entries[nr].len = slash ? slash - name : strlen(name);
+		entries[nr].mode = entry->result.mode;
+		entries[nr].oid = &entry->result.oid;
+		nr++;
+	}
+
+	if (!nr)
+		return 0;
+
+	/* the subtrees array may have moved while it grew */
+	for (i = 0, subtrees_nr = 0; i < nr; i++)
+		if (!entries[i].oid)
+			entries[i].oid = &subtrees[subtrees_nr++];
+
+	QSORT(entries, nr, merged_tree_entry_cmp);
+	for (i = 0; i < nr; i++) {
+		strbuf_addf(&buf, "%o %.*s%c", entries[i].mode,
+			    entries[i].len, entries[i].name, '\0');
+		strbuf_add(&buf, entries[i].oid->hash, GIT_SHA1_RAWSZ);
+	}
+	if (write_sha1_file(buf.buf, buf.len, tree_type, oid->hash))
+		die(_("unable to write tree %.*s"), (int)base_len, base);
+
+	strbuf_release(&buf);
+	free(entries);
+	free(subtrees);
+	return nr;
+}
+
+static int merge_conflict_cmp(const void *a_, const void *b_)
+{
+	const struct merge_conflict *a = a_, *b = b_;
+	return strcmp(a->path, b->path);
+}
+
+void merge_incore_nonrecursive(struct merge_options *opt,
+			       struct tree *merge_base,
+			       struct tree *side1,
+			       struct tree *side2,
+			       struct merge_result *result)
+{
+	struct merge_state state;
+	const struct object_id *oids[3];
+	struct object_id tree_oid;
+	int i;
+
+	memset(result, 0, sizeof(*result));
+	memset(&state, 0, sizeof(state));
+	state.opt = opt;
+	state.result = result;
+	state.trees[0] = merge_base;
+	state.trees[1] = side1;
+	state.trees[2] = side2;
+	string_list_init(&state.paths, 1);
+	string_list_init(&state.expand_dirs, 1);
+	string_list_init(&state.side2_renames, 0);
+
+	if (opt->detect_rename) {
+		detect_renames(&state, 1);
+		detect_renames(&state, 2);
+		string_list_sort(&state.expand_dirs);
+		string_list_remove_duplicates(&state.expand_dirs, 0);
+		for (i = 0; i < state.renames_nr; i++)
+			if (state.renames[i].side == 2)
+				string_list_append(&state.side2_renames,
+						   state.renames[i].src)->util =
+					(void *)(intptr_t)i;
+		string_list_sort(&state.side2_renames);
+	}
+
+	for (i = 0; i < 3; i++)
+		oids[i] = &state.trees[i]->object.oid;
+	if (collect_merge_info(&state, "", oids) < 0) {
+		result->clean = -1;
+		goto cleanup;
+	}
+	string_list_sort(&state.paths);
+
+	process_renames(&state);
+	for (i = 0; i < state.paths.nr; i++) {
+		struct merge_entry *entry = state.paths.items[i].util;
+		if (entry->resolved)
+			continue;
+		if (process_entry(&state, state.paths.items[i].string, entry) < 0) {
+			result->clean = -1;
+			goto cleanup;
+		}
+	}
+	resolve_df_conflicts(&state);
+
+	i = 0;
+	if (!write_merged_tree(&state.paths, &i, "", 0, &tree_oid))
+		oidcpy(&tree_oid, the_hash_algo->empty_tree);
+	result->tree = lookup_tree(&tree_oid);
+
+	QSORT(result->conflicts, result->conflicts_nr, merge_conflict_cmp);
+	result->clean = !result->conflicts_nr;
+
+cleanup:
+	string_list_clear(&state.paths, 1);
+	string_list_clear(&state.expand_dirs, 0);
+	string_list_clear(&state.side2_renames, 0);
+	for (i = 0; i < state.renames_nr; i++) {
+		free(state.renames[i].src);
+		free(state.renames[i].dst);
+	}
+	free(state.renames);
+}
+
+static struct commit *make_virtual_commit(struct tree *tree, const char *comment)
+{
+	struct commit *commit = alloc_commit_node();
+
+	set_merge_remote_desc(commit, comment, (struct object *)commit);
+	commit->tree = tree;
+	commit->object.parsed = 1;
+	return commit;
+}
+
+static struct commit_list *reverse_commit_list(struct commit_list *list)
+{
+	struct commit_list *next = NULL, *current, *backup;
+	for (current = list; current; current = backup) {
+		backup = current->next;
+		current->next = next;
+		next = current;
+	}
+	return next;
+}
+
+void merge_incore_recursive(struct merge_options *opt,
+			    struct commit_list *merge_bases,
+			    struct commit *side1,
+			    struct commit *side2,
+			    struct merge_result *result)
+{
+	struct commit_list *iter;
+	struct commit *merged_base;
+
+	if (!merge_bases) {
+		merge_bases = get_merge_bases(side1, side2);
+		merge_bases = reverse_commit_list(merge_bases);
+	}
+
+	merged_base = pop_commit(&merge_bases);
+	if (!merged_base) {
+		/* if there is no common ancestor, use an empty tree */
+		struct tree *tree = lookup_tree(the_hash_algo->empty_tree);
+		merged_base = make_virtual_commit(tree, "ancestor");
+	}
+
+	for (iter = merge_bases; iter; iter = iter->next) {
+		const char *saved_b1 = opt->branch1, *saved_b2 = opt->branch2;
+		struct merge_result inner;
+		struct commit *prev = merged_base;
+
+		/*
+		 * The conflicts of the virtual merge base are recorded in
+		 * its tree with their markers; only errors stop us.
+		 */
+		opt->call_depth++;
+		opt->branch1 = "Temporary merge branch 1";
+		opt->branch2 = "Temporary merge branch 2";
+		merge_incore_recursive(opt, NULL, prev, iter->item, &inner);
+		opt->branch1 = saved_b1;
+		opt->branch2 = saved_b2;
+		opt->call_depth--;
+
+		if (inner.clean < 0) {
+			merge_result_release(&inner);
+			memset(result, 0, sizeof(*result));
+			result->clean = -1;
+			return;
+		}
+		merged_base = make_virtual_commit(inner.tree, "merged tree");
+		commit_list_insert(prev, &merged_base->parents);
+		commit_list_insert(iter->item, &merged_base->parents->next);
+		merge_result_release(&inner);
+	}
+	free_commit_list(merge_bases);
+
+	if (parse_commit(side1) || parse_commit(side2)) {
+		memset(result, 0, sizeof(*result));
+		result->clean = -1;
+		return;
+	}
+	opt->ancestor = "merged common ancestors";
+	merge_incore_nonrecursive(opt, merged_base->tree, side1->tree,
+				  side2->tree, result);
+}
+
+void merge_result_release(struct merge_result *result)
+{
+	int i;
+
+	for (i = 0; i < result->conflicts_nr; i++) {
+		free(result->conflicts[i].path);
+		free(result->conflicts[i].message);
+	}
+	FREE_AND_NULL(result->conflicts);
+	result->conflicts_nr = result->conflicts_alloc = 0;
+}
@@ -0,0 +1,79 @@
+#ifndef MERGE_ORT_H
+#define MERGE_ORT_H
+
+struct commit;
+struct commit_list;
+struct tree;
+
+#include "merge-recursive.h"
+
+/*
+ * A three-way merge that works on trees only: it reads the trees and
+ * blobs it needs from the object store and writes the merged blobs and
+ * trees back there, but never looks at the index or the working tree.
+ * The merge_options are the ones of merge-recursive; the buffered
+ * output and the index-related fields are not used.
+ */
+
+enum merge_conflict_type {
+	MERGE_CONFLICT_CONTENT = 0,
+	MERGE_CONFLICT_ADD_ADD,
+	MERGE_CONFLICT_MODIFY_DELETE,
+	MERGE_CONFLICT_RENAME_DELETE,
+	MERGE_CONFLICT_RENAME_RENAME,
+	MERGE_CONFLICT_RENAME_ADD,
+	MERGE_CONFLICT_DIRECTORY_FILE,
+	MERGE_CONFLICT_FILE_TYPE,
+	MERGE_CONFLICT_SUBMODULE
+};
+
+/* A version of a path; a zero mode means the path does not exist */
+struct merge_version {
+	struct object_id oid;
+	unsigned mode;
+};
+
+struct merge_conflict {
+	enum merge_conflict_type type;
+	/* where the conflicted result was recorded in the result tree */
+	char *path;
+	/* the merge base, side1 and side2 versions (index stages 1 to 3) */
+	struct merge_version stages[3];
+	/* a "CONFLICT (<type>): ..." line for the user */
+	char *message;
+};
+
+struct merge_result {
+	/* 1 if the merge is clean, 0 if it has conflicts, -1 on errors */
+	int clean;
+	/*
+	 * The merged tree.  Conflicted files are recorded in it with
+	 * conflict markers, like they would be in the working tree.
+	 */
+	struct tree *tree;
+	/* the conflicts, sorted by path */
+	struct merge_conflict *conflicts;
+	int conflicts_nr, conflicts_alloc;
+};
+
+/* Merge side1 and side2 of merge_base, without recursing */
+void merge_incore_nonrecursive(struct merge_options *opt,
+			       struct tree *merge_base,
+			       struct tree *side1,
+			       struct tree *side2,
+			       struct merge_result *result);
+
+/*
+ * Merge the commits side1 and side2, first merging their merge bases
+ * into a virtual one if there are more than one.  If merge_bases is
+ * NULL, they are computed.
+ */
+void merge_incore_recursive(struct merge_options *opt,
+			    struct commit_list *merge_bases,
+			    struct commit *side1,
+			    struct commit *side2,
+			    struct merge_result *result);
+
+void merge_result_release(struct merge_result *result);
+
+#endif
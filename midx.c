@@ -0,0 +1,980 @@
+#include "cache.h"
+#include "config.h"
+#include "dir.h"
+#include "lockfile.h"
+#include "packfile.h"
+#include "sha1-lookup.h"
+#include "csum-file.h"
+#include "string-list.h"
+#include "midx.h"
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
+#define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
+#define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_VERSION 1
+#define MIDX_HASH_VERSION 1
+#define MIDX_HASH_LEN GIT_SHA1_RAWSZ
+
+#define MIDX_HEADER_SIZE 12
+#define MIDX_CHUNKLOOKUP_WIDTH 12
+#define MIDX_FANOUT_SIZE (4 * 256)
+#define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + MIDX_FANOUT_SIZE + MIDX_HASH_LEN)
+
+#define MIDX_CHUNK_ALIGNMENT 4
+#define MIDX_CHUNK_OFFSET_WIDTH (2 * sizeof(uint32_t))
+#define MIDX_CHUNK_LARGE_OFFSET_WIDTH (sizeof(uint64_t))
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+
+#define MIDX_MAX_CHUNKS 5
+
+char *get_midx_filename(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index", object_dir);
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+{
+	struct multi_pack_index *m = NULL;
+	int fd;
+	struct stat st;
+	size_t midx_size;
+	void *midx_map = NULL;
+	const unsigned char *data, *chunk_lookup;
+	unsigned char hash_version;
+	char *midx_name = get_midx_filename(object_dir);
+	const char *cur_pack_name;
+	uint32_t i;
+
+	fd = git_open(midx_name);
+	if (fd < 0)
+		goto cleanup_fail;
+	if (fstat(fd, &st)) {
+		error_errno(_("failed to read %s"), midx_name);
+		goto cleanup_fail;
+	}
+
+	midx_size = xsize_t(st.st_size);
+	if (midx_size < MIDX_MIN_SIZE) {
+		error(_("multi-pack-index file %s is too small"), midx_name);
+		goto cleanup_fail;
+	}
+
+	midx_map = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	data = midx_map;
+
+	FLEX_ALLOC_STR(m, object_dir, object_dir);
+	m->fd = fd;
+	m->data = data;
+	m->data_len = midx_size;
+	m->local = local;
+
+	m->signature = get_be32(data);
+	if (m->signature != MIDX_SIGNATURE) {
+		error(_("multi-pack-index signature 0x%08x does not match signature 0x%08x"),
+		      m->signature, MIDX_SIGNATURE);
+		goto cleanup_fail;
+	}
+
+	m->version = data[4];
+	if (m->version != MIDX_VERSION) {
+		error(_("multi-pack-index version %d not recognized"),
+		      m->version);
+		goto cleanup_fail;
+	}
+
+	hash_version = data[5];
+	if (hash_version != MIDX_HASH_VERSION) {
+		error(_("hash version %u does not match"), hash_version);
+		goto cleanup_fail;
+	}
+	m->hash_len = MIDX_HASH_LEN;
+
+	m->num_chunks = data[6];
+	/* data[7] counts base multi-pack-index files; none are supported yet */
+	m->num_packs = get_be32(data + 8);
+
+	if (MIDX_HEADER_SIZE + (m->num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH >
+	    midx_size - m->hash_len) {
+		error(_("multi-pack-index chunk table extends past end of file"));
+		goto cleanup_fail;
+	}
+
+	chunk_lookup = data + MIDX_HEADER_SIZE;
+	for (i = 0; i < m->num_chunks; i++) {
+		uint32_t chunk_id = get_be32(chunk_lookup);
+		uint64_t chunk_offset = get_be64(chunk_lookup + 4);
+
+		chunk_lookup += MIDX_CHUNKLOOKUP_WIDTH;
+
+		if (chunk_offset >= midx_size - m->hash_len) {
+			error(_("improper chunk offset %08x%08x"),
+			      (uint32_t)(chunk_offset >> 32),
+			      (uint32_t)chunk_offset);
+			goto cleanup_fail;
+		}
+
+		switch (chunk_id) {
+		case MIDX_CHUNKID_PACKNAMES:
+			m->chunk_pack_names = data + chunk_offset;
+			break;
+
+		case MIDX_CHUNKID_OIDFANOUT:
+			m->chunk_oid_fanout = (const uint32_t *)(data + chunk_offset);
+			break;
+
+		case MIDX_CHUNKID_OIDLOOKUP:
+			m->chunk_oid_lookup = data + chunk_offset;
+			break;
+
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			m->chunk_object_offsets = data + chunk_offset;
+			break;
+
+		case MIDX_CHUNKID_LARGEOFFSETS:
+			m->chunk_large_offsets = data + chunk_offset;
+			break;
+
+		case 0:
+			die(_("terminating multi-pack-index chunk id appears earlier than expected"));
+			break;
+
+		default:
+			/*
+			 * Do nothing on unrecognized chunks, allowing future
+			 * extensions to add optional chunks.
+			 */
+			break;
+		}
+	}
+
+	if (!m->chunk_pack_names)
+		die(_("multi-pack-index missing required pack-name chunk"));
+	if (!m->chunk_oid_fanout)
+		die(_("multi-pack-index missing required OID fanout chunk"));
+	if (!m->chunk_oid_lookup)
+		die(_("multi-pack-index missing required OID lookup chunk"));
+	if (!m->chunk_object_offsets)
+		die(_("multi-pack-index missing required object offsets chunk"));
+
+	if ((const unsigned char *)m->chunk_oid_fanout + MIDX_FANOUT_SIZE >
+	    data + midx_size - m->hash_len)
+		die(_("multi-pack-index OID fanout chunk is truncated"));
+	m->num_objects = ntohl(m->chunk_oid_fanout[255]);
+
+	if (m->chunk_oid_lookup + (uint64_t)m->num_objects * m->hash_len >
+	    data + midx_size - m->hash_len ||
+	    m->chunk_object_offsets +
+	    (uint64_t)m->num_objects * MIDX_CHUNK_OFFSET_WIDTH >
+	    data + midx_size - m->hash_len)
+		die(_("multi-pack-index is too small for %u objects"),
+		    m->num_objects);
+
+	ALLOC_ARRAY(m->pack_names, m->num_packs);
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+
+	cur_pack_name = (const char *)m->chunk_pack_names;
+	for (i = 0; i < m->num_packs; i++) {
+		const char *end = memchr(cur_pack_name, '\0',
+					 (const char *)data + midx_size - cur_pack_name);
+
+		if (!end)
+			die(_("multi-pack-index pack names are truncated"));
+
+		m->pack_names[i] = cur_pack_name;
+		cur_pack_name = end + 1;
+
+		if (i && strcmp(m->pack_names[i], m->pack_names[i - 1]) <= 0)
+			die(_("multi-pack-index pack names out of order: '%s' before '%s'"),
+			    m->pack_names[i - 1],
+			    m->pack_names[i]);
+	}
+
+	free(midx_name);
+	return m;
+
+cleanup_fail:
+	free(m);
+	free(midx_name);
+	if (midx_map)
+		munmap(midx_map, midx_size);
+	if (0 <= fd)
+		close(fd);
+	return NULL;
+}
+
+void close_midx(struct multi_pack_index *m)
+{
+	if (!m)
+		return;
+
+	munmap((unsigned char *)m->data, m->data_len);
+	close(m->fd);
+	free(m->packs);
+	free(m->pack_names);
+	free(m);
+}
+
+/* global storage */
+static struct multi_pack_index *multi_pack_index;
+
+struct multi_pack_index *get_multi_pack_index(void)
+{
+	return multi_pack_index;
+}
+
+static int midx_pack_pos(struct multi_pack_index *m, const char *idx_name,
+			 uint32_t *pos)
+{
+	uint32_t first = 0, last = m->num_packs;
+
+	while (first < last) {
+		uint32_t mid = first + (last - first) / 2;
+		int cmp = strcmp(idx_name, m->pack_names[mid]);
+
+		if (!cmp) {
+			*pos = mid;
+			return 1;
+		}
+		if (cmp > 0)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	return 0;
+}
+
+int midx_contains_pack(struct multi_pack_index *m, const char *idx_name)
+{
+	uint32_t pos;
+	return midx_pack_pos(m, idx_name, &pos);
+}
+
+/*
+ * Point the multi-pack-index at "p" if "p" is one of its packs, and
+ * mark "p" so that find_pack_entry() need not search it separately.
+ */
+static void link_midx_pack(struct multi_pack_index *m, struct packed_git *p)
+{
+	struct strbuf idx_name = STRBUF_INIT;
+	const char *base;
+	size_t len;
+	uint32_t pos;
+
+	if (!skip_prefix(p->pack_name, m->object_dir, &base) ||
+	    !skip_prefix(base, "/pack/", &base) ||
+	    !strip_suffix(base, ".pack", &len))
+		return;
+
+	strbuf_add(&idx_name, base, len);
+	strbuf_addstr(&idx_name, ".idx");
+
+	if (midx_pack_pos(m, idx_name.buf, &pos) && !m->packs[pos]) {
+		m->packs[pos] = p;
+		p->multi_pack_index = 1;
+	}
+
+	strbuf_release(&idx_name);
+}
+
+void prepare_multi_pack_index_one(const char *object_dir, int local)
+{
+	struct multi_pack_index *m;
+	struct packed_git *p;
+
+	if (!core_multi_pack_index)
+		return;
+
+	for (m = multi_pack_index; m; m = m->next)
+		if (!strcmp(object_dir, m->object_dir))
+			break;
+
+	if (!m) {
+		m = load_multi_pack_index(object_dir, local);
+		if (!m)
+			return;
+		m->next = multi_pack_index;
+		multi_pack_index = m;
+	}
+
+	/*
+	 * Packs may have been installed since the last call (see
+	 * reprepare_packed_git()), so link any we have not seen yet.
+	 */
+	for (p = packed_git; p; p = p->next)
+		if (!p->multi_pack_index)
+			link_midx_pack(m, p);
+}
+
+int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m,
+		 uint32_t *result)
+{
+	uint32_t lo, hi;
+
+	hi = ntohl(m->chunk_oid_fanout[oid->hash[0]]);
+	lo = oid->hash[0] ? ntohl(m->chunk_oid_fanout[oid->hash[0] - 1]) : 0;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(oid->hash,
+				  m->chunk_oid_lookup + m->hash_len * mi);
+
+		if (!cmp) {
+			*result = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+
+	*result = lo;
+	return 0;
+}
+
+struct object_id *nth_midxed_object_oid(struct object_id *oid,
+					struct multi_pack_index *m,
+					uint32_t n)
+{
+	if (n >= m->num_objects)
+		return NULL;
+
+	hashcpy(oid->hash, m->chunk_oid_lookup + m->hash_len * n);
+	return oid;
+}
+
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+{
+	const unsigned char *offset_data;
+	uint32_t offset32;
+
+	offset_data = m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH;
+	offset32 = get_be32(offset_data + sizeof(uint32_t));
+
+	if (m->chunk_large_offsets && offset32 & MIDX_LARGE_OFFSET_NEEDED) {
+		if (sizeof(off_t) < sizeof(uint64_t))
+			die(_("multi-pack-index stores a 64-bit offset, but off_t is too small"));
+
+		offset32 ^= MIDX_LARGE_OFFSET_NEEDED;
+		return get_be64(m->chunk_large_offsets +
+				MIDX_CHUNK_LARGE_OFFSET_WIDTH * offset32);
+	}
+
+	return offset32;
+}
+
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
+{
+	return get_be32(m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH);
+}
+
+static int nth_midxed_pack_entry(const unsigned char *sha1,
+				 struct pack_entry *e,
+				 struct multi_pack_index *m,
+				 uint32_t pos)
+{
+	uint32_t pack_int_id = nth_midxed_pack_int_id(m, pos);
+	struct packed_git *p;
+
+	if (pack_int_id >= m->num_packs)
+		die(_("bad pack-int-id: %u (%u total packs)"),
+		    pack_int_id, m->num_packs);
+
+	p = m->packs[pack_int_id];
+	if (!p)
+		return 0;
+
+	if (p->num_bad_objects) {
+		uint32_t i;
+		for (i = 0; i < p->num_bad_objects; i++)
+			if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
+				return 0;
+	}
+
+	/*
+	 * As in fill_pack_entry(), make sure the pack is still there
+	 * before handing out an offset into it.
+	 */
+	if (!is_pack_valid(p))
+		return 0;
+
+	e->offset = nth_midxed_offset(m, pos);
+	e->p = p;
+	hashcpy(e->sha1, sha1);
+	return 1;
+}
+
+int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e)
+{
+	struct multi_pack_index *m;
+	struct object_id oid;
+	int found = 0;
+
+	if (!multi_pack_index)
+		return 0;
+
+	hashcpy(oid.hash, sha1);
+	for (m = multi_pack_index; m; m = m->next) {
+		uint32_t pos;
+
+		if (!bsearch_midx(&oid, m, &pos))
+			continue;
+		found = 1;
+		if (nth_midxed_pack_entry(sha1, e, m, pos))
+			return 1;
+	}
+
+	return found ? -1 : 0;
+}
+
+struct pack_info {
+	char *pack_name;
+	struct packed_git *p;
+};
+
+struct pack_list {
+	struct pack_info *info;
+	uint32_t nr;
+	uint32_t alloc;
+};
+
+static int pack_info_compare(const void *_a, const void *_b)
+{
+	const struct pack_info *a = _a, *b = _b;
+	return strcmp(a->pack_name, b->pack_name);
+}
+
+static void add_packs_from_dir(const char *object_dir,
+			       struct string_list *packs_to_drop,
+			       struct pack_list *packs)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t dirlen;
+	DIR *dir;
+	struct dirent *de;
+
+	strbuf_addf(&path, "%s/pack", object_dir);
+	dir = opendir(path.buf);
+	if (!dir) {
+		if (errno != ENOENT)
+			error_errno(_("unable to open object pack directory: %s"),
+				    path.buf);
+		strbuf_release(&path);
+		return;
+	}
+	strbuf_addch(&path, '/');
+	dirlen = path.len;
+
+	while ((de = readdir(dir)) != NULL) {
+		struct packed_git *p;
+
+		if (!ends_with(de->d_name, ".idx"))
+			continue;
+		if (packs_to_drop &&
+		    string_list_has_string(packs_to_drop, de->d_name))
+			continue;
+
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, de->d_name);
+
+		p = add_packed_git(path.buf, path.len, 0);
+		if (!p) {
+			warning(_("failed to add packfile '%s'"), path.buf);
+			continue;
+		}
+		if (open_pack_index(p)) {
+			warning(_("failed to open pack-index '%s'"), path.buf);
+			close_pack(p);
+			free(p);
+			continue;
+		}
+
+		ALLOC_GROW(packs->info, packs->nr + 1, packs->alloc);
+		packs->info[packs->nr].pack_name = xstrdup(de->d_name);
+		packs->info[packs->nr].p = p;
+		packs->nr++;
+	}
+
+	closedir(dir);
+	strbuf_release(&path);
+}
+
+struct pack_midx_entry {
+	struct object_id oid;
+	uint32_t pack_int_id;
+	time_t pack_mtime;
+	uint64_t offset;
+};
+
+static int midx_oid_compare(const void *_a, const void *_b)
+{
+	const struct pack_midx_entry *a = _a, *b = _b;
+	int cmp = oidcmp(&a->oid, &b->oid);
+
+	if (cmp)
+		return cmp;
+
+	/* Prefer the copy in the newest pack, as prepare_packed_git() does. */
+	if (a->pack_mtime > b->pack_mtime)
+		return -1;
+	else if (a->pack_mtime < b->pack_mtime)
+		return 1;
+
+	if (a->pack_int_id < b->pack_int_id)
+		return -1;
+	return a->pack_int_id > b->pack_int_id;
+}
+
+/*
+ * Collect one entry per object across all "packs", choosing the
+ * newest pack when an object appears in several of them.  The
+ * result is sorted by object id.
+ */
+static struct pack_midx_entry *get_sorted_entries(struct pack_list *packs,
+						  uint32_t *nr_objects)
+{
+	struct pack_midx_entry *entries;
+	uint64_t total = 0;
+	uint32_t i, nr = 0, out = 0;
+
+	for (i = 0; i < packs->nr; i++)
+		total += packs->info[i].p->num_objects;
+	if (total >= (1ULL << 32))
+		die(_("too many objects to write a multi-pack-index"));
+
+	ALLOC_ARRAY(entries, total);
+
+	for (i = 0; i < packs->nr; i++) {
+		struct packed_git *p = packs->info[i].p;
+		uint32_t j;
+
+		for (j = 0; j < p->num_objects; j++) {
+			struct pack_midx_entry *e = &entries[nr++];
+
+			nth_packed_object_oid(&e->oid, p, j);
+			e->pack_int_id = i;
+			e->pack_mtime = p->mtime;
+			e->offset = nth_packed_object_offset(p, j);
+		}
+	}
+
+	QSORT(entries, nr, midx_oid_compare);
+
+	for (i = 0; i < nr; i++) {
+		if (out && !oidcmp(&entries[out - 1].oid, &entries[i].oid))
+			continue;
+		entries[out++] = entries[i];
+	}
+
+	*nr_objects = out;
+	return entries;
+}
+
+static size_t write_midx_pack_names(struct sha1file *f,
+				    struct pack_list *packs)
+{
+	unsigned char padding[MIDX_CHUNK_ALIGNMENT];
+	size_t written = 0;
+	uint32_t i;
+
+	for (i = 0; i < packs->nr; i++) {
+		size_t writelen = strlen(packs->info[i].pack_name) + 1;
+
+		sha1write(f, packs->info[i].pack_name, writelen);
+		written += writelen;
+	}
+
+	/* add padding to be aligned */
+	i = MIDX_CHUNK_ALIGNMENT - (written % MIDX_CHUNK_ALIGNMENT);
+	if (i < MIDX_CHUNK_ALIGNMENT) {
+		memset(padding, 0, sizeof(padding));
+		sha1write(f, padding, i);
+		written += i;
+	}
+
+	return written;
+}
+
+static void write_midx_oid_fanout(struct sha1file *f,
+				  struct pack_midx_entry *objects,
+				  uint32_t nr_objects)
+{
+	struct pack_midx_entry *list = objects;
+	struct pack_midx_entry *last = objects + nr_objects;
+	uint32_t count = 0;
+	uint32_t i;
+
+	/*
+	 * Write the first-level table (the list is sorted,
+	 * but we use a 256-entry lookup to be able to avoid
+	 * having to do eight extra binary search iterations).
+	 */
+	for (i = 0; i < 256; i++) {
+		struct pack_midx_entry *next = list;
+
+		while (next < last && next->oid.hash[0] == i) {
+			count++;
+			next++;
+		}
+
+		sha1write_be32(f, count);
+		list = next;
+	}
+}
+
+static void write_midx_oid_lookup(struct sha1file *f,
+				  struct pack_midx_entry *objects,
+				  uint32_t nr_objects)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr_objects; i++)
+		sha1write(f, objects[i].oid.hash, MIDX_HASH_LEN);
+}
+
+static void write_midx_object_offsets(struct sha1file *f,
+				      struct pack_midx_entry *objects,
+				      uint32_t nr_objects)
+{
+	uint32_t i, nr_large_offset = 0;
+
+	for (i = 0; i < nr_objects; i++) {
+		struct pack_midx_entry *obj = &objects[i];
+
+		sha1write_be32(f, obj->pack_int_id);
+
+		if (obj->offset >> 31)
+			sha1write_be32(f, MIDX_LARGE_OFFSET_NEEDED | nr_large_offset++);
+		else
+			sha1write_be32(f, (uint32_t)obj->offset);
+	}
+}
+
+static void write_midx_large_offsets(struct sha1file *f,
+				     struct pack_midx_entry *objects,
+				     uint32_t nr_objects)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr_objects; i++) {
+		uint64_t offset = objects[i].offset;
+
+		if (!(offset >> 31))
+			continue;
+
+		sha1write_be32(f, offset >> 32);
+		sha1write_be32(f, offset & 0xffffffffUL);
+	}
+}
+
+static int write_midx_internal(const char *object_dir,
+			       struct string_list *packs_to_drop)
+{
+	char *midx_name;
+	struct lock_file lk = LOCK_INIT;
+	struct sha1file *f;
+	struct pack_list packs;
+	struct pack_midx_entry *entries;
+	uint32_t i, nr_entries, num_large_offsets = 0;
+	uint32_t chunk_ids[MIDX_MAX_CHUNKS + 1];
+	uint64_t chunk_offsets[MIDX_MAX_CHUNKS + 1];
+	size_t pack_name_len = 0;
+	int num_chunks;
+
+	memset(&packs, 0, sizeof(packs));
+	add_packs_from_dir(object_dir, packs_to_drop, &packs);
+	QSORT(packs.info, packs.nr, pack_info_compare);
+
+	entries = get_sorted_entries(&packs, &nr_entries);
+
+	for (i = 0; i < packs.nr; i++)
+		pack_name_len += strlen(packs.info[i].pack_name) + 1;
+	if (pack_name_len % MIDX_CHUNK_ALIGNMENT)
+		pack_name_len += MIDX_CHUNK_ALIGNMENT -
+				 (pack_name_len % MIDX_CHUNK_ALIGNMENT);
+
+	for (i = 0; i < nr_entries; i++)
+		if (entries[i].offset >> 31)
+			num_large_offsets++;
+
+	num_chunks = num_large_offsets ? 5 : 4;
+
+	chunk_ids[0] = MIDX_CHUNKID_PACKNAMES;
+	chunk_ids[1] = MIDX_CHUNKID_OIDFANOUT;
+	chunk_ids[2] = MIDX_CHUNKID_OIDLOOKUP;
+	chunk_ids[3] = MIDX_CHUNKID_OBJECTOFFSETS;
+	chunk_ids[4] = num_large_offsets ? MIDX_CHUNKID_LARGEOFFSETS : 0;
+	chunk_ids[5] = 0;
+
+	chunk_offsets[0] = MIDX_HEADER_SIZE +
+			   (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
+	chunk_offsets[1] = chunk_offsets[0] + pack_name_len;
+	chunk_offsets[2] = chunk_offsets[1] + MIDX_FANOUT_SIZE;
+	chunk_offsets[3] = chunk_offsets[2] + (uint64_t)nr_entries * MIDX_HASH_LEN;
+	chunk_offsets[4] = chunk_offsets[3] +
+			   (uint64_t)nr_entries * MIDX_CHUNK_OFFSET_WIDTH;
+	chunk_offsets[5] = chunk_offsets[4] +
+			   (uint64_t)num_large_offsets * MIDX_CHUNK_LARGE_OFFSET_WIDTH;
+
+	midx_name = get_midx_filename(object_dir);
+	if (safe_create_leading_directories(midx_name))
+		die_errno(_("unable to create leading directories of %s"),
+			  midx_name);
+
+	hold_lock_file_for_update(&lk, midx_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(lk.tempfile->fd, lk.tempfile->filename.buf);
+
+	sha1write_be32(f, MIDX_SIGNATURE);
+	sha1write_u8(f, MIDX_VERSION);
+	sha1write_u8(f, MIDX_HASH_VERSION);
+	sha1write_u8(f, num_chunks);
+	sha1write_u8(f, 0); /* number of base multi-pack-index files */
+	sha1write_be32(f, packs.nr);
+
+	for (i = 0; i <= num_chunks; i++) {
+		uint32_t chunk_write[3];
+
+		chunk_write[0] = htonl(chunk_ids[i]);
+		chunk_write[1] = htonl(chunk_offsets[i] >> 32);
+		chunk_write[2] = htonl(chunk_offsets[i] & 0xffffffff);
+		sha1write(f, chunk_write, MIDX_CHUNKLOOKUP_WIDTH);
+	}
+
+	write_midx_pack_names(f, &packs);
+	write_midx_oid_fanout(f, entries, nr_entries);
+	write_midx_oid_lookup(f, entries, nr_entries);
+	write_midx_object_offsets(f, entries, nr_entries);
+	if (num_large_offsets)
+		write_midx_large_offsets(f, entries, nr_entries);
+
+	sha1close(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+	commit_lock_file(&lk);
+
+	for (i = 0; i < packs.nr; i++) {
+		close_pack(packs.info[i].p);
+		free(packs.info[i].p);
+		free(packs.info[i].pack_name);
+	}
+	free(packs.info);
+	free(entries);
+	free(midx_name);
+	return 0;
+}
+
+int write_midx_file(const char *object_dir)
+{
+	return write_midx_internal(object_dir, NULL);
+}
+
+void clear_midx_file(const char *object_dir)
+{
+	char *midx = get_midx_filename(object_dir);
+
+	if (unlink(midx) && errno != ENOENT)
+		die_errno(_("failed to clear multi-pack-index at %s"), midx);
+
+	free(midx);
+}
+
+static int verify_midx_error;
+
+static void midx_report(const char *fmt, ...)
+{
+	va_list ap;
+
+	verify_midx_error = 1;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+int verify_midx_file(const char *object_dir)
+{
+	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+	struct strbuf pack_name = STRBUF_INIT;
+	struct object_id oid, prev_oid, checksum;
+	git_SHA_CTX ctx;
+	size_t dirlen;
+	uint32_t i;
+
+	verify_midx_error = 0;
+
+	if (!m)
+		return 0;
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, m->data, m->data_len - m->hash_len);
+	git_SHA1_Final(checksum.hash, &ctx);
+	if (hashcmp(checksum.hash, m->data + m->data_len - m->hash_len))
+		midx_report(_("the multi-pack-index file has incorrect checksum and is likely corrupt"));
+
+	strbuf_addf(&pack_name, "%s/pack/", object_dir);
+	dirlen = pack_name.len;
+	for (i = 0; i < m->num_packs; i++) {
+		struct packed_git *p;
+
+		strbuf_setlen(&pack_name, dirlen);
+		strbuf_addstr(&pack_name, m->pack_names[i]);
+		p = add_packed_git(pack_name.buf, pack_name.len, 1);
+		if (!p || open_pack_index(p)) {
+			midx_report(_("failed to load pack in position %d"), i);
+			if (p) {
+				close_pack(p);
+				free(p);
+			}
+			continue;
+		}
+		m->packs[i] = p;
+	}
+	strbuf_release(&pack_name);
+
+	for (i = 0; i < 255; i++) {
+		uint32_t oid_fanout1 = ntohl(m->chunk_oid_fanout[i]);
+		uint32_t oid_fanout2 = ntohl(m->chunk_oid_fanout[i + 1]);
+
+		if (oid_fanout1 > oid_fanout2)
+			midx_report(_("oid fanout out of order: fanout[%d] = %"PRIx32" > %"PRIx32" = fanout[%d]"),
+				    i, oid_fanout1, oid_fanout2, i + 1);
+	}
+
+	for (i = 0; i < m->num_objects; i++) {
+		uint32_t pack_int_id;
+		off_t m_offset, p_offset;
+
+		nth_midxed_object_oid(&oid, m, i);
+		if (i && oidcmp(&prev_oid, &oid) >= 0)
+			midx_report(_("oid lookup out of order: oid[%d] = %s >= %s = oid[%d]"),
+				    i - 1, oid_to_hex(&prev_oid),
+				    oid_to_hex(&oid), i);
+		oidcpy(&prev_oid, &oid);
+
+		if (oid.hash[0] &&
+		    i < ntohl(m->chunk_oid_fanout[oid.hash[0] - 1]))
+			midx_report(_("oid fanout does not cover oid[%d] = %s"),
+				    i, oid_to_hex(&oid));
+
+		pack_int_id = nth_midxed_pack_int_id(m, i);
+		if (pack_int_id >= m->num_packs) {
+			midx_report(_("bad pack-int-id: %u (%u total packs)"),
+				    pack_int_id, m->num_packs);
+			continue;
+		}
+		if (!m->packs[pack_int_id])
+			continue;
+
+		m_offset = nth_midxed_offset(m, i);
+		p_offset = find_pack_entry_one(oid.hash, m->packs[pack_int_id]);
+
+		if (m_offset != p_offset)
+			midx_report(_("incorrect object offset for oid[%d] = %s: %"PRIx64" != %"PRIx64),
+				    i, oid_to_hex(&oid),
+				    (uint64_t)m_offset, (uint64_t)p_offset);
+	}
+
+	for (i = 0; i < m->num_packs; i++) {
+		struct packed_git *p = m->packs[i];
+		uint32_t j, pos;
+
+		if (!p)
+			continue;
+
+		for (j = 0; j < p->num_objects; j++) {
+			nth_packed_object_oid(&oid, p, j);
+			if (!bsearch_midx(&oid, m, &pos))
+				midx_report(_("object %s from %s is missing from the multi-pack-index"),
+					    oid_to_hex(&oid), m->pack_names[i]);
+		}
+
+		close_pack(p);
+		free(p);
+	}
+
+	close_midx(m);
+	return verify_midx_error;
+}
+
+static void unlink_pack_files(const char *object_dir, const char *idx_name)
+{
+	static const char *exts[] = { ".pack", ".idx", ".bitmap", ".rev" };
+	struct strbuf path = STRBUF_INIT;
+	size_t baselen;
+	int i;
+
+	strbuf_addf(&path, "%s/pack/%s", object_dir, idx_name);
+	strbuf_strip_suffix(&path, ".idx");
+	baselen = path.len;
+
+	for (i = 0; i < ARRAY_SIZE(exts); i++) {
+		strbuf_setlen(&path, baselen);
+		strbuf_addstr(&path, exts[i]);
+		unlink_or_warn(path.buf);
+	}
+
+	strbuf_release(&path);
+}
+
+int expire_midx_packs(const char *object_dir)
+{
+	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+	struct string_list packs_to_drop = STRING_LIST_INIT_DUP;
+	struct strbuf keep_name = STRBUF_INIT;
+	uint32_t *count;
+	uint32_t i;
+	int result = 0;
+
+	if (!m)
+		return 0;
+
+	count = xcalloc(m->num_packs, sizeof(uint32_t));
+	for (i = 0; i < m->num_objects; i++) {
+		uint32_t pack_int_id = nth_midxed_pack_int_id(m, i);
+
+		if (pack_int_id >= m->num_packs)
+			die(_("bad pack-int-id: %u (%u total packs)"),
+			    pack_int_id, m->num_packs);
+		count[pack_int_id]++;
+	}
+
+	for (i = 0; i < m->num_packs; i++) {
+		if (count[i])
+			continue;
+
+		/* Never delete a pack that was explicitly kept. */
+		strbuf_reset(&keep_name);
+		strbuf_addf(&keep_name, "%s/pack/%s", object_dir, m->pack_names[i]);
+		strbuf_strip_suffix(&keep_name, ".idx");
+		strbuf_addstr(&keep_name, ".keep");
+		if (file_exists(keep_name.buf))
+			continue;
+
+		string_list_insert(&packs_to_drop, m->pack_names[i]);
+	}
+
+	free(count);
+	strbuf_release(&keep_name);
+	close_midx(m);
+
+	if (!packs_to_drop.nr)
+		goto out;
+
+	/*
+	 * Rewrite the multi-pack-index first, so that a concurrent
+	 * reader never sees it refer to a pack that is already gone.
+	 */
+	result = write_midx_internal(object_dir, &packs_to_drop);
+	if (!result) {
+		struct string_list_item *item;
+		for_each_string_list_item(item, &packs_to_drop)
+			unlink_pack_files(object_dir, item->string);
+	}
+
+out:
+	string_list_clear(&packs_to_drop, 0);
+	return result;
+}
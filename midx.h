@@ -0,0 +1,103 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+#include "git-compat-util.h"
+
+struct object_id;
+struct pack_entry;
+struct packed_git;
+
+/*
+ * A multi-pack-index ("midx") indexes the objects of every pack in
+ * an object directory at once, so that a lookup costs one binary
+ * search instead of one per pack.
+ */
+struct multi_pack_index {
+	struct multi_pack_index *next;
+
+	int fd;
+
+	const unsigned char *data;
+	size_t data_len;
+
+	uint32_t signature;
+	unsigned char version;
+	unsigned char hash_len;
+	unsigned char num_chunks;
+	uint32_t num_packs;
+	uint32_t num_objects;
+
+	int local;
+
+	const unsigned char *chunk_pack_names;
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_object_offsets;
+	const unsigned char *chunk_large_offsets;
+
+	const char **pack_names;
+	struct packed_git **packs;
+	char object_dir[FLEX_ARRAY];
+};
+
+extern char *get_midx_filename(const char *object_dir);
+
+/*
+ * Load the multi-pack-index of "object_dir", or return NULL if there
+ * is none (or it cannot be used).
+ */
+extern struct multi_pack_index *load_multi_pack_index(const char *object_dir,
+						      int local);
+
+/*
+ * Load the multi-pack-index of "object_dir" into the list returned by
+ * get_multi_pack_index() and link it to the packs already installed
+ * in the packed_git list.  Called from prepare_packed_git(); a no-op
+ * unless core.multiPackIndex is set.
+ */
+extern void prepare_multi_pack_index_one(const char *object_dir, int local);
+extern struct multi_pack_index *get_multi_pack_index(void);
+
+extern int bsearch_midx(const struct object_id *oid,
+			struct multi_pack_index *m, uint32_t *result);
+extern struct object_id *nth_midxed_object_oid(struct object_id *oid,
+					       struct multi_pack_index *m,
+					       uint32_t n);
+extern off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos);
+extern uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m,
+				       uint32_t pos);
+extern int midx_contains_pack(struct multi_pack_index *m,
+			      const char *idx_name);
+
+/*
+ * Look up "sha1" in the loaded multi-pack-indexes.  Returns 1 and
+ * fills "e" when the object was found in a usable pack, 0 when no
+ * multi-pack-index knows the object (so packs marked with
+ * "multi_pack_index" need not be searched either), and -1 when the
+ * object is listed but its pack cannot be used.
+ */
+extern int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e);
+
+/*
+ * Write a multi-pack-index covering every pack in "object_dir".
+ * Returns 0 on success.
+ */
+extern int write_midx_file(const char *object_dir);
+extern void clear_midx_file(const char *object_dir);
+
+/*
+ * Check the multi-pack-index of "object_dir" against its packs.
+ * Returns the number of errors found.
+ */
+extern int verify_midx_file(const char *object_dir);
+
+/*
+ * Delete the packs listed in the multi-pack-index of "object_dir"
+ * that no longer supply any of its objects, and rewrite the
+ * multi-pack-index without them.  Returns 0 on success.
+ */
+extern int expire_midx_packs(const char *object_dir);
+
+extern void close_midx(struct multi_pack_index *m);
+
+#endif
@@ -28,7 +28,7 @@ struct object_array {
 #define TYPE_BITS   3
 /*
  * object flag allocation:
- * revision.h:      0---------10                                26
+ * revision.h:      0---------10                                26--28
  * fetch-pack.c:    0---5
  * walker.c:        0-2
  * upload-pack.c:       4       11----------------19
@@ -41,7 +41,7 @@ struct object_array {
  * list-objects-filter.c:                             21
  * builtin/fsck.c:  0--3
  */
-#define FLAG_BITS  27
+#define FLAG_BITS  29
 
 /*
  * The object type is stored in 3 bits.
@@ -36,6 +36,14 @@ struct bitmap_writer {
 	struct progress *progress;
 	int show_progress;
 	unsigned char pack_checksum[20];
+
+	/*
+	 * When writing a layer, the objects of the pack come after the
+	 * "base_nr" objects of the loaded bitmaps.
+	 */
+	unsigned layer : 1;
+	uint32_t base_nr;
+	unsigned char base_checksum[20];
 };
 
 static struct bitmap_writer writer;
@@ -45,6 +53,24 @@ void bitmap_writer_show_progress(int show)
 	writer.show_progress = show;
 }
 
+/**
+ * Write the bitmaps as a layer on top of the existing ones
+ */
+int bitmap_writer_init_layer(void)
+{
+	if (prepare_bitmap_git() < 0)
+		return -1;
+
+	writer.base_nr = bitmap_base_objects(writer.base_checksum);
+	writer.layer = 1;
+	return 0;
+}
+
+static void set_type_bit(size_t pos, void *type_index)
+{
+	ewah_set(type_index, pos);
+}
+
 /**
  * Build the initial type index for the packfile
  */
@@ -58,6 +84,13 @@ void bitmap_writer_build_type_index(struct pack_idx_entry **index,
 	writer.blobs = ewah_new();
 	writer.tags = ewah_new();
 
+	if (writer.layer) {
+		ewah_each_bit(bitmap_base_type_index(OBJ_COMMIT), set_type_bit, writer.commits);
+		ewah_each_bit(bitmap_base_type_index(OBJ_TREE), set_type_bit, writer.trees);
+		ewah_each_bit(bitmap_base_type_index(OBJ_BLOB), set_type_bit, writer.blobs);
+		ewah_each_bit(bitmap_base_type_index(OBJ_TAG), set_type_bit, writer.tags);
+	}
+
 	for (i = 0; i < index_nr; ++i) {
 		struct object_entry *entry = (struct object_entry *)index[i];
 		enum object_type real_type;
@@ -80,19 +113,19 @@ void bitmap_writer_build_type_index(struct pack_idx_entry **index,
 
 		switch (real_type) {
 		case OBJ_COMMIT:
-			ewah_set(writer.commits, i);
+			ewah_set(writer.commits, writer.base_nr + i);
 			break;
 
 		case OBJ_TREE:
-			ewah_set(writer.trees, i);
+			ewah_set(writer.trees, writer.base_nr + i);
 			break;
 
 		case OBJ_BLOB:
-			ewah_set(writer.blobs, i);
+			ewah_set(writer.blobs, writer.base_nr + i);
 			break;
 
 		case OBJ_TAG:
-			ewah_set(writer.tags, i);
+			ewah_set(writer.tags, writer.base_nr + i);
 			break;
 
 		default:
@@ -142,12 +175,17 @@ static uint32_t find_object_pos(const unsigned char *sha1)
 {
 	struct object_entry *entry = packlist_find(writer.to_pack, sha1, NULL);
 
-	if (!entry) {
-		die("Failed to write bitmap index. Packfile doesn't have full closure "
-			"(object %s is missing)", sha1_to_hex(sha1));
+	if (entry)
+		return writer.base_nr + entry->in_pack_pos;
+
+	if (writer.layer) {
+		int pos = bitmap_base_position(sha1);
+		if (pos >= 0)
+			return pos;
 	}
 
-	return entry->in_pack_pos;
+	die("Failed to write bitmap index. Packfile doesn't have full closure "
+		"(object %s is missing)", sha1_to_hex(sha1));
 }
 
 static void show_object(struct object *object, const char *name, void *data)
@@ -178,6 +216,14 @@ add_to_include_set(struct bitmap *base, struct commit *commit)
 		return 0;
 	}
 
+	if (writer.layer) {
+		struct ewah_bitmap *bm = bitmap_base_for_commit(commit->object.oid.hash);
+		if (bm) {
+			bitmap_or_ewah(base, bm);
+			return 0;
+		}
+	}
+
 	bitmap_set(base, bitmap_pos);
 	return 1;
 }
@@ -358,7 +404,8 @@ static int date_compare(const void *_a, const void *_b)
 
 void bitmap_writer_reuse_bitmaps(struct packing_data *to_pack)
 {
-	if (prepare_bitmap_git() < 0)
+	/* a layer uses the bitmaps below it as they are */
+	if (writer.layer || prepare_bitmap_git() < 0)
 		return;
 
 	writer.reused = kh_init_sha1();
@@ -464,7 +511,8 @@ static const unsigned char *sha1_access(size_t pos, void *table)
 
 static void write_selected_commits_v1(struct sha1file *f,
 				      struct pack_idx_entry **index,
-				      uint32_t index_nr)
+				      uint32_t index_nr,
+				      off_t *offsets)
 {
 	int i;
 
@@ -477,6 +525,10 @@ static void write_selected_commits_v1(struct sha1file *f,
 		if (commit_pos < 0)
 			die("BUG: trying to write commit not in index");
 
+		stored->commit_pos = commit_pos;
+		if (offsets)
+			offsets[i] = f->total + f->offset;
+
 		sha1write_be32(f, commit_pos);
 		sha1write_u8(f, stored->xor_offset);
 		sha1write_u8(f, stored->flags);
@@ -485,6 +537,52 @@ static void write_selected_commits_v1(struct sha1file *f,
 	}
 }
 
+static int lookup_table_cmp(const void *_a, const void *_b)
+{
+	const struct bitmapped_commit *a = *(const struct bitmapped_commit **)_a;
+	const struct bitmapped_commit *b = *(const struct bitmapped_commit **)_b;
+
+	if (a->commit_pos < b->commit_pos)
+		return -1;
+	return a->commit_pos > b->commit_pos;
+}
+
+/*
+ * Write a row for each entry, in the order of the commits in the pack
+ * index, with the offset of the entry and the row of the entry it is
+ * xor'ed with.
+ */
+static void write_lookup_table(struct sha1file *f, off_t *offsets)
+{
+	struct bitmapped_commit **table;
+	uint32_t *table_row;
+	int i;
+
+	ALLOC_ARRAY(table, writer.selected_nr);
+	ALLOC_ARRAY(table_row, writer.selected_nr);
+	for (i = 0; i < writer.selected_nr; i++)
+		table[i] = &writer.selected[i];
+	QSORT(table, writer.selected_nr, lookup_table_cmp);
+	for (i = 0; i < writer.selected_nr; i++)
+		table_row[table[i] - writer.selected] = i;
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *stored = table[i];
+		int selected = stored - writer.selected;
+		uint32_t xor_row = BITMAP_NO_XOR_ROW;
+
+		if (stored->xor_offset)
+			xor_row = table_row[selected - stored->xor_offset];
+
+		sha1write_be32(f, stored->commit_pos);
+		sha1write_be64(f, offsets[selected]);
+		sha1write_be32(f, xor_row);
+	}
+
+	free(table);
+	free(table_row);
+}
+
 static void write_hash_cache(struct sha1file *f,
 			     struct pack_idx_entry **index,
 			     uint32_t index_nr)
@@ -510,8 +608,10 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 {
 	static uint16_t default_version = 1;
 	static uint16_t flags = BITMAP_OPT_FULL_DAG;
+	uint16_t version = writer.layer ? BITMAP_LAYER_VERSION : default_version;
 	struct strbuf tmp_file = STRBUF_INIT;
 	struct sha1file *f;
+	off_t *offsets = NULL;
 
 	struct bitmap_disk_header header;
 
@@ -520,22 +620,34 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	f = sha1fd(fd, tmp_file.buf);
 
 	memcpy(header.magic, BITMAP_IDX_SIGNATURE, sizeof(BITMAP_IDX_SIGNATURE));
-	header.version = htons(default_version);
+	header.version = htons(version);
 	header.options = htons(flags | options);
 	header.entry_count = htonl(writer.selected_nr);
 	hashcpy(header.checksum, writer.pack_checksum);
 
 	sha1write(f, &header, sizeof(header));
+	if (writer.layer) {
+		struct bitmap_layer_header base;
+
+		hashcpy(base.checksum, writer.base_checksum);
+		base.num_objects = htonl(writer.base_nr);
+		sha1write(f, &base, sizeof(base));
+	}
 	dump_bitmap(f, writer.commits);
 	dump_bitmap(f, writer.trees);
 	dump_bitmap(f, writer.blobs);
 	dump_bitmap(f, writer.tags);
-	write_selected_commits_v1(f, index, index_nr);
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		ALLOC_ARRAY(offsets, writer.selected_nr);
+	write_selected_commits_v1(f, index, index_nr, offsets);
+
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		write_lookup_table(f, offsets);
 
 	if (options & BITMAP_OPT_HASH_CACHE)
 		write_hash_cache(f, index, index_nr);
 
-	sha1close(f, NULL, CSUM_FSYNC);
+	sha1close(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC | CSUM_CLOSE);
 
 	if (adjust_shared_perm(tmp_file.buf))
 		die_errno("unable to make temporary bitmap file readable");
@@ -543,5 +655,6 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	if (rename(tmp_file.buf, filename))
 		die_errno("unable to rename temporary bitmap file to '%s'", filename);
 
+	free(offsets);
 	strbuf_release(&tmp_file);
 }
@@ -10,6 +10,7 @@
 #include "pack-revindex.h"
 #include "pack-objects.h"
 #include "packfile.h"
+#include "list-objects-filter-options.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -22,34 +23,67 @@ struct stored_bitmap {
 	int flags;
 };
 
+/*
+ * A bitmap file.  The first one is for a pack with full closure; each
+ * next one is a "layer" for a pack holding objects added on top of the
+ * packs below it.  The bits for the objects of a layer come after those
+ * of the packs below, and its bitmaps cover these packs too.
+ */
+struct bitmap_layer {
+	/* Packfile to which this bitmap file belongs to */
+	struct packed_git *pack;
+
+	/* mmapped buffer of the whole bitmap file */
+	unsigned char *map;
+	size_t map_size; /* size of the mmaped buffer */
+	size_t map_pos; /* current position when loading the file */
+
+	/* Number of bitmapped commits in this file */
+	uint32_t entry_count;
+
+	/* Name-hash cache (or NULL if not present). */
+	uint32_t *hashes;
+
+	/*
+	 * Lookup table (or NULL if not present).  With it, the bitmaps
+	 * are only read when asked for.
+	 */
+	unsigned char *table;
+
+	/* Bit position of the first object of the pack */
+	uint32_t offset;
+
+	/* Checksum of the pack, and of the pack below it for a layer */
+	unsigned char checksum[20];
+	unsigned char base_checksum[20];
+	uint32_t base_objects;
+
+	/* Version of the bitmap file */
+	unsigned int version;
+	unsigned is_layer : 1;
+};
+
 /*
  * The currently active bitmap index. By design, repositories only have
  * a single bitmap index available (the index for the biggest packfile in
- * the repository), since bitmap indexes need full closure.
+ * the repository, possibly with layers on top), since bitmap indexes need
+ * full closure.
  *
  * If there is more than one bitmap index available (e.g. because of alternates),
  * the active bitmap index is the largest one.
  */
 static struct bitmap_index {
-	/* Packfile to which this bitmap index belongs to */
-	struct packed_git *pack;
-
-	/*
-	 * Mark the first `reuse_objects` in the packfile as reused:
-	 * they will be sent as-is without using them for repacking
-	 * calculations
-	 */
-	uint32_t reuse_objects;
+	/* The bitmap files, from the one with full closure up */
+	struct bitmap_layer *layers;
+	int nr_layers, alloc_layers;
 
-	/* mmapped buffer of the whole bitmap index */
-	unsigned char *map;
-	size_t map_size; /* size of the mmaped buffer */
-	size_t map_pos; /* current position when loading the index */
+	/* Number of objects in the packs of all layers */
+	uint32_t num_objects;
 
 	/*
 	 * Type indexes.
 	 *
-	 * Each bitmap marks which objects in the packfile  are of the given
+	 * Each bitmap marks which objects in the packfiles are of the given
 	 * type. This provides type information when yielding the objects from
 	 * the packfile during a walk, which allows for better delta bases.
 	 */
@@ -64,15 +98,12 @@ static struct bitmap_index {
 	/* Number of bitmapped commits */
 	uint32_t entry_count;
 
-	/* Name-hash cache (or NULL if not present). */
-	uint32_t *hashes;
-
 	/*
 	 * Extended index.
 	 *
 	 * When trying to perform bitmap operations with objects that are not
-	 * packed in `pack`, these objects are added to this "fake index" and
-	 * are assumed to appear at the end of the packfile for all operations
+	 * packed in the bitmapped packs, these objects are added to this "fake
+	 * index" and are assumed to appear after them for all operations
 	 */
 	struct eindex {
 		struct object **objects;
@@ -114,13 +145,13 @@ static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
  * Read a bitmap from the current read position on the mmaped
  * index, and increase the read position accordingly
  */
-static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
+static struct ewah_bitmap *read_bitmap_1(struct bitmap_layer *layer)
 {
 	struct ewah_bitmap *b = ewah_pool_new();
 
 	int bitmap_size = ewah_read_mmap(b,
-		index->map + index->map_pos,
-		index->map_size - index->map_pos);
+		layer->map + layer->map_pos,
+		layer->map_size - layer->map_pos);
 
 	if (bitmap_size < 0) {
 		error("Failed to load bitmap index (corrupted?)");
@@ -128,23 +159,38 @@ static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
 		return NULL;
 	}
 
-	index->map_pos += bitmap_size;
+	layer->map_pos += bitmap_size;
 	return b;
 }
 
-static int load_bitmap_header(struct bitmap_index *index)
+static int load_bitmap_header(struct bitmap_layer *layer)
 {
-	struct bitmap_disk_header *header = (void *)index->map;
+	struct bitmap_disk_header *header = (void *)layer->map;
+	unsigned int version;
+	size_t header_size = sizeof(*header);
 
-	if (index->map_size < sizeof(*header) + 20)
+	if (layer->map_size < sizeof(*header) + 20)
 		return error("Corrupted bitmap index (missing header data)");
 
 	if (memcmp(header->magic, BITMAP_IDX_SIGNATURE, sizeof(BITMAP_IDX_SIGNATURE)) != 0)
 		return error("Corrupted bitmap index file (wrong header)");
 
-	index->version = ntohs(header->version);
-	if (index->version != 1)
-		return error("Unsupported version for bitmap index file (%d)", index->version);
+	version = ntohs(header->version);
+	if (version != 1 && version != BITMAP_LAYER_VERSION)
+		return error("Unsupported version for bitmap index file (%d)", version);
+
+	if (version == BITMAP_LAYER_VERSION) {
+		struct bitmap_layer_header *base = (void *)(header + 1);
+
+		header_size += sizeof(*base);
+		if (layer->map_size < header_size + 20)
+			return error("Corrupted bitmap index (missing header data)");
+		layer->is_layer = 1;
+		hashcpy(layer->base_checksum, base->checksum);
+		layer->base_objects = ntohl(base->num_objects);
+	}
+
+	layer->entry_count = ntohl(header->entry_count);
 
 	/* Parse known bitmap format options */
 	{
@@ -155,13 +201,27 @@ static int load_bitmap_header(struct bitmap_index *index)
 				"(Git requires BITMAP_OPT_FULL_DAG)");
 
 		if (flags & BITMAP_OPT_HASH_CACHE) {
-			unsigned char *end = index->map + index->map_size - 20;
-			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
+			unsigned char *end = layer->map + layer->map_size - 20;
+			layer->hashes = ((uint32_t *)end) - layer->pack->num_objects;
+		}
+
+		if (flags & BITMAP_OPT_LOOKUP_TABLE) {
+			unsigned char *end = layer->hashes ?
+				(unsigned char *)layer->hashes :
+				layer->map + layer->map_size - 20;
+			size_t table_size = st_mult(layer->entry_count,
+						    BITMAP_LOOKUP_ROW_SIZE);
+
+			if (end < layer->map + header_size ||
+			    table_size > end - (layer->map + header_size))
+				return error("Corrupted bitmap index (lookup table too large)");
+			layer->table = end - table_size;
 		}
 	}
 
-	index->entry_count = ntohl(header->entry_count);
-	index->map_pos += sizeof(*header);
+	hashcpy(layer->checksum, header->checksum);
+	layer->version = version;
+	layer->map_pos += header_size;
 	return 0;
 }
 
@@ -209,25 +269,26 @@ static inline uint8_t read_u8(const unsigned char *buffer, size_t *pos)
 
 #define MAX_XOR_OFFSET 160
 
-static int load_bitmap_entries_v1(struct bitmap_index *index)
+static int load_bitmap_entries_v1(struct bitmap_index *index,
+				  struct bitmap_layer *layer)
 {
 	uint32_t i;
 	struct stored_bitmap *recent_bitmaps[MAX_XOR_OFFSET] = { NULL };
 
-	for (i = 0; i < index->entry_count; ++i) {
+	for (i = 0; i < layer->entry_count; ++i) {
 		int xor_offset, flags;
 		struct ewah_bitmap *bitmap = NULL;
 		struct stored_bitmap *xor_bitmap = NULL;
 		uint32_t commit_idx_pos;
 		const unsigned char *sha1;
 
-		commit_idx_pos = read_be32(index->map, &index->map_pos);
-		xor_offset = read_u8(index->map, &index->map_pos);
-		flags = read_u8(index->map, &index->map_pos);
+		commit_idx_pos = read_be32(layer->map, &layer->map_pos);
+		xor_offset = read_u8(layer->map, &layer->map_pos);
+		flags = read_u8(layer->map, &layer->map_pos);
 
-		sha1 = nth_packed_object_sha1(index->pack, commit_idx_pos);
+		sha1 = nth_packed_object_sha1(layer->pack, commit_idx_pos);
 
-		bitmap = read_bitmap_1(index);
+		bitmap = read_bitmap_1(layer);
 		if (!bitmap)
 			return -1;
 
@@ -248,6 +309,157 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 	return 0;
 }
 
+/*
+ * Read the entry of the given row of the lookup table of "layer", and
+ * those it is xor'ed with, into the index.
+ */
+static struct stored_bitmap *load_bitmap_row(struct bitmap_layer *layer,
+					     uint32_t row)
+{
+	struct stored_bitmap *xor_bitmap = NULL;
+	uint32_t *chain = NULL;
+	size_t chain_nr = 0, chain_alloc = 0;
+
+	/*
+	 * Follow the xor rows down to an entry that is already loaded, or
+	 * that is not xor'ed, then load them back up.
+	 */
+	for (;;) {
+		const unsigned char *p = layer->table + st_mult(row, BITMAP_LOOKUP_ROW_SIZE);
+		const unsigned char *sha1;
+		khiter_t pos;
+
+		if (row >= layer->entry_count || chain_nr > layer->entry_count) {
+			error("Corrupted bitmap lookup table");
+			goto out;
+		}
+
+		sha1 = nth_packed_object_sha1(layer->pack, get_be32(p));
+		if (!sha1) {
+			error("Corrupted bitmap lookup table");
+			goto out;
+		}
+		pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
+		if (pos < kh_end(bitmap_git.bitmaps)) {
+			xor_bitmap = kh_value(bitmap_git.bitmaps, pos);
+			break;
+		}
+
+		ALLOC_GROW(chain, chain_nr + 1, chain_alloc);
+		chain[chain_nr++] = row;
+		row = get_be32(p + 12);
+		if (row == BITMAP_NO_XOR_ROW)
+			break;
+	}
+
+	while (chain_nr--) {
+		const unsigned char *p =
+			layer->table + st_mult(chain[chain_nr], BITMAP_LOOKUP_ROW_SIZE);
+		uint32_t commit_pos = get_be32(p);
+		uint64_t offset = get_be64(p + 4);
+		struct ewah_bitmap *bitmap;
+		int flags;
+
+		if (offset > layer->map_size - 20 - 6 ||
+		    get_be32(layer->map + offset) != commit_pos) {
+			error("Corrupted bitmap lookup table");
+			xor_bitmap = NULL;
+			goto out;
+		}
+
+		layer->map_pos = offset + 4 + 1;
+		flags = read_u8(layer->map, &layer->map_pos);
+		bitmap = read_bitmap_1(layer);
+		if (!bitmap) {
+			xor_bitmap = NULL;
+			goto out;
+		}
+
+		xor_bitmap = store_bitmap(&bitmap_git, bitmap,
+					  nth_packed_object_sha1(layer->pack, commit_pos),
+					  xor_bitmap, flags);
+	}
+
+out:
+	free(chain);
+	return xor_bitmap;
+}
+
+/*
+ * Find the row of the lookup table of "layer" for the commit "sha1";
+ * the rows are in the order of the pack index, which is sorted.
+ */
+static int find_bitmap_row(struct bitmap_layer *layer, const unsigned char *sha1)
+{
+	uint32_t lo = 0, hi = layer->entry_count;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *p = layer->table + st_mult(mi, BITMAP_LOOKUP_ROW_SIZE);
+		const unsigned char *row_sha1 =
+			nth_packed_object_sha1(layer->pack, get_be32(p));
+		int cmp;
+
+		if (!row_sha1)
+			return -1;
+		cmp = hashcmp(row_sha1, sha1);
+		if (!cmp)
+			return mi;
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return -1;
+}
+
+/*
+ * Return the bitmap of the commit "sha1" (or NULL if it has none),
+ * reading it from the lookup tables if it was not loaded yet.
+ */
+static struct ewah_bitmap *bitmap_for_commit(const unsigned char *sha1)
+{
+	khiter_t pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
+	int i;
+
+	if (pos < kh_end(bitmap_git.bitmaps))
+		return lookup_stored_bitmap(kh_value(bitmap_git.bitmaps, pos));
+
+	for (i = 0; i < bitmap_git.nr_layers; i++) {
+		struct bitmap_layer *layer = &bitmap_git.layers[i];
+		struct stored_bitmap *st;
+		int row;
+
+		if (!layer->table)
+			continue;
+		row = find_bitmap_row(layer, sha1);
+		if (row < 0)
+			continue;
+		st = load_bitmap_row(layer, row);
+		return st ? lookup_stored_bitmap(st) : NULL;
+	}
+	return NULL;
+}
+
+/* Read all the bitmaps that are not loaded yet */
+static int load_all_bitmap_rows(void)
+{
+	int i;
+	uint32_t row;
+
+	for (i = 0; i < bitmap_git.nr_layers; i++) {
+		struct bitmap_layer *layer = &bitmap_git.layers[i];
+
+		if (!layer->table)
+			continue;
+		for (row = 0; row < layer->entry_count; row++)
+			if (!load_bitmap_row(layer, row))
+				return -1;
+		layer->table = NULL;
+	}
+	return 0;
+}
+
 static char *pack_bitmap_filename(struct packed_git *p)
 {
 	size_t len;
@@ -257,7 +469,15 @@ static char *pack_bitmap_filename(struct packed_git *p)
 	return xstrfmt("%.*s.bitmap", (int)len, p->pack_name);
 }
 
-static int open_pack_bitmap_1(struct packed_git *packfile)
+static void close_bitmap_layer(struct bitmap_layer *layer)
+{
+	munmap(layer->map, layer->map_size);
+	layer->map = NULL;
+	layer->map_size = 0;
+}
+
+static int open_pack_bitmap_1(struct packed_git *packfile,
+			      struct bitmap_layer *layer)
 {
 	int fd;
 	struct stat st;
@@ -278,69 +498,151 @@ static int open_pack_bitmap_1(struct packed_git *packfile)
 		return -1;
 	}
 
-	if (bitmap_git.pack) {
-		warning("ignoring extra bitmap file: %s", packfile->pack_name);
-		close(fd);
-		return -1;
-	}
-
-	bitmap_git.pack = packfile;
-	bitmap_git.map_size = xsize_t(st.st_size);
-	bitmap_git.map = xmmap(NULL, bitmap_git.map_size, PROT_READ, MAP_PRIVATE, fd, 0);
-	bitmap_git.map_pos = 0;
+	memset(layer, 0, sizeof(*layer));
+	layer->pack = packfile;
+	layer->map_size = xsize_t(st.st_size);
+	layer->map = xmmap(NULL, layer->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	layer->map_pos = 0;
 	close(fd);
 
-	if (load_bitmap_header(&bitmap_git) < 0) {
-		munmap(bitmap_git.map, bitmap_git.map_size);
-		bitmap_git.map = NULL;
-		bitmap_git.map_size = 0;
+	if (load_bitmap_header(layer) < 0) {
+		close_bitmap_layer(layer);
 		return -1;
 	}
 
 	return 0;
 }
 
+static void close_pack_bitmap(void)
+{
+	int i;
+
+	for (i = 0; i < bitmap_git.nr_layers; i++)
+		close_bitmap_layer(&bitmap_git.layers[i]);
+	bitmap_git.nr_layers = 0;
+	bitmap_git.num_objects = 0;
+}
+
 static int load_pack_bitmap(void)
 {
-	assert(bitmap_git.map && !bitmap_git.loaded);
+	int i;
+
+	assert(bitmap_git.nr_layers && !bitmap_git.loaded);
 
 	bitmap_git.bitmaps = kh_init_sha1();
 	bitmap_git.ext_index.positions = kh_init_sha1_pos();
-	load_pack_revindex(bitmap_git.pack);
 
-	if (!(bitmap_git.commits = read_bitmap_1(&bitmap_git)) ||
-		!(bitmap_git.trees = read_bitmap_1(&bitmap_git)) ||
-		!(bitmap_git.blobs = read_bitmap_1(&bitmap_git)) ||
-		!(bitmap_git.tags = read_bitmap_1(&bitmap_git)))
-		goto failed;
+	for (i = 0; i < bitmap_git.nr_layers; i++) {
+		struct bitmap_layer *layer = &bitmap_git.layers[i];
 
-	if (load_bitmap_entries_v1(&bitmap_git) < 0)
-		goto failed;
+		load_pack_revindex(layer->pack);
 
+		/* the type indexes of the top layer cover all the others */
+		if (bitmap_git.commits) {
+			ewah_pool_free(bitmap_git.commits);
+			ewah_pool_free(bitmap_git.trees);
+			ewah_pool_free(bitmap_git.blobs);
+			ewah_pool_free(bitmap_git.tags);
+		}
+		if (!(bitmap_git.commits = read_bitmap_1(layer)) ||
+			!(bitmap_git.trees = read_bitmap_1(layer)) ||
+			!(bitmap_git.blobs = read_bitmap_1(layer)) ||
+			!(bitmap_git.tags = read_bitmap_1(layer)))
+			goto failed;
+
+		/* with a lookup table, the entries are read when needed */
+		if (!layer->table &&
+		    load_bitmap_entries_v1(&bitmap_git, layer) < 0)
+			goto failed;
+		bitmap_git.entry_count += layer->entry_count;
+	}
+
+	bitmap_git.version = bitmap_git.layers[bitmap_git.nr_layers - 1].version;
 	bitmap_git.loaded = 1;
 	return 0;
 
 failed:
-	munmap(bitmap_git.map, bitmap_git.map_size);
-	bitmap_git.map = NULL;
-	bitmap_git.map_size = 0;
+	close_pack_bitmap();
 	return -1;
 }
 
+/*
+ * Stack the layers found among "candidates" on top of the bitmap with
+ * full closure, each on the pack it was written for.
+ */
+static void stack_bitmap_layers(struct bitmap_layer *candidates, int nr)
+{
+	int i;
+
+	for (;;) {
+		struct bitmap_layer *top =
+			&bitmap_git.layers[bitmap_git.nr_layers - 1];
+		struct bitmap_layer *next = NULL;
+
+		for (i = 0; i < nr && !next; i++) {
+			if (candidates[i].map && candidates[i].is_layer &&
+			    !hashcmp(candidates[i].base_checksum, top->checksum))
+				next = &candidates[i];
+		}
+		if (!next)
+			break;
+		if (next->base_objects != bitmap_git.num_objects) {
+			error("bitmap layer does not match its base: %s",
+			      next->pack->pack_name);
+			close_bitmap_layer(next);
+			break;
+		}
+
+		next->offset = bitmap_git.num_objects;
+		bitmap_git.num_objects += next->pack->num_objects;
+		ALLOC_GROW(bitmap_git.layers, bitmap_git.nr_layers + 1,
+			   bitmap_git.alloc_layers);
+		bitmap_git.layers[bitmap_git.nr_layers++] = *next;
+		next->map = NULL;
+	}
+}
+
 static int open_pack_bitmap(void)
 {
 	struct packed_git *p;
-	int ret = -1;
+	struct bitmap_layer *candidates = NULL;
+	int i, nr = 0, alloc = 0;
 
-	assert(!bitmap_git.map && !bitmap_git.loaded);
+	assert(!bitmap_git.nr_layers && !bitmap_git.loaded);
 
 	prepare_packed_git();
 	for (p = packed_git; p; p = p->next) {
-		if (open_pack_bitmap_1(p) == 0)
-			ret = 0;
+		ALLOC_GROW(candidates, nr + 1, alloc);
+		if (open_pack_bitmap_1(p, &candidates[nr]))
+			continue;
+		if (candidates[nr].is_layer) {
+			nr++;
+			continue;
+		}
+		if (bitmap_git.nr_layers) {
+			warning("ignoring extra bitmap file: %s", p->pack_name);
+			close_bitmap_layer(&candidates[nr]);
+			continue;
+		}
+		ALLOC_GROW(bitmap_git.layers, 1, bitmap_git.alloc_layers);
+		bitmap_git.layers[0] = candidates[nr];
+		bitmap_git.nr_layers = 1;
+		bitmap_git.num_objects = p->num_objects;
+	}
+
+	if (bitmap_git.nr_layers)
+		stack_bitmap_layers(candidates, nr);
+
+	for (i = 0; i < nr; i++) {
+		if (!candidates[i].map)
+			continue;
+		warning("ignoring extra bitmap file: %s",
+			candidates[i].pack->pack_name);
+		close_bitmap_layer(&candidates[i]);
 	}
+	free(candidates);
 
-	return ret;
+	return bitmap_git.nr_layers ? 0 : -1;
 }
 
 int prepare_bitmap_git(void)
@@ -366,7 +668,7 @@ static inline int bitmap_position_extended(const unsigned char *sha1)
 
 	if (pos < kh_end(positions)) {
 		int bitmap_pos = kh_value(positions, pos);
-		return bitmap_pos + bitmap_git.pack->num_objects;
+		return bitmap_pos + bitmap_git.num_objects;
 	}
 
 	return -1;
@@ -374,11 +676,27 @@ static inline int bitmap_position_extended(const unsigned char *sha1)
 
 static inline int bitmap_position_packfile(const unsigned char *sha1)
 {
-	off_t offset = find_pack_entry_one(sha1, bitmap_git.pack);
-	if (!offset)
-		return -1;
+	int i;
+
+	for (i = 0; i < bitmap_git.nr_layers; i++) {
+		struct bitmap_layer *layer = &bitmap_git.layers[i];
+		off_t offset = find_pack_entry_one(sha1, layer->pack);
+		if (offset)
+			return layer->offset +
+				find_revindex_position(layer->pack, offset);
+	}
 
-	return find_revindex_position(bitmap_git.pack, offset);
+	return -1;
+}
+
+/* Find the layer whose pack holds the object at bit "pos" */
+static struct bitmap_layer *layer_for_position(uint32_t pos)
+{
+	int i = bitmap_git.nr_layers;
+
+	while (--i > 0 && bitmap_git.layers[i].offset > pos)
+		; /* nothing */
+	return &bitmap_git.layers[i];
 }
 
 static int bitmap_position(const unsigned char *sha1)
@@ -412,7 +730,7 @@ static int ext_index_add_object(struct object *object, const char *name)
 		bitmap_pos = kh_value(eindex->positions, hash_pos);
 	}
 
-	return bitmap_pos + bitmap_git.pack->num_objects;
+	return bitmap_pos + bitmap_git.num_objects;
 }
 
 static void show_object(struct object *object, const char *name, void *data)
@@ -436,7 +754,7 @@ static int add_to_include_set(struct include_data *data,
 			      const unsigned char *sha1,
 			      int bitmap_pos)
 {
-	khiter_t hash_pos;
+	struct ewah_bitmap *bitmap;
 
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
@@ -444,10 +762,9 @@ static int add_to_include_set(struct include_data *data,
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	hash_pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
-	if (hash_pos < kh_end(bitmap_git.bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, hash_pos);
-		bitmap_or_ewah(data->base, lookup_stored_bitmap(st));
+	bitmap = bitmap_for_commit(sha1);
+	if (bitmap) {
+		bitmap_or_ewah(data->base, bitmap);
 		return 0;
 	}
 
@@ -500,12 +817,9 @@ static struct bitmap *find_objects(struct rev_info *revs,
 		roots = roots->next;
 
 		if (object->type == OBJ_COMMIT) {
-			khiter_t pos = kh_get_sha1(bitmap_git.bitmaps, object->oid.hash);
-
-			if (pos < kh_end(bitmap_git.bitmaps)) {
-				struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, pos);
-				struct ewah_bitmap *or_with = lookup_stored_bitmap(st);
+			struct ewah_bitmap *or_with = bitmap_for_commit(object->oid.hash);
 
+			if (or_with) {
 				if (base == NULL)
 					base = ewah_to_bitmap(or_with);
 				else
@@ -583,7 +897,7 @@ static void show_extended_objects(struct bitmap *objects,
 	for (i = 0; i < eindex->count; ++i) {
 		struct object *obj;
 
-		if (!bitmap_get(objects, bitmap_git.pack->num_objects + i))
+		if (!bitmap_get(objects, bitmap_git.num_objects + i))
 			continue;
 
 		obj = eindex->objects[i];
@@ -603,9 +917,6 @@ static void show_objects_for_type(
 	struct ewah_iterator it;
 	eword_t filter;
 
-	if (bitmap_git.reuse_objects == bitmap_git.pack->num_objects)
-		return;
-
 	ewah_iterator_init(&it, type_filter);
 
 	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
@@ -613,7 +924,8 @@ static void show_objects_for_type(
 
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
 			struct object_id oid;
-			struct revindex_entry *entry;
+			struct bitmap_layer *layer;
+			uint32_t pack_pos, index_pos;
 			uint32_t hash = 0;
 
 			if ((word >> offset) == 0)
@@ -621,16 +933,16 @@ static void show_objects_for_type(
 
 			offset += ewah_bit_ctz64(word >> offset);
 
-			if (pos + offset < bitmap_git.reuse_objects)
-				continue;
-
-			entry = &bitmap_git.pack->revindex[pos + offset];
-			nth_packed_object_oid(&oid, bitmap_git.pack, entry->nr);
+			layer = layer_for_position(pos + offset);
+			pack_pos = pos + offset - layer->offset;
+			index_pos = pack_pos_to_index(layer->pack, pack_pos);
+			nth_packed_object_oid(&oid, layer->pack, index_pos);
 
-			if (bitmap_git.hashes)
-				hash = get_be32(bitmap_git.hashes + entry->nr);
+			if (layer->hashes)
+				hash = get_be32(layer->hashes + index_pos);
 
-			show_reach(&oid, object_type, 0, hash, bitmap_git.pack, entry->offset);
+			show_reach(&oid, object_type, 0, hash, layer->pack,
+				   pack_pos_to_offset(layer->pack, pack_pos));
 		}
 
 		pos += BITS_IN_EWORD;
@@ -640,18 +952,143 @@ static void show_objects_for_type(
 
 static int in_bitmapped_pack(struct object_list *roots)
 {
+	int i;
+
 	while (roots) {
 		struct object *object = roots->item;
 		roots = roots->next;
 
-		if (find_pack_entry_one(object->oid.hash, bitmap_git.pack) > 0)
-			return 1;
+		for (i = 0; i < bitmap_git.nr_layers; i++)
+			if (find_pack_entry_one(object->oid.hash,
+						bitmap_git.layers[i].pack) > 0)
+				return 1;
 	}
 
 	return 0;
 }
 
-int prepare_bitmap_walk(struct rev_info *revs)
+/*
+ * Drop all objects of the given type from the bitmap.
+ */
+static void filter_bitmap_exclude_type(struct bitmap *to_filter,
+				       struct ewah_bitmap *type_filter,
+				       enum object_type type)
+{
+	struct eindex *eindex = &bitmap_git.ext_index;
+	struct ewah_iterator it;
+	eword_t mask;
+	uint32_t i;
+
+	ewah_iterator_init(&it, type_filter);
+	for (i = 0; i < to_filter->word_alloc && ewah_iterator_next(&mask, &it); i++)
+		to_filter->words[i] &= ~mask;
+
+	for (i = 0; i < eindex->count; i++) {
+		if (eindex->objects[i]->type == type)
+			bitmap_clear(to_filter, bitmap_git.num_objects + i);
+	}
+}
+
+/*
+ * Return 1 if the blob at bitmap position "pos" is at least "limit"
+ * bytes.  A blob whose size cannot be found is kept, as the traversal
+ * filter would.
+ */
+static int blob_over_limit(uint32_t pos, unsigned long limit)
+{
+	struct object_info oi = OBJECT_INFO_INIT;
+	unsigned long size;
+
+	oi.sizep = &size;
+	if (pos < bitmap_git.num_objects) {
+		struct bitmap_layer *layer = layer_for_position(pos);
+		off_t offset = pack_pos_to_offset(layer->pack, pos - layer->offset);
+		if (packed_object_info(layer->pack, offset, &oi) < 0)
+			return 0;
+	} else {
+		struct object *obj =
+			bitmap_git.ext_index.objects[pos - bitmap_git.num_objects];
+		if (sha1_object_info_extended(obj->oid.hash, &oi, 0) < 0)
+			return 0;
+	}
+	return size >= limit;
+}
+
+/*
+ * Drop the blobs of "limit" bytes or more from the bitmap.  Only the
+ * blobs that are set need their size looked up, and for a packed blob
+ * that is read from its (delta) header.
+ */
+static void filter_bitmap_blob_limit(struct bitmap *to_filter,
+				     unsigned long limit)
+{
+	struct eindex *eindex = &bitmap_git.ext_index;
+	struct ewah_iterator it;
+	eword_t mask;
+	uint32_t i, offset;
+
+	ewah_iterator_init(&it, bitmap_git.blobs);
+	for (i = 0; i < to_filter->word_alloc && ewah_iterator_next(&mask, &it); i++) {
+		eword_t word = to_filter->words[i] & mask;
+
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			uint32_t pos;
+
+			if ((word >> offset) == 0)
+				break;
+
+			offset += ewah_bit_ctz64(word >> offset);
+			pos = i * BITS_IN_EWORD + offset;
+			if (blob_over_limit(pos, limit))
+				bitmap_clear(to_filter, pos);
+		}
+	}
+
+	for (i = 0; i < eindex->count; i++) {
+		uint32_t pos = bitmap_git.num_objects + i;
+
+		if (eindex->objects[i]->type == OBJ_BLOB &&
+		    bitmap_get(to_filter, pos) &&
+		    blob_over_limit(pos, limit))
+			bitmap_clear(to_filter, pos);
+	}
+}
+
+/*
+ * Apply "filter" to the result of a walk.  Returns -1 if it cannot be
+ * done with bitmaps; the caller then has to do a filtered traversal.
+ */
+static int filter_bitmap(struct list_objects_filter_options *filter,
+			 struct bitmap *to_filter)
+{
+	if (!filter || filter->choice == LOFC_DISABLED)
+		return 0;
+
+	if (filter->choice == LOFC_BLOB_NONE) {
+		if (to_filter)
+			filter_bitmap_exclude_type(to_filter, bitmap_git.blobs,
+						   OBJ_BLOB);
+		return 0;
+	}
+
+	if (filter->choice == LOFC_BLOB_LIMIT) {
+		if (to_filter)
+			filter_bitmap_blob_limit(to_filter,
+						 filter->blob_limit_value);
+		return 0;
+	}
+
+	/* filter choice not handled */
+	return -1;
+}
+
+static int can_filter_bitmap(struct list_objects_filter_options *filter)
+{
+	return !filter_bitmap(filter, NULL);
+}
+
+int prepare_bitmap_walk(struct rev_info *revs,
+			struct list_objects_filter_options *filter)
 {
 	unsigned int i;
 
@@ -661,6 +1098,9 @@ int prepare_bitmap_walk(struct rev_info *revs)
 	struct bitmap *wants_bitmap = NULL;
 	struct bitmap *haves_bitmap = NULL;
 
+	if (!can_filter_bitmap(filter))
+		return -1;
+
 	if (!bitmap_git.loaded) {
 		/* try to open a bitmapped pack, but don't parse it yet
 		 * because we may not need to use it */
@@ -733,70 +1173,130 @@ int prepare_bitmap_walk(struct rev_info *revs)
 	if (haves_bitmap)
 		bitmap_and_not(wants_bitmap, haves_bitmap);
 
+	filter_bitmap(filter, wants_bitmap);
+
 	bitmap_git.result = wants_bitmap;
 
 	bitmap_free(haves_bitmap);
 	return 0;
 }
 
-int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
-				       uint32_t *entries,
-				       off_t *up_to)
+static void try_partial_reuse(size_t pos,
+			      struct bitmap *reuse,
+			      struct pack_window **w_curs)
 {
+	struct packed_git *pack = bitmap_git.layers[0].pack;
+	off_t offset, obj_offset;
+	enum object_type type;
+	unsigned long size;
+
+	if (pos >= pack->num_objects)
+		return; /* not actually in the pack */
+
+	offset = obj_offset = pack_pos_to_offset(pack, pos);
+	type = unpack_object_header(pack, w_curs, &offset, &size);
+	if (type < 0)
+		return; /* broken packfile, punt */
+
+	if (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA) {
+		off_t base_offset;
+		int base_pos;
+
+		/*
+		 * Find the position of the base object so we can look it up
+		 * in our bitmaps. If we can't come up with an offset, or if
+		 * that offset is not in the revidx, the pack is corrupt.
+		 * There's nothing we can do, so just punt on this object,
+		 * and the normal slow path will complain about it in
+		 * more detail.
+		 */
+		base_offset = get_delta_base(pack, w_curs, &offset, type,
+					     obj_offset);
+		if (!base_offset)
+			return;
+		base_pos = find_revindex_position(pack, base_offset);
+		if (base_pos < 0)
+			return;
+
+		/*
+		 * We assume delta dependencies always point backwards, which
+		 * lets us decide in a single pass. This is always true for
+		 * OFS_DELTA, and a pack we wrote a bitmap for will rarely
+		 * have a REF_DELTA, but check anyway.
+		 */
+		if (base_pos >= pos)
+			return;
+
+		/*
+		 * If we are not sending the base verbatim too, leave this
+		 * object to the normal object_entry code path, which can
+		 * send it against whatever base it ends up with.
+		 */
+		if (!bitmap_get(reuse, base_pos))
+			return;
+	}
+
 	/*
-	 * Reuse the packfile content if we need more than
-	 * 90% of its objects
+	 * If we got here, then the object is OK to reuse. Mark it.
 	 */
-	static const double REUSE_PERCENT = 0.9;
+	bitmap_set(reuse, pos);
+}
 
+int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
+				       uint32_t *entries,
+				       struct bitmap **reuse_out)
+{
 	struct bitmap *result = bitmap_git.result;
-	uint32_t reuse_threshold;
-	uint32_t i, reuse_objects = 0;
+	struct bitmap *reuse;
+	struct pack_window *w_curs = NULL;
+	size_t i = 0;
+	uint32_t offset;
 
 	assert(result);
 
-	for (i = 0; i < result->word_alloc; ++i) {
-		if (result->words[i] != (eword_t)~0) {
-			reuse_objects += ewah_bit_ctz64(~result->words[i]);
-			break;
-		}
-
-		reuse_objects += BITS_IN_EWORD;
-	}
+	/*
+	 * Whole words of wanted objects at the start of the pack can be
+	 * sent without looking at them: every delta in there has its base
+	 * earlier in the same run.
+	 */
+	while (i < result->word_alloc && result->words[i] == (eword_t)~0)
+		i++;
 
-#ifdef GIT_BITMAP_DEBUG
-	{
-		const unsigned char *sha1;
-		struct revindex_entry *entry;
+	/* Don't mark objects not in the packfile (of the bottom layer) */
+	if (i > bitmap_git.layers[0].pack->num_objects / BITS_IN_EWORD)
+		i = bitmap_git.layers[0].pack->num_objects / BITS_IN_EWORD;
 
-		entry = &bitmap_git.reverse_index->revindex[reuse_objects];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+	reuse = bitmap_word_alloc(i);
+	memset(reuse->words, 0xFF, i * sizeof(eword_t));
 
-		fprintf(stderr, "Failed to reuse at %d (%016llx)\n",
-			reuse_objects, result->words[i]);
-		fprintf(stderr, " %s\n", sha1_to_hex(sha1));
-	}
-#endif
+	for (; i < result->word_alloc; ++i) {
+		eword_t word = result->words[i];
+		size_t pos = (i * BITS_IN_EWORD);
 
-	if (!reuse_objects)
-		return -1;
+		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
+			if ((word >> offset) == 0)
+				break;
 
-	if (reuse_objects >= bitmap_git.pack->num_objects) {
-		bitmap_git.reuse_objects = *entries = bitmap_git.pack->num_objects;
-		*up_to = -1; /* reuse the full pack */
-		*packfile = bitmap_git.pack;
-		return 0;
+			offset += ewah_bit_ctz64(word >> offset);
+			try_partial_reuse(pos + offset, reuse, &w_curs);
+		}
 	}
 
-	reuse_threshold = bitmap_popcount(bitmap_git.result) * REUSE_PERCENT;
+	unuse_pack(&w_curs);
 
-	if (reuse_objects < reuse_threshold)
+	*entries = bitmap_popcount(reuse);
+	if (!*entries) {
+		bitmap_free(reuse);
 		return -1;
+	}
 
-	bitmap_git.reuse_objects = *entries = reuse_objects;
-	*up_to = bitmap_git.pack->revindex[reuse_objects].offset;
-	*packfile = bitmap_git.pack;
-
+	/*
+	 * Drop any reused objects from the result, since they will not
+	 * need to be handled separately.
+	 */
+	bitmap_and_not(result, reuse);
+	*packfile = bitmap_git.layers[0].pack;
+	*reuse_out = reuse;
 	return 0;
 }
 
@@ -856,7 +1356,7 @@ static uint32_t count_object_type(struct bitmap *objects,
 
 	for (i = 0; i < eindex->count; ++i) {
 		if (eindex->objects[i]->type == type &&
-			bitmap_get(objects, bitmap_git.pack->num_objects + i))
+			bitmap_get(objects, bitmap_git.num_objects + i))
 			count++;
 	}
 
@@ -881,6 +1381,49 @@ void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees,
 		*tags = count_object_type(bitmap_git.result, OBJ_TAG);
 }
 
+uint32_t bitmap_base_objects(unsigned char *checksum)
+{
+	assert(bitmap_git.loaded);
+	hashcpy(checksum, bitmap_git.layers[bitmap_git.nr_layers - 1].checksum);
+	return bitmap_git.num_objects;
+}
+
+int bitmap_has_pack(struct packed_git *p)
+{
+	int i;
+
+	for (i = 0; i < bitmap_git.nr_layers; i++)
+		if (bitmap_git.layers[i].pack == p)
+			return 1;
+	return 0;
+}
+
+int bitmap_base_position(const unsigned char *sha1)
+{
+	return bitmap_position_packfile(sha1);
+}
+
+struct ewah_bitmap *bitmap_base_for_commit(const unsigned char *sha1)
+{
+	return bitmap_for_commit(sha1);
+}
+
+struct ewah_bitmap *bitmap_base_type_index(enum object_type type)
+{
+	switch (type) {
+	case OBJ_COMMIT:
+		return bitmap_git.commits;
+	case OBJ_TREE:
+		return bitmap_git.trees;
+	case OBJ_BLOB:
+		return bitmap_git.blobs;
+	case OBJ_TAG:
+		return bitmap_git.tags;
+	default:
+		die("BUG: no type index for object type %d", type);
+	}
+}
+
 struct bitmap_test_data {
 	struct bitmap *base;
 	struct progress *prg;
@@ -918,7 +1461,7 @@ void test_bitmap_walk(struct rev_info *revs)
 {
 	struct object *root;
 	struct bitmap *result = NULL;
-	khiter_t pos;
+	struct ewah_bitmap *bm;
 	size_t result_popcnt;
 	struct bitmap_test_data tdata;
 
@@ -932,12 +1475,9 @@ void test_bitmap_walk(struct rev_info *revs)
 		bitmap_git.version, bitmap_git.entry_count);
 
 	root = revs->pending.objects[0].item;
-	pos = kh_get_sha1(bitmap_git.bitmaps, root->oid.hash);
-
-	if (pos < kh_end(bitmap_git.bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, pos);
-		struct ewah_bitmap *bm = lookup_stored_bitmap(st);
+	bm = bitmap_for_commit(root->oid.hash);
 
+	if (bm) {
 		fprintf(stderr, "Found bitmap for %s. %d bits / %08x checksum\n",
 			oid_to_hex(&root->oid), (int)bm->bit_size, ewah_checksum(bm));
 
@@ -1016,19 +1556,19 @@ int rebuild_existing_bitmaps(struct packing_data *mapping,
 	khiter_t hash_pos;
 	int hash_ret;
 
-	if (prepare_bitmap_git() < 0)
+	if (prepare_bitmap_git() < 0 || load_all_bitmap_rows() < 0)
 		return -1;
 
-	num_objects = bitmap_git.pack->num_objects;
+	num_objects = bitmap_git.num_objects;
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
 		const unsigned char *sha1;
-		struct revindex_entry *entry;
+		struct bitmap_layer *layer = layer_for_position(i);
 		struct object_entry *oe;
 
-		entry = &bitmap_git.pack->revindex[i];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+		sha1 = nth_packed_object_sha1(layer->pack,
+				pack_pos_to_index(layer->pack, i - layer->offset));
 		oe = packlist_find(mapping, sha1, NULL);
 
 		if (oe)
@@ -5,6 +5,8 @@
 #include "khash.h"
 #include "pack-objects.h"
 
+struct list_objects_filter_options;
+
 struct bitmap_disk_header {
 	char magic[4];
 	uint16_t version;
@@ -13,6 +15,17 @@ struct bitmap_disk_header {
 	unsigned char checksum[20];
 };
 
+/*
+ * A bitmap "layer" stacked on the bitmap of another pack is written with
+ * this version, and this header follows the common one.
+ */
+#define BITMAP_LAYER_VERSION 2
+
+struct bitmap_layer_header {
+	unsigned char checksum[20];
+	uint32_t num_objects;
+};
+
 static const char BITMAP_IDX_SIGNATURE[] = {'B', 'I', 'T', 'M'};
 
 #define NEEDS_BITMAP (1u<<22)
@@ -20,8 +33,17 @@ static const char BITMAP_IDX_SIGNATURE[] = {'B', 'I', 'T', 'M'};
 enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 1,
 	BITMAP_OPT_HASH_CACHE = 4,
+	BITMAP_OPT_LOOKUP_TABLE = 16,
 };
 
+/*
+ * A row of the lookup table: the position of the commit in the pack
+ * index, the offset of its entry and the row it is xor'ed with (or
+ * BITMAP_NO_XOR_ROW).
+ */
+#define BITMAP_LOOKUP_ROW_SIZE (4 + 8 + 4)
+#define BITMAP_NO_XOR_ROW 0xffffffff
+
 enum pack_bitmap_flags {
 	BITMAP_FLAG_REUSE = 0x1
 };
@@ -38,11 +60,39 @@ int prepare_bitmap_git(void);
 void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees, uint32_t *blobs, uint32_t *tags);
 void traverse_bitmap_commit_list(show_reachable_fn show_reachable);
 void test_bitmap_walk(struct rev_info *revs);
-int prepare_bitmap_walk(struct rev_info *revs);
-int reuse_partial_packfile_from_bitmap(struct packed_git **packfile, uint32_t *entries, off_t *up_to);
+/*
+ * Compute the objects of the walk described by "revs" with bitmaps.
+ * Objects left out by "filter" (which may be NULL) are dropped from the
+ * result; returns -1 if bitmaps cannot be used, including for a filter
+ * that cannot be applied to them.
+ */
+int prepare_bitmap_walk(struct rev_info *revs,
+			struct list_objects_filter_options *filter);
+/*
+ * Pick the objects of the last walk that can be copied verbatim from
+ * the bitmapped pack: those that are not deltas, and those whose base
+ * is copied too.  They are marked (by pack position) in *reuse_out and
+ * dropped from the walk result.
+ */
+int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
+				       uint32_t *entries,
+				       struct bitmap **reuse_out);
 int rebuild_existing_bitmaps(struct packing_data *mapping, khash_sha1 *reused_bitmaps, int show_progress);
 
+/*
+ * The loaded bitmaps, as the base of a new layer: the number of objects
+ * they cover (and the checksum of the top pack), whether a pack is one
+ * of theirs, the bit position of an object in them (or -1), the bitmap
+ * of a commit (or NULL), and the index of the objects of a type.
+ */
+uint32_t bitmap_base_objects(unsigned char *checksum);
+int bitmap_has_pack(struct packed_git *p);
+int bitmap_base_position(const unsigned char *sha1);
+struct ewah_bitmap *bitmap_base_for_commit(const unsigned char *sha1);
+struct ewah_bitmap *bitmap_base_type_index(enum object_type type);
+
 void bitmap_writer_show_progress(int show);
+int bitmap_writer_init_layer(void);
 void bitmap_writer_set_checksum(unsigned char *sha1);
 void bitmap_writer_build_type_index(struct pack_idx_entry **index, uint32_t index_nr);
 void bitmap_writer_reuse_bitmaps(struct packing_data *to_pack);
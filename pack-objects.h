@@ -40,6 +40,9 @@ struct object_entry {
 		DFS_DONE
 	} dfs_state;
 	int depth;
+
+	/* deepest path at which this tree was seen, for delta islands */
+	unsigned tree_depth;
 };
 
 struct packing_data {
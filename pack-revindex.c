@@ -1,5 +1,7 @@
 #include "cache.h"
 #include "pack-revindex.h"
+#include "packfile.h"
+#include "config.h"
 
 /*
  * Pack index for existing packs give us easy access to the offsets into
@@ -157,23 +159,141 @@ static void create_pack_revindex(struct packed_git *p)
 	sort_revindex(p->revindex, num_ent, p->pack_size);
 }
 
+static char *pack_revindex_filename(struct packed_git *p)
+{
+	size_t len;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		die("BUG: pack_name does not end in .pack");
+	return xstrfmt("%.*s.rev", (int)len, p->pack_name);
+}
+
+/*
+ * Map the ".rev" file of the pack, if it has a usable one.
+ */
+static int load_pack_revindex_from_disk(struct packed_git *p)
+{
+	char *rev_name;
+	int fd;
+	struct stat st;
+	size_t size;
+	const unsigned char *map;
+	const unsigned char *idx_trailer;
+	uint32_t i;
+
+	if (open_pack_index(p))
+		return -1;
+
+	rev_name = pack_revindex_filename(p);
+	fd = git_open(rev_name);
+	if (fd < 0) {
+		free(rev_name);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(rev_name);
+		return -1;
+	}
+
+	size = xsize_t(st.st_size);
+	if (size != RIDX_HEADER_SIZE + st_mult(p->num_objects, 4) + 2 * 20) {
+		close(fd);
+		error("reverse index file %s has wrong size", rev_name);
+		free(rev_name);
+		return -1;
+	}
+
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	/* the pack checksum is the first of the two in the .idx trailer */
+	idx_trailer = (const unsigned char *)p->index_data + p->index_size - 2 * 20;
+	if (get_be32(map) != RIDX_SIGNATURE ||
+	    get_be32(map + 4) != RIDX_VERSION ||
+	    get_be32(map + 8) != 1 ||
+	    hashcmp(map + size - 2 * 20, idx_trailer)) {
+		munmap((void *)map, size);
+		error("reverse index file %s is corrupt", rev_name);
+		free(rev_name);
+		return -1;
+	}
+
+	/*
+	 * Callers index the .idx with these entries without further
+	 * checks, so make sure none of them points past its end.
+	 */
+	for (i = 0; i < p->num_objects; i++) {
+		if (get_be32(map + RIDX_HEADER_SIZE + st_mult(i, 4)) >=
+		    p->num_objects) {
+			munmap((void *)map, size);
+			error("reverse index file %s has out-of-range entry",
+			      rev_name);
+			free(rev_name);
+			return -1;
+		}
+	}
+
+	free(rev_name);
+	p->revindex_map = map;
+	p->revindex_size = size;
+	p->revindex_data = (const uint32_t *)(map + RIDX_HEADER_SIZE);
+	return 0;
+}
+
 void load_pack_revindex(struct packed_git *p)
 {
-	if (!p->revindex)
-		create_pack_revindex(p);
+	if (p->revindex || p->revindex_data)
+		return;
+	if (!load_pack_revindex_from_disk(p))
+		return;
+	if (git_env_bool("GIT_TEST_REV_INDEX_DIE_IN_MEMORY", 0))
+		die("dying as requested by GIT_TEST_REV_INDEX_DIE_IN_MEMORY");
+	create_pack_revindex(p);
+}
+
+void close_pack_revindex(struct packed_git *p)
+{
+	if (!p->revindex_map)
+		return;
+	munmap((void *)p->revindex_map, p->revindex_size);
+	p->revindex_map = NULL;
+	p->revindex_data = NULL;
+	p->revindex_size = 0;
+}
+
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos)
+{
+	if (p->revindex_data)
+		return get_be32(p->revindex_data + pos);
+	return p->revindex[pos].nr;
+}
+
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos)
+{
+	if (p->revindex_data) {
+		/* the 20-byte trailer follows the last object */
+		if (pos == p->num_objects)
+			return p->pack_size - 20;
+		return nth_packed_object_offset(p, pack_pos_to_index(p, pos));
+	}
+	return p->revindex[pos].offset;
 }
 
 int find_revindex_position(struct packed_git *p, off_t ofs)
 {
 	int lo = 0;
 	int hi = p->num_objects + 1;
-	struct revindex_entry *revindex = p->revindex;
+
+	load_pack_revindex(p);
 
 	do {
 		unsigned mi = lo + (hi - lo) / 2;
-		if (revindex[mi].offset == ofs) {
+		off_t mi_ofs = pack_pos_to_offset(p, mi);
+
+		if (mi_ofs == ofs) {
 			return mi;
-		} else if (ofs < revindex[mi].offset)
+		} else if (ofs < mi_ofs)
 			hi = mi;
 		else
 			lo = mi + 1;
@@ -182,16 +302,3 @@ int find_revindex_position(struct packed_git *p, off_t ofs)
 	error("bad offset for revindex");
 	return -1;
 }
-
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
-{
-	int pos;
-
-	load_pack_revindex(p);
-	pos = find_revindex_position(p, ofs);
-
-	if (pos < 0)
-		return NULL;
-
-	return p->revindex + pos;
-}
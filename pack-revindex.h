@@ -3,14 +3,46 @@
 
 struct packed_git;
 
+/*
+ * The reverse index of a pack lists its objects in the order of their
+ * offsets ("pack order"): for each position in that order, it gives the
+ * position of the object in the pack index.  It is read from the ".rev"
+ * file of the pack when there is one, and sorted in memory otherwise.
+ *
+ * A ".rev" file is made of:
+ *
+ *   - a 12-byte header: RIDX_SIGNATURE, RIDX_VERSION and the id of
+ *     the hash function (1 for SHA-1), in network byte order;
+ *   - for each object, in pack order, its 4-byte position in the pack
+ *     index (network byte order);
+ *   - the checksum of the pack, and the checksum of all of the above.
+ */
+#define RIDX_SIGNATURE 0x52494458 /* "RIDX" */
+#define RIDX_VERSION 1
+#define RIDX_HEADER_SIZE 12
+
 struct revindex_entry {
 	off_t offset;
 	unsigned int nr;
 };
 
 void load_pack_revindex(struct packed_git *p);
+
+/*
+ * Return the pack position of the object at offset "ofs" (or -1 with an
+ * error if there is none), loading the reverse index if needed.
+ */
 int find_revindex_position(struct packed_git *p, off_t ofs);
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+/*
+ * Return the index position, or the offset, of the object at position
+ * "pos" in pack order.  The offset at position p->num_objects is the
+ * end of the last object.
+ */
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos);
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos);
+
+/* Release the reverse index read from the ".rev" file, if any */
+void close_pack_revindex(struct packed_git *p);
 
 #endif
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "pack.h"
 #include "csum-file.h"
+#include "pack-revindex.h"
 
 void reset_pack_idx_option(struct pack_idx_option *opts)
 {
@@ -170,11 +171,63 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 	}
 
 	sha1write(f, sha1, 20);
-	sha1close(f, NULL, ((opts->flags & WRITE_IDX_VERIFY)
-			    ? CSUM_CLOSE : CSUM_FSYNC));
+	sha1close(f, NULL, CSUM_HASH_IN_STREAM | CSUM_CLOSE |
+		  ((opts->flags & WRITE_IDX_VERIFY) ? 0 : CSUM_FSYNC));
 	return index_name;
 }
 
+static int pack_order_cmp(const void *a_, const void *b_, void *ctx)
+{
+	struct pack_idx_entry **objects = ctx;
+	off_t a = objects[*(uint32_t *)a_]->offset;
+	off_t b = objects[*(uint32_t *)b_]->offset;
+
+	return (a < b) ? -1 : (a != b);
+}
+
+/*
+ * The objects array must be sorted by object name, as write_idx_file()
+ * leaves it, so that positions in it are positions in the pack index.
+ */
+const char *write_rev_file(const char *rev_name,
+			   struct pack_idx_entry **objects,
+			   uint32_t nr_objects,
+			   const unsigned char *sha1)
+{
+	struct sha1file *f;
+	uint32_t *pack_order;
+	uint32_t i;
+	int fd;
+
+	if (!rev_name) {
+		struct strbuf tmp_file = STRBUF_INIT;
+		fd = odb_mkstemp(&tmp_file, "pack/tmp_rev_XXXXXX");
+		rev_name = strbuf_detach(&tmp_file, NULL);
+	} else {
+		unlink(rev_name);
+		fd = open(rev_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+		if (fd < 0)
+			die_errno("unable to create '%s'", rev_name);
+	}
+	f = sha1fd(fd, rev_name);
+
+	ALLOC_ARRAY(pack_order, nr_objects);
+	for (i = 0; i < nr_objects; i++)
+		pack_order[i] = i;
+	QSORT_S(pack_order, nr_objects, pack_order_cmp, objects);
+
+	sha1write_be32(f, RIDX_SIGNATURE);
+	sha1write_be32(f, RIDX_VERSION);
+	sha1write_be32(f, 1); /* SHA-1 */
+	for (i = 0; i < nr_objects; i++)
+		sha1write_be32(f, pack_order[i]);
+	sha1write(f, sha1, 20);
+	sha1close(f, NULL, CSUM_HASH_IN_STREAM | CSUM_CLOSE | CSUM_FSYNC);
+
+	free(pack_order);
+	return rev_name;
+}
+
 off_t write_pack_header(struct sha1file *f, uint32_t nr_entries)
 {
 	struct pack_header hdr;
@@ -349,7 +402,7 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 			 struct pack_idx_option *pack_idx_opts,
 			 unsigned char sha1[])
 {
-	const char *idx_tmp_name;
+	const char *idx_tmp_name, *rev_tmp_name = NULL;
 	int basename_len = name_buffer->len;
 
 	if (adjust_shared_perm(pack_tmp_name))
@@ -360,6 +413,13 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 	if (adjust_shared_perm(idx_tmp_name))
 		die_errno("unable to make temporary index file readable");
 
+	if (pack_idx_opts->flags & WRITE_REV) {
+		rev_tmp_name = write_rev_file(NULL, written_list, nr_written,
+					      sha1);
+		if (adjust_shared_perm(rev_tmp_name))
+			die_errno("unable to make temporary reverse index file readable");
+	}
+
 	strbuf_addf(name_buffer, "%s.pack", sha1_to_hex(sha1));
 
 	if (rename(pack_tmp_name, name_buffer->buf))
@@ -367,6 +427,14 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 
 	strbuf_setlen(name_buffer, basename_len);
 
+	if (rev_tmp_name) {
+		strbuf_addf(name_buffer, "%s.rev", sha1_to_hex(sha1));
+		if (rename(rev_tmp_name, name_buffer->buf))
+			die_errno("unable to rename temporary reverse index file");
+		strbuf_setlen(name_buffer, basename_len);
+		free((void *)rev_tmp_name);
+	}
+
 	strbuf_addf(name_buffer, "%s.idx", sha1_to_hex(sha1));
 	if (rename(idx_tmp_name, name_buffer->buf))
 		die_errno("unable to rename temporary index file");
@@ -8,6 +8,7 @@
 #include "list.h"
 #include "streaming.h"
 #include "sha1-lookup.h"
+#include "midx.h"
 
 char *odb_pack_name(struct strbuf *buf,
 		    const unsigned char *sha1,
@@ -297,9 +298,11 @@ void close_pack_index(struct packed_git *p)
 		munmap((void *)p->index_data, p->index_size);
 		p->index_data = NULL;
 	}
+	/* the mapped reverse index needs the index for offsets */
+	close_pack_revindex(p);
 }
 
-static void close_pack(struct packed_git *p)
+void close_pack(struct packed_git *p)
 {
 	close_pack_windows(p);
 	close_pack_fd(p);
@@ -781,6 +784,7 @@ static void prepare_packed_git_one(char *objdir, int local)
 		if (ends_with(de->d_name, ".idx") ||
 		    ends_with(de->d_name, ".pack") ||
 		    ends_with(de->d_name, ".bitmap") ||
+		    ends_with(de->d_name, ".rev") ||
 		    ends_with(de->d_name, ".keep"))
 			string_list_append(&garbage, path.buf);
 		else
@@ -806,10 +810,15 @@ unsigned long approximate_object_count(void)
 	static unsigned long count;
 	if (!approximate_object_count_valid) {
 		struct packed_git *p;
+		struct multi_pack_index *m;
 
 		prepare_packed_git();
 		count = 0;
+		for (m = get_multi_pack_index(); m; m = m->next)
+			count += m->num_objects;
 		for (p = packed_git; p; p = p->next) {
+			if (p->multi_pack_index)
+				continue;
 			if (open_pack_index(p))
 				continue;
 			count += p->num_objects;
@@ -879,9 +888,12 @@ void prepare_packed_git(void)
 	if (prepare_packed_git_run_once)
 		return;
 	prepare_packed_git_one(get_object_directory(), 1);
+	prepare_multi_pack_index_one(get_object_directory(), 1);
 	prepare_alt_odb();
-	for (alt = alt_odb_list; alt; alt = alt->next)
+	for (alt = alt_odb_list; alt; alt = alt->next) {
 		prepare_packed_git_one(alt->path, 0);
+		prepare_multi_pack_index_one(alt->path, 0);
+	}
 	rearrange_packed_git();
 	prepare_packed_git_mru();
 	prepare_packed_git_run_once = 1;
@@ -1009,11 +1021,11 @@ const struct packed_git *has_packed_and_bad(const unsigned char *sha1)
 	return NULL;
 }
 
-static off_t get_delta_base(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t *curpos,
-				    enum object_type type,
-				    off_t delta_obj_offset)
+off_t get_delta_base(struct packed_git *p,
+		     struct pack_window **w_curs,
+		     off_t *curpos,
+		     enum object_type type,
+		     off_t delta_obj_offset)
 {
 	unsigned char *base_info = use_pack(p, w_curs, *curpos, NULL);
 	off_t base_offset;
@@ -1064,18 +1076,18 @@ static const unsigned char *get_delta_base_sha1(struct packed_git *p,
 		unsigned char *base = use_pack(p, w_curs, curpos, NULL);
 		return base;
 	} else if (type == OBJ_OFS_DELTA) {
-		struct revindex_entry *revidx;
+		int base_pos;
 		off_t base_offset = get_delta_base(p, w_curs, &curpos,
 						   type, delta_obj_offset);
 
 		if (!base_offset)
 			return NULL;
 
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		base_pos = find_revindex_position(p, base_offset);
+		if (base_pos < 0)
 			return NULL;
 
-		return nth_packed_object_sha1(p, revidx->nr);
+		return nth_packed_object_sha1(p, pack_pos_to_index(p, base_pos));
 	} else
 		return NULL;
 }
@@ -1083,12 +1095,12 @@ static const unsigned char *get_delta_base_sha1(struct packed_git *p,
 static int retry_bad_packed_offset(struct packed_git *p, off_t obj_offset)
 {
 	int type;
-	struct revindex_entry *revidx;
+	int pos;
 	const unsigned char *sha1;
-	revidx = find_pack_revindex(p, obj_offset);
-	if (!revidx)
+	pos = find_revindex_position(p, obj_offset);
+	if (pos < 0)
 		return OBJ_BAD;
-	sha1 = nth_packed_object_sha1(p, revidx->nr);
+	sha1 = nth_packed_object_sha1(p, pack_pos_to_index(p, pos));
 	mark_bad_packed_object(p, sha1);
 	type = sha1_object_info(sha1, NULL);
 	if (type <= OBJ_NONE)
@@ -1346,8 +1358,12 @@ int packed_object_info(struct packed_git *p, off_t obj_offset,
 	}
 
 	if (oi->disk_sizep) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		*oi->disk_sizep = revidx[1].offset - obj_offset;
+		int pos = find_revindex_position(p, obj_offset);
+		if (pos < 0) {
+			type = OBJ_BAD;
+			goto out;
+		}
+		*oi->disk_sizep = pack_pos_to_offset(p, pos + 1) - obj_offset;
 	}
 
 	if (oi->typep || oi->typename) {
@@ -1487,11 +1503,12 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		}
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
-			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-			off_t len = revidx[1].offset - obj_offset;
-			if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+			int pos = find_revindex_position(p, obj_offset);
+			uint32_t nr = pack_pos_to_index(p, pos);
+			off_t len = pack_pos_to_offset(p, pos + 1) - obj_offset;
+			if (check_pack_crc(p, &w_curs, obj_offset, len, nr)) {
 				const unsigned char *sha1 =
-					nth_packed_object_sha1(p, revidx->nr);
+					nth_packed_object_sha1(p, nr);
 				error("bad packed object CRC for %s",
 				      sha1_to_hex(sha1));
 				mark_bad_packed_object(p, sha1);
@@ -1576,11 +1593,11 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			 * This is costly but should happen only in the presence
 			 * of a corrupted pack, and is better than failing outright.
 			 */
-			struct revindex_entry *revidx;
+			int pos;
 			const unsigned char *base_sha1;
-			revidx = find_pack_revindex(p, obj_offset);
-			if (revidx) {
-				base_sha1 = nth_packed_object_sha1(p, revidx->nr);
+			pos = find_revindex_position(p, obj_offset);
+			if (pos >= 0) {
+				base_sha1 = nth_packed_object_sha1(p, pack_pos_to_index(p, pos));
 				error("failed to read delta base object %s"
 				      " at offset %"PRIuMAX" from %s",
 				      sha1_to_hex(base_sha1), (uintmax_t)obj_offset,
@@ -1832,13 +1849,35 @@ static int fill_pack_entry(const unsigned char *sha1,
 int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 {
 	struct mru_entry *p;
+	int skip_midx_packs;
 
 	prepare_packed_git();
 	if (!packed_git)
 		return 0;
 
+	/*
+	 * A multi-pack-index lists every object of the packs it covers,
+	 * so if it does not know the object, those packs cannot have it
+	 * either. If it does know the object but its pack is unusable,
+	 * fall back to searching every pack for another copy.
+	 */
+	switch (fill_midx_entry(sha1, e)) {
+	case 1:
+		return 1;
+	case 0:
+		skip_midx_packs = 1;
+		break;
+	default:
+		skip_midx_packs = 0;
+		break;
+	}
+
 	for (p = packed_git_mru.head; p; p = p->next) {
-		if (fill_pack_entry(sha1, e, p->item)) {
+		struct packed_git *pack = p->item;
+
+		if (skip_midx_packs && pack->multi_pack_index)
+			continue;
+		if (fill_pack_entry(sha1, e, pack)) {
 			mru_mark(&packed_git_mru, p);
 			return 1;
 		}
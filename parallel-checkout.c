@@ -0,0 +1,484 @@
+#include "cache.h"
+#include "config.h"
+#include "parallel-checkout.h"
+#include "pkt-line.h"
+#include "run-command.h"
+#include "sigchain.h"
+#include "streaming.h"
+#include "thread-utils.h"
+
+/*
+ * Parallel checkout: check_updates() queues the regular files to be
+ * written instead of writing them one after another, and then spreads
+ * them over a pool of "git checkout--worker" processes which read the
+ * blobs, convert them and write them out. Worker processes rather than
+ * threads are used because the object reading machinery is not thread
+ * safe, and inflating the blobs is a big part of the cost.
+ *
+ * The main process still does everything that needs the index or the
+ * attributes: it removes what was in the way, creates the leading
+ * directories and looks up the conversion attributes of each entry
+ * when queueing it, and it updates the stat data of the entries in the
+ * index from what the workers report.
+ */
+
+struct parallel_checkout {
+	enum pc_status status;
+	struct parallel_checkout_item *items;
+	size_t nr, alloc;
+};
+
+static struct parallel_checkout parallel_checkout;
+
+enum pc_status parallel_checkout_status(void)
+{
+	return parallel_checkout.status;
+}
+
+#define DEFAULT_THRESHOLD_FOR_PARALLELISM 100
+
+void get_parallel_checkout_configs(int *num_workers, int *threshold)
+{
+	const char *env_workers = getenv("GIT_TEST_CHECKOUT_WORKERS");
+
+	/* Let the test suite exercise workers on every checkout. */
+	if (env_workers && *env_workers) {
+		*num_workers = atoi(env_workers);
+		if (*num_workers < 1)
+			*num_workers = online_cpus();
+		*threshold = 0;
+		return;
+	}
+
+	if (git_config_get_int("checkout.workers", num_workers))
+		*num_workers = 1;
+	else if (*num_workers < 1)
+		*num_workers = online_cpus();
+
+	if (git_config_get_int("checkout.thresholdforparallelism", threshold))
+		*threshold = DEFAULT_THRESHOLD_FOR_PARALLELISM;
+}
+
+void init_parallel_checkout(void)
+{
+	if (parallel_checkout.status != PC_UNINITIALIZED)
+		die("BUG: parallel checkout already initialized");
+
+	parallel_checkout.status = PC_ACCEPTING_ENTRIES;
+}
+
+static void finish_parallel_checkout(void)
+{
+	if (parallel_checkout.status == PC_UNINITIALIZED)
+		die("BUG: cannot finish parallel checkout: not initialized yet");
+
+	free(parallel_checkout.items);
+	memset(&parallel_checkout, 0, sizeof(parallel_checkout));
+}
+
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state)
+{
+	struct parallel_checkout_item *pc_item;
+	struct conv_attrs ca;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES ||
+	    state->base_dir_len || !S_ISREG(ce->ce_mode))
+		return -1;
+
+	/*
+	 * Entries with a smudge or process filter are left to the main
+	 * process, which knows how to run the filter and how to delay
+	 * the entry if the filter asks for it.
+	 */
+	convert_attrs(&ca, ce->name);
+	if (ca.drv)
+		return -1;
+
+	ALLOC_GROW(parallel_checkout.items, parallel_checkout.nr + 1,
+		   parallel_checkout.alloc);
+
+	pc_item = &parallel_checkout.items[parallel_checkout.nr];
+	memset(pc_item, 0, sizeof(*pc_item));
+	pc_item->id = parallel_checkout.nr++;
+	pc_item->ce = ce;
+	pc_item->ca = ca;
+	pc_item->status = PC_ITEM_PENDING;
+	return 0;
+}
+
+static int handle_results(struct checkout *state)
+{
+	int ret = 0;
+	size_t i;
+	int have_pending = 0;
+
+	/*
+	 * We first update the stat data of the written entries, so that
+	 * the collided ones, which are checked out below, see up to date
+	 * information when they look at the files in their way.
+	 */
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+		if (pc_item->status == PC_ITEM_WRITTEN)
+			update_ce_after_write(state, pc_item->ce, &pc_item->st);
+	}
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+		switch (pc_item->status) {
+		case PC_ITEM_WRITTEN:
+			break;
+		case PC_ITEM_COLLIDED:
+			/*
+			 * Write it again, now sequentially, so that it
+			 * replaces whatever took its place just like in a
+			 * sequential checkout (only the entry that ends
+			 * up on disk may differ).
+			 */
+			ret |= checkout_entry(pc_item->ce, state, NULL);
+			break;
+		case PC_ITEM_PENDING:
+			have_pending = 1;
+			/* fall through */
+		case PC_ITEM_FAILED:
+			ret = -1;
+			break;
+		default:
+			die("BUG: unknown checkout item status in parallel checkout");
+		}
+	}
+
+	if (have_pending)
+		error("parallel checkout finished with pending entries");
+
+	return ret;
+}
+
+static int reset_fd(int fd, const char *path)
+{
+	if (lseek(fd, 0, SEEK_SET) != 0)
+		return error_errno("failed to rewind descriptor of '%s'", path);
+	if (ftruncate(fd, 0))
+		return error_errno("failed to truncate file '%s'", path);
+	return 0;
+}
+
+static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
+			       const char *path)
+{
+	int ret;
+	struct stream_filter *filter;
+	struct strbuf buf = STRBUF_INIT;
+	enum object_type type;
+	unsigned long size;
+	char *blob;
+	ssize_t wrote;
+
+	filter = get_stream_filter_ca(&pc_item->ca, pc_item->ce->oid.hash);
+	if (filter) {
+		if (!stream_blob_to_fd(fd, &pc_item->ce->oid, filter, 1))
+			return 0;
+		/* Streaming failed; retry with the blob in core. */
+		if (reset_fd(fd, path))
+			return -1;
+	}
+
+	blob = read_sha1_file(pc_item->ce->oid.hash, &type, &size);
+	if (!blob || type != OBJ_BLOB) {
+		free(blob);
+		return error("unable to read sha1 file of %s (%s)",
+			     path, oid_to_hex(&pc_item->ce->oid));
+	}
+
+	ret = convert_to_working_tree_ca(&pc_item->ca, path, blob, size, &buf);
+	if (ret) {
+		size_t newsize;
+
+		free(blob);
+		blob = strbuf_detach(&buf, &newsize);
+		size = newsize;
+	}
+
+	wrote = write_in_full(fd, blob, size);
+	free(blob);
+	if (wrote < 0)
+		return error("unable to write file %s", path);
+
+	return 0;
+}
+
+void write_pc_item(struct parallel_checkout_item *pc_item)
+{
+	const char *path = pc_item->ce->name;
+	const char *slash = strrchr(path, '/');
+	unsigned int mode = (pc_item->ce->ce_mode & 0100) ? 0777 : 0666;
+	int fd, fstat_done = 0;
+
+	/*
+	 * The leading directories were created when the entry was
+	 * queued, but another entry of this checkout may have taken
+	 * their place since. Do not follow whatever is there now.
+	 */
+	if (slash && !has_dirs_only_path(path, slash - path, 0)) {
+		pc_item->status = PC_ITEM_COLLIDED;
+		return;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, mode);
+	if (fd < 0) {
+		if (errno == EEXIST || errno == EISDIR || errno == ENOTDIR ||
+		    errno == ELOOP) {
+			pc_item->status = PC_ITEM_COLLIDED;
+		} else {
+			error_errno("unable to create file %s", path);
+			pc_item->status = PC_ITEM_FAILED;
+		}
+		return;
+	}
+
+	if (write_pc_item_to_fd(pc_item, fd, path)) {
+		close(fd);
+		unlink(path);
+		pc_item->status = PC_ITEM_FAILED;
+		return;
+	}
+
+	if (fstat_is_reliable())
+		fstat_done = !fstat(fd, &pc_item->st);
+	if (close(fd)) {
+		error_errno("unable to write file %s", path);
+		unlink(path);
+		pc_item->status = PC_ITEM_FAILED;
+		return;
+	}
+	if (!fstat_done && lstat(path, &pc_item->st) < 0) {
+		error_errno("unable to stat just-written file %s", path);
+		pc_item->status = PC_ITEM_FAILED;
+		return;
+	}
+
+	pc_item->status = PC_ITEM_WRITTEN;
+}
+
+static void write_items_sequentially(void)
+{
+	size_t i;
+
+	for (i = 0; i < parallel_checkout.nr; i++)
+		write_pc_item(&parallel_checkout.items[i]);
+}
+
+/*
+ * Consecutive items are handed to the same worker in chunks of up to
+ * this many entries, so that each worker tends to write whole
+ * directories while the work is still spread evenly.
+ */
+#define ASSIGN_CHUNK_SIZE 10
+
+struct pc_worker {
+	struct child_process cp;
+	size_t nr_items;
+};
+
+static void setup_workers(struct pc_worker *workers, int num_workers)
+{
+	int i;
+
+	for (i = 0; i < num_workers; i++) {
+		struct child_process *cp = &workers[i].cp;
+
+		child_process_init(cp);
+		cp->git_cmd = 1;
+		cp->in = -1;
+		cp->out = -1;
+		cp->clean_on_exit = 1;
+		argv_array_push(&cp->args, "checkout--worker");
+		if (start_command(cp))
+			die(_("failed to spawn checkout worker"));
+	}
+}
+
+static void send_one_item(int fd, struct parallel_checkout_item *pc_item,
+			  struct strbuf *buf)
+{
+	struct pc_item_fixed_portion fixed_portion;
+	size_t name_len = ce_namelen(pc_item->ce);
+
+	memset(&fixed_portion, 0, sizeof(fixed_portion));
+	fixed_portion.id = pc_item->id;
+	oidcpy(&fixed_portion.oid, &pc_item->ce->oid);
+	fixed_portion.ce_mode = pc_item->ce->ce_mode;
+	fixed_portion.crlf_action = pc_item->ca.crlf_action;
+	fixed_portion.ident = pc_item->ca.ident;
+	fixed_portion.name_len = name_len;
+
+	if (sizeof(fixed_portion) + name_len > LARGE_PACKET_DATA_MAX)
+		die("BUG: path too long for parallel checkout: %s",
+		    pc_item->ce->name);
+
+	strbuf_reset(buf);
+	strbuf_add(buf, &fixed_portion, sizeof(fixed_portion));
+	strbuf_add(buf, pc_item->ce->name, name_len);
+	packet_write(fd, buf->buf, buf->len);
+}
+
+static void send_items_to_workers(struct pc_worker *workers, int num_workers,
+				  size_t chunk_size)
+{
+	struct strbuf buf = STRBUF_INIT;
+	size_t start, i;
+	int w;
+
+	for (w = 0; w < num_workers; w++) {
+		int fd = workers[w].cp.in;
+
+		for (start = w * chunk_size; start < parallel_checkout.nr;
+		     start += num_workers * chunk_size) {
+			size_t end = start + chunk_size;
+
+			if (end > parallel_checkout.nr)
+				end = parallel_checkout.nr;
+			for (i = start; i < end; i++)
+				send_one_item(fd, &parallel_checkout.items[i],
+					      &buf);
+			workers[w].nr_items += end - start;
+		}
+		packet_flush(fd);
+		close(fd);
+		workers[w].cp.in = -1;
+	}
+
+	strbuf_release(&buf);
+}
+
+static void parse_and_save_result(const char *buffer, int len, int worker)
+{
+	const struct pc_item_result *res = (const struct pc_item_result *)buffer;
+	struct parallel_checkout_item *pc_item;
+
+	if (len != sizeof(*res))
+		die("BUG: wrong result size from checkout worker %d "
+		    "(got %d bytes, expected %d)",
+		    worker, len, (int)sizeof(*res));
+	if (res->id >= parallel_checkout.nr)
+		die("BUG: checkout worker %d sent unknown item id %"PRIuMAX,
+		    worker, (uintmax_t)res->id);
+
+	pc_item = &parallel_checkout.items[res->id];
+	pc_item->status = res->status;
+	if (res->status == PC_ITEM_WRITTEN)
+		pc_item->st = res->st;
+}
+
+static void gather_results_from_workers(struct pc_worker *workers,
+					int num_workers)
+{
+	int i, active_workers = num_workers;
+	struct pollfd *pfds;
+
+	ALLOC_ARRAY(pfds, num_workers);
+	for (i = 0; i < num_workers; i++) {
+		pfds[i].fd = workers[i].cp.out;
+		pfds[i].events = POLLIN;
+	}
+
+	while (active_workers) {
+		int nr = poll(pfds, num_workers, -1);
+
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			die_errno("failed to poll checkout workers");
+		}
+
+		for (i = 0; i < num_workers && nr > 0; i++) {
+			struct pollfd *pfd = &pfds[i];
+
+			if (!pfd->revents)
+				continue;
+			nr--;
+
+			if (pfd->revents & POLLIN) {
+				int len = packet_read(pfd->fd, NULL, NULL,
+						      packet_buffer,
+						      sizeof(packet_buffer),
+						      PACKET_READ_GENTLE_ON_EOF);
+				if (len > 0) {
+					parse_and_save_result(packet_buffer,
+							      len, i);
+					continue;
+				}
+				/* Flush packet, or the worker died. */
+			} else if (!(pfd->revents & POLLHUP)) {
+				die("error polling from checkout worker %d", i);
+			}
+
+			/* Stop polling on this worker. */
+			pfd->fd = -1;
+			active_workers--;
+		}
+	}
+
+	free(pfds);
+}
+
+static void finish_workers(struct pc_worker *workers, int num_workers)
+{
+	int i;
+
+	for (i = 0; i < num_workers; i++) {
+		close(workers[i].cp.out);
+		if (finish_command(&workers[i].cp))
+			error("checkout worker %d finished with error", i);
+	}
+}
+
+static void write_items_in_parallel(int num_workers)
+{
+	struct pc_worker *workers;
+	size_t chunk_size;
+
+	chunk_size = parallel_checkout.nr / num_workers;
+	if (chunk_size > ASSIGN_CHUNK_SIZE)
+		chunk_size = ASSIGN_CHUNK_SIZE;
+	if (!chunk_size)
+		chunk_size = 1;
+
+	workers = xcalloc(num_workers, sizeof(*workers));
+	setup_workers(workers, num_workers);
+
+	/* Die with an error rather than by SIGPIPE if a worker dies early. */
+	sigchain_push(SIGPIPE, SIG_IGN);
+	send_items_to_workers(workers, num_workers, chunk_size);
+	sigchain_pop(SIGPIPE);
+
+	gather_results_from_workers(workers, num_workers);
+	finish_workers(workers, num_workers);
+	free(workers);
+}
+
+int run_parallel_checkout(struct checkout *state, int num_workers,
+			  int threshold)
+{
+	int ret;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES)
+		die("BUG: cannot run parallel checkout: uninitialized or already running");
+
+	parallel_checkout.status = PC_RUNNING;
+
+	if (parallel_checkout.nr < num_workers)
+		num_workers = parallel_checkout.nr;
+
+	if (num_workers <= 1 || parallel_checkout.nr < threshold)
+		write_items_sequentially();
+	else
+		write_items_in_parallel(num_workers);
+
+	ret = handle_results(state);
+
+	finish_parallel_checkout();
+	return ret;
+}
@@ -0,0 +1,106 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+#include "convert.h"
+
+struct cache_entry;
+struct checkout;
+
+/****************************************************************
+ * Users of parallel checkout
+ ****************************************************************/
+
+enum pc_status {
+	PC_UNINITIALIZED = 0,
+	PC_ACCEPTING_ENTRIES,
+	PC_RUNNING
+};
+
+enum pc_status parallel_checkout_status(void);
+
+/*
+ * Read "checkout.workers" and "checkout.thresholdForParallelism". A
+ * number of workers below one means one per online CPU.
+ */
+void get_parallel_checkout_configs(int *num_workers, int *threshold);
+
+/*
+ * Start queueing entries: from now on, checkout_entry() hands the
+ * regular files it would write over to enqueue_checkout() and leaves
+ * them for run_parallel_checkout().
+ */
+void init_parallel_checkout(void);
+
+/*
+ * Queue `ce` to be written by run_parallel_checkout(). Return 0 if it
+ * was queued, or -1 if it has to be written right away by the caller
+ * (e.g. because it needs an external filter or a delayed checkout).
+ */
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state);
+
+/*
+ * Write all queued entries, using up to `num_workers` worker processes
+ * if at least `threshold` entries were queued, and update their stat
+ * data in the index. Entries that a worker could not create because
+ * another entry of this checkout took their place (e.g. two paths
+ * differing only in case on a case-insensitive file system) are
+ * written again sequentially, just like a sequential checkout would
+ * have done. Return 0 on success, or non-zero if any entry could not
+ * be written.
+ */
+int run_parallel_checkout(struct checkout *state, int num_workers,
+			  int threshold);
+
+/****************************************************************
+ * Interface with checkout--worker
+ ****************************************************************/
+
+enum pc_item_status {
+	PC_ITEM_PENDING = 0,
+	PC_ITEM_WRITTEN,
+	/* The entry could not be written; an error has been printed. */
+	PC_ITEM_FAILED,
+	/*
+	 * The path (or one of its leading directories) was taken by
+	 * another entry of this checkout by the time it was written.
+	 */
+	PC_ITEM_COLLIDED
+};
+
+struct parallel_checkout_item {
+	/* Index of this item in the queue of the main process. */
+	size_t id;
+	struct cache_entry *ce;
+	struct conv_attrs ca;
+	enum pc_item_status status;
+	struct stat st;
+};
+
+/*
+ * The fixed-size part of the packet sent to a worker for each item;
+ * it is followed by the name of the entry. Main process and workers
+ * are the same executable, so the structure is sent as is.
+ */
+struct pc_item_fixed_portion {
+	size_t id;
+	struct object_id oid;
+	unsigned int ce_mode;
+	enum crlf_action crlf_action;
+	int ident;
+	size_t name_len;
+};
+
+/* The packet sent back by a worker for each item. */
+struct pc_item_result {
+	size_t id;
+	enum pc_item_status status;
+	struct stat st;
+};
+
+/*
+ * Write the item to the working tree and record the outcome and the
+ * stat data of the new file in `pc_item`.
+ */
+void write_pc_item(struct parallel_checkout_item *pc_item);
+
+#endif /* PARALLEL_CHECKOUT_H */
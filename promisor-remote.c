@@ -0,0 +1,145 @@
+#include "cache.h"
+#include "config.h"
+#include "remote.h"
+#include "packfile.h"
+#include "run-command.h"
+#include "sigchain.h"
+#include "promisor-remote.h"
+
+static struct trace_key trace_promisor = TRACE_KEY_INIT(PROMISOR);
+
+static struct string_list promisor_remotes = STRING_LIST_INIT_DUP;
+static int promisor_remotes_loaded;
+
+static int promisor_remote_config(const char *var, const char *value, void *data)
+{
+	const char *name, *key;
+	int namelen;
+
+	if (parse_config_key(var, "remote", &name, &namelen, &key) < 0 || !name)
+		return 0;
+	if (!strcmp(key, "promisor")) {
+		char *remote_name = xmemdupz(name, namelen);
+
+		if (git_config_bool(var, value))
+			string_list_insert(&promisor_remotes, remote_name);
+		else
+			string_list_remove(&promisor_remotes, remote_name, 0);
+		free(remote_name);
+	}
+	return 0;
+}
+
+static void promisor_remote_init(void)
+{
+	if (promisor_remotes_loaded)
+		return;
+	promisor_remotes_loaded = 1;
+	if (!startup_info->have_repository)
+		return;
+	git_config(promisor_remote_config, NULL);
+}
+
+int has_promisor_remote(void)
+{
+	promisor_remote_init();
+	return promisor_remotes.nr > 0;
+}
+
+/*
+ * Ask "remote_name" for the objects in "oids" with a single fetch-pack
+ * request; the objects are written to our object store by the
+ * fetch-pack child, which does not try to fetch anything it finds
+ * missing itself.
+ */
+static int fetch_objects(const char *remote_name,
+			 const struct object_id *oids, int oid_nr)
+{
+	struct remote *remote = remote_get(remote_name);
+	struct child_process child = CHILD_PROCESS_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	int i, err = 0;
+
+	if (!remote || !remote->url_nr)
+		return error(_("promisor remote '%s' has no url"), remote_name);
+
+	trace_printf_key(&trace_promisor, "promisor: fetching %d object(s) from %s\n",
+			 oid_nr, remote_name);
+
+	argv_array_pushl(&child.args, "fetch-pack", "--stdin",
+			 "--no-dependents", "--no-progress", "-q", NULL);
+	if (remote->uploadpack)
+		argv_array_pushf(&child.args, "--upload-pack=%s",
+				 remote->uploadpack);
+	argv_array_push(&child.args, remote->url[0]);
+	child.git_cmd = 1;
+	child.in = -1;
+	child.no_stdout = 1;
+
+	if (start_command(&child))
+		return error(_("could not run fetch-pack for promisor remote '%s'"),
+			     remote_name);
+
+	for (i = 0; i < oid_nr; i++)
+		strbuf_addf(&buf, "%s\n", oid_to_hex(&oids[i]));
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	if (write_in_full(child.in, buf.buf, buf.len) < 0)
+		err = error_errno(_("failed to send object names to fetch-pack"));
+	if (close(child.in))
+		err = error_errno(_("failed to close fetch-pack's stdin"));
+	sigchain_pop(SIGPIPE);
+
+	strbuf_release(&buf);
+	if (finish_command(&child))
+		err = -1;
+	return err;
+}
+
+/*
+ * Drop the objects we have from "oids", returning how many are left
+ * missing.  The array is reordered.
+ */
+static int remove_fetched_oids(struct object_id *oids, int oid_nr)
+{
+	int i, missing = 0;
+
+	for (i = 0; i < oid_nr; i++)
+		if (!has_object_file_with_flags(&oids[i],
+						OBJECT_INFO_SKIP_FETCH_OBJECT))
+			oidcpy(&oids[missing++], &oids[i]);
+	return missing;
+}
+
+int promisor_remote_get_direct(const struct object_id *oids, int oid_nr)
+{
+	struct object_id *missing;
+	int i, missing_nr, ret = -1;
+
+	if (!oid_nr)
+		return 0;
+	if (!has_promisor_remote())
+		return -1;
+
+	ALLOC_ARRAY(missing, oid_nr);
+	COPY_ARRAY(missing, oids, oid_nr);
+	missing_nr = oid_nr;
+
+	for (i = 0; i < promisor_remotes.nr; i++) {
+		const char *remote_name = promisor_remotes.items[i].string;
+
+		if (fetch_objects(remote_name, missing, missing_nr) < 0 &&
+		    i + 1 < promisor_remotes.nr)
+			warning(_("could not fetch all objects from promisor remote '%s'"),
+				remote_name);
+		reprepare_packed_git();
+		missing_nr = remove_fetched_oids(missing, missing_nr);
+		if (!missing_nr) {
+			ret = 0;
+			break;
+		}
+	}
+
+	free(missing);
+	return ret;
+}
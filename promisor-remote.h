@@ -0,0 +1,25 @@
+#ifndef PROMISOR_REMOTE_H
+#define PROMISOR_REMOTE_H
+
+struct object_id;
+
+/*
+ * A promisor remote is a remote ("remote.<name>.promisor" is true) that
+ * promises to serve any object this repository is missing, e.g. the
+ * blobs left out of a clone made with an object filter.
+ */
+
+/* Is at least one promisor remote configured? */
+int has_promisor_remote(void);
+
+/*
+ * Fetch the given objects, and nothing reachable from them, from the
+ * promisor remotes, asking for all of them in a single request to each
+ * remote until they have all arrived.  Objects we already have are
+ * not asked for again.
+ *
+ * Returns 0 if all the objects are now available, -1 otherwise.
+ */
+int promisor_remote_get_direct(const struct object_id *oids, int oid_nr);
+
+#endif
@@ -20,6 +20,8 @@
 #include "split-index.h"
 #include "utf8.h"
 #include "fsmonitor.h"
+#include "thread-utils.h"
+#include "sparse-index.h"
 
 /* Mask for the name length in ce_flags in the on-disk index */
 
@@ -40,6 +42,9 @@
 #define CACHE_EXT_LINK 0x6c696e6b	  /* "link" */
 #define CACHE_EXT_UNTRACKED 0x554E5452	  /* "UNTR" */
 #define CACHE_EXT_FSMONITOR 0x46534D4E	  /* "FSMN" */
+#define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
+#define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
+#define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972 /* "sdir" */
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
@@ -1586,6 +1591,14 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_FSMONITOR:
 		read_fsmonitor_extension(istate, data, sz);
 		break;
+	case CACHE_EXT_SPARSE_DIRECTORIES:
+		/* no content, only an indication that this is a sparse index */
+		istate->sparse_index = 1;
+		break;
+	case CACHE_EXT_ENDOFINDEXENTRIES:
+	case CACHE_EXT_INDEXENTRYOFFSETTABLE:
+		/* already handled in do_read_index() */
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error("index uses %.4s extension, which we do not understand",
@@ -1644,6 +1657,13 @@ static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
 	const unsigned char *ep, *cp = (const unsigned char *)cp_;
 	size_t len = decode_varint(&cp);
 
+	/*
+	 * An empty previous name means that we are at the start of a
+	 * block of the index entry offset table, whose first entry
+	 * strips all of the previous block's last name.
+	 */
+	if (!name->len)
+		len = 0;
 	if (name->len < len)
 		die("malformed name field in the index");
 	strbuf_remove(name, name->len - len, len);
@@ -1762,18 +1782,400 @@ static void post_read_index_from(struct index_state *istate)
 	tweak_untracked_cache(istate);
 	tweak_split_index(istate);
 	tweak_fsmonitor(istate);
+
+	/*
+	 * Commands that have not been taught about sparse directory
+	 * entries get to see every path.
+	 */
+	if (command_requires_full_index)
+		ensure_full_index(istate);
+}
+
+/*
+ * The end of index entries (EOIE) extension records where the cache
+ * entries stop and the extensions start, so that a reader can hand
+ * the extensions to a separate thread without first parsing every
+ * entry.  It is always written last, right before the trailing
+ * checksum, so that it can be found by looking backwards from EOF.
+ *
+ * "EOIE"
+ * <4-byte length>
+ * <4-byte offset>
+ * <20-byte hash>
+ */
+#define EOIE_SIZE (4 + 20)
+#define EOIE_SIZE_WITH_HEADER (4 + 4 + EOIE_SIZE)
+
+/*
+ * The index entry offset table (IEOT) extension splits the cache
+ * entries into blocks that can be parsed independently of each other.
+ * A version 4 index restarts its name prefix compression at the start
+ * of every block.
+ */
+#define IEOT_VERSION (1)
+
+struct index_entry_offset
+{
+	/* starting byte offset into index file, count of index entries in this block */
+	int offset, nr;
+};
+
+struct index_entry_offset_table
+{
+	int nr;
+	struct index_entry_offset entries[FLEX_ARRAY];
+};
+
+static size_t read_eoie_extension(const char *mmap, size_t mmap_size)
+{
+	const char *index, *eoie;
+	uint32_t extsize;
+	size_t offset, src_offset;
+	unsigned char sha1[20];
+	git_SHA_CTX c;
+
+	/* ensure we have an index big enough to contain an EOIE extension */
+	if (mmap_size < sizeof(struct cache_header) + EOIE_SIZE_WITH_HEADER + 20)
+		return 0;
+
+	/* validate the extension signature */
+	index = eoie = mmap + mmap_size - EOIE_SIZE_WITH_HEADER - 20;
+	if (CACHE_EXT(index) != CACHE_EXT_ENDOFINDEXENTRIES)
+		return 0;
+	index += sizeof(uint32_t);
+
+	/* validate the extension size */
+	extsize = get_be32(index);
+	if (extsize != EOIE_SIZE)
+		return 0;
+	index += sizeof(uint32_t);
+
+	/*
+	 * Validate the offset we're going to look for the first extension
+	 * signature is after the index header and before the eoie extension.
+	 */
+	offset = get_be32(index);
+	if (offset < sizeof(struct cache_header) || mmap + offset > eoie)
+		return 0;
+	index += sizeof(uint32_t);
+
+	/*
+	 * The hash is computed over extension types and their sizes (but
+	 * not their contents).  E.g. if we have a "TREE" extension that is
+	 * N bytes long and a "REUC" extension that is M bytes long, followed
+	 * by "EOIE", then the hash is
+	 *
+	 *   SHA-1("TREE" + <be32 N> + "REUC" + <be32 M>)
+	 */
+	src_offset = offset;
+	git_SHA1_Init(&c);
+	while (src_offset < mmap_size - 20 - EOIE_SIZE_WITH_HEADER) {
+		extsize = get_be32(mmap + src_offset + 4);
+
+		/* verify the extension size isn't so large it will wrap around */
+		if (src_offset + 8 + extsize < src_offset)
+			return 0;
+
+		git_SHA1_Update(&c, mmap + src_offset, 8);
+
+		src_offset += 8;
+		src_offset += extsize;
+	}
+	git_SHA1_Final(sha1, &c);
+	if (hashcmp(sha1, (const unsigned char *)index))
+		return 0;
+
+	/* validate that the extension offsets led us back to the eoie extension */
+	if (src_offset != mmap_size - 20 - EOIE_SIZE_WITH_HEADER)
+		return 0;
+
+	return offset;
+}
+
+static void write_eoie_extension(struct strbuf *sb, git_SHA_CTX *eoie_context,
+				 size_t offset)
+{
+	uint32_t buffer;
+	unsigned char sha1[20];
+
+	/* offset */
+	put_be32(&buffer, offset);
+	strbuf_add(sb, &buffer, sizeof(uint32_t));
+
+	/* hash */
+	git_SHA1_Final(sha1, eoie_context);
+	strbuf_add(sb, sha1, 20);
+}
+
+static struct index_entry_offset_table *read_ieot_extension(const char *mmap,
+							    size_t mmap_size,
+							    size_t offset,
+							    unsigned int cache_nr)
+{
+	const char *index = NULL;
+	uint32_t extsize, ext_version;
+	struct index_entry_offset_table *ieot;
+	unsigned int i, nr, total = 0;
+
+	/* find the IEOT extension */
+	while (offset <= mmap_size - 20 - 8) {
+		extsize = get_be32(mmap + offset + 4);
+		if (CACHE_EXT((mmap + offset)) == CACHE_EXT_INDEXENTRYOFFSETTABLE) {
+			index = mmap + offset + 4 + 4;
+			break;
+		}
+		offset += 8;
+		offset += extsize;
+	}
+	if (!index)
+		return NULL;
+
+	/* validate the version is IEOT_VERSION */
+	if (extsize < sizeof(uint32_t))
+		return NULL;
+	ext_version = get_be32(index);
+	if (ext_version != IEOT_VERSION) {
+		error("invalid IEOT version %d", ext_version);
+		return NULL;
+	}
+	index += sizeof(uint32_t);
+
+	/* extension size - version bytes / bytes per entry */
+	nr = (extsize - sizeof(uint32_t)) / (sizeof(uint32_t) + sizeof(uint32_t));
+	if (!nr) {
+		error("invalid number of IEOT entries %d", nr);
+		return NULL;
+	}
+	ieot = xmalloc(st_add(sizeof(*ieot),
+			      st_mult(nr, sizeof(struct index_entry_offset))));
+	ieot->nr = nr;
+	for (i = 0; i < nr; i++) {
+		ieot->entries[i].offset = get_be32(index);
+		index += sizeof(uint32_t);
+		ieot->entries[i].nr = get_be32(index);
+		index += sizeof(uint32_t);
+
+		if (ieot->entries[i].offset < sizeof(struct cache_header) ||
+		    ieot->entries[i].offset >= mmap_size - 20 ||
+		    ieot->entries[i].nr <= 0)
+			break;
+		total += ieot->entries[i].nr;
+	}
+
+	/* fall back to reading the entries serially if the table is off */
+	if (i < nr || total != cache_nr) {
+		free(ieot);
+		return NULL;
+	}
+
+	return ieot;
+}
+
+static void write_ieot_extension(struct strbuf *sb,
+				 struct index_entry_offset_table *ieot)
+{
+	uint32_t buffer;
+	int i;
+
+	/* version */
+	put_be32(&buffer, IEOT_VERSION);
+	strbuf_add(sb, &buffer, sizeof(uint32_t));
+
+	/* ieot */
+	for (i = 0; i < ieot->nr; i++) {
+
+		/* offset */
+		put_be32(&buffer, ieot->entries[i].offset);
+		strbuf_add(sb, &buffer, sizeof(uint32_t));
+
+		/* count */
+		put_be32(&buffer, ieot->entries[i].nr);
+		strbuf_add(sb, &buffer, sizeof(uint32_t));
+	}
+}
+
+static void load_index_extensions(struct index_state *istate, const char *mmap,
+				  size_t mmap_size, unsigned long src_offset)
+{
+	while (src_offset <= mmap_size - 20 - 8) {
+		/* After an array of active_nr index entries,
+		 * there can be arbitrary number of extended
+		 * sections, each of which is prefixed with
+		 * extension name (4-byte) and section length
+		 * in 4-byte network byte order.
+		 */
+		uint32_t extsize = get_be32(mmap + src_offset + 4);
+		if (read_index_extension(istate,
+					 mmap + src_offset,
+					 (char *)mmap + src_offset + 8,
+					 extsize) < 0)
+			die("index file corrupt");
+		src_offset += 8;
+		src_offset += extsize;
+	}
+}
+
+/*
+ * Parse the "nr" cache entries starting at "start_offset" in the
+ * mapped index into istate->cache[offset...], and return the number
+ * of bytes consumed.
+ */
+static unsigned long load_cache_entry_block(struct index_state *istate,
+					    const char *mmap,
+					    unsigned long start_offset,
+					    int offset, int nr,
+					    struct strbuf *previous_name)
+{
+	int i;
+	unsigned long src_offset = start_offset;
+
+	for (i = offset; i < offset + nr; i++) {
+		struct ondisk_cache_entry *disk_ce;
+		struct cache_entry *ce;
+		unsigned long consumed;
+
+		disk_ce = (struct ondisk_cache_entry *)(mmap + src_offset);
+		ce = create_from_disk(disk_ce, &consumed, previous_name);
+		set_index_entry(istate, i, ce);
+
+		src_offset += consumed;
+	}
+	return src_offset - start_offset;
+}
+
+static unsigned long load_all_cache_entries(struct index_state *istate,
+					    const char *mmap,
+					    unsigned long src_offset)
+{
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	unsigned long consumed;
+
+	previous_name = (istate->version == 4) ? &previous_name_buf : NULL;
+	consumed = load_cache_entry_block(istate, mmap, src_offset,
+					  0, istate->cache_nr, previous_name);
+	strbuf_release(&previous_name_buf);
+	return consumed;
+}
+
+/*
+ * Mostly randomly chosen: we want to have at least 10000 cache
+ * entries per thread for it to be worth starting a thread.
+ */
+#define THREAD_COST (10000)
+
+#ifndef NO_PTHREADS
+
+struct load_index_extensions_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	size_t mmap_size;
+	unsigned long src_offset;
+};
+
+static void *load_index_extensions_thread(void *_data)
+{
+	struct load_index_extensions_data *p = _data;
+
+	load_index_extensions(p->istate, p->mmap, p->mmap_size, p->src_offset);
+	return NULL;
+}
+
+struct load_cache_entries_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	struct index_entry_offset_table *ieot;
+	int ieot_start;		/* first block of the table to process */
+	int ieot_blocks;	/* number of blocks to process */
+	int offset;		/* index of the first cache entry to fill */
+};
+
+static void *load_cache_entries_thread(void *_data)
+{
+	struct load_cache_entries_data *p = _data;
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	int i, offset = p->offset;
+
+	previous_name = (p->istate->version == 4) ? &previous_name_buf : NULL;
+	for (i = p->ieot_start; i < p->ieot_start + p->ieot_blocks; i++) {
+		struct index_entry_offset *block = &p->ieot->entries[i];
+
+		/* the first entry of a block ignores the previous name */
+		strbuf_reset(&previous_name_buf);
+		load_cache_entry_block(p->istate, p->mmap, block->offset,
+				       offset, block->nr, previous_name);
+		offset += block->nr;
+	}
+	strbuf_release(&previous_name_buf);
+	return NULL;
 }
 
+static void load_cache_entries_threaded(struct index_state *istate,
+					const char *mmap, int nr_threads,
+					struct index_entry_offset_table *ieot)
+{
+	struct load_cache_entries_data *data;
+	int i, offset = 0, ieot_start = 0;
+
+	/* set_index_entry() must not touch the name hash from a thread */
+	if (istate->name_hash_initialized)
+		die("BUG: the name hash isn't thread safe");
+
+	/* ensure we have no more threads than we have blocks to process */
+	if (nr_threads > ieot->nr)
+		nr_threads = ieot->nr;
+	data = xcalloc(nr_threads, sizeof(*data));
+
+	for (i = 0; i < nr_threads; i++) {
+		struct load_cache_entries_data *p = &data[i];
+		int j, err;
+
+		p->istate = istate;
+		p->mmap = mmap;
+		p->ieot = ieot;
+		p->ieot_start = ieot_start;
+		p->ieot_blocks = DIV_ROUND_UP(ieot->nr - ieot_start,
+					      nr_threads - i);
+		p->offset = offset;
+
+		for (j = p->ieot_start; j < p->ieot_start + p->ieot_blocks; j++)
+			offset += ieot->entries[j].nr;
+		ieot_start += p->ieot_blocks;
+
+		err = pthread_create(&p->pthread, NULL,
+				     load_cache_entries_thread, p);
+		if (err)
+			die(_("unable to create load_cache_entries thread: %s"),
+			    strerror(err));
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_join(data[i].pthread, NULL);
+		if (err)
+			die(_("unable to join load_cache_entries thread: %s"),
+			    strerror(err));
+	}
+	free(data);
+}
+
+#endif
+
 /* remember to discard_cache() before reading a different cache! */
 int do_read_index(struct index_state *istate, const char *path, int must_exist)
 {
-	int fd, i;
+	int fd;
 	struct stat st;
 	unsigned long src_offset;
 	struct cache_header *hdr;
 	void *mmap;
 	size_t mmap_size;
-	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	size_t extension_offset = 0;
+#ifndef NO_PTHREADS
+	int nr_threads;
+	struct load_index_extensions_data p;
+	struct index_entry_offset_table *ieot = NULL;
+#endif
 
 	if (istate->initialized)
 		return istate->cache_nr;
@@ -1809,46 +2211,73 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	istate->cache_alloc = alloc_nr(istate->cache_nr);
 	istate->cache = xcalloc(istate->cache_alloc, sizeof(*istate->cache));
 	istate->initialized = 1;
-
-	if (istate->version == 4)
-		previous_name = &previous_name_buf;
-	else
-		previous_name = NULL;
+	istate->timestamp.sec = st.st_mtime;
+	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 
 	src_offset = sizeof(*hdr);
-	for (i = 0; i < istate->cache_nr; i++) {
-		struct ondisk_cache_entry *disk_ce;
-		struct cache_entry *ce;
-		unsigned long consumed;
 
-		disk_ce = (struct ondisk_cache_entry *)((char *)mmap + src_offset);
-		ce = create_from_disk(disk_ce, &consumed, previous_name);
-		set_index_entry(istate, i, ce);
+#ifndef NO_PTHREADS
+	nr_threads = git_config_get_index_threads();
+	if (!nr_threads) {
+		int cpus = online_cpus();
 
-		src_offset += consumed;
+		nr_threads = istate->cache_nr / THREAD_COST;
+		if (nr_threads > cpus)
+			nr_threads = cpus;
 	}
-	strbuf_release(&previous_name_buf);
-	istate->timestamp.sec = st.st_mtime;
-	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 
-	while (src_offset <= mmap_size - 20 - 8) {
-		/* After an array of active_nr index entries,
-		 * there can be arbitrary number of extended
-		 * sections, each of which is prefixed with
-		 * extension name (4-byte) and section length
-		 * in 4-byte network byte order.
-		 */
-		uint32_t extsize;
-		memcpy(&extsize, (char *)mmap + src_offset + 4, 4);
-		extsize = ntohl(extsize);
-		if (read_index_extension(istate,
-					 (const char *) mmap + src_offset,
-					 (char *) mmap + src_offset + 8,
-					 extsize) < 0)
-			goto unmap;
-		src_offset += 8;
-		src_offset += extsize;
+	/*
+	 * If the index tells us where its extensions start, load them
+	 * on a thread of their own while the entries are being parsed.
+	 */
+	if (nr_threads > 1) {
+		extension_offset = read_eoie_extension(mmap, mmap_size);
+		if (extension_offset) {
+			int err;
+
+			p.istate = istate;
+			p.mmap = mmap;
+			p.mmap_size = mmap_size;
+			p.src_offset = extension_offset;
+			err = pthread_create(&p.pthread, NULL,
+					     load_index_extensions_thread, &p);
+			if (err)
+				die(_("unable to create load_index_extensions thread: %s"),
+				    strerror(err));
+
+			nr_threads--;
+		}
 	}
+
+	/*
+	 * Locate and read the index entry offset table so that we can
+	 * use it to spread the parsing of the cache entries over threads.
+	 */
+	if (extension_offset && nr_threads > 1)
+		ieot = read_ieot_extension(mmap, mmap_size, extension_offset,
+					   istate->cache_nr);
+
+	if (ieot) {
+		load_cache_entries_threaded(istate, mmap, nr_threads, ieot);
+		free(ieot);
+	} else {
+		src_offset += load_all_cache_entries(istate, mmap, src_offset);
+	}
+
+	if (extension_offset) {
+		int err = pthread_join(p.pthread, NULL);
+		if (err)
+			die(_("unable to join load_index_extensions thread: %s"),
+			    strerror(err));
+	}
+#else
+	src_offset += load_all_cache_entries(istate, mmap, src_offset);
+#endif
+
+	/* load the extensions ourselves if no thread did it */
+	if (!extension_offset)
+		load_index_extensions(istate, mmap, mmap_size, src_offset);
+
 	munmap(mmap, mmap_size);
 	return istate->cache_nr;
 
@@ -1937,6 +2366,7 @@ int discard_index(struct index_state *istate)
 	istate->initialized = 0;
 	FREE_AND_NULL(istate->cache);
 	istate->cache_alloc = 0;
+	istate->sparse_index = 0;
 	discard_split_index(istate);
 	free_untracked_cache(istate->untracked);
 	istate->untracked = NULL;
@@ -1991,15 +2421,29 @@ static int ce_write(git_SHA_CTX *context, int fd, void *data, unsigned int len)
 	return 0;
 }
 
-static int write_index_ext_header(git_SHA_CTX *context, int fd,
-				  unsigned int ext, unsigned int sz)
+static int write_index_ext_header(git_SHA_CTX *context, git_SHA_CTX *eoie_context,
+				  int fd, unsigned int ext, unsigned int sz)
 {
 	ext = htonl(ext);
 	sz = htonl(sz);
+	if (eoie_context) {
+		git_SHA1_Update(eoie_context, &ext, 4);
+		git_SHA1_Update(eoie_context, &sz, 4);
+	}
 	return ((ce_write(context, fd, &ext, 4) < 0) ||
 		(ce_write(context, fd, &sz, 4) < 0)) ? -1 : 0;
 }
 
+/* The offset in the file at which the next ce_write() will land. */
+static off_t ce_write_offset(int fd)
+{
+	off_t offset = lseek(fd, 0, SEEK_CUR);
+
+	if (offset < 0)
+		return offset;
+	return offset + write_buffer_len;
+}
+
 static int ce_flush(git_SHA_CTX *context, int fd, unsigned char *sha1)
 {
 	unsigned int left = write_buffer_len;
@@ -2224,6 +2668,39 @@ void update_index_if_able(struct index_state *istate, struct lock_file *lockfile
 		rollback_lock_file(lockfile);
 }
 
+/*
+ * The EOIE and IEOT extensions are only useful for threaded reads,
+ * and older versions of Git complain about every extension they do
+ * not know, so unless asked for explicitly they are only written when
+ * the user has explicitly enabled index.threads.
+ */
+static int index_threads_requested(void)
+{
+	int is_bool, val;
+
+	if (git_config_get_bool_or_int("index.threads", &is_bool, &val))
+		return 0;
+	return is_bool ? val : val != 1;
+}
+
+static int record_eoie(void)
+{
+	int val;
+
+	if (!git_config_get_bool("index.recordendofindexentries", &val))
+		return val;
+	return index_threads_requested();
+}
+
+static int record_ieot(void)
+{
+	int val;
+
+	if (!git_config_get_bool("index.recordoffsettable", &val))
+		return val;
+	return index_threads_requested();
+}
+
 /*
  * On success, `tempfile` is closed. If it is the temporary file
  * of a `struct lock_file`, we will therefore effectively perform
@@ -2244,6 +2721,10 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	struct ondisk_cache_entry_extended ondisk;
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
 	int drop_cache_tree = 0;
+	int nr, ieot_entries = 0;
+	struct index_entry_offset_table *ieot = NULL;
+	git_SHA_CTX eoie_context, *eoie_c = NULL;
+	off_t offset;
 
 	for (i = removed = extended = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
@@ -2277,12 +2758,49 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
 		return -1;
 
+	if (record_ieot()) {
+		int ieot_blocks = git_config_get_index_threads();
+
+		if (!ieot_blocks) {
+			/* leave one cpu for loading the extensions */
+			int cpus = online_cpus();
+
+			ieot_blocks = (entries - removed) / THREAD_COST;
+			if (ieot_blocks > cpus - 1)
+				ieot_blocks = cpus - 1;
+		}
+		if (ieot_blocks > entries - removed)
+			ieot_blocks = entries - removed;
+
+		if (ieot_blocks > 1) {
+			ieot = xcalloc(1, st_add(sizeof(*ieot),
+				st_mult(ieot_blocks, sizeof(struct index_entry_offset))));
+			ieot_entries = DIV_ROUND_UP(entries - removed, ieot_blocks);
+		}
+	}
+
 	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
 
-	for (i = 0; i < entries; i++) {
+	for (i = nr = 0; i < entries; i++) {
 		struct cache_entry *ce = cache[i];
 		if (ce->ce_flags & CE_REMOVE)
 			continue;
+		if (ieot && !nr) {
+			offset = ce_write_offset(newfd);
+			if (offset < 0) {
+				free(ieot);
+				return -1;
+			}
+			ieot->entries[ieot->nr].offset = offset;
+			ieot->nr++;
+			/*
+			 * Start every block with a full name, by stripping
+			 * all of the previous one, so that readers without
+			 * the table still see the same names.
+			 */
+			if (previous_name && previous_name->len)
+				previous_name->buf[0] = '\0';
+		}
 		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
 			ce_smudge_racily_clean_entry(ce);
 		if (is_null_oid(&ce->oid)) {
@@ -2303,18 +2821,57 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 
 		if (err)
 			break;
+
+		if (ieot && ++nr == ieot_entries) {
+			ieot->entries[ieot->nr - 1].nr = nr;
+			nr = 0;
+		}
 	}
+	if (ieot && nr)
+		ieot->entries[ieot->nr - 1].nr = nr;
 	strbuf_release(&previous_name_buf);
 
-	if (err)
+	if (err) {
+		free(ieot);
 		return err;
+	}
+
+	offset = ce_write_offset(newfd);
+	if (offset < 0) {
+		free(ieot);
+		return -1;
+	}
+	if (record_eoie()) {
+		git_SHA1_Init(&eoie_context);
+		eoie_c = &eoie_context;
+	}
+
+	/*
+	 * The offset table must come first so that readers can find it
+	 * without walking over the other extensions.  Like EOIE below, it
+	 * describes the layout of the file rather than its contents, so
+	 * it is written even when the other extensions are stripped.
+	 */
+	if (ieot) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_ieot_extension(&sb, ieot);
+		err = write_index_ext_header(&c, eoie_c, newfd,
+					     CACHE_EXT_INDEXENTRYOFFSETTABLE,
+					     sb.len) < 0 ||
+			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		free(ieot);
+		if (err)
+			return -1;
+	}
 
 	/* Write extension data here */
 	if (!strip_extensions && istate->split_index) {
 		struct strbuf sb = STRBUF_INIT;
 
 		err = write_link_extension(&sb, istate) < 0 ||
-			write_index_ext_header(&c, newfd, CACHE_EXT_LINK,
+			write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_LINK,
 					       sb.len) < 0 ||
 			ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2325,7 +2882,8 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_TREE, sb.len) < 0
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_TREE,
+					     sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
@@ -2335,7 +2893,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		resolve_undo_write(&sb, istate->resolve_undo);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_RESOLVE_UNDO,
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_RESOLVE_UNDO,
 					     sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2346,7 +2904,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_untracked_extension(&sb, istate->untracked);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_UNTRACKED,
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_UNTRACKED,
 					     sb.len) < 0 ||
 			ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2357,12 +2915,35 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_fsmonitor_extension(&sb, istate);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_FSMONITOR, sb.len) < 0
+		err = write_index_ext_header(&c, eoie_c, newfd,
+					     CACHE_EXT_FSMONITOR, sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
 	}
+	if (!strip_extensions && istate->sparse_index) {
+		if (write_index_ext_header(&c, eoie_c, newfd,
+					   CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0)
+			return -1;
+	}
+
+	/*
+	 * The end of index entries extension must be the last one, right
+	 * before the checksum, so that readers can find it from the end.
+	 */
+	if (eoie_c) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_eoie_extension(&sb, eoie_c, offset);
+		err = write_index_ext_header(&c, NULL, newfd,
+					     CACHE_EXT_ENDOFINDEXENTRIES,
+					     sb.len) < 0 ||
+			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
 
 	if (ce_flush(&c, newfd, istate->sha1))
 		return -1;
@@ -2542,6 +3123,9 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 {
 	int new_shared_index, ret;
 	struct split_index *si = istate->split_index;
+	int was_full = !istate->sparse_index;
+
+	convert_to_sparse(istate);
 
 	if (istate->fsmonitor_last_update)
 		fill_fsmonitor_bitmap(istate);
@@ -2579,6 +3163,8 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 out:
 	if (flags & COMMIT_LOCK)
 		rollback_lock_file(lock);
+	if (was_full)
+		ensure_full_index(istate);
 	return ret;
 }
 
@@ -13,11 +13,12 @@
 #include "tag.h"
 #include "submodule.h"
 #include "worktree.h"
+#include "argv-array.h"
 
 /*
  * List of all available backends
  */
-static struct ref_storage_be *refs_backends = &refs_be_files;
+static struct ref_storage_be *refs_backends = &refs_be_reftable;
 
 static struct ref_storage_be *find_ref_storage_backend(const char *name)
 {
@@ -529,6 +530,19 @@ int dwim_ref(const char *str, int len, struct object_id *oid, char **ref)
 	return refs_found;
 }
 
+/*
+ * Given a 'prefix' expand it by the rules in 'ref_rev_parse_rules' and add
+ * the results to 'prefixes'
+ */
+void expand_ref_prefix(struct argv_array *prefixes, const char *prefix)
+{
+	const char **p;
+	int len = strlen(prefix);
+
+	for (p = ref_rev_parse_rules; *p; p++)
+		argv_array_pushf(prefixes, *p, len, prefix);
+}
+
 int expand_ref(const char *str, int len, struct object_id *oid, char **ref)
 {
 	const char **p, *r;
@@ -1637,17 +1651,46 @@ static struct ref_store *lookup_ref_store_map(struct hashmap *map,
  * Create, record, and return a ref_store instance for the specified
  * gitdir.
  */
+/*
+ * Return the ref storage backend that the repository at gitdir names
+ * in its config, or NULL if it uses the default.
+ */
+static char *read_ref_storage_format(const char *gitdir)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct repository_format format;
+
+	get_common_dir_noenv(&sb, gitdir);
+	strbuf_addstr(&sb, "/config");
+	read_repository_format(&format, sb.buf);
+	strbuf_release(&sb);
+
+	string_list_clear(&format.unknown_extensions, 0);
+	free(format.work_tree);
+	return format.ref_storage;
+}
+
 static struct ref_store *ref_store_init(const char *gitdir,
 					unsigned int flags)
 {
 	const char *be_name = "files";
-	struct ref_storage_be *be = find_ref_storage_backend(be_name);
+	char *to_free = NULL;
+	struct ref_storage_be *be;
 	struct ref_store *refs;
 
+	if (flags & REF_STORE_MAIN) {
+		if (repository_format_ref_storage)
+			be_name = repository_format_ref_storage;
+	} else if ((to_free = read_ref_storage_format(gitdir))) {
+		be_name = to_free;
+	}
+
+	be = find_ref_storage_backend(be_name);
 	if (!be)
-		die("BUG: reference backend %s is unknown", be_name);
+		die("reference backend %s is unknown", be_name);
 
 	refs = be->init(gitdir, flags);
+	free(to_free);
 	return refs;
 }
 
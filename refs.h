@@ -1,6 +1,7 @@
 #ifndef REFS_H
 #define REFS_H
 
+struct argv_array;
 struct object_id;
 struct ref_store;
 struct strbuf;
@@ -139,6 +140,12 @@ int resolve_gitlink_ref(const char *submodule, const char *refname,
  */
 int refname_match(const char *abbrev_name, const char *full_name);
 
+/*
+ * Add to 'prefixes' every full refname that 'prefix' could be an
+ * abbreviation of, according to the rules in ref_rev_parse_rules.
+ */
+void expand_ref_prefix(struct argv_array *prefixes, const char *prefix);
+
 int expand_ref(const char *str, int len, struct object_id *oid, char **ref);
 int dwim_ref(const char *str, int len, struct object_id *oid, char **ref);
 int dwim_log(const char *str, int len, struct object_id *oid, char **ref);
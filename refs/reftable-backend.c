@@ -0,0 +1,1771 @@
+#include "../cache.h"
+#include "../config.h"
+#include "../refs.h"
+#include "refs-internal.h"
+#include "reftable.h"
+#include "../iterator.h"
+#include "../object.h"
+
+/*
+ * A ref store that keeps references and reflogs in stacks of
+ * reftables (see reftable.h) instead of in loose files and
+ * `packed-refs`. Every update of the store, be it a transaction, a
+ * symref, a rename or a reflog expiry, adds one table to the top of
+ * the stack, so readers never see it half done.
+ */
+
+/*
+ * This backend uses the following flags in `ref_update::flags` for
+ * internal bookkeeping purposes. Their numerical values must not
+ * conflict with REF_NO_DEREF, REF_FORCE_CREATE_REFLOG, REF_HAVE_NEW,
+ * or REF_HAVE_OLD, which are also stored in `ref_update::flags`.
+ */
+
+/* The update deletes the reference. */
+#define REF_DELETING (1 << 5)
+
+/* The reference record has to be written. */
+#define REF_NEEDS_COMMIT (1 << 6)
+
+/*
+ * Only a reflog entry is to be written, because the update of the
+ * reference itself has been split off to another `ref_update`.
+ */
+#define REF_LOG_ONLY (1 << 7)
+
+/* The update was split off from an update of HEAD. */
+#define REF_UPDATE_VIA_HEAD (1 << 8)
+
+struct reftable_ref_store {
+	struct ref_store base;
+	unsigned int store_flags;
+
+	char *gitdir;
+	char *gitcommondir;
+
+	/*
+	 * The references shared by all worktrees, and also the
+	 * per-worktree references of the main worktree:
+	 */
+	struct reftable_stack main_stack;
+
+	/*
+	 * The per-worktree references (HEAD, the refs under refs/bisect/, and
+	 * pseudorefs) of a linked worktree, or NULL for the main
+	 * worktree:
+	 */
+	struct reftable_stack *worktree_stack;
+
+	/*
+	 * Pseudorefs like FETCH_HEAD and ORIG_HEAD are written as
+	 * plain files by refs.c (or directly by their users), so we
+	 * look for them there first.
+	 */
+	struct ref_store *pseudoref_store;
+};
+
+static struct ref_store *reftable_ref_store_create(const char *gitdir,
+						   unsigned int flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct ref_store *ref_store = (struct ref_store *)refs;
+	struct strbuf sb = STRBUF_INIT;
+
+	base_ref_store_init(ref_store, &refs_be_reftable);
+	refs->store_flags = flags;
+
+	refs->gitdir = xstrdup(gitdir);
+	get_common_dir_noenv(&sb, gitdir);
+	refs->gitcommondir = strbuf_detach(&sb, NULL);
+
+	strbuf_addf(&sb, "%s/reftable", refs->gitcommondir);
+	reftable_stack_init(&refs->main_stack, sb.buf);
+	if (strcmp(refs->gitdir, refs->gitcommondir)) {
+		strbuf_reset(&sb);
+		strbuf_addf(&sb, "%s/reftable", refs->gitdir);
+		refs->worktree_stack = xcalloc(1, sizeof(*refs->worktree_stack));
+		reftable_stack_init(refs->worktree_stack, sb.buf);
+	}
+	strbuf_release(&sb);
+
+	refs->pseudoref_store = refs_be_files.init(gitdir, REF_STORE_READ);
+
+	return ref_store;
+}
+
+/*
+ * Downcast ref_store to reftable_ref_store. Die if ref_store is not a
+ * reftable_ref_store. required_flags is compared with ref_store's
+ * store_flags to ensure the ref_store has all required capabilities.
+ * "caller" is used in any necessary error messages.
+ */
+static struct reftable_ref_store *reftable_downcast(struct ref_store *ref_store,
+						    unsigned int required_flags,
+						    const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		die("BUG: ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		die("BUG: operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+static long get_reftable_lock_timeout_ms(void)
+{
+	static int timeout_configured = 0;
+	static int timeout_value = 1000;
+
+	if (!timeout_configured) {
+		git_config_get_int("core.reftablelocktimeout", &timeout_value);
+		timeout_configured = 1;
+	}
+
+	return timeout_value;
+}
+
+/* Return the stack that holds `refname` and its reflog. */
+static struct reftable_stack *stack_for(struct reftable_ref_store *refs,
+					const char *refname)
+{
+	if (refs->worktree_stack && ref_type(refname) != REF_TYPE_NORMAL)
+		return refs->worktree_stack;
+	return &refs->main_stack;
+}
+
+static void reload_or_die(struct reftable_stack *stack)
+{
+	if (reftable_stack_reload(stack))
+		die("unable to read reftables in '%s'", stack->dir);
+}
+
+static int record_cmp(const void *va, const void *vb)
+{
+	const struct reftable_record *a = va, *b = vb;
+	int cmp = memcmp(a->key.buf, b->key.buf,
+			 a->key.len < b->key.len ? a->key.len : b->key.len);
+
+	if (cmp)
+		return cmp;
+	return a->key.len < b->key.len ? -1 : a->key.len != b->key.len;
+}
+
+/* Set `rec` to point at `oid`, recording its peeled value if it has one. */
+static void set_ref_value(struct reftable_record *rec,
+			  const struct object_id *oid)
+{
+	oidcpy(&rec->oid, oid);
+	if (peel_object(oid, &rec->peeled) == PEEL_PEELED)
+		rec->value_type = REFTABLE_REF_VAL2;
+	else
+		rec->value_type = REFTABLE_REF_VAL1;
+}
+
+/*
+ * Seek `mi` to the reflog of `refname` in `stack`, newest entry first.
+ * Use `is_reflog_of()` to tell when the reflog is exhausted.
+ */
+static int seek_reflog(struct reftable_merged_iter *mi,
+		       struct reftable_stack *stack, const char *refname,
+		       int keep_deletions)
+{
+	return reftable_merged_seek(mi, stack->tables, stack->nr,
+				    REFTABLE_BLOCK_LOG,
+				    refname, strlen(refname) + 1,
+				    keep_deletions);
+}
+
+static int is_reflog_of(const struct reftable_record *rec, const char *refname)
+{
+	return !strcmp(rec->key.buf, refname);
+}
+
+/*
+ * Batches of records to add to the stacks of a store in one go. Both
+ * stacks are locked while the batch is assembled, so that it can be
+ * based on their current contents.
+ */
+struct batch_stack {
+	struct reftable_stack *stack;
+	int locked;
+	uint64_t update_index;
+
+	struct reftable_record *refs;
+	size_t refs_nr, refs_alloc;
+	struct reftable_record *logs;
+	size_t logs_nr, logs_alloc;
+};
+
+struct reftable_batch {
+	struct reftable_ref_store *refs;
+	struct batch_stack stacks[2];
+	int nr;
+};
+
+static void batch_release(struct reftable_batch *batch)
+{
+	int i;
+	size_t j;
+
+	for (i = 0; i < batch->nr; i++) {
+		struct batch_stack *bs = &batch->stacks[i];
+
+		if (bs->locked)
+			reftable_stack_unlock(bs->stack);
+		bs->locked = 0;
+		for (j = 0; j < bs->refs_nr; j++)
+			reftable_record_release(&bs->refs[j]);
+		for (j = 0; j < bs->logs_nr; j++)
+			reftable_record_release(&bs->logs[j]);
+		FREE_AND_NULL(bs->refs);
+		FREE_AND_NULL(bs->logs);
+		bs->refs_nr = bs->refs_alloc = bs->logs_nr = bs->logs_alloc = 0;
+	}
+}
+
+static int batch_lock(struct reftable_batch *batch,
+		      struct reftable_ref_store *refs, struct strbuf *err)
+{
+	int i;
+
+	memset(batch, 0, sizeof(*batch));
+	batch->refs = refs;
+	batch->stacks[batch->nr++].stack = &refs->main_stack;
+	if (refs->worktree_stack)
+		batch->stacks[batch->nr++].stack = refs->worktree_stack;
+
+	for (i = 0; i < batch->nr; i++) {
+		struct batch_stack *bs = &batch->stacks[i];
+
+		if (reftable_stack_lock(bs->stack,
+					get_reftable_lock_timeout_ms(), err)) {
+			batch_release(batch);
+			return -1;
+		}
+		bs->locked = 1;
+		bs->update_index = reftable_stack_next_update_index(bs->stack);
+	}
+	return 0;
+}
+
+static struct batch_stack *batch_stack_for(struct reftable_batch *batch,
+					   const char *refname)
+{
+	struct reftable_stack *stack = stack_for(batch->refs, refname);
+	int i;
+
+	for (i = 0; i < batch->nr; i++)
+		if (batch->stacks[i].stack == stack)
+			return &batch->stacks[i];
+	die("BUG: no stack for '%s' in reftable batch", refname);
+}
+
+/* Add a ref record for `refname` to `batch`, for the caller to fill in. */
+static struct reftable_record *batch_add_ref(struct reftable_batch *batch,
+					     const char *refname)
+{
+	struct batch_stack *bs = batch_stack_for(batch, refname);
+	struct reftable_record *rec;
+
+	ALLOC_GROW(bs->refs, bs->refs_nr + 1, bs->refs_alloc);
+	rec = &bs->refs[bs->refs_nr++];
+	reftable_record_init(rec);
+	strbuf_addstr(&rec->key, refname);
+	rec->update_index = bs->update_index;
+	return rec;
+}
+
+/*
+ * Add a log record for `refname` at `update_index` (or at the update
+ * index of the batch if it is 0) to `batch`, for the caller to fill in.
+ */
+static struct reftable_record *batch_add_log(struct reftable_batch *batch,
+					     const char *refname,
+					     uint64_t update_index)
+{
+	struct batch_stack *bs = batch_stack_for(batch, refname);
+	struct reftable_record *rec;
+
+	ALLOC_GROW(bs->logs, bs->logs_nr + 1, bs->logs_alloc);
+	rec = &bs->logs[bs->logs_nr++];
+	reftable_record_init(rec);
+	rec->update_index = update_index ? update_index : bs->update_index;
+	reftable_log_key(&rec->key, refname, rec->update_index);
+	return rec;
+}
+
+static void batch_add_log_entry(struct reftable_batch *batch,
+				const char *refname,
+				const struct object_id *old_oid,
+				const struct object_id *new_oid,
+				const char *msg)
+{
+	struct reftable_record *rec = batch_add_log(batch, refname, 0);
+	const char *info = git_committer_info(0);
+	const char *email_end = strrchr(info, '>');
+	char *end;
+
+	if (!email_end)
+		die("BUG: unexpected committer info '%s'", info);
+
+	rec->value_type = REFTABLE_LOG_UPDATE;
+	oidcpy(&rec->old_oid, old_oid);
+	oidcpy(&rec->new_oid, new_oid);
+	strbuf_add(&rec->committer, info, email_end + 1 - info);
+	rec->time = parse_timestamp(email_end + 1, &end, 10);
+	rec->tz = strtol(end, NULL, 10);
+
+	if (msg && *msg) {
+		int len;
+
+		strbuf_grow(&rec->message, strlen(msg) + 2);
+		len = copy_reflog_msg(rec->message.buf, msg);
+		/* Strip the leading tab and the trailing newline: */
+		if (len > 1 && rec->message.buf[0] == '\t') {
+			memmove(rec->message.buf, rec->message.buf + 1, len - 2);
+			strbuf_setlen(&rec->message, len - 2);
+		} else {
+			strbuf_setlen(&rec->message, 0);
+		}
+	}
+}
+
+/* Add deletion records for all entries of the reflog of `refname`. */
+static int batch_delete_reflog(struct reftable_batch *batch,
+			       const char *refname)
+{
+	struct reftable_stack *stack = batch_stack_for(batch, refname)->stack;
+	struct reftable_merged_iter mi;
+	struct reftable_record rec;
+	int ret;
+
+	reftable_record_init(&rec);
+	ret = seek_reflog(&mi, stack, refname, 0);
+	while (!ret && !(ret = reftable_merged_next(&mi, &rec)) &&
+	       is_reflog_of(&rec, refname)) {
+		struct reftable_record *del =
+			batch_add_log(batch, refname, rec.update_index);
+		del->value_type = REFTABLE_LOG_DELETION;
+	}
+	reftable_merged_release(&mi);
+	reftable_record_release(&rec);
+	return ret < 0 ? -1 : 0;
+}
+
+/*
+ * Write the records of `batch` to their stacks and release the batch,
+ * including the locks.
+ */
+static int batch_commit(struct reftable_batch *batch, struct strbuf *err)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < batch->nr; i++) {
+		struct batch_stack *bs = &batch->stacks[i];
+
+		if (!bs->refs_nr && !bs->logs_nr)
+			continue;
+
+		QSORT(bs->refs, bs->refs_nr, record_cmp);
+		QSORT(bs->logs, bs->logs_nr, record_cmp);
+		bs->locked = 0;
+		if (!ret &&
+		    reftable_stack_add(bs->stack, bs->update_index,
+				       bs->refs, bs->refs_nr,
+				       bs->logs, bs->logs_nr, err))
+			ret = -1;
+		else if (ret)
+			reftable_stack_unlock(bs->stack);
+	}
+
+	batch_release(batch);
+	return ret;
+}
+
+static int reftable_read_raw_ref(struct ref_store *ref_store,
+				 const char *refname, struct object_id *oid,
+				 struct strbuf *referent, unsigned int *type)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	struct reftable_record rec;
+	int ret;
+
+	*type = 0;
+
+	if (ref_type(refname) == REF_TYPE_PSEUDOREF) {
+		if (!refs_read_raw_ref(refs->pseudoref_store, refname, oid,
+				       referent, type))
+			return 0;
+		if (errno != ENOENT)
+			return -1;
+		*type = 0;
+	}
+
+	reftable_record_init(&rec);
+	ret = reftable_stack_read_ref(stack_for(refs, refname), refname, &rec);
+	if (ret) {
+		errno = ret < 0 ? EIO : ENOENT;
+		ret = -1;
+	} else if (rec.value_type == REFTABLE_REF_SYMREF) {
+		strbuf_swap(referent, &rec.target);
+		*type |= REF_ISSYMREF;
+	} else {
+		oidcpy(oid, &rec.oid);
+	}
+	reftable_record_release(&rec);
+	return ret;
+}
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+
+	struct reftable_ref_store *refs;
+	struct reftable_merged_iter mi;
+	struct reftable_record rec;
+	char *prefix;
+	unsigned int flags;
+
+	/* Skip per-worktree refs, which live in the other stack: */
+	int shared_only;
+
+	struct object_id oid;
+};
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	int ret;
+
+	while (!(ret = reftable_merged_next(&iter->mi, &iter->rec))) {
+		const char *refname = iter->rec.key.buf;
+
+		/* The records are sorted, so we are done with the prefix: */
+		if (!starts_with(refname, iter->prefix)) {
+			ret = 1;
+			break;
+		}
+
+		/* HEAD and pseudorefs are not iterated over: */
+		if (!starts_with(refname, "refs/"))
+			continue;
+
+		if (iter->shared_only && ref_type(refname) != REF_TYPE_NORMAL)
+			continue;
+		if (iter->flags & DO_FOR_EACH_PER_WORKTREE_ONLY &&
+		    ref_type(refname) != REF_TYPE_PER_WORKTREE)
+			continue;
+
+		iter->base.flags = 0;
+		if (iter->rec.value_type == REFTABLE_REF_SYMREF) {
+			iter->base.flags |= REF_ISSYMREF;
+			if (!refs_resolve_ref_unsafe(&iter->refs->base, refname,
+						     RESOLVE_REF_READING,
+						     &iter->oid, NULL)) {
+				oidclr(&iter->oid);
+				iter->base.flags |= REF_ISBROKEN;
+			}
+		} else {
+			oidcpy(&iter->oid, &iter->rec.oid);
+		}
+
+		if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
+			if (!refname_is_safe(refname))
+				die("reftable refname is dangerous: %s", refname);
+			oidclr(&iter->oid);
+			iter->base.flags |= REF_BAD_NAME | REF_ISBROKEN;
+		}
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(refname, &iter->oid,
+					    iter->base.flags))
+			continue;
+
+		iter->base.refname = refname;
+		iter->base.oid = &iter->oid;
+		return ITER_OK;
+	}
+
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE || ret < 0)
+		return ITER_ERROR;
+	return ITER_DONE;
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	/*
+	 * The peeled value of every tag was recorded when the
+	 * reference was written, so VAL1 records do not peel.
+	 */
+	if (iter->base.flags & (REF_ISBROKEN | REF_ISSYMREF) ||
+	    iter->rec.value_type != REFTABLE_REF_VAL2)
+		return -1;
+	oidcpy(peeled, &iter->rec.peeled);
+	return 0;
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	reftable_merged_release(&iter->mi);
+	reftable_record_release(&iter->rec);
+	free(iter->prefix);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	reftable_ref_iterator_advance,
+	reftable_ref_iterator_peel,
+	reftable_ref_iterator_abort
+};
+
+static struct ref_iterator *stack_ref_iterator_begin(
+		struct reftable_ref_store *refs, struct reftable_stack *stack,
+		const char *prefix, unsigned int flags, int shared_only)
+{
+	struct reftable_ref_iterator *iter = xcalloc(1, sizeof(*iter));
+	struct ref_iterator *ref_iterator = &iter->base;
+
+	base_ref_iterator_init(ref_iterator, &reftable_ref_iterator_vtable, 1);
+	iter->refs = refs;
+	iter->prefix = xstrdup(prefix);
+	iter->flags = flags;
+	iter->shared_only = shared_only;
+	reftable_record_init(&iter->rec);
+
+	reload_or_die(stack);
+	if (reftable_merged_seek(&iter->mi, stack->tables, stack->nr,
+				 REFTABLE_BLOCK_REF, prefix, strlen(prefix), 0))
+		die("unable to read reftables in '%s'", stack->dir);
+
+	return ref_iterator;
+}
+
+static struct ref_iterator *reftable_ref_iterator_begin(
+		struct ref_store *ref_store,
+		const char *prefix, unsigned int flags)
+{
+	struct reftable_ref_store *refs;
+	struct ref_iterator *iter;
+	unsigned int required_flags = REF_STORE_READ;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+	refs = reftable_downcast(ref_store, required_flags,
+				 "ref_iterator_begin");
+
+	if (!prefix)
+		prefix = "";
+
+	iter = stack_ref_iterator_begin(refs, &refs->main_stack, prefix, flags,
+					!!refs->worktree_stack);
+	if (!refs->worktree_stack)
+		return iter;
+
+	return overlay_ref_iterator_begin(
+			stack_ref_iterator_begin(refs, refs->worktree_stack,
+						 prefix, flags, 0),
+			iter);
+}
+
+struct reftable_update {
+	/* The value of the reference before the update: */
+	struct object_id old_oid;
+	int exists;
+};
+
+/*
+ * If update is a direct update of head_ref (the reference pointed to
+ * by HEAD), then add an extra REF_LOG_ONLY update for HEAD.
+ */
+static int split_head_update(struct ref_update *update,
+			     struct ref_transaction *transaction,
+			     const char *head_ref,
+			     struct string_list *affected_refnames,
+			     struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+
+	if ((update->flags & REF_LOG_ONLY) ||
+	    (update->flags & REF_UPDATE_VIA_HEAD))
+		return 0;
+
+	if (strcmp(update->refname, head_ref))
+		return 0;
+
+	if (string_list_has_string(affected_refnames, "HEAD")) {
+		strbuf_addf(err,
+			    "multiple updates for 'HEAD' (including one "
+			    "via its referent '%s') are not allowed",
+			    update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_update = ref_transaction_add_update(
+			transaction, "HEAD",
+			update->flags | REF_LOG_ONLY | REF_NO_DEREF,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * update is for a symref that points at referent and doesn't have
+ * REF_NO_DEREF set. Split it into a REF_LOG_ONLY update of the symref
+ * and a new, separate update for the referent.
+ */
+static int split_symref_update(struct ref_update *update,
+			       const char *referent,
+			       struct ref_transaction *transaction,
+			       struct string_list *affected_refnames,
+			       struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+	unsigned int new_flags;
+
+	if (string_list_has_string(affected_refnames, referent)) {
+		strbuf_addf(err,
+			    "multiple updates for '%s' (including one "
+			    "via symref '%s') are not allowed",
+			    referent, update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_flags = update->flags;
+	if (!strcmp(update->refname, "HEAD"))
+		new_flags |= REF_UPDATE_VIA_HEAD;
+
+	new_update = ref_transaction_add_update(
+			transaction, referent, new_flags,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	new_update->parent_update = update;
+
+	update->flags |= REF_LOG_ONLY | REF_NO_DEREF;
+	update->flags &= ~REF_HAVE_OLD;
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	if (item->util)
+		BUG("%s unexpectedly found in affected_refnames",
+		    new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * Return the refname under which update was originally requested.
+ */
+static const char *original_update_refname(struct ref_update *update)
+{
+	while (update->parent_update)
+		update = update->parent_update;
+
+	return update->refname;
+}
+
+/*
+ * Check whether the REF_HAVE_OLD and old_oid values stored in update
+ * are consistent with oid, which is the reference's current value. If
+ * everything is OK, return 0; otherwise, write an error message to
+ * err and return -1.
+ */
+static int check_old_oid(struct ref_update *update, struct object_id *oid,
+			 struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+		   !oidcmp(oid, &update->old_oid))
+		return 0;
+
+	if (is_null_oid(&update->old_oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    original_update_refname(update));
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(&update->old_oid));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(oid),
+			    oid_to_hex(&update->old_oid));
+
+	return -1;
+}
+
+static int check_new_oid(struct ref_update *update, struct strbuf *err)
+{
+	struct object *o = parse_object(&update->new_oid);
+
+	if (!o) {
+		strbuf_addf(err,
+			    "cannot update ref '%s': "
+			    "trying to write ref '%s' with nonexistent object %s",
+			    update->refname, update->refname,
+			    oid_to_hex(&update->new_oid));
+		return -1;
+	}
+	if (o->type != OBJ_COMMIT && is_branch(update->refname)) {
+		strbuf_addf(err,
+			    "cannot update ref '%s': "
+			    "trying to write non-commit object %s to branch '%s'",
+			    update->refname, oid_to_hex(&update->new_oid),
+			    update->refname);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Prepare for carrying out update, with the stacks locked:
+ * - Read the reference and check its old value (if specified), and in
+ *   any case record it for later use when writing the reflog.
+ * - If it is a symref update without REF_NO_DEREF, split it up into a
+ *   REF_LOG_ONLY update of the symref and add a separate update for
+ *   the referent to transaction.
+ * - If it is an update of head_ref, add a corresponding REF_LOG_ONLY
+ *   update of HEAD.
+ * - Decide whether the reference record has to be written at all.
+ */
+static int prepare_update(struct reftable_ref_store *refs,
+			  struct ref_update *update,
+			  struct ref_transaction *transaction,
+			  const char *head_ref,
+			  struct string_list *affected_refnames,
+			  struct strbuf *err)
+{
+	struct reftable_update *u;
+	struct reftable_record rec;
+	int ret = 0, r;
+
+	if ((update->flags & REF_HAVE_NEW) && is_null_oid(&update->new_oid))
+		update->flags |= REF_DELETING;
+
+	if (head_ref) {
+		ret = split_head_update(update, transaction, head_ref,
+					affected_refnames, err);
+		if (ret)
+			return ret;
+	}
+
+	u = xcalloc(1, sizeof(*u));
+	update->backend_data = u;
+
+	reftable_record_init(&rec);
+	r = reftable_stack_read_ref(stack_for(refs, update->refname),
+				    update->refname, &rec);
+	if (r < 0) {
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "error reading reference",
+			    original_update_refname(update));
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+	u->exists = !r;
+
+	if (u->exists && rec.value_type == REFTABLE_REF_SYMREF) {
+		update->type |= REF_ISSYMREF;
+		if (!(update->flags & REF_NO_DEREF)) {
+			/*
+			 * The old value will be recorded and checked
+			 * when the split-off update is processed.
+			 */
+			ret = split_symref_update(update, rec.target.buf,
+						  transaction,
+						  affected_refnames, err);
+			goto out;
+		}
+
+		if (refs_read_ref_full(&refs->base, rec.target.buf, 0,
+				       &u->old_oid, NULL)) {
+			if (update->flags & REF_HAVE_OLD) {
+				strbuf_addf(err, "cannot lock ref '%s': "
+					    "error reading reference",
+					    original_update_refname(update));
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto out;
+			}
+		} else if (check_old_oid(update, &u->old_oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+	} else {
+		struct ref_update *parent_update;
+
+		if (u->exists)
+			oidcpy(&u->old_oid, &rec.oid);
+		if (check_old_oid(update, &u->old_oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+
+		/*
+		 * If this update is happening indirectly because of a
+		 * symref update, record the old OID in the parent
+		 * update:
+		 */
+		for (parent_update = update->parent_update;
+		     parent_update;
+		     parent_update = parent_update->parent_update) {
+			struct reftable_update *parent_u =
+				parent_update->backend_data;
+			oidcpy(&parent_u->old_oid, &u->old_oid);
+		}
+	}
+
+	if (!(update->flags & REF_HAVE_NEW) || (update->flags & REF_LOG_ONLY))
+		goto out;
+
+	if (update->flags & REF_DELETING) {
+		if (u->exists)
+			update->flags |= REF_NEEDS_COMMIT;
+		goto out;
+	}
+
+	if (!u->exists &&
+	    refs_verify_refname_available(&refs->base, update->refname,
+					  affected_refnames, NULL, err)) {
+		char *reason = strbuf_detach(err, NULL);
+
+		strbuf_addf(err, "cannot lock ref '%s': %s",
+			    original_update_refname(update), reason);
+		free(reason);
+		ret = TRANSACTION_NAME_CONFLICT;
+		goto out;
+	}
+
+	if (!(update->type & REF_ISSYMREF) && u->exists &&
+	    !oidcmp(&u->old_oid, &update->new_oid)) {
+		/*
+		 * The reference already has the desired value, so we
+		 * don't need to write it.
+		 */
+		goto out;
+	}
+
+	if (check_new_oid(update, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+	update->flags |= REF_NEEDS_COMMIT;
+
+out:
+	reftable_record_release(&rec);
+	return ret;
+}
+
+static void reftable_transaction_cleanup(struct ref_transaction *transaction)
+{
+	struct reftable_batch *batch = transaction->backend_data;
+	size_t i;
+
+	for (i = 0; i < transaction->nr; i++)
+		FREE_AND_NULL(transaction->updates[i]->backend_data);
+
+	if (batch) {
+		batch_release(batch);
+		free(batch);
+		transaction->backend_data = NULL;
+	}
+
+	transaction->state = REF_TRANSACTION_CLOSED;
+}
+
+static int reftable_transaction_prepare(struct ref_store *ref_store,
+					struct ref_transaction *transaction,
+					struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "ref_transaction_prepare");
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	struct reftable_batch *batch;
+	char *head_ref = NULL;
+	int head_type;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	if (!transaction->nr)
+		goto cleanup;
+
+	/*
+	 * Fail if a refname appears more than once in the
+	 * transaction. (If we end up splitting up any updates using
+	 * split_symref_update() or split_head_update(), those
+	 * functions will check that the new updates don't have the
+	 * same refname as any existing ones.)
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct string_list_item *item =
+			string_list_append(&affected_refnames, update->refname);
+
+		item->util = update;
+	}
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	batch = xmalloc(sizeof(*batch));
+	if (batch_lock(batch, refs, err)) {
+		free(batch);
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+	transaction->backend_data = batch;
+
+	/*
+	 * If HEAD is a symbolic reference, then record the name of
+	 * the reference that it points to, so that a direct update of
+	 * that reference is logged in the reflog of HEAD, too (see the
+	 * files backend for the rationale).
+	 */
+	head_ref = refs_resolve_refdup(ref_store, "HEAD",
+				       RESOLVE_REF_NO_RECURSE,
+				       NULL, &head_type);
+	if (head_ref && !(head_type & REF_ISSYMREF))
+		FREE_AND_NULL(head_ref);
+
+	/* Note that prepare_update() might append more updates. */
+	for (i = 0; i < transaction->nr; i++) {
+		ret = prepare_update(refs, transaction->updates[i],
+				     transaction, head_ref,
+				     &affected_refnames, err);
+		if (ret)
+			goto cleanup;
+	}
+
+cleanup:
+	free(head_ref);
+	string_list_clear(&affected_refnames, 0);
+
+	if (ret)
+		reftable_transaction_cleanup(transaction);
+	else
+		transaction->state = REF_TRANSACTION_PREPARED;
+
+	return ret;
+}
+
+/*
+ * Return true if an update of `refname` with the given `flags` should
+ * be recorded in its reflog.
+ */
+static int should_write_log(struct reftable_ref_store *refs,
+			    const char *refname, unsigned int flags)
+{
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ? LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	return (flags & REF_FORCE_CREATE_REFLOG) ||
+		should_autocreate_reflog(refname) ||
+		refs_reflog_exists(&refs->base, refname);
+}
+
+static int reftable_transaction_finish(struct ref_store *ref_store,
+				       struct ref_transaction *transaction,
+				       struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, 0, "ref_transaction_finish");
+	struct reftable_batch *batch = transaction->backend_data;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	if (!transaction->nr) {
+		transaction->state = REF_TRANSACTION_CLOSED;
+		return 0;
+	}
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_update *u = update->backend_data;
+		int deleting = update->flags & REF_DELETING;
+
+		if (update->flags & REF_NEEDS_COMMIT) {
+			struct reftable_record *rec =
+				batch_add_ref(batch, update->refname);
+
+			if (!deleting) {
+				set_ref_value(rec, &update->new_oid);
+			} else {
+				rec->value_type = REFTABLE_REF_DELETION;
+				if (batch_delete_reflog(batch, update->refname)) {
+					strbuf_addf(err, "cannot delete the reflog of '%s'",
+						    update->refname);
+					ret = TRANSACTION_GENERIC_ERROR;
+					goto cleanup;
+				}
+			}
+		}
+
+		if ((update->flags & REF_LOG_ONLY ||
+		     (update->flags & REF_NEEDS_COMMIT && !deleting)) &&
+		    should_write_log(refs, update->refname, update->flags))
+			batch_add_log_entry(batch, update->refname,
+					    &u->old_oid, &update->new_oid,
+					    update->msg);
+	}
+
+	if (batch_commit(batch, err))
+		ret = TRANSACTION_GENERIC_ERROR;
+
+cleanup:
+	reftable_transaction_cleanup(transaction);
+	return ret;
+}
+
+static int reftable_transaction_abort(struct ref_store *ref_store,
+				      struct ref_transaction *transaction,
+				      struct strbuf *err)
+{
+	reftable_downcast(ref_store, 0, "ref_transaction_abort");
+	reftable_transaction_cleanup(transaction);
+	return 0;
+}
+
+static int reftable_initial_transaction_commit(struct ref_store *ref_store,
+					       struct ref_transaction *transaction,
+					       struct strbuf *err)
+{
+	/*
+	 * Adding a table is as cheap for many references as for a few,
+	 * so there is no need for a special bulk path.
+	 */
+	int ret = reftable_transaction_prepare(ref_store, transaction, err);
+
+	if (!ret)
+		ret = reftable_transaction_finish(ref_store, transaction, err);
+	return ret;
+}
+
+static int reftable_pack_refs(struct ref_store *ref_store, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				  "pack_refs");
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	if (reftable_stack_compact_all(&refs->main_stack,
+				       get_reftable_lock_timeout_ms(), &err) ||
+	    (refs->worktree_stack &&
+	     reftable_stack_compact_all(refs->worktree_stack,
+					get_reftable_lock_timeout_ms(), &err)))
+		ret = error("%s", err.buf);
+
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_create_symref(struct ref_store *ref_store,
+				  const char *refname, const char *target,
+				  const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_batch batch;
+	struct reftable_record *rec;
+	struct object_id old_oid, new_oid;
+	int ret = 0;
+
+	if (batch_lock(&batch, refs, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	if (refs_read_ref_full(ref_store, refname, 0, &old_oid, NULL))
+		oidclr(&old_oid);
+
+	rec = batch_add_ref(&batch, refname);
+	rec->value_type = REFTABLE_REF_SYMREF;
+	strbuf_addstr(&rec->target, target);
+
+	if (logmsg &&
+	    !refs_read_ref_full(ref_store, target, RESOLVE_REF_READING,
+				&new_oid, NULL) &&
+	    should_write_log(refs, refname, 0))
+		batch_add_log_entry(&batch, refname, &old_oid, &new_oid, logmsg);
+
+	if (batch_commit(&batch, &err))
+		ret = error("unable to write symref for %s: %s",
+			    refname, err.buf);
+
+out:
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_delete_refs(struct ref_store *ref_store, const char *msg,
+				struct string_list *refnames, unsigned int flags)
+{
+	struct ref_transaction *transaction;
+	struct strbuf err = STRBUF_INIT;
+	int i, ret = 0;
+
+	if (!refnames->nr)
+		return 0;
+
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction)
+		goto error;
+
+	for (i = 0; i < refnames->nr; i++)
+		if (ref_transaction_delete(transaction,
+					   refnames->items[i].string, NULL,
+					   flags, msg, &err))
+			goto error;
+
+	if (ref_transaction_commit(transaction, &err))
+		goto error;
+
+	goto out;
+
+error:
+	if (refnames->nr == 1)
+		error(_("could not delete reference %s: %s"),
+		      refnames->items[0].string, err.buf);
+	else
+		error(_("could not delete references: %s"), err.buf);
+	ret = -1;
+
+out:
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return ret;
+}
+
+/* Read the entries of the reflog of `refname`, newest first. */
+static int read_reflog(struct reftable_stack *stack, const char *refname,
+		       struct reftable_record **entries, size_t *nr)
+{
+	struct reftable_merged_iter mi;
+	size_t alloc = 0;
+	int ret;
+
+	*entries = NULL;
+	*nr = 0;
+
+	if (reftable_stack_reload(stack))
+		return -1;
+	ret = seek_reflog(&mi, stack, refname, 0);
+	while (!ret) {
+		ALLOC_GROW(*entries, *nr + 1, alloc);
+		reftable_record_init(&(*entries)[*nr]);
+		ret = reftable_merged_next(&mi, &(*entries)[*nr]);
+		if (ret || !is_reflog_of(&(*entries)[*nr], refname)) {
+			reftable_record_release(&(*entries)[*nr]);
+			break;
+		}
+		(*nr)++;
+	}
+	reftable_merged_release(&mi);
+	return ret < 0 ? -1 : 0;
+}
+
+static void free_reflog(struct reftable_record *entries, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		reftable_record_release(&entries[i]);
+	free(entries);
+}
+
+static int reftable_copy_or_rename_ref(struct ref_store *ref_store,
+				       const char *oldrefname,
+				       const char *newrefname,
+				       const char *logmsg, int copy)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "rename_ref");
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_batch batch;
+	struct reftable_record *old_log = NULL, *new_log = NULL;
+	size_t old_nr = 0, new_nr = 0, i, j;
+	struct object_id orig_oid;
+	const char *head_ref;
+	int flag = 0, head_flag;
+	int ret = 0;
+
+	if (batch_lock(&batch, refs, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	if (!refs_resolve_ref_unsafe(ref_store, oldrefname,
+				     RESOLVE_REF_READING | RESOLVE_REF_NO_RECURSE,
+				     &orig_oid, &flag)) {
+		ret = error("refname %s not found", oldrefname);
+		goto out;
+	}
+
+	if (flag & REF_ISSYMREF) {
+		if (copy)
+			ret = error("refname %s is a symbolic ref, copying it is not supported",
+				    oldrefname);
+		else
+			ret = error("refname %s is a symbolic ref, renaming it is not supported",
+				    oldrefname);
+		goto out;
+	}
+	if (!refs_rename_ref_available(ref_store, oldrefname, newrefname)) {
+		ret = 1;
+		goto out;
+	}
+	if (!strcmp(oldrefname, newrefname))
+		goto out;
+
+	if (read_reflog(stack_for(refs, oldrefname), oldrefname,
+			&old_log, &old_nr) ||
+	    read_reflog(stack_for(refs, newrefname), newrefname,
+			&new_log, &new_nr)) {
+		ret = error("unable to read reflogs in '%s'",
+			    refs->main_stack.dir);
+		goto out;
+	}
+
+	if (!copy)
+		batch_add_ref(&batch, oldrefname)->value_type =
+			REFTABLE_REF_DELETION;
+	set_ref_value(batch_add_ref(&batch, newrefname), &orig_oid);
+
+	/*
+	 * Replace the reflog of newrefname by a copy of that of
+	 * oldrefname. Both are sorted by decreasing update index, and
+	 * entries that are about to be overwritten need no deletion
+	 * record.
+	 */
+	for (i = j = 0; i < new_nr; i++) {
+		while (j < old_nr &&
+		       old_log[j].update_index > new_log[i].update_index)
+			j++;
+		if (j < old_nr &&
+		    old_log[j].update_index == new_log[i].update_index)
+			continue;
+		batch_add_log(&batch, newrefname, new_log[i].update_index)
+			->value_type = REFTABLE_LOG_DELETION;
+	}
+	for (i = 0; i < old_nr; i++) {
+		struct reftable_record *rec =
+			batch_add_log(&batch, newrefname,
+				      old_log[i].update_index);
+
+		rec->value_type = old_log[i].value_type;
+		oidcpy(&rec->old_oid, &old_log[i].old_oid);
+		oidcpy(&rec->new_oid, &old_log[i].new_oid);
+		strbuf_addbuf(&rec->committer, &old_log[i].committer);
+		rec->time = old_log[i].time;
+		rec->tz = old_log[i].tz;
+		strbuf_addbuf(&rec->message, &old_log[i].message);
+
+		if (!copy)
+			batch_add_log(&batch, oldrefname,
+				      old_log[i].update_index)->value_type =
+				REFTABLE_LOG_DELETION;
+	}
+
+	if (should_write_log(refs, newrefname, 0))
+		batch_add_log_entry(&batch, newrefname,
+				    &orig_oid, &orig_oid, logmsg);
+
+	/* Log the update in the reflog of HEAD if it points at newrefname: */
+	head_ref = refs_resolve_ref_unsafe(ref_store, "HEAD",
+					   RESOLVE_REF_READING | RESOLVE_REF_NO_RECURSE,
+					   NULL, &head_flag);
+	if (head_ref && (head_flag & REF_ISSYMREF) &&
+	    !strcmp(head_ref, newrefname) &&
+	    should_write_log(refs, "HEAD", 0))
+		batch_add_log_entry(&batch, "HEAD",
+				    &orig_oid, &orig_oid, logmsg);
+
+	if (batch_commit(&batch, &err)) {
+		if (copy)
+			ret = error("unable to copy '%s' to '%s': %s",
+				    oldrefname, newrefname, err.buf);
+		else
+			ret = error("unable to rename '%s' to '%s': %s",
+				    oldrefname, newrefname, err.buf);
+	}
+
+out:
+	batch_release(&batch);
+	free_reflog(old_log, old_nr);
+	free_reflog(new_log, new_nr);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_rename_ref(struct ref_store *ref_store,
+			       const char *oldrefname, const char *newrefname,
+			       const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname,
+					   newrefname, logmsg, 0);
+}
+
+static int reftable_copy_ref(struct ref_store *ref_store,
+			     const char *oldrefname, const char *newrefname,
+			     const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname,
+					   newrefname, logmsg, 1);
+}
+
+struct reftable_reflog_iterator {
+	struct ref_iterator base;
+
+	struct ref_store *ref_store;
+	struct string_list refnames;
+	size_t pos;
+	struct object_id oid;
+};
+
+static int reftable_reflog_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	while (iter->pos < iter->refnames.nr) {
+		const char *refname = iter->refnames.items[iter->pos++].string;
+		int flags;
+
+		if (refs_read_ref_full(iter->ref_store, refname, 0,
+				       &iter->oid, &flags)) {
+			error("bad ref for %s", refname);
+			continue;
+		}
+
+		iter->base.refname = refname;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE)
+		return ITER_ERROR;
+	return ITER_DONE;
+}
+
+static int reftable_reflog_iterator_peel(struct ref_iterator *ref_iterator,
+					 struct object_id *peeled)
+{
+	die("BUG: ref_iterator_peel() called for reflog_iterator");
+}
+
+static int reftable_reflog_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	string_list_clear(&iter->refnames, 0);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_reflog_iterator_vtable = {
+	reftable_reflog_iterator_advance,
+	reftable_reflog_iterator_peel,
+	reftable_reflog_iterator_abort
+};
+
+/*
+ * Add the names of the reflogs in `stack` to `refnames`, skipping
+ * per-worktree ones if `shared_only` is set.
+ */
+static void collect_reflog_names(struct reftable_stack *stack,
+				 struct string_list *refnames, int shared_only)
+{
+	struct reftable_merged_iter mi;
+	struct reftable_record rec;
+	int ret;
+
+	reftable_record_init(&rec);
+	reload_or_die(stack);
+	ret = reftable_merged_seek(&mi, stack->tables, stack->nr,
+				   REFTABLE_BLOCK_LOG, "", 0, 0);
+	while (!ret && !(ret = reftable_merged_next(&mi, &rec))) {
+		const char *refname = rec.key.buf;
+
+		if (refnames->nr &&
+		    !strcmp(refnames->items[refnames->nr - 1].string, refname))
+			continue;
+		if (shared_only && ref_type(refname) != REF_TYPE_NORMAL)
+			continue;
+		string_list_append(refnames, refname);
+	}
+	if (ret < 0)
+		die("unable to read reftables in '%s'", stack->dir);
+	reftable_merged_release(&mi);
+	reftable_record_release(&rec);
+}
+
+static struct ref_iterator *reftable_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "reflog_iterator_begin");
+	struct reftable_reflog_iterator *iter = xcalloc(1, sizeof(*iter));
+	struct ref_iterator *ref_iterator = &iter->base;
+
+	base_ref_iterator_init(ref_iterator, &reftable_reflog_iterator_vtable, 0);
+	iter->ref_store = ref_store;
+	string_list_init(&iter->refnames, 1);
+
+	collect_reflog_names(&refs->main_stack, &iter->refnames,
+			     !!refs->worktree_stack);
+	if (refs->worktree_stack)
+		collect_reflog_names(refs->worktree_stack, &iter->refnames, 0);
+
+	return ref_iterator;
+}
+
+static int show_reflog_entry(struct reftable_record *rec,
+			     each_reflog_ent_fn fn, void *cb_data,
+			     struct strbuf *message)
+{
+	if (rec->value_type != REFTABLE_LOG_UPDATE)
+		return 0;
+
+	strbuf_reset(message);
+	strbuf_addbuf(message, &rec->message);
+	strbuf_addch(message, '\n');
+	return fn(&rec->old_oid, &rec->new_oid, rec->committer.buf,
+		  rec->time, rec->tz, message->buf, cb_data);
+}
+
+static int reftable_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						const char *refname,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent_reverse");
+	struct reftable_stack *stack = stack_for(refs, refname);
+	struct strbuf message = STRBUF_INIT;
+	struct reftable_merged_iter mi;
+	struct reftable_record rec;
+	int ret;
+
+	if (reftable_stack_reload(stack))
+		return -1;
+
+	reftable_record_init(&rec);
+	ret = seek_reflog(&mi, stack, refname, 0);
+	while (!ret) {
+		int next = reftable_merged_next(&mi, &rec);
+
+		if (next < 0)
+			ret = -1;
+		if (next || !is_reflog_of(&rec, refname))
+			break;
+		ret = show_reflog_entry(&rec, fn, cb_data, &message);
+	}
+	reftable_merged_release(&mi);
+	reftable_record_release(&rec);
+	strbuf_release(&message);
+	return ret;
+}
+
+static int reftable_for_each_reflog_ent(struct ref_store *ref_store,
+					const char *refname,
+					each_reflog_ent_fn fn, void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent");
+	struct strbuf message = STRBUF_INIT;
+	struct reftable_record *entries;
+	size_t nr, i;
+	int ret = 0;
+
+	if (read_reflog(stack_for(refs, refname), refname, &entries, &nr))
+		return -1;
+
+	for (i = nr; !ret && i--; )
+		ret = show_reflog_entry(&entries[i], fn, cb_data, &message);
+
+	free_reflog(entries, nr);
+	strbuf_release(&message);
+	return ret;
+}
+
+static int reftable_reflog_exists(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+	struct reftable_stack *stack = stack_for(refs, refname);
+	struct reftable_merged_iter mi;
+	struct reftable_record rec;
+	int ret;
+
+	if (reftable_stack_reload(stack))
+		return 0;
+
+	reftable_record_init(&rec);
+	ret = seek_reflog(&mi, stack, refname, 0);
+	if (!ret)
+		ret = reftable_merged_next(&mi, &rec);
+	ret = !ret && is_reflog_of(&rec, refname);
+	reftable_merged_release(&mi);
+	reftable_record_release(&rec);
+	return ret;
+}
+
+static int reftable_create_reflog(struct ref_store *ref_store,
+				  const char *refname, int force_create,
+				  struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+	struct reftable_batch batch;
+
+	if (!force_create && !should_autocreate_reflog(refname))
+		return 0;
+
+	if (batch_lock(&batch, refs, err))
+		return -1;
+
+	if (reftable_reflog_exists(ref_store, refname)) {
+		batch_release(&batch);
+		return 0;
+	}
+
+	batch_add_log(&batch, refname, 0)->value_type = REFTABLE_LOG_EXISTS;
+	return batch_commit(&batch, err);
+}
+
+static int reftable_delete_reflog(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_batch batch;
+	int ret = 0;
+
+	if (batch_lock(&batch, refs, &err) ||
+	    batch_delete_reflog(&batch, refname) ||
+	    batch_commit(&batch, &err))
+		ret = error("unable to delete reflog of '%s': %s",
+			    refname, err.buf);
+
+	batch_release(&batch);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_reflog_expire(struct ref_store *ref_store,
+				  const char *refname, const struct object_id *oid,
+				  unsigned int flags,
+				  reflog_expiry_prepare_fn prepare_fn,
+				  reflog_expiry_should_prune_fn should_prune_fn,
+				  reflog_expiry_cleanup_fn cleanup_fn,
+				  void *policy_cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	int dry_run = flags & EXPIRE_REFLOGS_DRY_RUN;
+	struct strbuf err = STRBUF_INIT;
+	struct strbuf message = STRBUF_INIT;
+	struct reftable_batch batch;
+	struct reftable_record *entries = NULL;
+	struct object_id last_kept_oid, current_oid;
+	size_t nr = 0, i, kept = 0;
+	int type = 0, status = 0;
+
+	oidclr(&last_kept_oid);
+
+	/*
+	 * Holding the lock makes sure that nobody updates the
+	 * reference or its reflog while we are looking at it.
+	 */
+	if (batch_lock(&batch, refs, &err)) {
+		status = error("cannot lock ref '%s': %s", refname, err.buf);
+		goto out;
+	}
+	if (!refs_reflog_exists(ref_store, refname))
+		goto out;
+	if (!refs_resolve_ref_unsafe(ref_store, refname, RESOLVE_REF_NO_RECURSE,
+				     &current_oid, &type))
+		oidclr(&current_oid);
+
+	if (read_reflog(stack_for(refs, refname), refname, &entries, &nr)) {
+		status = error("unable to read reflog of '%s'", refname);
+		goto out;
+	}
+
+	(*prepare_fn)(refname, oid, policy_cb_data);
+	for (i = nr; i--; ) {
+		struct reftable_record *rec = &entries[i];
+		struct object_id *ooid = &rec->old_oid;
+
+		if (rec->value_type != REFTABLE_LOG_UPDATE)
+			continue;
+
+		strbuf_reset(&message);
+		strbuf_addbuf(&message, &rec->message);
+		strbuf_addch(&message, '\n');
+
+		if (flags & EXPIRE_REFLOGS_REWRITE)
+			ooid = &last_kept_oid;
+
+		if ((*should_prune_fn)(ooid, &rec->new_oid, rec->committer.buf,
+				       rec->time, rec->tz, message.buf,
+				       policy_cb_data)) {
+			if (dry_run)
+				printf("would prune %s", message.buf);
+			else if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("prune %s", message.buf);
+			if (!dry_run)
+				batch_add_log(&batch, refname, rec->update_index)
+					->value_type = REFTABLE_LOG_DELETION;
+		} else {
+			if (!dry_run) {
+				if (oidcmp(ooid, &rec->old_oid)) {
+					struct reftable_record *new_rec =
+						batch_add_log(&batch, refname,
+							      rec->update_index);
+
+					new_rec->value_type = REFTABLE_LOG_UPDATE;
+					oidcpy(&new_rec->old_oid, ooid);
+					oidcpy(&new_rec->new_oid, &rec->new_oid);
+					strbuf_addbuf(&new_rec->committer,
+						      &rec->committer);
+					new_rec->time = rec->time;
+					new_rec->tz = rec->tz;
+					strbuf_addbuf(&new_rec->message,
+						      &rec->message);
+				}
+				oidcpy(&last_kept_oid, &rec->new_oid);
+				kept++;
+			}
+			if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("keep %s", message.buf);
+		}
+	}
+	(*cleanup_fn)(policy_cb_data);
+
+	if (dry_run)
+		goto out;
+
+	/*
+	 * It doesn't make sense to adjust a reference pointed to by a
+	 * symbolic ref based on expiring entries in the symbolic
+	 * reference's reflog. Nor can we update a reference if there
+	 * are no remaining reflog entries.
+	 */
+	if ((flags & EXPIRE_REFLOGS_UPDATE_REF) &&
+	    !(type & REF_ISSYMREF) &&
+	    !is_null_oid(&last_kept_oid) &&
+	    oidcmp(&last_kept_oid, &current_oid))
+		set_ref_value(batch_add_ref(&batch, refname), &last_kept_oid);
+
+	/* An expired reflog still exists, even if it is empty: */
+	if (!kept)
+		batch_add_log(&batch, refname, 0)->value_type =
+			REFTABLE_LOG_EXISTS;
+
+	if (batch_commit(&batch, &err))
+		status = error("unable to write reflog of '%s': %s",
+			       refname, err.buf);
+
+out:
+	batch_release(&batch);
+	free_reflog(entries, nr);
+	strbuf_release(&message);
+	strbuf_release(&err);
+	return status;
+}
+
+static void init_stack_dir(struct reftable_stack *stack)
+{
+	safe_create_dir(stack->dir, 1);
+	if (access(stack->list_path, F_OK))
+		write_file(stack->list_path, "%s", "");
+	adjust_shared_perm(stack->list_path);
+}
+
+static int reftable_init_db(struct ref_store *ref_store, struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	struct strbuf sb = STRBUF_INIT;
+
+	init_stack_dir(&refs->main_stack);
+	if (refs->worktree_stack)
+		init_stack_dir(refs->worktree_stack);
+
+	/*
+	 * Older versions of git only recognize a repository if it
+	 * has a HEAD file, so leave one that points nowhere. The real
+	 * HEAD lives in the reftable.
+	 */
+	strbuf_addf(&sb, "%s/HEAD", refs->gitdir);
+	if (access(sb.buf, F_OK))
+		write_file(sb.buf, "ref: refs/heads/.invalid");
+	strbuf_release(&sb);
+	return 0;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	&refs_be_files,
+	"reftable",
+	reftable_ref_store_create,
+	reftable_init_db,
+	reftable_transaction_prepare,
+	reftable_transaction_finish,
+	reftable_transaction_abort,
+	reftable_initial_transaction_commit,
+
+	reftable_pack_refs,
+	reftable_create_symref,
+	reftable_delete_refs,
+	reftable_rename_ref,
+	reftable_copy_ref,
+
+	reftable_ref_iterator_begin,
+	reftable_read_raw_ref,
+
+	reftable_reflog_iterator_begin,
+	reftable_for_each_reflog_ent,
+	reftable_for_each_reflog_ent_reverse,
+	reftable_reflog_exists,
+	reftable_create_reflog,
+	reftable_delete_reflog,
+	reftable_reflog_expire
+};
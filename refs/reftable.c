@@ -0,0 +1,1345 @@
+#include "../cache.h"
+#include "../tempfile.h"
+#include "../varint.h"
+#include "reftable.h"
+
+#define REFTABLE_SIGNATURE 0x52454654 /* "REFT" */
+#define REFTABLE_VERSION 1
+
+#define REFTABLE_HEADER_SIZE 24
+#define REFTABLE_FOOTER_SIZE (REFTABLE_HEADER_SIZE + 3 * 8 + 4)
+
+/* Type byte and length of a block: */
+#define REFTABLE_BLOCK_HEADER_SIZE 5
+
+#define REFTABLE_DEFAULT_BLOCK_SIZE 4096
+#define REFTABLE_RESTART_INTERVAL 16
+
+#define REFTABLE_HASH_LEN GIT_SHA1_RAWSZ
+
+void reftable_record_init(struct reftable_record *rec)
+{
+	memset(rec, 0, sizeof(*rec));
+	strbuf_init(&rec->key, 0);
+	strbuf_init(&rec->target, 0);
+	strbuf_init(&rec->committer, 0);
+	strbuf_init(&rec->message, 0);
+}
+
+void reftable_record_release(struct reftable_record *rec)
+{
+	strbuf_release(&rec->key);
+	strbuf_release(&rec->target);
+	strbuf_release(&rec->committer);
+	strbuf_release(&rec->message);
+}
+
+void reftable_log_key(struct strbuf *key, const char *refname,
+		      uint64_t update_index)
+{
+	unsigned char be[8];
+
+	strbuf_reset(key);
+	strbuf_addstr(key, refname);
+	strbuf_addch(key, '\0');
+	put_be64(be, ~update_index);
+	strbuf_add(key, be, sizeof(be));
+}
+
+static int keycmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+	int cmp = memcmp(a, b, alen < blen ? alen : blen);
+
+	if (cmp)
+		return cmp;
+	return alen < blen ? -1 : alen != blen;
+}
+
+static int reccmp(const struct reftable_record *a,
+		  const struct reftable_record *b)
+{
+	return keycmp(a->key.buf, a->key.len, b->key.buf, b->key.len);
+}
+
+/*
+ * Encoding and decoding of records.
+ */
+
+static void add_varint(struct strbuf *sb, uintmax_t value)
+{
+	unsigned char buf[16];
+
+	strbuf_add(sb, buf, encode_varint(value, buf));
+}
+
+static void add_be16(struct strbuf *sb, uint16_t value)
+{
+	unsigned char buf[2];
+
+	buf[0] = value >> 8;
+	buf[1] = value & 0xff;
+	strbuf_add(sb, buf, sizeof(buf));
+}
+
+static void add_be32(struct strbuf *sb, uint32_t value)
+{
+	unsigned char buf[4];
+
+	put_be32(buf, value);
+	strbuf_add(sb, buf, sizeof(buf));
+}
+
+static size_t common_prefix(const struct strbuf *a, const struct strbuf *b)
+{
+	size_t i, len = a->len < b->len ? a->len : b->len;
+
+	for (i = 0; i < len; i++)
+		if (a->buf[i] != b->buf[i])
+			break;
+	return i;
+}
+
+static void encode_record(struct strbuf *out, int block_type,
+			  const struct reftable_record *rec,
+			  const struct strbuf *last_key, int restart,
+			  uint64_t min_update_index)
+{
+	size_t prefix = restart ? 0 : common_prefix(last_key, &rec->key);
+	size_t suffix = rec->key.len - prefix;
+
+	add_varint(out, prefix);
+	add_varint(out, (suffix << 3) | rec->value_type);
+	strbuf_add(out, rec->key.buf + prefix, suffix);
+
+	switch (block_type) {
+	case REFTABLE_BLOCK_REF:
+		add_varint(out, rec->update_index - min_update_index);
+		switch (rec->value_type) {
+		case REFTABLE_REF_DELETION:
+			break;
+		case REFTABLE_REF_VAL1:
+			strbuf_add(out, rec->oid.hash, REFTABLE_HASH_LEN);
+			break;
+		case REFTABLE_REF_VAL2:
+			strbuf_add(out, rec->oid.hash, REFTABLE_HASH_LEN);
+			strbuf_add(out, rec->peeled.hash, REFTABLE_HASH_LEN);
+			break;
+		case REFTABLE_REF_SYMREF:
+			add_varint(out, rec->target.len);
+			strbuf_addbuf(out, &rec->target);
+			break;
+		default:
+			die("BUG: unknown ref value type %u", rec->value_type);
+		}
+		break;
+	case REFTABLE_BLOCK_LOG:
+		if (rec->value_type != REFTABLE_LOG_UPDATE)
+			break;
+		strbuf_add(out, rec->old_oid.hash, REFTABLE_HASH_LEN);
+		strbuf_add(out, rec->new_oid.hash, REFTABLE_HASH_LEN);
+		add_varint(out, rec->committer.len);
+		strbuf_addbuf(out, &rec->committer);
+		add_varint(out, rec->time);
+		add_be16(out, (uint16_t)(int16_t)rec->tz);
+		add_varint(out, rec->message.len);
+		strbuf_addbuf(out, &rec->message);
+		break;
+	case REFTABLE_BLOCK_INDEX:
+		add_varint(out, rec->offset);
+		break;
+	default:
+		die("BUG: unknown reftable block type %d", block_type);
+	}
+}
+
+static int read_varint(const unsigned char **p, const unsigned char *end,
+		       uintmax_t *value)
+{
+	if (*p >= end)
+		return -1;
+	*value = decode_varint(p);
+	return *p > end ? -1 : 0;
+}
+
+static int read_string(const unsigned char **p, const unsigned char *end,
+		       struct strbuf *sb)
+{
+	uintmax_t len;
+
+	if (read_varint(p, end, &len) || len > end - *p)
+		return -1;
+	strbuf_reset(sb);
+	strbuf_add(sb, *p, len);
+	*p += len;
+	return 0;
+}
+
+static int read_oid(const unsigned char **p, const unsigned char *end,
+		    struct object_id *oid)
+{
+	if (end - *p < REFTABLE_HASH_LEN)
+		return -1;
+	hashcpy(oid->hash, *p);
+	*p += REFTABLE_HASH_LEN;
+	return 0;
+}
+
+/*
+ * Decode the record at `*p`, whose key shares a prefix with
+ * `last_key`, into `rec`, and update `last_key` and `*p`. Return 0
+ * on success or -1 if the record is corrupt.
+ */
+static int decode_record(int block_type, const unsigned char **p,
+			 const unsigned char *end, struct strbuf *last_key,
+			 uint64_t min_update_index, struct reftable_record *rec)
+{
+	uintmax_t prefix, suffix_and_type, value;
+	size_t suffix;
+
+	if (read_varint(p, end, &prefix) || prefix > last_key->len ||
+	    read_varint(p, end, &suffix_and_type))
+		return -1;
+	suffix = suffix_and_type >> 3;
+	if (suffix > end - *p)
+		return -1;
+
+	strbuf_setlen(last_key, prefix);
+	strbuf_add(last_key, *p, suffix);
+	*p += suffix;
+
+	strbuf_reset(&rec->key);
+	strbuf_addbuf(&rec->key, last_key);
+	rec->value_type = suffix_and_type & 7;
+
+	switch (block_type) {
+	case REFTABLE_BLOCK_REF:
+		if (read_varint(p, end, &value))
+			return -1;
+		rec->update_index = min_update_index + value;
+		switch (rec->value_type) {
+		case REFTABLE_REF_DELETION:
+			return 0;
+		case REFTABLE_REF_VAL1:
+			return read_oid(p, end, &rec->oid);
+		case REFTABLE_REF_VAL2:
+			if (read_oid(p, end, &rec->oid))
+				return -1;
+			return read_oid(p, end, &rec->peeled);
+		case REFTABLE_REF_SYMREF:
+			return read_string(p, end, &rec->target);
+		}
+		return -1;
+	case REFTABLE_BLOCK_LOG:
+		if (rec->key.len < 9 || rec->key.buf[rec->key.len - 9])
+			return -1;
+		rec->update_index =
+			~get_be64(rec->key.buf + rec->key.len - 8);
+		switch (rec->value_type) {
+		case REFTABLE_LOG_DELETION:
+		case REFTABLE_LOG_EXISTS:
+			return 0;
+		case REFTABLE_LOG_UPDATE:
+			if (read_oid(p, end, &rec->old_oid) ||
+			    read_oid(p, end, &rec->new_oid) ||
+			    read_string(p, end, &rec->committer) ||
+			    read_varint(p, end, &value) ||
+			    end - *p < 2)
+				return -1;
+			rec->time = value;
+			rec->tz = (int16_t)get_be16(*p);
+			*p += 2;
+			return read_string(p, end, &rec->message);
+		}
+		return -1;
+	case REFTABLE_BLOCK_INDEX:
+		if (read_varint(p, end, &value))
+			return -1;
+		rec->offset = value;
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * Writing tables.
+ */
+
+struct index_entry {
+	char *key;
+	size_t keylen;
+	uint64_t offset;
+};
+
+struct table_writer {
+	struct tempfile *tempfile;
+	uint32_t block_size;
+	uint64_t min_update_index;
+	uint64_t offset;
+	int failed;
+
+	/* The block currently being filled: */
+	int block_type;
+	struct strbuf block;
+	uint32_t *restarts;
+	size_t restarts_nr, restarts_alloc;
+	size_t entries;
+	struct strbuf last_key;
+
+	/* One entry for each block written in the current section: */
+	struct index_entry *index;
+	size_t index_nr, index_alloc;
+
+	uint64_t ref_index_offset, log_offset, log_index_offset;
+	struct strbuf scratch;
+};
+
+static void put_header(unsigned char *buf, uint32_t block_size,
+		       uint64_t min_update_index, uint64_t max_update_index)
+{
+	put_be32(buf, REFTABLE_SIGNATURE);
+	put_be32(buf + 4, block_size);
+	buf[4] = REFTABLE_VERSION;
+	put_be64(buf + 8, min_update_index);
+	put_be64(buf + 16, max_update_index);
+}
+
+static void writer_write(struct table_writer *w, const void *buf, size_t len)
+{
+	if (w->failed)
+		return;
+	if (write_in_full(get_tempfile_fd(w->tempfile), buf, len) < 0)
+		w->failed = errno;
+	w->offset += len;
+}
+
+static void writer_init(struct table_writer *w, struct tempfile *tempfile,
+			uint64_t min_update_index, uint64_t max_update_index)
+{
+	unsigned char header[REFTABLE_HEADER_SIZE];
+
+	memset(w, 0, sizeof(*w));
+	w->tempfile = tempfile;
+	w->block_size = REFTABLE_DEFAULT_BLOCK_SIZE;
+	w->min_update_index = min_update_index;
+	w->block_type = REFTABLE_BLOCK_REF;
+	strbuf_init(&w->block, 0);
+	strbuf_init(&w->last_key, 0);
+	strbuf_init(&w->scratch, 0);
+
+	put_header(header, w->block_size, min_update_index, max_update_index);
+	writer_write(w, header, sizeof(header));
+}
+
+static void writer_release(struct table_writer *w)
+{
+	size_t i;
+
+	for (i = 0; i < w->index_nr; i++)
+		free(w->index[i].key);
+	free(w->index);
+	free(w->restarts);
+	strbuf_release(&w->block);
+	strbuf_release(&w->last_key);
+	strbuf_release(&w->scratch);
+}
+
+/*
+ * Append the restart table to the block in `w`, fill in its length
+ * and return its contents in `w->block`.
+ */
+static void seal_block(struct table_writer *w)
+{
+	size_t i;
+
+	for (i = 0; i < w->restarts_nr; i++)
+		add_be32(&w->block, w->restarts[i]);
+	add_be32(&w->block, w->restarts_nr);
+	put_be32(w->block.buf + 1, w->block.len);
+}
+
+static void flush_block(struct table_writer *w)
+{
+	struct index_entry *e;
+
+	if (!w->entries)
+		return;
+
+	seal_block(w);
+
+	ALLOC_GROW(w->index, w->index_nr + 1, w->index_alloc);
+	e = &w->index[w->index_nr++];
+	e->key = xmemdupz(w->last_key.buf, w->last_key.len);
+	e->keylen = w->last_key.len;
+	e->offset = w->offset;
+
+	writer_write(w, w->block.buf, w->block.len);
+
+	strbuf_reset(&w->block);
+	w->restarts_nr = 0;
+	w->entries = 0;
+	strbuf_reset(&w->last_key);
+}
+
+static void block_append(struct table_writer *w, int block_type,
+			 const struct reftable_record *rec, int limit)
+{
+	int restart = !(w->entries % REFTABLE_RESTART_INTERVAL);
+
+	strbuf_reset(&w->scratch);
+	encode_record(&w->scratch, block_type, rec, &w->last_key, restart,
+		      w->min_update_index);
+
+	if (limit && w->entries &&
+	    w->block.len + w->scratch.len + 4 * (w->restarts_nr + 2) >
+	    w->block_size) {
+		flush_block(w);
+		restart = 1;
+		strbuf_reset(&w->scratch);
+		encode_record(&w->scratch, block_type, rec, &w->last_key,
+			      restart, w->min_update_index);
+	}
+
+	if (!w->entries) {
+		strbuf_addch(&w->block, block_type);
+		add_be32(&w->block, 0);
+	}
+	if (restart) {
+		ALLOC_GROW(w->restarts, w->restarts_nr + 1, w->restarts_alloc);
+		w->restarts[w->restarts_nr++] = w->block.len;
+	}
+	strbuf_addbuf(&w->block, &w->scratch);
+	w->entries++;
+	strbuf_reset(&w->last_key);
+	strbuf_addbuf(&w->last_key, &rec->key);
+}
+
+/*
+ * Flush the last block of the current section and, if the section
+ * spans more than one block, write an index block for it. Return the
+ * offset of the index block, or 0 if none was written.
+ */
+static uint64_t finish_section(struct table_writer *w)
+{
+	uint64_t index_offset = 0;
+	size_t i;
+
+	flush_block(w);
+
+	if (w->index_nr > 1) {
+		struct reftable_record rec;
+
+		reftable_record_init(&rec);
+		index_offset = w->offset;
+		for (i = 0; i < w->index_nr; i++) {
+			strbuf_reset(&rec.key);
+			strbuf_add(&rec.key, w->index[i].key, w->index[i].keylen);
+			rec.offset = w->index[i].offset;
+			block_append(w, REFTABLE_BLOCK_INDEX, &rec, 0);
+		}
+		reftable_record_release(&rec);
+
+		seal_block(w);
+		writer_write(w, w->block.buf, w->block.len);
+		strbuf_reset(&w->block);
+		w->restarts_nr = 0;
+		w->entries = 0;
+		strbuf_reset(&w->last_key);
+	}
+
+	for (i = 0; i < w->index_nr; i++)
+		free(w->index[i].key);
+	w->index_nr = 0;
+
+	return index_offset;
+}
+
+static void writer_add(struct table_writer *w, int block_type,
+		       const struct reftable_record *rec)
+{
+	if (w->block_type != block_type) {
+		if (block_type != REFTABLE_BLOCK_LOG)
+			die("BUG: reftable sections written out of order");
+		w->ref_index_offset = finish_section(w);
+		w->log_offset = w->offset;
+		w->block_type = block_type;
+	} else if (w->entries &&
+		   keycmp(w->last_key.buf, w->last_key.len,
+			  rec->key.buf, rec->key.len) >= 0) {
+		die("BUG: reftable records out of order at '%s'", rec->key.buf);
+	}
+
+	block_append(w, block_type, rec, 1);
+}
+
+static int writer_finish(struct table_writer *w, uint64_t max_update_index)
+{
+	unsigned char footer[REFTABLE_FOOTER_SIZE];
+	uint64_t index_offset = finish_section(w);
+
+	if (w->block_type == REFTABLE_BLOCK_LOG)
+		w->log_index_offset = index_offset;
+	else
+		w->ref_index_offset = index_offset;
+
+	put_header(footer, w->block_size, w->min_update_index,
+		   max_update_index);
+	put_be64(footer + REFTABLE_HEADER_SIZE, w->ref_index_offset);
+	put_be64(footer + REFTABLE_HEADER_SIZE + 8, w->log_offset);
+	put_be64(footer + REFTABLE_HEADER_SIZE + 16, w->log_index_offset);
+	put_be32(footer + REFTABLE_FOOTER_SIZE - 4,
+		 crc32(0, footer, REFTABLE_FOOTER_SIZE - 4));
+	writer_write(w, footer, sizeof(footer));
+
+	return w->failed ? -1 : 0;
+}
+
+/*
+ * Reading tables.
+ */
+
+static int corrupt_table(const struct reftable *table, const char *what)
+{
+	return error("reftable %s is corrupt: %s", table->path, what);
+}
+
+struct reftable *reftable_open(const char *path)
+{
+	struct reftable *table;
+	struct stat st;
+	const unsigned char *footer;
+	uint64_t file_end;
+	int fd;
+
+	fd = git_open(path);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		int save_errno = errno;
+		close(fd);
+		errno = save_errno;
+		return NULL;
+	}
+
+	table = xcalloc(1, sizeof(*table));
+	table->path = xstrdup(path);
+	table->name = strrchr(table->path, '/');
+	table->name = table->name ? table->name + 1 : table->path;
+	table->size = xsize_t(st.st_size);
+	table->referrers = 1;
+
+	if (table->size < REFTABLE_HEADER_SIZE + REFTABLE_FOOTER_SIZE) {
+		close(fd);
+		corrupt_table(table, "file too small");
+		goto fail;
+	}
+	table->map = xmmap(NULL, table->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	footer = table->map + table->size - REFTABLE_FOOTER_SIZE;
+	if (get_be32(table->map) != REFTABLE_SIGNATURE ||
+	    table->map[4] != REFTABLE_VERSION) {
+		corrupt_table(table, "bad signature or version");
+		goto fail;
+	}
+	if (memcmp(table->map, footer, REFTABLE_HEADER_SIZE) ||
+	    get_be32(footer + REFTABLE_FOOTER_SIZE - 4) !=
+	    crc32(0, footer, REFTABLE_FOOTER_SIZE - 4)) {
+		corrupt_table(table, "bad footer");
+		goto fail;
+	}
+
+	table->block_size = get_be32(table->map + 4) & 0xffffff;
+	table->min_update_index = get_be64(table->map + 8);
+	table->max_update_index = get_be64(table->map + 16);
+	table->ref_index_offset = get_be64(footer + REFTABLE_HEADER_SIZE);
+	table->log_start = get_be64(footer + REFTABLE_HEADER_SIZE + 8);
+	table->log_index_offset = get_be64(footer + REFTABLE_HEADER_SIZE + 16);
+
+	file_end = table->size - REFTABLE_FOOTER_SIZE;
+	table->ref_start = REFTABLE_HEADER_SIZE;
+	if (table->ref_index_offset)
+		table->ref_end = table->ref_index_offset;
+	else if (table->log_start)
+		table->ref_end = table->log_start;
+	else
+		table->ref_end = file_end;
+
+	if (table->log_start) {
+		table->log_end = table->log_index_offset ?
+			table->log_index_offset : file_end;
+	} else {
+		table->log_start = table->log_end = file_end;
+	}
+
+	if (table->ref_end < table->ref_start ||
+	    table->ref_end > file_end ||
+	    table->log_start < table->ref_end ||
+	    table->log_end < table->log_start ||
+	    table->log_end > file_end) {
+		corrupt_table(table, "bad section offsets");
+		goto fail;
+	}
+
+	return table;
+
+fail:
+	reftable_release(table);
+	errno = EINVAL;
+	return NULL;
+}
+
+void reftable_acquire(struct reftable *table)
+{
+	table->referrers++;
+}
+
+void reftable_release(struct reftable *table)
+{
+	if (--table->referrers)
+		return;
+	if (table->map)
+		munmap(table->map, table->size);
+	free(table->path);
+	free(table);
+}
+
+/*
+ * Point `it` at the block at `offset`, which must be of type
+ * `block_type` and must end before `limit`.
+ */
+static int load_block(struct reftable_iter *it, uint64_t offset,
+		      uint64_t limit, int block_type)
+{
+	const struct reftable *table = it->table;
+	const unsigned char *block = table->map + offset;
+	uint32_t len, restarts;
+
+	if (offset + REFTABLE_BLOCK_HEADER_SIZE + 4 > limit ||
+	    block[0] != block_type)
+		return corrupt_table(table, "bad block header");
+
+	len = get_be32(block + 1);
+	if (len < REFTABLE_BLOCK_HEADER_SIZE + 4 || len > limit - offset)
+		return corrupt_table(table, "bad block length");
+
+	restarts = get_be32(block + len - 4);
+	if (restarts > (len - REFTABLE_BLOCK_HEADER_SIZE - 4) / 4)
+		return corrupt_table(table, "bad restart count");
+
+	it->block = block;
+	it->pos = block + REFTABLE_BLOCK_HEADER_SIZE;
+	it->records_end = block + len - 4 - 4 * restarts;
+	it->next_block = offset + len;
+	strbuf_reset(&it->last_key);
+	return 0;
+}
+
+static uint32_t block_restart_count(const struct reftable_iter *it)
+{
+	uint32_t len = get_be32(it->block + 1);
+	return get_be32(it->block + len - 4);
+}
+
+static uint32_t block_restart(const struct reftable_iter *it, uint32_t i)
+{
+	return get_be32(it->records_end + 4 * i);
+}
+
+/*
+ * Position `it`, whose block has just been loaded, at the first
+ * record with a key not less than `key`. Set `*found` if there is
+ * such a record in this block.
+ */
+static int block_seek(struct reftable_iter *it, const char *key,
+		      size_t keylen, int *found)
+{
+	uint32_t lo = 0, hi = block_restart_count(it);
+	uint64_t min_update_index = it->table->min_update_index;
+	struct reftable_record rec;
+	struct strbuf prev_key = STRBUF_INIT;
+	int ret = 0;
+
+	reftable_record_init(&rec);
+
+	/* Find the first restart point whose key is greater than key: */
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		const unsigned char *p = it->block + block_restart(it, mid);
+
+		strbuf_reset(&it->last_key);
+		if (p >= it->records_end ||
+		    decode_record(it->block[0], &p, it->records_end,
+				  &it->last_key, min_update_index, &rec)) {
+			ret = corrupt_table(it->table, "bad restart point");
+			goto out;
+		}
+		if (keycmp(rec.key.buf, rec.key.len, key, keylen) > 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	/* ...and scan forward from the restart point before it. */
+	strbuf_reset(&it->last_key);
+	if (lo)
+		it->pos = it->block + block_restart(it, lo - 1);
+
+	*found = 0;
+	while (it->pos < it->records_end) {
+		const unsigned char *p = it->pos;
+
+		strbuf_reset(&prev_key);
+		strbuf_addbuf(&prev_key, &it->last_key);
+		if (decode_record(it->block[0], &p, it->records_end,
+				  &it->last_key, min_update_index, &rec)) {
+			ret = corrupt_table(it->table, "bad record");
+			goto out;
+		}
+		if (keycmp(rec.key.buf, rec.key.len, key, keylen) >= 0) {
+			strbuf_swap(&prev_key, &it->last_key);
+			*found = 1;
+			break;
+		}
+		it->pos = p;
+	}
+
+out:
+	strbuf_release(&prev_key);
+	reftable_record_release(&rec);
+	return ret;
+}
+
+int reftable_iter_seek(struct reftable_iter *it, struct reftable *table,
+		       int block_type, const char *key, size_t keylen)
+{
+	uint64_t start, offset, index_offset, index_end;
+	int found;
+
+	memset(it, 0, sizeof(*it));
+	strbuf_init(&it->last_key, 0);
+	it->table = table;
+	it->block_type = block_type;
+	reftable_acquire(table);
+
+	if (block_type == REFTABLE_BLOCK_REF) {
+		offset = table->ref_start;
+		it->section_end = table->ref_end;
+		index_offset = table->ref_index_offset;
+		index_end = table->log_start;
+	} else {
+		offset = table->log_start;
+		it->section_end = table->log_end;
+		index_offset = table->log_index_offset;
+		index_end = table->size - REFTABLE_FOOTER_SIZE;
+	}
+	start = it->next_block = offset;
+
+	if (offset >= it->section_end)
+		return 0;
+
+	if (index_offset) {
+		struct reftable_record rec;
+		int ret;
+
+		if (load_block(it, index_offset, index_end,
+			       REFTABLE_BLOCK_INDEX) ||
+		    block_seek(it, key, keylen, &found))
+			return -1;
+		if (!found) {
+			it->block = NULL;
+			it->next_block = it->section_end;
+			return 0;
+		}
+
+		reftable_record_init(&rec);
+		ret = decode_record(REFTABLE_BLOCK_INDEX, &it->pos,
+				    it->records_end, &it->last_key,
+				    table->min_update_index, &rec);
+		offset = rec.offset;
+		reftable_record_release(&rec);
+		if (ret || offset < start || offset >= it->section_end)
+			return corrupt_table(table, "bad index record");
+		it->block = NULL;
+	}
+
+	while (offset < it->section_end) {
+		if (load_block(it, offset, it->section_end, block_type) ||
+		    block_seek(it, key, keylen, &found))
+			return -1;
+		if (found)
+			break;
+		offset = it->next_block;
+	}
+	return 0;
+}
+
+int reftable_iter_next(struct reftable_iter *it, struct reftable_record *rec)
+{
+	while (!it->block || it->pos >= it->records_end) {
+		if (it->next_block >= it->section_end)
+			return 1;
+		if (load_block(it, it->next_block, it->section_end,
+			       it->block_type))
+			return -1;
+	}
+
+	if (decode_record(it->block_type, &it->pos, it->records_end,
+			  &it->last_key, it->table->min_update_index, rec))
+		return corrupt_table(it->table, "bad record");
+	return 0;
+}
+
+void reftable_iter_release(struct reftable_iter *it)
+{
+	if (it->table)
+		reftable_release(it->table);
+	it->table = NULL;
+	strbuf_release(&it->last_key);
+}
+
+int reftable_merged_seek(struct reftable_merged_iter *mi,
+			 struct reftable **tables, size_t nr,
+			 int block_type, const char *key, size_t keylen,
+			 int keep_deletions)
+{
+	size_t i;
+
+	mi->nr = nr;
+	mi->keep_deletions = keep_deletions;
+	mi->its = xcalloc(nr, sizeof(*mi->its));
+	mi->recs = xcalloc(nr, sizeof(*mi->recs));
+	mi->live = xcalloc(nr, sizeof(*mi->live));
+
+	for (i = 0; i < nr; i++) {
+		int ret;
+
+		reftable_record_init(&mi->recs[i]);
+		if (reftable_iter_seek(&mi->its[i], tables[i], block_type,
+				       key, keylen))
+			return -1;
+		ret = reftable_iter_next(&mi->its[i], &mi->recs[i]);
+		if (ret < 0)
+			return -1;
+		mi->live[i] = !ret;
+	}
+	return 0;
+}
+
+static int merged_advance(struct reftable_merged_iter *mi, size_t i)
+{
+	int ret = reftable_iter_next(&mi->its[i], &mi->recs[i]);
+
+	if (ret < 0)
+		return -1;
+	mi->live[i] = !ret;
+	return 0;
+}
+
+int reftable_merged_next(struct reftable_merged_iter *mi,
+			 struct reftable_record *rec)
+{
+	for (;;) {
+		struct reftable_record tmp;
+		size_t i, best = mi->nr;
+
+		/* The smallest key wins; among equal keys, the newest table: */
+		for (i = 0; i < mi->nr; i++) {
+			if (!mi->live[i])
+				continue;
+			if (best == mi->nr || reccmp(&mi->recs[i], &mi->recs[best]) <= 0)
+				best = i;
+		}
+		if (best == mi->nr)
+			return 1;
+
+		tmp = *rec;
+		*rec = mi->recs[best];
+		mi->recs[best] = tmp;
+		if (merged_advance(mi, best))
+			return -1;
+
+		/* Skip the records that the winner shadows: */
+		for (i = 0; i < mi->nr; i++)
+			if (mi->live[i] && !reccmp(&mi->recs[i], rec) &&
+			    merged_advance(mi, i))
+				return -1;
+
+		if (!mi->keep_deletions && !rec->value_type)
+			continue;
+		return 0;
+	}
+}
+
+void reftable_merged_release(struct reftable_merged_iter *mi)
+{
+	size_t i;
+
+	for (i = 0; i < mi->nr; i++) {
+		reftable_iter_release(&mi->its[i]);
+		reftable_record_release(&mi->recs[i]);
+	}
+	FREE_AND_NULL(mi->its);
+	FREE_AND_NULL(mi->recs);
+	FREE_AND_NULL(mi->live);
+	mi->nr = 0;
+}
+
+/*
+ * Stacks.
+ */
+
+void reftable_stack_init(struct reftable_stack *stack, const char *dir)
+{
+	memset(stack, 0, sizeof(*stack));
+	stack->dir = xstrdup(dir);
+	stack->list_path = xstrfmt("%s/tables.list", dir);
+}
+
+static void release_tables(struct reftable **tables, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		reftable_release(tables[i]);
+	free(tables);
+}
+
+/*
+ * Read `tables.list` and open the tables it names, reusing the ones
+ * we already have open. Return 0 on success, 1 if a table vanished
+ * while we were reading (presumably because it was compacted away,
+ * so the caller should try again), or -1 on other errors.
+ */
+static int load_stack(struct reftable_stack *stack)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct strbuf path = STRBUF_INIT;
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct reftable **tables = NULL;
+	size_t i, j, nr = 0;
+	int fd, ret = 0;
+
+	fd = open(stack->list_path, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			return error_errno("unable to open '%s'",
+					   stack->list_path);
+		stat_validity_clear(&stack->validity);
+	} else {
+		if (strbuf_read(&buf, fd, 0) < 0) {
+			ret = error_errno("unable to read '%s'",
+					  stack->list_path);
+			close(fd);
+			goto out;
+		}
+		stat_validity_update(&stack->validity, fd);
+		close(fd);
+		string_list_split(&names, buf.buf, '\n', -1);
+	}
+
+	ALLOC_ARRAY(tables, names.nr);
+	for (i = 0; i < names.nr; i++) {
+		const char *name = names.items[i].string;
+		struct reftable *table = NULL;
+
+		if (!*name)
+			continue;
+
+		for (j = 0; j < stack->nr; j++) {
+			if (!strcmp(stack->tables[j]->name, name)) {
+				table = stack->tables[j];
+				reftable_acquire(table);
+				break;
+			}
+		}
+		if (!table) {
+			strbuf_reset(&path);
+			strbuf_addf(&path, "%s/%s", stack->dir, name);
+			table = reftable_open(path.buf);
+			if (!table) {
+				if (errno == ENOENT)
+					ret = 1;
+				else
+					ret = error_errno("unable to open reftable '%s'",
+							  path.buf);
+				goto out;
+			}
+		}
+		tables[nr++] = table;
+	}
+
+	release_tables(stack->tables, stack->nr);
+	stack->tables = tables;
+	stack->nr = stack->alloc = nr;
+	tables = NULL;
+	nr = 0;
+	stack->loaded = 1;
+
+out:
+	if (ret)
+		stat_validity_clear(&stack->validity);
+	if (tables)
+		release_tables(tables, nr);
+	string_list_clear(&names, 0);
+	strbuf_release(&path);
+	strbuf_release(&buf);
+	return ret;
+}
+
+int reftable_stack_reload(struct reftable_stack *stack)
+{
+	int tries, ret = 0;
+
+	if (stack->loaded &&
+	    stat_validity_check(&stack->validity, stack->list_path))
+		return 0;
+
+	for (tries = 0; tries < 5; tries++) {
+		ret = load_stack(stack);
+		if (ret <= 0)
+			return ret;
+	}
+	return error("'%s' keeps changing; giving up", stack->list_path);
+}
+
+int reftable_stack_lock(struct reftable_stack *stack, long timeout_ms,
+			struct strbuf *err)
+{
+	if (mkdir(stack->dir, 0777) && errno != EEXIST) {
+		strbuf_addf(err, "unable to create directory '%s': %s",
+			    stack->dir, strerror(errno));
+		return -1;
+	}
+	adjust_shared_perm(stack->dir);
+
+	if (hold_lock_file_for_update_timeout(&stack->lock, stack->list_path,
+					      0, timeout_ms) < 0) {
+		unable_to_lock_message(stack->list_path, errno, err);
+		return -1;
+	}
+
+	/* Nobody can change the stack now; make sure we see its latest state. */
+	stack->loaded = 0;
+	if (reftable_stack_reload(stack)) {
+		strbuf_addf(err, "unable to read '%s'", stack->list_path);
+		rollback_lock_file(&stack->lock);
+		return -1;
+	}
+	return 0;
+}
+
+void reftable_stack_unlock(struct reftable_stack *stack)
+{
+	rollback_lock_file(&stack->lock);
+}
+
+uint64_t reftable_stack_next_update_index(struct reftable_stack *stack)
+{
+	if (!stack->nr)
+		return 1;
+	return stack->tables[stack->nr - 1]->max_update_index + 1;
+}
+
+int reftable_stack_read_ref(struct reftable_stack *stack, const char *refname,
+			    struct reftable_record *rec)
+{
+	size_t i, len = strlen(refname);
+
+	if (reftable_stack_reload(stack))
+		return -1;
+
+	for (i = stack->nr; i--; ) {
+		struct reftable_iter it;
+		int ret;
+
+		ret = reftable_iter_seek(&it, stack->tables[i],
+					 REFTABLE_BLOCK_REF, refname, len);
+		if (!ret)
+			ret = reftable_iter_next(&it, rec);
+		reftable_iter_release(&it);
+
+		if (ret < 0)
+			return -1;
+		if (!ret && !keycmp(rec->key.buf, rec->key.len, refname, len))
+			return rec->value_type == REFTABLE_REF_DELETION;
+	}
+	return 1;
+}
+
+/*
+ * Create a temporary file in the stack's directory for a table
+ * covering the given update indexes and prepare `w` to write to it.
+ */
+static struct tempfile *begin_table(struct reftable_stack *stack,
+				    struct table_writer *w,
+				    uint64_t min_update_index,
+				    uint64_t max_update_index,
+				    struct strbuf *err)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct tempfile *tempfile;
+
+	strbuf_addf(&path, "%s/tmp_table_XXXXXX", stack->dir);
+	tempfile = mks_tempfile_m(path.buf, 0666);
+	if (!tempfile) {
+		strbuf_addf(err, "unable to create '%s': %s",
+			    path.buf, strerror(errno));
+		strbuf_release(&path);
+		return NULL;
+	}
+	strbuf_release(&path);
+
+	if (adjust_shared_perm(get_tempfile_path(tempfile))) {
+		strbuf_addf(err, "unable to adjust permissions of '%s'",
+			    get_tempfile_path(tempfile));
+		delete_tempfile(&tempfile);
+		return NULL;
+	}
+
+	writer_init(w, tempfile, min_update_index, max_update_index);
+	return tempfile;
+}
+
+/*
+ * Finish writing the table started by `begin_table()`, move it to
+ * its permanent name and open it.
+ */
+static struct reftable *finish_table(struct reftable_stack *stack,
+				     struct table_writer *w,
+				     uint64_t max_update_index,
+				     struct strbuf *err)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct reftable *table = NULL;
+
+	strbuf_addf(&path, "%s/%012"PRIx64"-%012"PRIx64".ref", stack->dir,
+		    w->min_update_index, max_update_index);
+
+	if (writer_finish(w, max_update_index)) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    get_tempfile_path(w->tempfile), strerror(w->failed));
+		delete_tempfile(&w->tempfile);
+		goto out;
+	}
+	if (fsync_object_files)
+		fsync_or_die(get_tempfile_fd(w->tempfile),
+			     get_tempfile_path(w->tempfile));
+	if (rename_tempfile(&w->tempfile, path.buf)) {
+		strbuf_addf(err, "unable to rename temporary reftable to '%s': %s",
+			    path.buf, strerror(errno));
+		goto out;
+	}
+
+	table = reftable_open(path.buf);
+	if (!table)
+		strbuf_addf(err, "unable to open new reftable '%s'", path.buf);
+
+out:
+	writer_release(w);
+	strbuf_release(&path);
+	return table;
+}
+
+/*
+ * Merge `tables[0..nr-1]` into a new table. Deletion records are
+ * only retained if `keep_deletions` is set, as they may shadow
+ * records in older tables.
+ */
+static struct reftable *compact_tables(struct reftable_stack *stack,
+				       struct reftable **tables, size_t nr,
+				       int keep_deletions, struct strbuf *err)
+{
+	static const int block_types[] = {
+		REFTABLE_BLOCK_REF, REFTABLE_BLOCK_LOG
+	};
+	uint64_t max_update_index = tables[nr - 1]->max_update_index;
+	struct table_writer w;
+	struct reftable_record rec;
+	int i, ret = 0;
+
+	if (!begin_table(stack, &w, tables[0]->min_update_index,
+			 max_update_index, err))
+		return NULL;
+
+	reftable_record_init(&rec);
+	for (i = 0; !ret && i < ARRAY_SIZE(block_types); i++) {
+		struct reftable_merged_iter mi;
+
+		ret = reftable_merged_seek(&mi, tables, nr, block_types[i],
+					   "", 0, keep_deletions);
+		while (!ret && !(ret = reftable_merged_next(&mi, &rec)))
+			writer_add(&w, block_types[i], &rec);
+		if (ret > 0)
+			ret = 0;
+		reftable_merged_release(&mi);
+	}
+	reftable_record_release(&rec);
+
+	if (ret) {
+		strbuf_addf(err, "unable to read reftables in '%s'", stack->dir);
+		delete_tempfile(&w.tempfile);
+		writer_release(&w);
+		return NULL;
+	}
+
+	return finish_table(stack, &w, max_update_index, err);
+}
+
+/*
+ * Decide which tables at the top of `tables` to merge: keep the
+ * table sizes decreasing geometrically (by at least a factor of two
+ * from each table to the sum of the ones above it), so that the stack
+ * has only logarithmically many tables. Return the index of the
+ * first table to merge, or `nr - 1` if nothing needs merging.
+ */
+static size_t compaction_start(struct reftable **tables, size_t nr)
+{
+	size_t i = nr - 1;
+	uint64_t total = tables[i]->size;
+
+	while (i > 0 && tables[i - 1]->size < 2 * total) {
+		i--;
+		total += tables[i]->size;
+	}
+	return i;
+}
+
+/*
+ * Write the names of `tables` to the lockfile of the stack, commit
+ * it, and delete the files of the `obsolete` tables.
+ */
+static int commit_stack(struct reftable_stack *stack,
+			struct reftable **tables, size_t nr,
+			struct reftable **obsolete, size_t obsolete_nr,
+			struct strbuf *err)
+{
+	struct strbuf buf = STRBUF_INIT;
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < nr; i++)
+		strbuf_addf(&buf, "%s\n", tables[i]->name);
+
+	if (write_in_full(get_lock_file_fd(&stack->lock), buf.buf, buf.len) < 0 ||
+	    commit_lock_file(&stack->lock)) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    stack->list_path, strerror(errno));
+		rollback_lock_file(&stack->lock);
+		ret = -1;
+		goto out;
+	}
+
+	for (i = 0; i < obsolete_nr; i++)
+		unlink_or_warn(obsolete[i]->path);
+
+	stack->loaded = 0;
+
+out:
+	strbuf_release(&buf);
+	return ret;
+}
+
+int reftable_stack_add(struct reftable_stack *stack, uint64_t update_index,
+		       struct reftable_record *refs, size_t refs_nr,
+		       struct reftable_record *logs, size_t logs_nr,
+		       struct strbuf *err)
+{
+	struct table_writer w;
+	struct reftable **tables;
+	struct reftable *table, *compacted = NULL;
+	size_t i, nr, start;
+	int ret;
+
+	if (!begin_table(stack, &w, update_index, update_index, err)) {
+		reftable_stack_unlock(stack);
+		return -1;
+	}
+	for (i = 0; i < refs_nr; i++)
+		writer_add(&w, REFTABLE_BLOCK_REF, &refs[i]);
+	for (i = 0; i < logs_nr; i++)
+		writer_add(&w, REFTABLE_BLOCK_LOG, &logs[i]);
+
+	table = finish_table(stack, &w, update_index, err);
+	if (!table) {
+		reftable_stack_unlock(stack);
+		return -1;
+	}
+
+	nr = stack->nr + 1;
+	ALLOC_ARRAY(tables, nr);
+	COPY_ARRAY(tables, stack->tables, stack->nr);
+	tables[nr - 1] = table;
+
+	/*
+	 * Compacting is only an optimization, so if it fails we still
+	 * go ahead with the new table on its own.
+	 */
+	start = compaction_start(tables, nr);
+	if (start < nr - 1) {
+		struct strbuf compact_err = STRBUF_INIT;
+
+		compacted = compact_tables(stack, tables + start, nr - start,
+					   start > 0, &compact_err);
+		if (!compacted)
+			warning("unable to compact reftables: %s",
+				compact_err.buf);
+		strbuf_release(&compact_err);
+	}
+
+	if (compacted) {
+		struct reftable **obsolete;
+		size_t obsolete_nr = nr - start;
+
+		ALLOC_ARRAY(obsolete, obsolete_nr);
+		COPY_ARRAY(obsolete, tables + start, obsolete_nr);
+		tables[start] = compacted;
+		ret = commit_stack(stack, tables, start + 1,
+				   obsolete, obsolete_nr, err);
+		if (ret)
+			unlink_or_warn(compacted->path);
+		free(obsolete);
+		reftable_release(compacted);
+	} else {
+		ret = commit_stack(stack, tables, nr, NULL, 0, err);
+	}
+
+	if (ret || compacted)
+		unlink_or_warn(table->path);
+	reftable_release(table);
+	free(tables);
+
+	if (!ret)
+		ret = reftable_stack_reload(stack);
+	return ret;
+}
+
+int reftable_stack_compact_all(struct reftable_stack *stack, long timeout_ms,
+			       struct strbuf *err)
+{
+	struct reftable *compacted;
+	int ret;
+
+	if (reftable_stack_lock(stack, timeout_ms, err))
+		return -1;
+
+	if (stack->nr < 2) {
+		reftable_stack_unlock(stack);
+		return 0;
+	}
+
+	compacted = compact_tables(stack, stack->tables, stack->nr, 0, err);
+	if (!compacted) {
+		reftable_stack_unlock(stack);
+		return -1;
+	}
+
+	ret = commit_stack(stack, &compacted, 1,
+			   stack->tables, stack->nr, err);
+	if (ret)
+		unlink_or_warn(compacted->path);
+	reftable_release(compacted);
+
+	if (!ret)
+		ret = reftable_stack_reload(stack);
+	return ret;
+}
@@ -0,0 +1,232 @@
+#ifndef REFS_REFTABLE_H
+#define REFS_REFTABLE_H
+
+/*
+ * Low-level support for reftables: immutable, sorted, block-based
+ * tables of references and reflog entries that are stacked on top of
+ * each other in a `reftable/` directory. See
+ * Documentation/technical/reftable.txt for the file format.
+ *
+ * Nothing in here knows about `ref_store`s or transactions; that is
+ * the job of refs/reftable-backend.c.
+ */
+
+#include "../lockfile.h"
+
+/* Block types: */
+#define REFTABLE_BLOCK_REF 'r'
+#define REFTABLE_BLOCK_LOG 'g'
+#define REFTABLE_BLOCK_INDEX 'i'
+
+/* Value types of ref records: */
+#define REFTABLE_REF_DELETION 0
+#define REFTABLE_REF_VAL1 1 /* an object id */
+#define REFTABLE_REF_VAL2 2 /* an object id and its peeled value */
+#define REFTABLE_REF_SYMREF 3
+
+/* Value types of log records: */
+#define REFTABLE_LOG_DELETION 0
+#define REFTABLE_LOG_UPDATE 1
+/* An empty reflog, as created by `create_reflog()`: */
+#define REFTABLE_LOG_EXISTS 2
+
+/*
+ * One record of any block type. Which of the fields are meaningful
+ * depends on the block type and on `value_type`.
+ *
+ * For ref records, `key` is the refname. For log records, it is the
+ * refname, a NUL, and the bitwise complement of the update index in
+ * network byte order, so that the newest entry of a reflog sorts
+ * first; `key.buf` can therefore be used as the refname in both
+ * cases. For index records, `key` is the last key of the block at
+ * `offset`.
+ */
+struct reftable_record {
+	struct strbuf key;
+	unsigned int value_type;
+	uint64_t update_index;
+
+	/* ref records: */
+	struct object_id oid;
+	struct object_id peeled;
+	struct strbuf target;
+
+	/* log records: */
+	struct object_id old_oid;
+	struct object_id new_oid;
+	struct strbuf committer;
+	timestamp_t time;
+	int tz;
+	struct strbuf message;
+
+	/* index records: */
+	uint64_t offset;
+};
+
+void reftable_record_init(struct reftable_record *rec);
+void reftable_record_release(struct reftable_record *rec);
+
+/* Set `key` to the key of the log record of `refname` at `update_index`. */
+void reftable_log_key(struct strbuf *key, const char *refname,
+		      uint64_t update_index);
+
+/* Return the length of the refname at the start of a log record key. */
+static inline size_t reftable_log_refname_len(const struct strbuf *key)
+{
+	return strlen(key->buf);
+}
+
+/*
+ * One mmapped reftable file. Instances are reference counted, as an
+ * iterator may still be reading from a table that its stack has
+ * already dropped.
+ */
+struct reftable {
+	char *path;
+	const char *name;
+
+	unsigned char *map;
+	size_t size;
+
+	uint32_t block_size;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+
+	/* [ref_start, ref_end) holds the ref blocks, and so on: */
+	uint64_t ref_start, ref_end, ref_index_offset;
+	uint64_t log_start, log_end, log_index_offset;
+
+	unsigned int referrers;
+};
+
+/*
+ * Open and map the reftable at `path`, returning a table with one
+ * referrer. On failure, return NULL and leave errno set (ENOENT if
+ * the file does not exist); if the file is corrupt, also print an
+ * error message.
+ */
+struct reftable *reftable_open(const char *path);
+void reftable_acquire(struct reftable *table);
+void reftable_release(struct reftable *table);
+
+/*
+ * An iterator over the ref or log records of one table, in key order.
+ */
+struct reftable_iter {
+	struct reftable *table;
+	int block_type;
+	uint64_t section_end;
+
+	/* The current block, and the offset of the one after it: */
+	const unsigned char *block;
+	const unsigned char *pos;
+	const unsigned char *records_end;
+	uint64_t next_block;
+
+	struct strbuf last_key;
+};
+
+/*
+ * Position `it` at the first record of type `block_type` in `table`
+ * whose key is not less than `key`. The iterator keeps a reference
+ * to `table`. Returns 0 on success or -1 if the table is corrupt.
+ */
+int reftable_iter_seek(struct reftable_iter *it, struct reftable *table,
+		       int block_type, const char *key, size_t keylen);
+
+/*
+ * Read the next record into `rec`. Return 0 on success, 1 at the end
+ * of the section and -1 if the table is corrupt.
+ */
+int reftable_iter_next(struct reftable_iter *it, struct reftable_record *rec);
+void reftable_iter_release(struct reftable_iter *it);
+
+/*
+ * An iterator merging the records of several tables, of which later
+ * ones take precedence. Only the newest record of each key is
+ * returned, and deletion records are dropped unless `keep_deletions`
+ * is set.
+ */
+struct reftable_merged_iter {
+	struct reftable_iter *its;
+	struct reftable_record *recs;
+	int *live;
+	size_t nr;
+	int keep_deletions;
+};
+
+int reftable_merged_seek(struct reftable_merged_iter *mi,
+			 struct reftable **tables, size_t nr,
+			 int block_type, const char *key, size_t keylen,
+			 int keep_deletions);
+int reftable_merged_next(struct reftable_merged_iter *mi,
+			 struct reftable_record *rec);
+void reftable_merged_release(struct reftable_merged_iter *mi);
+
+/*
+ * A stack of reftables, listed oldest first in `tables.list` within
+ * `dir`. Updates add a new table on top of the stack; tables are
+ * merged now and then so that the stack stays logarithmic in size.
+ */
+struct reftable_stack {
+	char *dir;
+	char *list_path;
+
+	struct reftable **tables;
+	size_t nr, alloc;
+
+	int loaded;
+	struct stat_validity validity;
+
+	/*
+	 * The lock on `tables.list`. Note that this (and thus the
+	 * enclosing stack) must not be freed.
+	 */
+	struct lock_file lock;
+};
+
+void reftable_stack_init(struct reftable_stack *stack, const char *dir);
+
+/*
+ * Make sure that `stack->tables` reflects `tables.list`, rereading
+ * it if it has changed on disk. Return 0 on success.
+ */
+int reftable_stack_reload(struct reftable_stack *stack);
+
+/*
+ * Lock `tables.list`, waiting at most `timeout_ms` milliseconds, and
+ * reload the stack under the lock.
+ */
+int reftable_stack_lock(struct reftable_stack *stack, long timeout_ms,
+			struct strbuf *err);
+void reftable_stack_unlock(struct reftable_stack *stack);
+
+/* The update index to use for the next table added to the stack. */
+uint64_t reftable_stack_next_update_index(struct reftable_stack *stack);
+
+/*
+ * Look up the ref record for `refname`. Return 0 if the ref exists,
+ * 1 if it does not and -1 on errors.
+ */
+int reftable_stack_read_ref(struct reftable_stack *stack, const char *refname,
+			    struct reftable_record *rec);
+
+/*
+ * Add a table holding `refs` and `logs` (each sorted by key, without
+ * duplicates) at update index `update_index` to the locked stack,
+ * compact the top of the stack if it has become unbalanced, and
+ * release the lock. Return 0 on success.
+ */
+int reftable_stack_add(struct reftable_stack *stack, uint64_t update_index,
+		       struct reftable_record *refs, size_t refs_nr,
+		       struct reftable_record *logs, size_t logs_nr,
+		       struct strbuf *err);
+
+/*
+ * Merge all tables of the stack into one, dropping deletion records.
+ * The stack must not be locked by the caller.
+ */
+int reftable_stack_compact_all(struct reftable_stack *stack, long timeout_ms,
+			       struct strbuf *err);
+
+#endif /* REFS_REFTABLE_H */
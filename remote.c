@@ -636,6 +636,28 @@ void free_refspec(int nr_refspec, struct refspec *refspec)
 	free(refspec);
 }
 
+void refspec_ref_prefixes(const struct refspec *refspec, int nr_refspec,
+			  struct argv_array *ref_prefixes)
+{
+	int i;
+
+	for (i = 0; i < nr_refspec; i++) {
+		const struct refspec *item = &refspec[i];
+		const char *prefix = item->src;
+
+		if (!prefix || !*prefix || item->exact_sha1)
+			continue;
+
+		if (item->pattern) {
+			const char *glob = strchr(prefix, '*');
+			argv_array_pushf(ref_prefixes, "%.*s",
+					 (int)(glob - prefix), prefix);
+		} else {
+			expand_ref_prefix(ref_prefixes, prefix);
+		}
+	}
+}
+
 static int valid_remote_nick(const char *name)
 {
 	if (!name[0] || is_dot_or_dotdot(name))
@@ -3,6 +3,8 @@
 #include "blob.h"
 #include "tree.h"
 #include "commit.h"
+#include "commit-graph.h"
+#include "bloom.h"
 #include "diff.h"
 #include "refs.h"
 #include "revision.h"
@@ -16,6 +18,7 @@
 #include "line-log.h"
 #include "mailmap.h"
 #include "commit-slab.h"
+#include "prio-queue.h"
 #include "dir.h"
 #include "cache-tree.h"
 #include "bisect.h"
@@ -434,11 +437,108 @@ static void file_change(struct diff_options *options,
 	options->flags.has_changes = 1;
 }
 
+static struct trace_key trace_bloom = TRACE_KEY_INIT(BLOOM_FILTER);
+
+static int bloom_filter_not_present;
+static int bloom_filter_definitely_not;
+static int bloom_filter_maybe;
+static int bloom_filter_false_positive;
+
+static void prepare_to_use_bloom_filter(struct rev_info *revs)
+{
+	const struct bloom_filter_settings *settings;
+	int i;
+
+	if (!revs->prune || !revs->prune_data.nr ||
+	    revs->diffopt.flags.follow_renames ||
+	    revs->line_level_traverse)
+		return;
+
+	/*
+	 * The filters only know about literal paths; leave wildcards,
+	 * case-insensitive matching and the like to the tree diff.
+	 */
+	for (i = 0; i < revs->prune_data.nr; i++) {
+		struct pathspec_item *pi = &revs->prune_data.items[i];
+
+		if (pi->magic & ~(PATHSPEC_FROMTOP | PATHSPEC_LITERAL) ||
+		    pi->nowildcard_len < pi->len)
+			return;
+		if (!pi->len || (pi->len == 1 && pi->match[0] == '/'))
+			return;
+	}
+
+	settings = get_commit_graph_bloom_settings();
+	if (!settings)
+		return;
+
+	revs->bloom_filter_settings = settings;
+	ALLOC_ARRAY(revs->bloom_keys, revs->prune_data.nr);
+	for (i = 0; i < revs->prune_data.nr; i++) {
+		struct pathspec_item *pi = &revs->prune_data.items[i];
+		int len = pi->len;
+
+		if (pi->match[len - 1] == '/')
+			len--;
+		fill_bloom_key(pi->match, len, &revs->bloom_keys[i], settings);
+	}
+	revs->bloom_keys_nr = revs->prune_data.nr;
+}
+
+static void release_bloom_keys(struct rev_info *revs)
+{
+	int i;
+
+	if (!revs->bloom_keys)
+		return;
+
+	trace_printf_key(&trace_bloom,
+			 "bloom filter statistics: not present %d, "
+			 "definitely not %d, maybe %d, false positive %d\n",
+			 bloom_filter_not_present, bloom_filter_definitely_not,
+			 bloom_filter_maybe, bloom_filter_false_positive);
+
+	for (i = 0; i < revs->bloom_keys_nr; i++)
+		clear_bloom_key(&revs->bloom_keys[i]);
+	FREE_AND_NULL(revs->bloom_keys);
+	revs->bloom_keys_nr = 0;
+}
+
+/*
+ * Returns 0 if the changed-path Bloom filter of "commit" says none of
+ * the paths we are interested in changed, 1 if some of them may have
+ * changed, and -1 if the commit has no filter.
+ */
+static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
+						 struct commit *commit)
+{
+	struct bloom_filter filter;
+	int i;
+
+	if (!get_commit_graph_bloom_filter(commit, &filter)) {
+		bloom_filter_not_present++;
+		return -1;
+	}
+
+	for (i = 0; i < revs->bloom_keys_nr; i++) {
+		if (bloom_filter_contains(&filter, &revs->bloom_keys[i],
+					  revs->bloom_filter_settings)) {
+			bloom_filter_maybe++;
+			return 1;
+		}
+	}
+
+	bloom_filter_definitely_not++;
+	return 0;
+}
+
 static int rev_compare_tree(struct rev_info *revs,
-			    struct commit *parent, struct commit *commit)
+			    struct commit *parent, struct commit *commit,
+			    int nth_parent)
 {
 	struct tree *t1 = parent->tree;
 	struct tree *t2 = commit->tree;
+	int bloom_ret = -1;
 
 	if (!t1)
 		return REV_TREE_NEW;
@@ -463,11 +563,24 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
+	/*
+	 * The filters are computed against the first parent, so they
+	 * cannot say anything about the other parents of a merge.
+	 */
+	if (revs->bloom_keys_nr && !nth_parent) {
+		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
+		if (!bloom_ret)
+			return REV_TREE_SAME;
+	}
+
 	tree_difference = REV_TREE_SAME;
 	revs->pruning.flags.has_changes = 0;
 	if (diff_tree_oid(&t1->object.oid, &t2->object.oid, "",
 			   &revs->pruning) < 0)
 		return REV_TREE_DIFFERENT;
+
+	if (bloom_ret == 1 && tree_difference == REV_TREE_SAME)
+		bloom_filter_false_positive++;
 	return tree_difference;
 }
 
@@ -665,7 +778,7 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 			die("cannot simplify commit %s (because of %s)",
 			    oid_to_hex(&commit->object.oid),
 			    oid_to_hex(&p->object.oid));
-		switch (rev_compare_tree(revs, p, commit)) {
+		switch (rev_compare_tree(revs, p, commit, nth_parent)) {
 		case REV_TREE_SAME:
 			if (!revs->simplify_history || !relevant_commit(p)) {
 				/* Even if a merge with an uninteresting
@@ -780,7 +893,8 @@ static int add_parents_to_list(struct rev_info *revs, struct commit *commit,
 			if (p->object.flags & SEEN)
 				continue;
 			p->object.flags |= SEEN;
-			commit_list_insert_by_date_cached(p, list, cached_base, cache_ptr);
+			if (list)
+				commit_list_insert_by_date_cached(p, list, cached_base, cache_ptr);
 		}
 		return 0;
 	}
@@ -807,7 +921,8 @@ static int add_parents_to_list(struct rev_info *revs, struct commit *commit,
 		p->object.flags |= left_flag;
 		if (!(p->object.flags & SEEN)) {
 			p->object.flags |= SEEN;
-			commit_list_insert_by_date_cached(p, list, cached_base, cache_ptr);
+			if (list)
+				commit_list_insert_by_date_cached(p, list, cached_base, cache_ptr);
 		}
 		if (revs->first_parent_only)
 			break;
@@ -2414,7 +2529,11 @@ int setup_revisions(int argc, const char **argv, struct rev_info *revs, struct s
 	    revs->diffopt.flags.follow_renames)
 		revs->diff = 1;
 
-	if (revs->topo_order)
+	/*
+	 * Without generation numbers, --topo-order has to see the whole
+	 * history before it can emit anything.
+	 */
+	if (revs->topo_order && !generation_numbers_enabled())
 		revs->limited = 1;
 
 	if (revs->prune_data.nr) {
@@ -2839,7 +2958,229 @@ static void set_children(struct rev_info *revs)
 
 void reset_revision_walk(void)
 {
-	clear_object_flags(SEEN | ADDED | SHOWN);
+	clear_object_flags(SEEN | ADDED | SHOWN |
+			   TOPO_WALK_EXPLORED | TOPO_WALK_INDEGREE);
+}
+
+define_commit_slab(indegree_slab, int);
+define_commit_slab(author_date_slab, unsigned long);
+
+struct topo_walk_info {
+	uint32_t min_generation;
+	struct prio_queue explore_queue;
+	struct prio_queue indegree_queue;
+	struct prio_queue topo_queue;
+	struct indegree_slab indegree;
+	struct author_date_slab author_date;
+};
+
+static inline void test_flag_and_insert(struct prio_queue *q, struct commit *c, int flag)
+{
+	if (c->object.flags & flag)
+		return;
+
+	c->object.flags |= flag;
+	prio_queue_put(q, c);
+}
+
+/*
+ * The "explore" walk runs ahead of the "indegree" walk and makes sure
+ * every commit whose in-degree gets counted has already been through
+ * add_parents_to_list(), i.e. has been simplified and marked.
+ */
+static void explore_walk_step(struct rev_info *revs)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit_list *p;
+	struct commit *c = prio_queue_get(&info->explore_queue);
+
+	if (!c)
+		return;
+
+	if (parse_commit_gently(c, 1) < 0)
+		return;
+
+	if (revs->sort_order == REV_SORT_BY_AUTHOR_DATE)
+		record_author_date(&info->author_date, c);
+
+	if (revs->max_age != -1 && (c->date < revs->max_age))
+		c->object.flags |= UNINTERESTING;
+
+	if (add_parents_to_list(revs, c, NULL, NULL) < 0)
+		return;
+
+	if (c->object.flags & UNINTERESTING)
+		mark_parents_uninteresting(c);
+
+	for (p = c->parents; p; p = p->next)
+		test_flag_and_insert(&info->explore_queue, p->item, TOPO_WALK_EXPLORED);
+}
+
+static void explore_to_depth(struct rev_info *revs,
+			     uint32_t gen_cutoff)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit *c;
+	while ((c = prio_queue_peek(&info->explore_queue)) &&
+	       c->generation >= gen_cutoff)
+		explore_walk_step(revs);
+}
+
+static void indegree_walk_step(struct rev_info *revs)
+{
+	struct commit_list *p;
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit *c = prio_queue_get(&info->indegree_queue);
+
+	if (!c)
+		return;
+
+	if (parse_commit_gently(c, 1) < 0)
+		return;
+
+	explore_to_depth(revs, c->generation);
+
+	for (p = c->parents; p; p = p->next) {
+		struct commit *parent = p->item;
+		int *pi = indegree_slab_at(&info->indegree, parent);
+
+		if (*pi)
+			(*pi)++;
+		else
+			*pi = 2;
+
+		test_flag_and_insert(&info->indegree_queue, parent, TOPO_WALK_INDEGREE);
+
+		if (revs->first_parent_only)
+			return;
+	}
+}
+
+/*
+ * Count in-degrees only as deep as the lowest generation we have been
+ * asked to emit: nothing below it can affect the order of what is
+ * shown so far.
+ */
+static void compute_indegrees_to_depth(struct rev_info *revs,
+				       uint32_t gen_cutoff)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit *c;
+	while ((c = prio_queue_peek(&info->indegree_queue)) &&
+	       c->generation >= gen_cutoff)
+		indegree_walk_step(revs);
+}
+
+static void init_topo_walk(struct rev_info *revs)
+{
+	struct topo_walk_info *info;
+	struct commit_list *list;
+
+	info = xcalloc(1, sizeof(*info));
+	revs->topo_walk_info = info;
+
+	init_indegree_slab(&info->indegree);
+
+	switch (revs->sort_order) {
+	default: /* REV_SORT_IN_GRAPH_ORDER */
+		info->topo_queue.compare = NULL;
+		break;
+	case REV_SORT_BY_COMMIT_DATE:
+		info->topo_queue.compare = compare_commits_by_commit_date;
+		break;
+	case REV_SORT_BY_AUTHOR_DATE:
+		init_author_date_slab(&info->author_date);
+		info->topo_queue.compare = compare_commits_by_author_date;
+		info->topo_queue.cb_data = &info->author_date;
+		break;
+	}
+
+	info->explore_queue.compare = compare_commits_by_gen_then_commit_date;
+	info->indegree_queue.compare = compare_commits_by_gen_then_commit_date;
+
+	info->min_generation = GENERATION_NUMBER_INFINITY;
+	for (list = revs->commits; list; list = list->next) {
+		struct commit *c = list->item;
+
+		if (parse_commit_gently(c, 1))
+			continue;
+
+		test_flag_and_insert(&info->explore_queue, c, TOPO_WALK_EXPLORED);
+		test_flag_and_insert(&info->indegree_queue, c, TOPO_WALK_INDEGREE);
+
+		if (c->generation < info->min_generation)
+			info->min_generation = c->generation;
+
+		*(indegree_slab_at(&info->indegree, c)) = 1;
+
+		if (revs->sort_order == REV_SORT_BY_AUTHOR_DATE)
+			record_author_date(&info->author_date, c);
+	}
+	compute_indegrees_to_depth(revs, info->min_generation);
+
+	for (list = revs->commits; list; list = list->next) {
+		struct commit *c = list->item;
+
+		if (*(indegree_slab_at(&info->indegree, c)) == 1)
+			prio_queue_put(&info->topo_queue, c);
+	}
+
+	/*
+	 * This is unfortunate; the initial tips need to be shown
+	 * in the order given from the revision traversal machinery.
+	 */
+	if (revs->sort_order == REV_SORT_IN_GRAPH_ORDER)
+		prio_queue_reverse(&info->topo_queue);
+}
+
+static struct commit *next_topo_commit(struct rev_info *revs)
+{
+	struct commit *c;
+	struct topo_walk_info *info = revs->topo_walk_info;
+
+	/* pop next off of topo_queue */
+	c = prio_queue_get(&info->topo_queue);
+
+	if (c)
+		*(indegree_slab_at(&info->indegree, c)) = 0;
+
+	return c;
+}
+
+static void expand_topo_walk(struct rev_info *revs, struct commit *commit)
+{
+	struct commit_list *p;
+	struct topo_walk_info *info = revs->topo_walk_info;
+	if (add_parents_to_list(revs, commit, NULL, NULL) < 0) {
+		if (!revs->ignore_missing_links)
+			die("Failed to traverse parents of commit %s",
+			    oid_to_hex(&commit->object.oid));
+	}
+
+	for (p = commit->parents; p; p = p->next) {
+		struct commit *parent = p->item;
+		int *pi;
+
+		if (parent->object.flags & UNINTERESTING)
+			continue;
+
+		if (parse_commit_gently(parent, 1) < 0)
+			continue;
+
+		if (parent->generation < info->min_generation) {
+			info->min_generation = parent->generation;
+			compute_indegrees_to_depth(revs, info->min_generation);
+		}
+
+		pi = indegree_slab_at(&info->indegree, parent);
+
+		(*pi)--;
+		if (*pi == 1)
+			prio_queue_put(&info->topo_queue, parent);
+
+		if (revs->first_parent_only)
+			return;
+	}
 }
 
 int prepare_revision_walk(struct rev_info *revs)
@@ -2874,11 +3215,15 @@ int prepare_revision_walk(struct rev_info *revs)
 		commit_list_sort_by_date(&revs->commits);
 	if (revs->no_walk)
 		return 0;
-	if (revs->limited)
+
+	prepare_to_use_bloom_filter(revs);
+	if (revs->limited) {
 		if (limit_list(revs) < 0)
 			return -1;
-	if (revs->topo_order)
-		sort_in_topological_order(&revs->commits, revs->sort_order);
+		if (revs->topo_order)
+			sort_in_topological_order(&revs->commits, revs->sort_order);
+	} else if (revs->topo_order)
+		init_topo_walk(revs);
 	if (revs->line_level_traverse)
 		line_log_filter(revs);
 	if (revs->simplify_merges)
@@ -3206,6 +3551,8 @@ static struct commit *get_revision_1(struct rev_info *revs)
 
 		if (revs->reflog_info)
 			commit = next_reflog_entry(revs->reflog_info);
+		else if (revs->topo_walk_info)
+			commit = next_topo_commit(revs);
 		else
 			commit = pop_commit(&revs->commits);
 
@@ -3227,6 +3574,8 @@ static struct commit *get_revision_1(struct rev_info *revs)
 
 			if (revs->reflog_info)
 				try_to_simplify_commit(revs, commit);
+			else if (revs->topo_walk_info)
+				expand_topo_walk(revs, commit);
 			else if (add_parents_to_list(revs, commit, &revs->commits, NULL) < 0) {
 				if (!revs->ignore_missing_links)
 					die("Failed to traverse parents of commit %s",
@@ -3403,6 +3752,7 @@ struct commit *get_revision(struct rev_info *revs)
 		reversed = NULL;
 		while ((c = get_revision_internal(revs)))
 			commit_list_insert(c, &reversed);
+		release_bloom_keys(revs);
 		revs->commits = reversed;
 		revs->reverse = 0;
 		revs->reverse_output_stage = 1;
@@ -3418,16 +3768,21 @@ struct commit *get_revision(struct rev_info *revs)
 	c = get_revision_internal(revs);
 	if (c && revs->graph)
 		graph_update(revs->graph, c);
-	if (!c) {
-		free_saved_parents(revs);
-		if (revs->previous_parents) {
-			free_commit_list(revs->previous_parents);
-			revs->previous_parents = NULL;
-		}
-	}
+	if (!c)
+		release_revisions(revs);
 	return c;
 }
 
+void release_revisions(struct rev_info *revs)
+{
+	release_bloom_keys(revs);
+	free_saved_parents(revs);
+	if (revs->previous_parents) {
+		free_commit_list(revs->previous_parents);
+		revs->previous_parents = NULL;
+	}
+}
+
 char *get_revision_mark(const struct rev_info *revs, const struct commit *commit)
 {
 	if (commit->object.flags & BOUNDARY)
@@ -20,7 +20,10 @@
 #define PATCHSAME	(1u<<9)
 #define BOTTOM		(1u<<10)
 #define TRACK_LINEAR	(1u<<26)
-#define ALL_REV_FLAGS	(((1u<<11)-1) | TRACK_LINEAR)
+#define TOPO_WALK_EXPLORED	(1u<<27)
+#define TOPO_WALK_INDEGREE	(1u<<28)
+#define ALL_REV_FLAGS	(((1u<<11)-1) | TRACK_LINEAR | \
+			 TOPO_WALK_EXPLORED | TOPO_WALK_INDEGREE)
 
 #define DECORATE_SHORT_REFS	1
 #define DECORATE_FULL_REFS	2
@@ -29,6 +32,9 @@ struct rev_info;
 struct log_info;
 struct string_list;
 struct saved_parents;
+struct topo_walk_info;
+struct bloom_filter_settings;
+struct bloom_key;
 
 struct rev_cmdline_info {
 	unsigned int nr;
@@ -229,11 +235,22 @@ struct rev_info {
 	/* line level range that we are chasing */
 	struct decoration line_log_data;
 
+	/*
+	 * Keys of the pathspec for the changed-path Bloom filters of the
+	 * commit-graph, if it has them and the pathspec allows their use.
+	 */
+	const struct bloom_filter_settings *bloom_filter_settings;
+	struct bloom_key *bloom_keys;
+	int bloom_keys_nr;
+
 	/* copies of the parent lists, for --full-diff display */
 	struct saved_parents *saved_parents_slab;
 
 	struct commit_list *previous_parents;
 	const char *break_bar;
+
+	/* incremental --topo-order walk driven by generation numbers */
+	struct topo_walk_info *topo_walk_info;
 };
 
 extern int ref_excluded(struct string_list *, const char *path);
@@ -272,6 +289,11 @@ extern int handle_revision_arg(const char *arg, struct rev_info *revs,
 extern void reset_revision_walk(void);
 extern int prepare_revision_walk(struct rev_info *revs);
 extern struct commit *get_revision(struct rev_info *revs);
+/*
+ * Free what the walk allocated for itself.  get_revision() does so when
+ * it runs out of commits; callers that may stop before that call this.
+ */
+extern void release_revisions(struct rev_info *revs);
 extern char *get_revision_mark(const struct rev_info *revs,
 			       const struct commit *commit);
 extern void put_revision_mark(const struct rev_info *revs,
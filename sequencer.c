@@ -193,6 +193,16 @@ static const char *gpg_sign_opt_quoted(struct replay_opts *opts)
 	return buf.buf;
 }
 
+/*
+ * The rename cache only serves the commits replayed by one command;
+ * let go of it once they are done, whether or not there is state left.
+ */
+static void release_rename_cache(struct replay_opts *opts)
+{
+	rename_cache_free(opts->rename_cache);
+	opts->rename_cache = NULL;
+}
+
 int sequencer_remove_state(struct replay_opts *opts)
 {
 	struct strbuf dir = STRBUF_INIT;
@@ -203,6 +213,7 @@ int sequencer_remove_state(struct replay_opts *opts)
 	for (i = 0; i < opts->xopts_nr; i++)
 		free(opts->xopts[i]);
 	free(opts->xopts);
+	release_rename_cache(opts);
 
 	strbuf_addstr(&dir, get_dir(opts));
 	remove_dir_recursively(&dir, 0);
@@ -450,6 +461,14 @@ static int do_recursive_merge(struct commit *base, struct commit *next,
 	if (is_rebase_i(opts))
 		o.buffer_output = 2;
 	o.show_rename_progress = 1;
+	/*
+	 * The commits are all replayed on the same upstream, whose side
+	 * of each merge mostly has the same renames, between mostly the
+	 * same files, from one commit to the next.
+	 */
+	if (!opts->rename_cache)
+		opts->rename_cache = rename_cache_new();
+	o.rename_cache = opts->rename_cache;
 
 	head_tree = parse_tree_indirect(head);
 	next_tree = next ? next->tree : empty_tree();
@@ -2311,6 +2330,7 @@ int sequencer_continue(struct replay_opts *opts)
 	}
 
 	res = pick_commits(&todo_list, opts);
+	release_rename_cache(opts);
 release_todo_list:
 	todo_list_release(&todo_list);
 	return res;
@@ -2368,7 +2388,9 @@ int sequencer_pick_revisions(struct replay_opts *opts)
 		cmit = get_revision(opts->revs);
 		if (!cmit || get_revision(opts->revs))
 			return error("BUG: expected exactly one commit from walk");
-		return single_pick(cmit, opts);
+		res = single_pick(cmit, opts);
+		release_rename_cache(opts);
+		return res;
 	}
 
 	/*
@@ -2388,6 +2410,7 @@ int sequencer_pick_revisions(struct replay_opts *opts)
 		return -1;
 	update_abort_safety_file();
 	res = pick_commits(&todo_list, opts);
+	release_rename_cache(opts);
 	todo_list_release(&todo_list);
 	return res;
 }
@@ -37,6 +37,9 @@ struct replay_opts {
 
 	/* Only used by REPLAY_NONE */
 	struct rev_info *revs;
+
+	/* Private use */
+	struct rename_cache *rename_cache;
 };
 #define REPLAY_OPTS_INIT { -1 }
 
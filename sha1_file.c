@@ -29,6 +29,7 @@
 #include "mergesort.h"
 #include "quote.h"
 #include "packfile.h"
+#include "promisor-remote.h"
 
 const unsigned char null_sha1[GIT_MAX_RAWSZ];
 const struct object_id null_oid;
@@ -1221,6 +1222,7 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 	const unsigned char *real = (flags & OBJECT_INFO_LOOKUP_REPLACE) ?
 				    lookup_replace_object(sha1) :
 				    sha1;
+	int already_retried = 0;
 
 	if (is_null_sha1(real))
 		return -1;
@@ -1248,19 +1250,32 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 		}
 	}
 
-	if (!find_pack_entry(real, &e)) {
+	while (!find_pack_entry(real, &e)) {
 		/* Most likely it's a loose object. */
 		if (!sha1_loose_object_info(real, oi, flags))
 			return 0;
 
 		/* Not a loose object; someone else may have just packed it. */
-		if (flags & OBJECT_INFO_QUICK) {
-			return -1;
-		} else {
+		if (!(flags & OBJECT_INFO_QUICK)) {
 			reprepare_packed_git();
-			if (!find_pack_entry(real, &e))
-				return -1;
+			if (find_pack_entry(real, &e))
+				break;
+		}
+
+		/* Check if it is a missing object we can still fetch */
+		if (fetch_if_missing && !already_retried &&
+		    !(flags & OBJECT_INFO_SKIP_FETCH_OBJECT) &&
+		    has_promisor_remote()) {
+			struct object_id oid;
+
+			hashcpy(oid.hash, real);
+			already_retried = 1;
+			if (!promisor_remote_get_direct(&oid, 1)) {
+				reprepare_packed_git();
+				continue;
+			}
 		}
+		return -1;
 	}
 
 	if (oi == &blank_oi)
@@ -0,0 +1,305 @@
+#include "cache.h"
+#include "config.h"
+#include "cache-tree.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "pathspec.h"
+#include "sparse-index.h"
+
+static struct trace_key trace_sparse_index = TRACE_KEY_INIT(SPARSE_INDEX);
+
+static struct cache_entry *construct_sparse_dir_entry(const char *sparse_dir,
+						      size_t len,
+						      struct cache_tree *tree)
+{
+	struct cache_entry *de = xcalloc(1, cache_entry_size(len));
+
+	memcpy(de->name, sparse_dir, len);
+	de->ce_namelen = len;
+	de->ce_mode = S_IFDIR;
+	de->ce_flags = CE_SKIP_WORKTREE | CE_EXTENDED;
+	oidcpy(&de->oid, &tree->oid);
+	return de;
+}
+
+/*
+ * Can the entries between start and end (all below the directory
+ * "ct_path") be replaced by a single sparse directory entry?
+ */
+static int can_collapse(struct index_state *istate, int start, int end)
+{
+	int i;
+
+	for (i = start; i < end; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (ce_stage(ce) ||
+		    !ce_skip_worktree(ce) ||
+		    S_ISGITLINK(ce->ce_mode) ||
+		    ce_intent_to_add(ce))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Walk the entries between start and end, which are covered by the
+ * cache-tree node "ct" for the directory "ct_path", and move them
+ * down to istate->cache[num_converted...], replacing every directory
+ * that can be collapsed by a sparse directory entry.  Returns the new
+ * number of converted entries.
+ */
+static int convert_to_sparse_rec(struct index_state *istate,
+				 int num_converted,
+				 int start, int end,
+				 const char *ct_path, size_t ct_pathlen,
+				 struct cache_tree *ct)
+{
+	int i, first = num_converted;
+	struct strbuf child_path = STRBUF_INIT;
+
+	if (ct_pathlen && can_collapse(istate, start, end)) {
+		for (i = start; i < end; i++)
+			free(istate->cache[i]);
+		istate->cache[num_converted++] =
+			construct_sparse_dir_entry(ct_path, ct_pathlen, ct);
+
+		/* the node becomes a leaf covering the one new entry */
+		for (i = 0; i < ct->subtree_nr; i++) {
+			cache_tree_free(&ct->down[i]->cache_tree);
+			free(ct->down[i]);
+		}
+		ct->subtree_nr = 0;
+		ct->entry_count = 1;
+		return num_converted;
+	}
+
+	for (i = start; i < end; ) {
+		int span, pos = -1;
+		struct cache_entry *ce = istate->cache[i];
+		const char *base, *slash;
+
+		/* Is this a file directly in ct_path? */
+		base = ce->name + ct_pathlen;
+		slash = strchr(base, '/');
+		if (slash)
+			pos = cache_tree_subtree_pos(ct, base, slash - base);
+
+		if (pos < 0) {
+			istate->cache[num_converted++] = ce;
+			i++;
+			continue;
+		}
+
+		strbuf_setlen(&child_path, 0);
+		strbuf_add(&child_path, ce->name, slash - ce->name + 1);
+
+		span = ct->down[pos]->cache_tree->entry_count;
+		num_converted = convert_to_sparse_rec(istate, num_converted,
+						      i, i + span,
+						      child_path.buf,
+						      child_path.len,
+						      ct->down[pos]->cache_tree);
+		i += span;
+	}
+
+	strbuf_release(&child_path);
+	ct->entry_count = num_converted - first;
+	return num_converted;
+}
+
+static int sparse_index_enabled(void)
+{
+	int val;
+
+	if (!core_apply_sparse_checkout)
+		return 0;
+	if (git_config_get_bool("index.sparse", &val))
+		return 0;
+	return val;
+}
+
+void convert_to_sparse(struct index_state *istate)
+{
+	int nr;
+
+	if (istate->split_index || istate->sparse_index ||
+	    !istate->cache_nr || !sparse_index_enabled())
+		return;
+
+	/*
+	 * The cache-tree tells us which range of entries belongs to
+	 * which directory, and which tree to record for it; it must be
+	 * valid all the way down.
+	 */
+	if (unmerged_index(istate))
+		return;
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_SILENT) ||
+	    !cache_tree_fully_valid(istate->cache_tree))
+		return;
+
+	free_name_hash(istate);
+
+	nr = convert_to_sparse_rec(istate, 0, 0, istate->cache_nr,
+				   "", 0, istate->cache_tree);
+	if (nr == istate->cache_nr)
+		return; /* nothing to collapse */
+
+	trace_printf_key(&trace_sparse_index,
+			 "convert_to_sparse: %u entries down to %d",
+			 istate->cache_nr, nr);
+	istate->cache_nr = nr;
+	istate->sparse_index = 1;
+}
+
+static int add_path_to_index(const unsigned char *sha1,
+			     struct strbuf *base, const char *path,
+			     unsigned int mode, int stage, void *context)
+{
+	struct index_state *istate = context;
+	struct cache_entry *ce;
+	size_t len;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+
+	len = base->len + strlen(path);
+	ce = xcalloc(1, cache_entry_size(len));
+	memcpy(ce->name, base->buf, base->len);
+	memcpy(ce->name + base->len, path, len - base->len);
+	ce->ce_namelen = len;
+	ce->ce_mode = create_ce_mode(mode);
+	ce->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE | CE_EXTENDED;
+	hashcpy(ce->oid.hash, sha1);
+
+	ALLOC_GROW(istate->cache, istate->cache_nr + 1, istate->cache_alloc);
+	istate->cache[istate->cache_nr++] = ce;
+	return 0;
+}
+
+static struct cache_tree *find_cache_tree_node(struct cache_tree *it,
+					       const char *path)
+{
+	const char *slash;
+
+	while (it && (slash = strchr(path, '/'))) {
+		int pos = cache_tree_subtree_pos(it, path, slash - path);
+
+		if (pos < 0)
+			return NULL;
+		it = it->down[pos]->cache_tree;
+		path = slash + 1;
+	}
+	return it;
+}
+
+/*
+ * The cache-tree node of a sparse directory covered one entry, and
+ * now covers "nr" of them; fix up the counts from the root down,
+ * leaving invalid nodes alone.
+ */
+static void adjust_cache_tree_counts(struct cache_tree *it,
+				     const char *path, int nr)
+{
+	while (it) {
+		const char *slash = strchr(path, '/');
+		int pos;
+
+		if (it->entry_count >= 0)
+			it->entry_count += nr - 1;
+		if (!slash)
+			break;
+		pos = cache_tree_subtree_pos(it, path, slash - path);
+		if (pos < 0)
+			break;
+		it = it->down[pos]->cache_tree;
+		path = slash + 1;
+	}
+}
+
+void ensure_full_index(struct index_state *istate)
+{
+	struct index_state full;
+	struct pathspec ps;
+	int i, nr;
+
+	if (!istate || !istate->sparse_index)
+		return;
+
+	trace_printf_key(&trace_sparse_index, "ensure_full_index: expanding");
+
+	free_name_hash(istate);
+	memset(&full, 0, sizeof(full));
+	full.cache_alloc = alloc_nr(istate->cache_alloc);
+	ALLOC_ARRAY(full.cache, full.cache_alloc);
+	memset(&ps, 0, sizeof(ps));
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct tree *tree;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode)) {
+			ALLOC_GROW(full.cache, full.cache_nr + 1, full.cache_alloc);
+			full.cache[full.cache_nr++] = ce;
+			continue;
+		}
+
+		nr = full.cache_nr;
+		tree = lookup_tree(&ce->oid);
+		if (!tree ||
+		    read_tree_recursive(tree, ce->name, ce_namelen(ce), 0,
+					&ps, add_path_to_index, &full))
+			die(_("unable to expand sparse directory '%s'"),
+			    ce->name);
+		adjust_cache_tree_counts(istate->cache_tree, ce->name,
+					 full.cache_nr - nr);
+		free(ce);
+	}
+
+	/*
+	 * This only changes the in-core representation; the index on
+	 * disk stays as it is unless the command changes something.
+	 */
+	free(istate->cache);
+	istate->cache = full.cache;
+	istate->cache_nr = full.cache_nr;
+	istate->cache_alloc = full.cache_alloc;
+	istate->sparse_index = 0;
+}
+
+int sparse_dirs_match_tree(struct index_state *istate,
+			   const struct object_id *tree)
+{
+	struct strbuf path = STRBUF_INIT;
+	int i, ret = 1;
+
+	if (!istate->sparse_index)
+		return 1;
+
+	for (i = 0; ret && i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+		struct cache_tree *it;
+		struct object_id oid;
+		unsigned mode;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode))
+			continue;
+
+		/* unpack_trees() skips it by its cache-tree node */
+		it = find_cache_tree_node(istate->cache_tree, ce->name);
+		if (!it || it->entry_count <= 0 || oidcmp(&it->oid, &ce->oid)) {
+			ret = 0;
+			break;
+		}
+
+		strbuf_reset(&path);
+		strbuf_add(&path, ce->name, ce_namelen(ce) - 1);
+		if (get_tree_entry(tree->hash, path.buf, oid.hash, &mode) ||
+		    !S_ISDIR(mode) || oidcmp(&oid, &ce->oid))
+			ret = 0;
+	}
+	strbuf_release(&path);
+	return ret;
+}
@@ -0,0 +1,38 @@
+#ifndef SPARSE_INDEX_H
+#define SPARSE_INDEX_H
+
+struct index_state;
+struct object_id;
+
+/*
+ * A sparse index replaces each directory whose entries are all
+ * outside of the sparse checkout (i.e. CE_SKIP_WORKTREE, stage #0)
+ * by a single "sparse directory" entry.  Its name is the directory
+ * with a trailing slash, its mode is S_IFDIR and its object name is
+ * the tree recorded for that directory.
+ */
+#define S_ISSPARSEDIR(m) ((m) == S_IFDIR)
+
+/*
+ * Collapse the index into a sparse index, if index.sparse and
+ * core.sparseCheckout are enabled.  The index is left alone if it
+ * uses a split index, has unmerged entries or its cache-tree cannot
+ * be computed.
+ */
+void convert_to_sparse(struct index_state *istate);
+
+/*
+ * Expand all sparse directory entries, so that the index lists
+ * every path again.  Does nothing if the index is not sparse.
+ */
+void ensure_full_index(struct index_state *istate);
+
+/*
+ * Return 1 if every sparse directory entry of the index records the
+ * same tree as the corresponding directory of "tree", so that a
+ * cached diff against "tree" can skip them whole.
+ */
+int sparse_dirs_match_tree(struct index_state *istate,
+			   const struct object_id *tree);
+
+#endif
@@ -1,13 +1,44 @@
 #include "cache.h"
+#include "object.h"
+#include "sparse-index.h"
+
+static void print_cache_table(struct index_state *istate)
+{
+	int i;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		printf("%06o %s %s\t%s\n", ce->ce_mode,
+		       typename(object_type(ce->ce_mode)),
+		       oid_to_hex(&ce->oid), ce->name);
+	}
+}
 
 int cmd_main(int argc, const char **argv)
 {
-	int i, cnt = 1;
-	if (argc == 2)
-		cnt = strtol(argv[1], NULL, 0);
+	int i, cnt = 1, table = 0, expand = 0;
+
+	for (argc--, argv++; argc && starts_with(*argv, "--"); argc--, argv++) {
+		if (!strcmp(*argv, "--table"))
+			table = 1;
+		else if (!strcmp(*argv, "--expand"))
+			expand = 1;
+		else
+			die("unknown option '%s'", *argv);
+	}
+	if (argc == 1)
+		cnt = strtol(argv[0], NULL, 0);
 	setup_git_directory();
+
+	/* look at the index as it is on disk */
+	command_requires_full_index = 0;
 	for (i = 0; i < cnt; i++) {
 		read_cache();
+		if (expand)
+			ensure_full_index(&the_index);
+		if (table)
+			print_cache_table(&the_index);
 		discard_cache();
 	}
 	return 0;
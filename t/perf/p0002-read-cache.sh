@@ -11,4 +11,17 @@ test_perf "read_cache/discard_cache $count times" "
 	test-read-cache $count
 "
 
+test_expect_success 'rewrite the index with an offset table' '
+	git -c index.threads=true update-index --index-version 4 &&
+	git -c index.threads=true update-index --index-version 2
+'
+
+test_perf "read_cache/discard_cache $count times (index.threads=1)" "
+	GIT_TEST_INDEX_THREADS=1 test-read-cache $count
+"
+
+test_perf "read_cache/discard_cache $count times (index.threads=true)" "
+	test-read-cache $count
+"
+
 test_done
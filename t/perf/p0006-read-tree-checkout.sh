@@ -64,4 +64,17 @@ test_perf "switch between aliases ($nr_files)" '
 	git checkout -q br_ballast
 '
 
+# Unlike the tests above, these do measure writing out the files: a
+# local clone hardlinks the objects, so its cost is mostly that of the
+# checkout, sequential or spread over one worker per core.
+test_perf "clone ($nr_files)" '
+	rm -rf clone-seq &&
+	git -c checkout.workers=1 clone -q . clone-seq
+'
+
+test_perf "clone with parallel checkout ($nr_files)" '
+	rm -rf clone-par &&
+	git -c checkout.workers=0 clone -q . clone-par
+'
+
 test_done
@@ -0,0 +1,49 @@
+#!/bin/sh
+
+test_description='replay identical clones against upload-pack
+
+This sends the same clone request to upload-pack a number of times in a
+row (GIT_PERF_IDENTICAL_CLONES, 10 by default), as a burst of CI jobs
+cloning the same repository would, with and without the pack cache.
+Only the server side is measured: the packs are thrown away.
+'
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+clones=${GIT_PERF_IDENTICAL_CLONES:-10}
+
+test_expect_success 'setup clone request' '
+	rm -rf .git/upload-pack-cache &&
+	git for-each-ref --format="%(objectname)" refs/heads refs/tags |
+	sort -u |
+	perl -e '\''
+		sub pkt { printf "%04x%s", length($_[0]) + 4, $_[0] }
+		my $caps = " multi_ack_detailed side-band-64k thin-pack" .
+			   " ofs-delta include-tag no-progress";
+		while (<STDIN>) {
+			chomp;
+			pkt("want $_" . ($. == 1 ? $caps : "") . "\n");
+		}
+		print "0000";
+		pkt("done\n");
+	'\'' >request
+'
+
+replay () {
+	for i in $(test_seq $clones)
+	do
+		git "$@" upload-pack --stateless-rpc . <request >/dev/null ||
+		return 1
+	done
+}
+
+test_perf "$clones identical clones" '
+	replay -c uploadpack.packCache=false
+'
+
+test_perf "$clones identical clones (pack cache)" '
+	replay -c uploadpack.packCache=true
+'
+
+test_done
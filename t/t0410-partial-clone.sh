@@ -0,0 +1,119 @@
+#!/bin/sh
+
+test_description='fetching missing objects from a promisor remote'
+. ./test-lib.sh
+
+# make_partial <repo>: drop all the blobs from the object store of
+# <repo>, as if it had been cloned with a blob:none filter
+make_partial () {
+	(
+		cd "$1" &&
+		git for-each-ref --format="%(objectname)" >tips &&
+		git pack-objects --revs --stdout --filter=blob:none \
+			<tips >filtered.pack &&
+		rm -f .git/objects/pack/* tips &&
+		git index-pack --stdin <filtered.pack &&
+		rm filtered.pack
+	)
+}
+
+test_expect_success 'setup' '
+	git init server &&
+	test_commit -C server one &&
+	test_commit -C server two &&
+	mkdir server/dir &&
+	echo three >server/dir/three.t &&
+	git -C server add dir &&
+	git -C server commit -m three &&
+	git -C server config uploadpack.allowAnySHA1InWant true &&
+	git clone --no-local --no-checkout server client &&
+	make_partial client &&
+	git -C client config remote.origin.promisor true
+'
+
+test_expect_success 'blobs are missing without a promisor remote' '
+	blob=$(git -C server rev-parse HEAD:one.t) &&
+	test_must_fail git -C client -c remote.origin.promisor=false \
+		cat-file -e $blob
+'
+
+test_expect_success 'missing blob is fetched on demand' '
+	GIT_TRACE_PROMISOR="$(pwd)/trace" git -C client cat-file -p $blob >actual &&
+	echo one >expect &&
+	test_cmp expect actual &&
+	grep "fetching 1 object(s) from origin" trace &&
+	rm trace &&
+	git -C client cat-file -e $blob &&
+	test_path_is_missing trace
+'
+
+test_expect_success 'checkout fetches missing blobs in one batch' '
+	rm -f trace &&
+	GIT_TRACE_PROMISOR="$(pwd)/trace" git -C client checkout -f master &&
+	test_line_count = 1 trace &&
+	grep "fetching 2 object(s) from origin" trace &&
+	echo three >expect &&
+	test_cmp expect client/dir/three.t &&
+	git -C client fsck
+'
+
+test_expect_success 'objects the remote does not have are not found' '
+	blob=$(echo not-on-the-server | git hash-object --stdin) &&
+	rm -f trace &&
+	GIT_TRACE_PROMISOR="$(pwd)/trace" \
+		test_must_fail git -C client cat-file -e $blob &&
+	test_line_count = 1 trace
+'
+
+test_expect_success 'fetch does not lazily fetch the new tips' '
+	test_commit -C server four &&
+	rm -f trace &&
+	GIT_TRACE_PROMISOR="$(pwd)/trace" git -C client fetch origin &&
+	test_path_is_missing trace &&
+	git -C server rev-parse HEAD >expect &&
+	git -C client rev-parse origin/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fsck does not lazily fetch missing blobs' '
+	rm -rf partial &&
+	git clone --no-local --no-checkout server partial &&
+	make_partial partial &&
+	git -C partial config remote.origin.promisor true &&
+	rm -f trace &&
+	GIT_TRACE_PROMISOR="$(pwd)/trace" git -C partial fsck &&
+	test_path_is_missing trace &&
+	test_must_fail git -C partial -c remote.origin.promisor=false fsck
+'
+
+test_expect_success 'gc does not lazily fetch missing blobs' '
+	rm -f trace &&
+	GIT_TRACE_PROMISOR="$(pwd)/trace" git -C partial gc &&
+	test_path_is_missing trace &&
+	blob=$(git -C server rev-parse HEAD:one.t) &&
+	test_must_fail git -C partial -c remote.origin.promisor=false \
+		cat-file -e $blob &&
+	git -C partial fsck
+'
+
+test_expect_success 'rev-list --missing=allow-promisor allows missing blobs' '
+	rm -f trace &&
+	GIT_TRACE_PROMISOR="$(pwd)/trace" git -C partial \
+		rev-list --objects --all --missing=allow-promisor &&
+	test_path_is_missing trace &&
+	test_must_fail git -C partial -c remote.origin.promisor=false \
+		rev-list --objects --all --missing=allow-promisor
+'
+
+test_expect_success 'missing blobs can be fetched over protocol v2' '
+	rm -rf client &&
+	git clone --no-local --no-checkout server client &&
+	make_partial client &&
+	git -C client config remote.origin.promisor true &&
+	GIT_TRACE_PACKET="$(pwd)/packets" \
+		git -C client -c protocol.version=2 checkout -f master &&
+	grep "fetch-pack< version 2" packets &&
+	git -C client fsck
+'
+
+test_done
@@ -0,0 +1,138 @@
+#!/bin/sh
+
+test_description='sparse index with sparse directory entries'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git init repo &&
+	(
+		cd repo &&
+		echo a >a &&
+		for dir in deep deep/deeper1 deep/deeper2 folder1 folder1/0 folder2 x
+		do
+			mkdir -p $dir &&
+			echo a >$dir/a || exit 1
+		done &&
+		git add . &&
+		git commit -m initial &&
+		git checkout -b update &&
+		echo changed >>folder1/a &&
+		echo changed >>deep/a &&
+		git commit -a -m update &&
+		git checkout master
+	) &&
+
+	# Only the files at the root and everything in deep/ are checked
+	# out; "full" uses a regular index, "sparse" a sparse index.
+	for name in full sparse
+	do
+		git clone repo $name &&
+		git -C $name config core.sparseCheckout true &&
+		cat >$name/.git/info/sparse-checkout <<-\EOF &&
+		/*
+		!/*/
+		/deep/
+		EOF
+		git -C $name config index.sparse $(test $name = sparse && echo true || echo false) &&
+		git -C $name read-tree -mu HEAD || return 1
+	done &&
+	test_path_is_missing sparse/folder1 &&
+	test_path_is_file sparse/deep/deeper1/a
+'
+
+test_all_match () {
+	(cd full && "$@") >full-out 2>full-err &&
+	(cd sparse && "$@") >sparse-out 2>sparse-err &&
+	test_cmp full-out sparse-out &&
+	test_cmp full-err sparse-err
+}
+
+test_sparse_index () {
+	(cd sparse && test-read-cache --table) >table &&
+	grep "^040000 tree $(git -C sparse rev-parse HEAD:folder1)	folder1/\$" table &&
+	! grep "	folder1/a\$" table
+}
+
+test_expect_success 'directories outside the sparse checkout are collapsed' '
+	(cd sparse && test-read-cache --table) >table &&
+	cat >expect <<-EOF &&
+	100644 blob $(git -C sparse rev-parse HEAD:a)	a
+	100644 blob $(git -C sparse rev-parse HEAD:deep/a)	deep/a
+	100644 blob $(git -C sparse rev-parse HEAD:deep/deeper1/a)	deep/deeper1/a
+	100644 blob $(git -C sparse rev-parse HEAD:deep/deeper2/a)	deep/deeper2/a
+	040000 tree $(git -C sparse rev-parse HEAD:folder1)	folder1/
+	040000 tree $(git -C sparse rev-parse HEAD:folder2)	folder2/
+	040000 tree $(git -C sparse rev-parse HEAD:x)	x/
+	EOF
+	test_cmp expect table
+'
+
+test_expect_success 'expanded sparse index matches the full index' '
+	(cd full && test-read-cache --table) >expect &&
+	(cd sparse && test-read-cache --table --expand) >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'commands that need every path see them' '
+	test_all_match git ls-files -s &&
+	test_all_match git ls-files -t &&
+	test_all_match git diff --cached --name-status origin/update
+'
+
+test_expect_success 'status does not expand the sparse index' '
+	test_when_finished "rm -f trace" &&
+	GIT_TRACE_SPARSE_INDEX="$(pwd)/trace" git -C sparse status &&
+	! grep ensure_full_index trace &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git status &&
+	test_sparse_index
+'
+
+test_expect_success 'status with changes inside the sparse checkout' '
+	for name in full sparse
+	do
+		echo more >>$name/deep/deeper1/a || return 1
+	done &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git add deep &&
+	test_all_match git status --porcelain=v2 &&
+	test_sparse_index
+'
+
+test_expect_success 'status with staged changes outside the sparse checkout' '
+	test_all_match git reset --soft origin/update &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git diff --cached --name-status &&
+	test_all_match git reset --soft master
+'
+
+test_expect_success 'untracked files in a collapsed directory' '
+	test_when_finished "rm -rf full/folder2 sparse/folder2" &&
+	for name in full sparse
+	do
+		mkdir $name/folder2 &&
+		echo new >$name/folder2/untracked || return 1
+	done &&
+	test_all_match git status --porcelain=v2 --untracked-files=all
+'
+
+test_expect_success 'commit and checkout with a sparse index' '
+	test_all_match git commit -m "deep change" &&
+	test_all_match git checkout -b update origin/update &&
+	test_all_match git ls-files -s -t &&
+	test_sparse_index &&
+	test_all_match git checkout master &&
+	test_all_match git status --porcelain=v2 &&
+	test_path_is_missing sparse/folder1
+'
+
+test_expect_success 'index.sparse=false brings back a full index' '
+	git -C sparse config index.sparse false &&
+	test_all_match git checkout update &&
+	(cd full && test-read-cache --table) >expect &&
+	(cd sparse && test-read-cache --table) >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,107 @@
+#!/bin/sh
+
+test_description='sparse checkout with cone patterns'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	echo a >a &&
+	for dir in deep deep/deeper1 deep/deeper1/deepest deep/deeper2 \
+		   folder1 folder2 "f[o]o"
+	do
+		mkdir -p "$dir" &&
+		echo a >"$dir/a" || return 1
+	done &&
+	git add . &&
+	git commit -m initial &&
+	git config core.sparseCheckout true &&
+	git config core.sparseCheckoutCone true
+'
+
+# Check out with the patterns on stdin, once with cone matching and
+# once without, and make sure both agree.
+check_cone () {
+	cat >.git/info/sparse-checkout &&
+	git -c core.sparseCheckoutCone=false read-tree -mu HEAD &&
+	git ls-files -t >expect &&
+	git read-tree -mu HEAD 2>err &&
+	git ls-files -t >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'top-level files only' '
+	check_cone <<-\EOF &&
+	/*
+	!/*/
+	EOF
+	test_must_be_empty err &&
+	test_path_is_file a &&
+	test_path_is_missing deep
+'
+
+test_expect_success 'everything' '
+	check_cone <<-\EOF &&
+	/*
+	EOF
+	test_must_be_empty err &&
+	test_path_is_file deep/deeper1/deepest/a
+'
+
+test_expect_success 'recursive and parent directories' '
+	check_cone <<-\EOF &&
+	/*
+	!/*/
+	/deep/
+	!/deep/*/
+	/deep/deeper1/
+	/folder2/
+	EOF
+	test_must_be_empty err &&
+	cat >expect <<-\EOF &&
+	H a
+	H deep/a
+	H deep/deeper1/a
+	H deep/deeper1/deepest/a
+	S deep/deeper2/a
+	S f[o]o/a
+	S folder1/a
+	H folder2/a
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'escaped wildcard characters in directory names' '
+	check_cone <<-\EOF &&
+	/*
+	!/*/
+	/f\[o\]o/
+	EOF
+	test_must_be_empty err &&
+	test_path_is_file "f[o]o/a" &&
+	test_path_is_missing folder1
+'
+
+test_expect_success 'other patterns fall back to the full matching' '
+	check_cone <<-\EOF &&
+	/*
+	!/*/
+	/deep/
+	!/deep/deeper*/
+	EOF
+	test_i18ngrep "disabling cone pattern matching" err &&
+	test_path_is_file deep/a &&
+	test_path_is_missing deep/deeper1
+'
+
+test_expect_success 'directory whose parent is not in the cone' '
+	check_cone <<-\EOF &&
+	/*
+	!/*/
+	/deep/deeper1/
+	EOF
+	test_i18ngrep "disabling cone pattern matching" err &&
+	test_path_is_file deep/deeper1/a &&
+	test_path_is_missing deep/a
+'
+
+test_done
@@ -0,0 +1,227 @@
+#!/bin/sh
+
+test_description='reftable ref storage backend'
+
+. ./test-lib.sh
+
+test_expect_success 'init with unknown ref format fails' '
+	test_must_fail git init --ref-format=bogus bogus 2>err &&
+	test_i18ngrep "unknown ref storage format" err &&
+	test_path_is_missing bogus
+'
+
+test_expect_success 'init --ref-format=reftable' '
+	git init --ref-format=reftable repo &&
+	test_path_is_file repo/.git/reftable/tables.list &&
+	echo reftable >expect &&
+	git -C repo config extensions.refstorage >actual &&
+	test_cmp expect actual &&
+	echo 1 >expect &&
+	git -C repo config core.repositoryformatversion >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'reinit with a different ref format fails' '
+	test_must_fail git init --ref-format=files repo
+'
+
+test_expect_success 'commits, branches and tags' '
+	(
+		cd repo &&
+		test_commit one &&
+		test_commit two &&
+		git branch side one &&
+		git tag -a -m annotated annotated &&
+		git rev-parse two >expect &&
+		git rev-parse HEAD >actual &&
+		test_cmp expect actual &&
+		echo refs/heads/master >expect &&
+		git symbolic-ref HEAD >actual &&
+		test_cmp expect actual &&
+		test_path_is_missing .git/refs/heads/master
+	)
+'
+
+test_expect_success 'for-each-ref and peeled tags' '
+	(
+		cd repo &&
+		cat >expect <<-EOF &&
+		$(git rev-parse two) commit refs/heads/master
+		$(git rev-parse one) commit refs/heads/side
+		$(git rev-parse annotated) tag refs/tags/annotated
+		$(git rev-parse one) commit refs/tags/one
+		$(git rev-parse two) commit refs/tags/two
+		EOF
+		git for-each-ref --format="%(objectname) %(objecttype) %(refname)" >actual &&
+		test_cmp expect actual &&
+		echo "$(git rev-parse two) refs/tags/annotated^{}" >expect &&
+		git show-ref -d annotated | grep "\^{}" >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'update-ref create, verify and delete' '
+	(
+		cd repo &&
+		git update-ref refs/heads/new one &&
+		git rev-parse one >expect &&
+		git rev-parse new >actual &&
+		test_cmp expect actual &&
+		test_must_fail git update-ref refs/heads/new two two &&
+		git update-ref refs/heads/new two one &&
+		test_must_fail git update-ref -d refs/heads/new one &&
+		git update-ref -d refs/heads/new two &&
+		test_must_fail git rev-parse --verify -q refs/heads/new
+	)
+'
+
+test_expect_success 'name conflicts are rejected' '
+	(
+		cd repo &&
+		test_must_fail git update-ref refs/heads/side/sub one &&
+		test_must_fail git update-ref refs/heads refs/heads/side one
+	)
+'
+
+test_expect_success 'update-ref --stdin is atomic' '
+	(
+		cd repo &&
+		cat >stdin <<-EOF &&
+		create refs/heads/a one
+		create refs/heads/b two
+		verify refs/heads/side $(git rev-parse two)
+		EOF
+		test_must_fail git update-ref --stdin <stdin &&
+		test_must_fail git rev-parse --verify -q refs/heads/a &&
+		cat >stdin <<-EOF &&
+		create refs/heads/a one
+		create refs/heads/b two
+		EOF
+		git update-ref --stdin <stdin &&
+		git rev-parse one two >expect &&
+		git rev-parse a b >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'symbolic-ref' '
+	(
+		cd repo &&
+		git symbolic-ref refs/heads/sym refs/heads/side &&
+		echo refs/heads/side >expect &&
+		git symbolic-ref refs/heads/sym >actual &&
+		test_cmp expect actual &&
+		git rev-parse side >expect &&
+		git rev-parse sym >actual &&
+		test_cmp expect actual &&
+		git symbolic-ref -d refs/heads/sym
+	)
+'
+
+test_expect_success 'reflogs' '
+	(
+		cd repo &&
+		cat >expect <<-\EOF &&
+		HEAD@{0}: commit: two
+		HEAD@{1}: commit (initial): one
+		EOF
+		git reflog --format="%gd: %gs" HEAD >actual &&
+		test_cmp expect actual &&
+		git reflog exists refs/heads/side &&
+		! git reflog exists refs/heads/nope
+	)
+'
+
+test_expect_success 'rename and copy branches with their reflogs' '
+	(
+		cd repo &&
+		git branch -c side copied &&
+		git branch -m side renamed &&
+		test_must_fail git rev-parse --verify -q side &&
+		! git reflog exists refs/heads/side &&
+		cat >expect <<-\EOF &&
+		renamed@{0}: Branch: renamed refs/heads/side to refs/heads/renamed
+		renamed@{1}: branch: Created from one
+		EOF
+		git reflog --format="%gd: %gs" renamed >actual &&
+		test_cmp expect actual &&
+		git reflog --format="%gs" copied >actual &&
+		test_line_count = 2 actual
+	)
+'
+
+test_expect_success 'reflog expire' '
+	(
+		cd repo &&
+		git reflog expire --expire=now refs/heads/renamed &&
+		git reflog renamed >actual &&
+		test_must_be_empty actual &&
+		git rev-parse --verify renamed
+	)
+'
+
+test_expect_success 'pack-refs compacts the stack' '
+	(
+		cd repo &&
+		git for-each-ref >expect &&
+		git pack-refs --all &&
+		test_line_count = 1 .git/reftable/tables.list &&
+		ls .git/reftable/*.ref >tables &&
+		test_line_count = 1 tables &&
+		git for-each-ref >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'stack stays small without pack-refs' '
+	(
+		cd repo &&
+		for i in $(test_seq 50)
+		do
+			git update-ref refs/heads/loop-$i one || return 1
+		done &&
+		test $(wc -l <.git/reftable/tables.list) -le 7 &&
+		git for-each-ref refs/heads/loop-* >actual &&
+		test_line_count = 50 actual
+	)
+'
+
+test_expect_success 'lookups in tables spanning many blocks' '
+	(
+		cd repo &&
+		oid=$(git rev-parse one) &&
+		for i in $(test_seq 1000)
+		do
+			echo "create refs/heads/many/$i $oid" || return 1
+		done >stdin &&
+		git update-ref --stdin <stdin &&
+		git pack-refs --all &&
+		test $(cat .git/reftable/*.ref | wc -c) -gt 16384 &&
+		for i in 1 1000 17 500 999
+		do
+			echo "$oid refs/heads/many/$i" || return 1
+		done >expect &&
+		git show-ref refs/heads/many/1 refs/heads/many/17 \
+			refs/heads/many/500 refs/heads/many/999 \
+			refs/heads/many/1000 >actual &&
+		test_cmp expect actual &&
+		test_must_fail git rev-parse --verify -q refs/heads/many/1001 &&
+		git for-each-ref refs/heads/many/ >actual &&
+		test_line_count = 1000 actual
+	)
+'
+
+test_expect_success 'checkout, fsck and gc' '
+	(
+		cd repo &&
+		git checkout copied &&
+		echo refs/heads/copied >expect &&
+		git symbolic-ref HEAD >actual &&
+		test_cmp expect actual &&
+		git fsck &&
+		git gc &&
+		git rev-parse --verify copied
+	)
+'
+
+test_done
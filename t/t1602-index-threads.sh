@@ -0,0 +1,99 @@
+#!/bin/sh
+
+test_description='threaded index loading with the EOIE and IEOT extensions'
+
+. ./test-lib.sh
+
+# Rewrite the index in the given version and compare what a threaded
+# and a single-threaded reader make of it.
+check_threaded_read () {
+	git -c index.threads=4 -c index.version=$1 read-tree HEAD &&
+	git -c index.threads=4 update-index --refresh &&
+	test "$(test-index-version <.git/index)" = $1 &&
+	GIT_TEST_INDEX_THREADS=1 git ls-files -s >expect &&
+	GIT_TEST_INDEX_THREADS=1 test-dump-cache-tree >expect.tree &&
+	GIT_TEST_INDEX_THREADS=4 git ls-files -s >actual &&
+	GIT_TEST_INDEX_THREADS=4 test-dump-cache-tree >actual.tree &&
+	test_cmp expect actual &&
+	test_cmp expect.tree actual.tree
+}
+
+test_expect_success 'setup' '
+	for d in a b c d
+	do
+		mkdir $d &&
+		for f in 0 1 2 3 4 5 6 7 8 9
+		do
+			echo "$d/$f" >$d/file-$f || return 1
+		done
+	done &&
+	git add . &&
+	git commit -m initial
+'
+
+test_expect_success 'extensions are not written by default' '
+	git read-tree HEAD &&
+	! grep -q EOIE .git/index &&
+	! grep -q IEOT .git/index
+'
+
+test_expect_success 'index.threads enables the extensions' '
+	git -c index.threads=4 read-tree HEAD &&
+	grep -q EOIE .git/index &&
+	grep -q IEOT .git/index &&
+	git -c index.threads=false read-tree HEAD &&
+	! grep -q EOIE .git/index &&
+	! grep -q IEOT .git/index
+'
+
+test_expect_success 'extensions can be enabled on their own' '
+	git -c index.recordEndOfIndexEntries=true read-tree HEAD &&
+	grep -q EOIE .git/index &&
+	! grep -q IEOT .git/index &&
+	git -c index.threads=4 -c index.recordOffsetTable=false read-tree HEAD &&
+	grep -q EOIE .git/index &&
+	! grep -q IEOT .git/index
+'
+
+test_expect_success 'threaded read of a version 2 index' '
+	check_threaded_read 2
+'
+
+test_expect_success 'threaded read of a version 4 index' '
+	check_threaded_read 4
+'
+
+test_expect_success 'threaded read with extended flags and cache tree' '
+	git -c index.threads=4 -c index.version=3 read-tree HEAD &&
+	echo new >c/new &&
+	git -c index.threads=4 add -N c/new &&
+	git -c index.threads=4 write-tree &&
+	test "$(test-index-version <.git/index)" = 3 &&
+	GIT_TEST_INDEX_THREADS=1 git ls-files -s >expect &&
+	GIT_TEST_INDEX_THREADS=4 git ls-files -s >actual &&
+	test_cmp expect actual &&
+	GIT_TEST_INDEX_THREADS=4 git diff --cached --name-only >actual &&
+	echo c/new >expect &&
+	test_cmp expect actual &&
+	rm c/new
+'
+
+test_expect_success 'threaded read of a split index' '
+	git -c index.threads=4 update-index --split-index &&
+	echo changed >d/file-0 &&
+	git -c index.threads=4 add d/file-0 &&
+	GIT_TEST_INDEX_THREADS=1 git ls-files -s >expect &&
+	GIT_TEST_INDEX_THREADS=4 git ls-files -s >actual &&
+	test_cmp expect actual &&
+	git update-index --no-split-index &&
+	git checkout d/file-0
+'
+
+test_expect_success 'threaded reader accepts an index without the extensions' '
+	git -c index.threads=false read-tree HEAD &&
+	GIT_TEST_INDEX_THREADS=4 git ls-files -s >actual &&
+	git ls-files -s >expect &&
+	test_cmp expect actual
+'
+
+test_done
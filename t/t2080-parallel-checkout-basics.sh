@@ -0,0 +1,153 @@
+#!/bin/sh
+
+test_description='parallel checkout
+
+Check that entries written by checkout workers end up just like the
+ones written sequentially, with clean stat info in the index.'
+
+. ./test-lib.sh
+
+# Run "git <args>" with parallel checkout, and check whether workers were
+# spawned (when the first argument is "parallel") or not ("sequential").
+test_checkout_workers () {
+	mode=$1 &&
+	shift &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git \
+		-c checkout.workers=2 -c checkout.thresholdForParallelism=0 \
+		"$@" &&
+	if test "$mode" = parallel
+	then
+		grep "run_command: .*checkout--worker" trace
+	else
+		! grep "run_command: .*checkout--worker" trace
+	fi
+}
+
+test_expect_success 'setup' '
+	git init src &&
+	(
+		cd src &&
+		for d in a b c/d
+		do
+			mkdir -p $d &&
+			for f in 1 2 3 4 5
+			do
+				echo "$d/$f" >$d/f$f || return 1
+			done
+		done &&
+		chmod +x a/f1 &&
+		printf "one\ntwo\n" >crlf.txt &&
+		echo "\$Id\$" >ident &&
+		echo lowercase >filtered &&
+		cat >.gitattributes <<-\EOF &&
+		*.txt text eol=crlf
+		ident ident
+		filtered filter=upper
+		EOF
+		git add . &&
+		git commit -m initial &&
+		git checkout -b side &&
+		git rm -r b &&
+		echo changed >a/f2 &&
+		echo new >b &&
+		git add . &&
+		git commit -m side &&
+		git checkout master
+	) &&
+	git config --global filter.upper.smudge "tr a-z A-Z" &&
+	git config --global filter.upper.clean "tr A-Z a-z"
+'
+
+test_expect_success 'clone with parallel checkout' '
+	test_checkout_workers parallel clone src parallel &&
+	git clone src sequential &&
+	git -C sequential ls-files -s >expect &&
+	git -C parallel ls-files -s >actual &&
+	test_cmp expect actual &&
+	(
+		cd parallel &&
+		test "$(git diff-files --raw)" = ""
+	) &&
+	for f in a/f1 a/f2 b/f1 c/d/f5 crlf.txt ident filtered
+	do
+		test_cmp sequential/$f parallel/$f || return 1
+	done &&
+	test -x parallel/a/f1 &&
+	echo LOWERCASE >expect &&
+	test_cmp expect parallel/filtered &&
+	printf "one\r\ntwo\r\n" >expect &&
+	test_cmp expect parallel/crlf.txt
+'
+
+test_expect_success 'branch switching with parallel checkout' '
+	(
+		cd parallel &&
+		test_checkout_workers parallel checkout side &&
+		test "$(git diff-files --raw)" = "" &&
+		echo changed >expect &&
+		test_cmp expect a/f2 &&
+		echo new >expect &&
+		test_cmp expect b &&
+		test_checkout_workers parallel checkout master &&
+		test "$(git diff-files --raw)" = "" &&
+		test_path_is_file b/f5 &&
+		git status --porcelain --untracked-files=no >actual &&
+		test_must_be_empty actual
+	)
+'
+
+test_expect_success 'below the threshold, entries are written sequentially' '
+	(
+		cd parallel &&
+		rm -r a &&
+		test_checkout_workers sequential \
+			-c checkout.thresholdForParallelism=100 reset --hard &&
+		test "$(git diff-files --raw)" = "" &&
+		test_path_is_file a/f5
+	)
+'
+
+test_expect_success 'checkout.workers=1 disables parallel checkout' '
+	(
+		cd parallel &&
+		rm -r a &&
+		test_checkout_workers sequential \
+			-c checkout.workers=1 reset --hard &&
+		test_path_is_file a/f5
+	)
+'
+
+test_expect_success SYMLINKS 'symlinks are written sequentially' '
+	(
+		cd src &&
+		ln -s a/f1 link &&
+		git add link &&
+		git commit -m link
+	) &&
+	test_checkout_workers parallel clone src with-link &&
+	echo a/f1 >expect &&
+	readlink with-link/link >actual &&
+	test_cmp expect actual &&
+	(
+		cd with-link &&
+		test "$(git diff-files --raw)" = ""
+	)
+'
+
+test_expect_success CASE_INSENSITIVE_FS 'colliding paths are still checked out' '
+	git init collide &&
+	(
+		cd collide &&
+		empty=$(git hash-object -w --stdin </dev/null) &&
+		one=$(echo one | git hash-object -w --stdin) &&
+		printf "100644 $empty 0\tA\n100644 $one 0\ta\n" |
+		git update-index --index-info &&
+		git commit -m collide
+	) &&
+	test_checkout_workers parallel clone collide collide-clone &&
+	ls collide-clone >actual &&
+	test_line_count = 1 actual
+'
+
+test_done
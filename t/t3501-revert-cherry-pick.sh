@@ -153,4 +153,37 @@ test_expect_success 'cherry-pick works with dirty renamed file' '
 	git cherry-pick refs/heads/unrelated
 '
 
+test_expect_success 'cherry-pick a range onto an upstream that moved the file' '
+	git checkout -f -b before-move initial &&
+	test_seq 1 20 >numbers &&
+	git add numbers &&
+	test_tick &&
+	git commit -m numbers &&
+	git checkout -b moved-upstream &&
+	mkdir moved &&
+	git mv oops numbers moved/ &&
+	echo "Add a line after the move" >>moved/oops &&
+	echo 21 >>moved/numbers &&
+	git add moved &&
+	test_tick &&
+	git commit -m moved &&
+	git checkout -b several-edits before-move &&
+	for l in b d f
+	do
+		sed -e "s/^$l$l*/$l edited/" oops >oops.new &&
+		mv oops.new oops &&
+		test_tick &&
+		git commit -a -m "edit $l" &&
+		test_commit "unrelated-$l" || return 1
+	done &&
+	git checkout moved-upstream &&
+	git cherry-pick before-move..several-edits &&
+	test_path_is_missing oops &&
+	git show several-edits:oops >expect &&
+	echo "Add a line after the move" >>expect &&
+	test_cmp expect moved/oops &&
+	test_seq 1 21 >expect &&
+	test_cmp expect moved/numbers
+'
+
 test_done
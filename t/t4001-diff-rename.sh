@@ -245,4 +245,73 @@ test_expect_success 'diff-tree -l0 defaults to a big rename limit, not zero' '
 	grep "myotherfile.*myfile" actual
 '
 
+test_expect_success 'inexact renames do not depend on diff.renameThreads' '
+	git reset --hard &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		test_seq $i 100 >threads-$i || return 1
+	done &&
+	git add threads-* &&
+	git commit -m threads &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		git mv threads-$i threads-moved-$i &&
+		echo $i >>threads-moved-$i || return 1
+	done &&
+	git add threads-moved-* &&
+	git -c diff.renameThreads=1 diff --cached -M -C --name-status >expect &&
+	grep "^R" expect >renames &&
+	test_line_count = 8 renames &&
+	git -c diff.renameThreads=4 diff --cached -M -C --name-status >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'files moved to another directory are found by their names' '
+	git reset --hard &&
+	mkdir -p old-a old-c &&
+	for f in old-a/one old-a/two old-a/Makefile old-c/Makefile
+	do
+		test_seq 1 50 >$f &&
+		echo $f >>$f || return 1
+	done &&
+	git add old-a old-c &&
+	git commit -m "before the move" &&
+	git mv old-a new-b &&
+	git mv old-c new-d &&
+	for f in new-b/one new-b/two new-b/Makefile new-d/Makefile
+	do
+		echo modified >>$f || return 1
+	done &&
+	git add new-b new-d &&
+	git diff --cached -M -l1 --name-status >actual &&
+	cat >expect <<-\EOF &&
+	R094	old-a/Makefile	new-b/Makefile
+	R094	old-a/one	new-b/one
+	R094	old-a/two	new-b/two
+	R094	old-c/Makefile	new-d/Makefile
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'a weak match by name does not hide a better one' '
+	git reset --hard &&
+	mkdir -p src &&
+	test_seq 1 50 >src/file &&
+	git add src/file &&
+	git commit -m "before the split" &&
+	mkdir -p copy moved &&
+	test_seq 1 30 >copy/file &&
+	test_seq 101 120 >>copy/file &&
+	test_seq 1 50 >moved/other &&
+	echo modified >>moved/other &&
+	git rm -q src/file &&
+	git add copy moved &&
+	git diff --cached -M --name-status >actual &&
+	cat >expect <<-\EOF &&
+	A	copy/file
+	R094	src/file	moved/other
+	EOF
+	test_cmp expect actual
+'
+
 test_done
@@ -0,0 +1,131 @@
+#!/bin/sh
+
+test_description='git log for a path with changed-path Bloom filters'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git config core.commitGraph true &&
+	mkdir A A/B A/B/C &&
+	test_commit c1 A/file1 &&
+	test_commit c2 A/B/file2 &&
+	test_commit c3 A/B/C/file3 &&
+	test_commit c4 A/file1 &&
+	test_commit c5 A/B/file2 &&
+	test_commit c6 A/B/C/file3 &&
+	test_commit c7 A/file1 &&
+	test_commit c8 A/B/file2 &&
+	test_commit c9 A/B/C/file3 &&
+	git checkout -b side HEAD~4 &&
+	test_commit side1 A/B/C/side_file &&
+	test_commit side2 file4 &&
+	git checkout master &&
+	test_merge m1 side &&
+	test_commit c10 file_to_be_deleted &&
+	git rm file_to_be_deleted &&
+	git commit -m "file removed" &&
+	mv A/file1 A/B/file1 &&
+	git add -A &&
+	git commit -m "rename A/file1" &&
+	git commit-graph write --reachable --changed-paths
+'
+
+test_expect_success 'commit-graph has Bloom filter chunks' '
+	git commit-graph read >output &&
+	grep "bloom_indexes bloom_data" output &&
+	git commit-graph verify
+'
+
+test_bloom_filters_used () {
+	log_args=$1
+	rm -f trace &&
+	git -c core.commitGraph=false log --pretty=oneline $log_args >expect &&
+	GIT_TRACE_BLOOM_FILTER="$(pwd)/trace" \
+		git log --pretty=oneline $log_args >actual &&
+	test_cmp expect actual &&
+	grep "definitely not [1-9]" trace
+}
+
+test_bloom_filters_not_used () {
+	log_args=$1
+	rm -f trace &&
+	git -c core.commitGraph=false log --pretty=oneline $log_args >expect &&
+	GIT_TRACE_BLOOM_FILTER="$(pwd)/trace" \
+		git log --pretty=oneline $log_args >actual &&
+	test_cmp expect actual &&
+	! test -s trace
+}
+
+for path in A A/B A/B/C A/file1 A/B/file2 A/B/C/side_file A/B/ file4 \
+	    file_to_be_deleted
+do
+	for option in "" --full-history --first-parent --topo-order \
+		      --simplify-merges --no-merges --reverse
+	do
+		test_expect_success "git log $option -- $path" '
+			test_bloom_filters_used "$option -- $path"
+		'
+	done
+done
+
+test_expect_success 'the filters are released when the walk stops early' '
+	test_bloom_filters_used "-n 1 -- file4" &&
+	grep "bloom filter statistics" trace >stats &&
+	test_line_count = 1 stats
+'
+
+test_expect_success 'git log with several paths' '
+	test_bloom_filters_used "-- A/file1 file4" &&
+	test_bloom_filters_used "-- A/B/file2 A/B/C"
+'
+
+test_expect_success 'git log from a subdirectory' '
+	(
+		cd A &&
+		git -c core.commitGraph=false log --pretty=oneline -- B >../expect &&
+		git log --pretty=oneline -- B >../actual
+	) &&
+	test_cmp expect actual
+'
+
+test_expect_success 'wildcards and magic do not use the filters' '
+	test_bloom_filters_not_used "-- :(glob)A/*/file2" &&
+	test_bloom_filters_not_used "-- :(icase)a/file1" &&
+	test_bloom_filters_not_used "-- ." &&
+	test_bloom_filters_not_used "--follow -- A/B/file1"
+'
+
+test_expect_success 'commits outside the graph fall back to tree diffs' '
+	test_commit c11 A/B/C/file3 &&
+	test_bloom_filters_used "-- A/B/C" &&
+	grep "not present 1," trace
+'
+
+test_expect_success 'commits changing many paths' '
+	mkdir many &&
+	for i in $(test_seq 600)
+	do
+		echo $i >many/$i || return 1
+	done &&
+	git add many &&
+	git commit -m "many files" &&
+	git commit-graph write --reachable --changed-paths &&
+	test_bloom_filters_used "-- many/42" &&
+	test_bloom_filters_used "-- A/B/C/file3"
+'
+
+test_expect_success '--append keeps the filters' '
+	test_commit c12 A/file5 &&
+	git rev-parse HEAD | git commit-graph write --stdin-commits --append --changed-paths &&
+	git commit-graph verify &&
+	test_bloom_filters_used "-- A/file5" &&
+	grep "not present 0," trace
+'
+
+test_expect_success 'writing without --changed-paths drops the filters' '
+	git commit-graph write --reachable &&
+	git commit-graph read >output &&
+	! grep bloom output &&
+	test_bloom_filters_not_used "-- A"
+'
+
+test_done
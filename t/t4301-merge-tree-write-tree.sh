@@ -0,0 +1,222 @@
+#!/bin/sh
+
+test_description='git merge-tree --write-tree'
+. ./test-lib.sh
+
+# merge_with_recursive <branch1> <branch2>: the tree merge-recursive
+# makes of a clean merge
+merge_with_recursive () {
+	git checkout -q --detach $1 &&
+	git merge -q -s recursive --no-edit $2 >/dev/null &&
+	git rev-parse HEAD^{tree} &&
+	git checkout -q master
+}
+
+test_expect_success 'setup' '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >numbers &&
+	test_write_lines a b c d e f g h i >letters &&
+	mkdir -p dir/sub &&
+	echo deep >dir/sub/file &&
+	echo shallow >dir/file &&
+	git add numbers letters dir &&
+	test_tick &&
+	git commit -m base &&
+	git tag base &&
+
+	git checkout -b side1 &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >numbers &&
+	echo new >dir/new &&
+	git add numbers dir/new &&
+	test_tick &&
+	git commit -m side1 &&
+
+	git checkout -b side2 base &&
+	test_write_lines 0 1 2 3 4 5 6 7 8 9 >numbers &&
+	test_write_lines a b c d e f g h i j >letters &&
+	git add numbers letters &&
+	test_tick &&
+	git commit -m side2 &&
+
+	git checkout -b side3 base &&
+	test_write_lines one 2 3 4 5 6 7 8 9 >numbers &&
+	git rm -q letters &&
+	git add numbers &&
+	test_tick &&
+	git commit -m side3 &&
+
+	git checkout master
+'
+
+test_expect_success 'clean merge' '
+	git merge-tree --write-tree side1 side2 >out &&
+	test_line_count = 1 out &&
+	merge_with_recursive side1 side2 >expect &&
+	test_cmp expect out
+'
+
+test_expect_success 'clean merge does not touch the index or working tree' '
+	git status --porcelain -uno >before &&
+	git ls-files -s >index-before &&
+	git merge-tree --write-tree side2 side1 >out &&
+	git status --porcelain -uno >after &&
+	git ls-files -s >index-after &&
+	test_cmp before after &&
+	test_cmp index-before index-after
+'
+
+test_expect_success 'content conflict' '
+	test_expect_code 1 git merge-tree --write-tree side2 side3 >out &&
+	tree=$(head -n 1 out) &&
+	git cat-file -p $tree:numbers >numbers.merged &&
+	grep "^<<<<<<< side2" numbers.merged &&
+	grep "^>>>>>>> side3" numbers.merged &&
+	cat >expect <<-EOF &&
+	100644 $(git rev-parse base:letters) 1	letters
+	100644 $(git rev-parse side2:letters) 2	letters
+	100644 $(git rev-parse base:numbers) 1	numbers
+	100644 $(git rev-parse side2:numbers) 2	numbers
+	100644 $(git rev-parse side3:numbers) 3	numbers
+
+	CONFLICT (modify/delete): letters deleted in side3 and modified in side2. Version side2 of letters left in tree.
+	CONFLICT (content): Merge conflict in numbers
+	EOF
+	sed 1d out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--name-only lists the conflicted paths' '
+	test_expect_code 1 git merge-tree --write-tree --name-only side2 side3 >out &&
+	sed 1d out >actual &&
+	cat >expect <<-\EOF &&
+	letters
+	numbers
+
+	CONFLICT (modify/delete): letters deleted in side3 and modified in side2. Version side2 of letters left in tree.
+	CONFLICT (content): Merge conflict in numbers
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'rename on one side, modification on the other' '
+	git checkout -b renamed base &&
+	git mv numbers digits &&
+	git mv dir moved &&
+	test_tick &&
+	git commit -m renamed &&
+	git checkout master &&
+	git merge-tree --write-tree renamed side1 >out &&
+	tree=$(cat out) &&
+	git ls-tree -r --name-only $tree >actual &&
+	cat >expect <<-\EOF &&
+	digits
+	dir/new
+	letters
+	moved/file
+	moved/sub/file
+	EOF
+	test_cmp expect actual &&
+	test "$(git rev-parse $tree:digits)" = "$(git rev-parse side1:numbers)" &&
+	merge_with_recursive renamed side1 >expect &&
+	test_cmp expect out
+'
+
+test_expect_success 'rename/delete' '
+	git checkout -b deleted base &&
+	git rm -q numbers &&
+	test_tick &&
+	git commit -m deleted &&
+	git checkout master &&
+	test_expect_code 1 git merge-tree --write-tree renamed deleted >out &&
+	grep "CONFLICT (rename/delete): numbers deleted in deleted and renamed to digits in renamed" out &&
+	tree=$(head -n 1 out) &&
+	test "$(git rev-parse $tree:digits)" = "$(git rev-parse base:numbers)"
+'
+
+test_expect_success 'rename/rename' '
+	git checkout -b renamed-too base &&
+	git mv numbers figures &&
+	test_tick &&
+	git commit -m renamed-too &&
+	git checkout master &&
+	test_expect_code 1 git merge-tree --write-tree renamed renamed-too >out &&
+	grep "CONFLICT (rename/rename)" out &&
+	tree=$(head -n 1 out) &&
+	git rev-parse $tree:digits $tree:figures
+'
+
+test_expect_success 'directory/file conflict' '
+	git checkout -b file-at-dir base &&
+	git rm -rq dir &&
+	echo file >dir &&
+	git add dir &&
+	test_tick &&
+	git commit -m file-at-dir &&
+	git checkout master &&
+	test_expect_code 1 git merge-tree --write-tree file-at-dir side1 >out &&
+	grep "CONFLICT (directory/file): There is a directory with name dir in side1. Adding dir as dir~file-at-dir" out &&
+	tree=$(head -n 1 out) &&
+	echo file >expect &&
+	git cat-file -p $tree:dir~file-at-dir >actual &&
+	test_cmp expect actual &&
+	git cat-file -p $tree:dir/new
+'
+
+test_expect_success 'the stages of a path with two conflicts are listed once' '
+	git checkout -b modify-file base &&
+	echo modified >>letters &&
+	git commit -qam modify-file &&
+	git checkout -b file-to-dir base &&
+	git rm -q letters &&
+	mkdir letters &&
+	echo inside >letters/file &&
+	git add letters &&
+	git commit -qm file-to-dir &&
+	git checkout master &&
+	test_expect_code 1 git merge-tree --write-tree file-to-dir modify-file >out &&
+	grep "CONFLICT (modify/delete)" out &&
+	grep "CONFLICT (directory/file)" out &&
+	sed -n "2,/^\$/p" out >stages &&
+	sort -u stages >expect &&
+	sort stages >actual &&
+	test_cmp expect actual &&
+	grep " 1	letters~modify-file\$" stages &&
+	grep " 3	letters~modify-file\$" stages
+'
+
+test_expect_success 'criss-cross merge uses a virtual merge base' '
+	git checkout -b cross1 base &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 ten >numbers &&
+	git commit -qam cross1 &&
+	git checkout -b cross2 base &&
+	test_write_lines zero 1 2 3 4 5 6 7 8 9 >numbers &&
+	git commit -qam cross2 &&
+	git checkout -q cross1 &&
+	git merge -q --no-edit cross2 &&
+	git checkout -q cross2 &&
+	git merge -q --no-edit cross1~1 &&
+	echo more >>letters &&
+	git commit -qam more-on-cross2 &&
+	git checkout -q cross1 &&
+	echo more >new-file &&
+	git add new-file &&
+	git commit -qm more-on-cross1 &&
+	git checkout master &&
+	git merge-base --all cross1 cross2 >bases &&
+	test_line_count = 2 bases &&
+	git merge-tree --write-tree cross1 cross2 >out &&
+	merge_with_recursive cross1 cross2 >expect &&
+	test_cmp expect out
+'
+
+test_expect_success 'works in a bare repository' '
+	git clone -q --bare . bare.git &&
+	git -C bare.git merge-tree --write-tree side1 side2 >actual &&
+	git merge-tree --write-tree side1 side2 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unknown branch' '
+	test_must_fail git merge-tree --write-tree side1 no-such-branch
+'
+
+test_done
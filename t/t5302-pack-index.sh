@@ -262,4 +262,42 @@ EOF
     grep "^warning:.* expected .tagger. line" err
 '
 
+test_expect_success 'index-pack --fix-thin completes a pack with threads' '
+    git init thin &&
+    (
+	cd thin &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		test-genrandom seed$i 8192 >file$i || return 1
+	done &&
+	git add . &&
+	git commit -m base &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		echo change >>file$i || return 1
+	done &&
+	git commit -a -m change &&
+	git branch base HEAD^ &&
+	printf "HEAD\n^HEAD^\n" |
+	git pack-objects --revs --thin --stdout >../thin.pack
+    ) &&
+    git init thin-dst &&
+    git -C thin-dst fetch ../thin base &&
+    pack=$(git -C thin-dst index-pack --stdin --fix-thin --threads=4 <thin.pack) &&
+    git show-index <thin-dst/.git/objects/pack/pack-${pack#pack	}.idx >objects &&
+    test_line_count = 18 objects &&
+    git -C thin-dst rev-list --objects $(git -C thin rev-parse HEAD) >/dev/null &&
+    git -C thin-dst fsck
+'
+
+test_expect_success 'index-pack --stdin resolves deltas while receiving' '
+    git pack-objects --delta-base-offset --stdout <obj-list >ofs.pack &&
+    git index-pack --stdin --threads=1 ofs-1.pack <ofs.pack &&
+    git index-pack --stdin --threads=2 ofs-2.pack <ofs.pack &&
+    cmp ofs-1.idx ofs-2.idx &&
+    git verify-pack -s ofs-1.pack >expect &&
+    git verify-pack -s ofs-2.pack >actual &&
+    test_cmp expect actual
+'
+
 test_done
@@ -92,7 +92,7 @@ rev_list_tests() {
 
 	test_expect_success "bitmap --objects handles non-commit objects ($state)" '
 		git rev-list --objects --use-bitmap-index HEAD tagged-blob >actual &&
-		grep $blob actual
+		grep $(git rev-parse tagged-blob) actual
 	'
 }
 
@@ -121,10 +121,15 @@ test_expect_success 'fetch (partial bitmap)' '
 	test_cmp expect actual
 '
 
-test_expect_success 'incremental repack fails when bitmaps are requested' '
+test_expect_success 'incremental repack writes a bitmap layer' '
 	test_commit more-1 &&
-	test_must_fail git repack -d 2>err &&
-	test_i18ngrep "Incremental repacks are incompatible with bitmap" err
+	git repack -d &&
+	ls .git/objects/pack/*.bitmap >bitmaps &&
+	test_line_count = 2 bitmaps &&
+	git rev-list --test-bitmap HEAD &&
+	git repack -ad &&
+	ls .git/objects/pack/*.bitmap >bitmaps &&
+	test_line_count = 1 bitmaps
 '
 
 test_expect_success 'incremental repack can disable bitmaps' '
@@ -331,4 +336,90 @@ test_expect_success 'pack reuse respects --incremental' '
 	git show-index <empty.idx >actual &&
 	test_cmp expect actual
 '
+test_expect_success 'set up history for partial pack reuse' '
+	test_seq 1 1000 >big &&
+	git add big &&
+	git commit -m "big 0" &&
+	for i in $(test_seq 1 20)
+	do
+		echo $i >>big &&
+		git commit -m "big $i" big || return 1
+	done &&
+	git repack -adb
+'
+
+# reuse_objects <rev-list args>: pack the objects with bitmap reuse,
+# check that the result holds exactly what rev-list says, and leave
+# the number of objects reused verbatim in $reused
+reuse_objects () {
+	git rev-list --objects "$@" | cut -d" " -f1 | sort >expect &&
+	printf "%s\n" "$@" |
+	git pack-objects --revs --stdout --delta-base-offset --progress \
+		>partial.pack 2>stderr &&
+	git index-pack --strict partial.pack &&
+	list_packed_objects partial.idx | sort >actual &&
+	test_cmp expect actual &&
+	reused=$(sed -n "s/.*pack-reused \([0-9]*\).*/\1/p" stderr)
+}
+
+test_expect_success 'full pack reuse' '
+	reuse_objects $(git for-each-ref --format="%(objectname)") &&
+	test "$reused" -gt 0
+'
+
+test_expect_success 'partial pack reuse of objects outside the pack prefix' '
+	reuse_objects master ^master~10 &&
+	test "$reused" -gt 0 &&
+	git verify-pack -v partial.idx >verify &&
+	grep "chain length = 1:" verify
+'
+
+test_expect_success 'partial pack reuse with a fetch' '
+	git --git-dir=clone.git fetch origin master:master &&
+	git rev-parse HEAD >expect &&
+	git --git-dir=clone.git rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git --git-dir=clone.git fsck
+'
+
+test_expect_success 'pack.allowPackReuse disables pack reuse' '
+	test_config pack.allowPackReuse false &&
+	reuse_objects master ^master~10 &&
+	test "$reused" = 0
+'
+
+test_expect_success 'pack reuse keeps the tags of --include-tag' '
+	git tag -a -m annotated reused-tag master~2 &&
+	test_when_finished "git tag -d reused-tag" &&
+	git repack -adb &&
+	echo master |
+	git pack-objects --revs --include-tag --stdout --delta-base-offset \
+		--progress >tagged.pack 2>stderr &&
+	grep "pack-reused [1-9]" stderr &&
+	git index-pack --strict tagged.pack &&
+	list_packed_objects tagged.idx >actual &&
+	grep $(git rev-parse reused-tag) actual
+'
+
+# The low byte of the big-endian flags that follow the "BITM" signature
+# and the version in the .bitmap header.
+bitmap_flags () {
+	od -An -tu1 -j7 -N1 .git/objects/pack/pack-*.bitmap | tr -d " "
+}
+
+test_expect_success 'full repack writes a lookup table' '
+	git config pack.writeBitmapLookupTable true &&
+	git repack -adb &&
+	test $(( $(bitmap_flags) & 16 )) = 16 &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --test-bitmap HEAD~5
+'
+
+rev_list_tests 'lookup table'
+
+test_expect_success 'bitmaps read from a lookup table are reused' '
+	git repack -adb &&
+	git rev-list --test-bitmap HEAD
+'
+
 test_done
@@ -0,0 +1,255 @@
+#!/bin/sh
+
+test_description='commit graph'
+. ./test-lib.sh
+
+test_expect_success 'setup full repo' '
+	mkdir full &&
+	cd "$TRASH_DIRECTORY/full" &&
+	git init &&
+	git config core.commitGraph true &&
+	objdir=".git/objects"
+'
+
+test_expect_success 'verify graph with no graph file' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph verify
+'
+
+test_expect_success 'write graph with no packs' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write --object-dir . &&
+	test_path_is_file info/commit-graph
+'
+
+test_expect_success 'create commits and repack' '
+	cd "$TRASH_DIRECTORY/full" &&
+	for i in $(test_seq 3)
+	do
+		test_commit $i &&
+		git branch commits/$i
+	done &&
+	git repack
+'
+
+graph_git_two_modes() {
+	git -c core.commitGraph=true $1 >output
+	git -c core.commitGraph=false $1 >expect
+	test_cmp expect output
+}
+
+graph_git_behavior() {
+	MSG=$1
+	DIR=$2
+	BRANCH=$3
+	COMPARE=$4
+	test_expect_success "check normal git operations: $MSG" '
+		cd "$TRASH_DIRECTORY/$DIR" &&
+		graph_git_two_modes "log --oneline $BRANCH" &&
+		graph_git_two_modes "log --topo-order $BRANCH" &&
+		graph_git_two_modes "log --graph $COMPARE..$BRANCH" &&
+		graph_git_two_modes "branch -vv" &&
+		graph_git_two_modes "merge-base -a $BRANCH $COMPARE"
+	'
+}
+
+graph_git_behavior 'no graph' full commits/3 commits/1
+
+graph_read_expect() {
+	OPTIONAL=""
+	NUM_CHUNKS=3
+	if test ! -z $2
+	then
+		OPTIONAL=" $2"
+		NUM_CHUNKS=$((3 + $(echo "$2" | wc -w)))
+	fi
+	cat >expect <<- EOF
+	header: 43475048 1 1 $NUM_CHUNKS 0
+	num_commits: $1
+	chunks: oid_fanout oid_lookup commit_metadata$OPTIONAL
+	EOF
+	git commit-graph read >output &&
+	test_cmp expect output
+}
+
+test_expect_success 'write graph' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write &&
+	test_path_is_file $objdir/info/commit-graph &&
+	graph_read_expect "3"
+'
+
+graph_git_behavior 'graph exists' full commits/3 commits/1
+
+test_expect_success 'Add more commits' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git reset --hard commits/1 &&
+	for i in $(test_seq 4 5)
+	do
+		test_commit $i &&
+		git branch commits/$i
+	done &&
+	git reset --hard commits/2 &&
+	for i in $(test_seq 6 7)
+	do
+		test_commit $i &&
+		git branch commits/$i
+	done &&
+	git reset --hard commits/2 &&
+	git merge commits/4 &&
+	git branch merge/1 &&
+	git reset --hard commits/4 &&
+	git merge commits/6 &&
+	git branch merge/2 &&
+	git reset --hard commits/3 &&
+	git merge commits/5 commits/7 &&
+	git branch merge/3 &&
+	git repack
+'
+
+# Current graph structure:
+#
+#   __M3___
+#  /   |   \
+# 3 M1 5 M2 7
+# |/  \|/  \|
+# 2    4    6
+# |___/____/
+# 1
+
+test_expect_success 'write graph with merges' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write &&
+	test_path_is_file $objdir/info/commit-graph &&
+	graph_read_expect "10" "large_edges"
+'
+
+graph_git_behavior 'merge 1 vs 2' full merge/1 merge/2
+graph_git_behavior 'merge 1 vs 3' full merge/1 merge/3
+graph_git_behavior 'merge 2 vs 3' full merge/2 merge/3
+
+test_expect_success 'add one more commit, write a tip graph' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git reset --hard commits/3 &&
+	git merge merge/1 &&
+	git merge commits/5 &&
+	git merge merge/2 &&
+	git branch merge/4 &&
+	git commit-graph write --stdin-commits <<-EOF &&
+	$(git rev-parse merge/4)
+	EOF
+	graph_read_expect "11"
+'
+
+graph_git_behavior 'tip graph, commit 7 vs merge 4' full merge/4 commits/7
+
+test_expect_success 'write graph from packs with --stdin-packs' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git repack -ad &&
+	ls $objdir/pack | grep idx >packs &&
+	git commit-graph write --stdin-packs <packs &&
+	graph_read_expect "13" "large_edges"
+'
+
+graph_git_behavior 'packed graph' full merge/4 commits/1
+
+test_expect_success 'write graph with --reachable and --append' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write --stdin-commits <<-EOF &&
+	$(git rev-parse commits/7)
+	EOF
+	graph_read_expect "4" &&
+	git commit-graph write --reachable --append &&
+	graph_read_expect "13" "large_edges"
+'
+
+test_expect_success 'commits from graph carry generation numbers' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git rev-list --topo-order merge/4 >expect &&
+	git -c core.commitGraph=false rev-list --topo-order merge/4 >actual &&
+	test_cmp expect actual &&
+	git rev-list --topo-order --date-order merge/4 >expect &&
+	git -c core.commitGraph=false rev-list --date-order merge/4 >actual &&
+	test_cmp expect actual &&
+	git rev-list --topo-order --author-date-order merge/4 >expect &&
+	git -c core.commitGraph=false rev-list --author-date-order merge/4 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'graph is ignored with grafts' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git rev-parse commits/2 >.git/info/grafts &&
+	git -c core.commitGraph=false log --oneline commits/3 >expect &&
+	git log --oneline commits/3 >actual &&
+	test_cmp expect actual &&
+	test_line_count = 2 actual &&
+	rm .git/info/grafts
+'
+
+test_expect_success 'setup bare repo' '
+	cd "$TRASH_DIRECTORY" &&
+	git clone --bare --no-local full bare &&
+	cd bare &&
+	git config core.commitGraph true &&
+	baredir="./objects"
+'
+
+graph_git_behavior 'bare repo, commit 7 vs merge 1' bare commits/7 merge/1
+
+test_expect_success 'write graph in bare repo' '
+	cd "$TRASH_DIRECTORY/bare" &&
+	git commit-graph write &&
+	test_path_is_file $baredir/info/commit-graph &&
+	graph_read_expect "13" "large_edges"
+'
+
+graph_git_behavior 'bare repo with graph, commit 7 vs merge 1' bare commits/7 merge/1
+
+test_expect_success 'git commit-graph verify' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write --reachable &&
+	git commit-graph verify
+'
+
+# usage: corrupt_graph_and_verify <position> <data> <string>
+# Manipulates the commit-graph file at the position
+# by inserting the data, then runs 'git commit-graph verify'
+# and places the output in the file 'err'. Test 'err' for
+# the given string.
+corrupt_graph_and_verify() {
+	pos=$1
+	data="${2:-\0}"
+	grepstr=$3
+	cd "$TRASH_DIRECTORY/full" &&
+	test_when_finished mv commit-graph-backup $objdir/info/commit-graph &&
+	cp $objdir/info/commit-graph commit-graph-backup &&
+	printf "$data" | dd of="$objdir/info/commit-graph" bs=1 seek="$pos" conv=notrunc &&
+	test_must_fail git commit-graph verify 2>test_err &&
+	grep -v "^+" test_err >err &&
+	test_i18ngrep "$grepstr" err
+}
+
+# Offsets into the graph written above: the header and
+# chunk table take 8 + 5 * 12 bytes (the large edges chunk is present),
+# followed by the 1024-byte fanout and 13 20-byte object ids.
+GRAPH_BYTE_FANOUT=$((8 + 5 * 12 + 4 * 255))
+GRAPH_BYTE_OID_LOOKUP=$((8 + 5 * 12 + 1024))
+GRAPH_BYTE_COMMIT_DATA=$(($GRAPH_BYTE_OID_LOOKUP + 20 * 13))
+GRAPH_BYTE_COMMIT_DATE=$(($GRAPH_BYTE_COMMIT_DATA + 32))
+
+test_expect_success 'detect incorrect fanout final value' '
+	corrupt_graph_and_verify $GRAPH_BYTE_FANOUT "\01" \
+		"incorrect fanout value"
+'
+
+test_expect_success 'detect bad commit date' '
+	corrupt_graph_and_verify $GRAPH_BYTE_COMMIT_DATE "\01" \
+		"commit date"
+'
+
+test_expect_success 'detect bad checksum' '
+	corrupt_graph_and_verify $(($(wc -c <$objdir/info/commit-graph) - 1)) "\00" \
+		"incorrect checksum"
+'
+
+test_done
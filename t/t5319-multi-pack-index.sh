@@ -0,0 +1,202 @@
+#!/bin/sh
+
+test_description='multi-pack-indexes'
+. ./test-lib.sh
+
+objdir=.git/objects
+
+midx_git_two_modes () {
+	git -c core.multiPackIndex=false $1 >expect &&
+	git -c core.multiPackIndex=true $1 >actual &&
+	test_cmp expect actual
+}
+
+compare_results_with_midx () {
+	MSG=$1
+	test_expect_success "check normal git operations: $MSG" '
+		midx_git_two_modes "rev-list --objects --all" &&
+		midx_git_two_modes "log --raw" &&
+		midx_git_two_modes "log --oneline --abbrev=4" &&
+		midx_git_two_modes "cat-file --batch-all-objects --batch-check"
+	'
+}
+
+test_expect_success 'verify with no multi-pack-index' '
+	git multi-pack-index verify
+'
+
+test_expect_success 'write midx with no packs' '
+	test_when_finished "rm -f pack/multi-pack-index" &&
+	git multi-pack-index --object-dir=. write &&
+	test_path_is_file pack/multi-pack-index
+'
+
+generate_objects () {
+	i=$1
+	iii=$(printf '%03i' $i)
+	{
+		test-genrandom "bar" 200 &&
+		test-genrandom "baz $iii" 50
+	} >wide_delta_$iii &&
+	{
+		test-genrandom "foo"$i 100 &&
+		test-genrandom "foo"$(( $i + 1 )) 100 &&
+		test-genrandom "foo"$(( $i + 2 )) 100
+	} >deep_delta_$iii &&
+	echo $iii >file_$iii &&
+	test-genrandom "$iii" 8192 >>file_$iii &&
+	git update-index --add file_$iii deep_delta_$iii wide_delta_$iii &&
+	i=$(( $i + 1 ))
+}
+
+commit_and_list_objects () {
+	{
+		echo 101 &&
+		test-genrandom 100 8192;
+	} >file_101 &&
+	git update-index --add file_101 &&
+	tree=$(git write-tree) &&
+	commit=$(git commit-tree $tree -p HEAD</dev/null) &&
+	{
+		echo $tree &&
+		git ls-tree $tree | sed -e "s/.* \\([0-9a-f]*\\)	.*/\\1/"
+	} >obj-list &&
+	git reset --hard $commit
+}
+
+test_expect_success 'create objects' '
+	test_commit initial &&
+	for i in $(test_seq 1 5)
+	do
+		generate_objects $i
+	done &&
+	commit_and_list_objects
+'
+
+test_expect_success 'write midx with one v1 pack' '
+	pack=$(git pack-objects --index-version=1 $objdir/pack/test <obj-list) &&
+	test_when_finished rm $objdir/pack/test-$pack.pack \
+		$objdir/pack/test-$pack.idx $objdir/pack/multi-pack-index &&
+	git multi-pack-index --object-dir=$objdir write &&
+	test_path_is_file $objdir/pack/multi-pack-index &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'write midx with one v2 pack' '
+	git pack-objects --index-version=2,0x40 $objdir/pack/test <obj-list &&
+	git multi-pack-index --object-dir=$objdir write &&
+	git multi-pack-index verify
+'
+
+compare_results_with_midx "one v2 pack"
+
+test_expect_success 'add more objects' '
+	for i in $(test_seq 6 10)
+	do
+		generate_objects $i
+	done &&
+	commit_and_list_objects
+'
+
+test_expect_success 'write midx with two packs' '
+	git pack-objects --index-version=1 $objdir/pack/test-2 <obj-list &&
+	git multi-pack-index --object-dir=$objdir write &&
+	git multi-pack-index verify
+'
+
+compare_results_with_midx "two packs"
+
+test_expect_success 'add more packs' '
+	for j in $(test_seq 11 20)
+	do
+		generate_objects $j &&
+		commit_and_list_objects &&
+		git pack-objects --index-version=2 $objdir/pack/test-pack <obj-list
+	done
+'
+
+compare_results_with_midx "mixed mode (two packs + extra)"
+
+test_expect_success 'write midx with twelve packs' '
+	git multi-pack-index --object-dir=$objdir write &&
+	git multi-pack-index verify
+'
+
+compare_results_with_midx "twelve packs"
+
+test_expect_success 'objects in packs added after the midx are found' '
+	generate_objects 21 &&
+	commit_and_list_objects &&
+	git pack-objects $objdir/pack/test-late <obj-list &&
+	git -c core.multiPackIndex=true cat-file --batch-check <obj-list >actual &&
+	! grep missing actual
+'
+
+compare_results_with_midx "packs missing from the midx"
+
+test_expect_success 'verify detects bad checksum' '
+	git multi-pack-index write &&
+	cp $objdir/pack/multi-pack-index midx-backup &&
+	test_when_finished "mv midx-backup $objdir/pack/multi-pack-index" &&
+	size=$(wc -c <$objdir/pack/multi-pack-index) &&
+	printf "\\377" |
+	dd of=$objdir/pack/multi-pack-index bs=1 seek=$(($size - 1)) conv=notrunc &&
+	test_must_fail git multi-pack-index verify 2>err &&
+	test_i18ngrep "incorrect checksum" err
+'
+
+test_expect_success 'verify detects a missing pack' '
+	git multi-pack-index write &&
+	idx=$(ls $objdir/pack/test-late-*.idx) &&
+	mv $idx idx-backup &&
+	test_when_finished "mv idx-backup $idx" &&
+	test_must_fail git multi-pack-index verify 2>err &&
+	test_i18ngrep "failed to load pack" err
+'
+
+test_expect_success 'expire removes packs with no referenced objects' '
+	git multi-pack-index write &&
+	cp obj-list dup-list &&
+	pack=$(git pack-objects $objdir/pack/test-dup <dup-list) &&
+	test-chmtime +20 $objdir/pack/test-dup-$pack.pack &&
+	git multi-pack-index write &&
+	git multi-pack-index expire &&
+	git multi-pack-index verify &&
+	test_path_is_file $objdir/pack/test-dup-$pack.pack &&
+	ls $objdir/pack >packs &&
+	! grep "^test-late-" packs
+'
+
+test_expect_success 'expire keeps packs with a .keep file' '
+	pack=$(git pack-objects $objdir/pack/test-keep <obj-list) &&
+	test-chmtime +40 $objdir/pack/test-keep-$pack.pack &&
+	git multi-pack-index write &&
+	dup=$(ls $objdir/pack/test-dup-*.idx | sed -e "s/\\.idx\$/.keep/") &&
+	touch $dup &&
+	git multi-pack-index expire &&
+	git multi-pack-index verify &&
+	test_path_is_file ${dup%.keep}.pack
+'
+
+compare_results_with_midx "after expire"
+
+test_expect_success 'repack removes the multi-pack-index' '
+	git multi-pack-index write &&
+	git repack -adf &&
+	test_path_is_missing $objdir/pack/multi-pack-index
+'
+
+compare_results_with_midx "after repack"
+
+test_expect_success 'multi-pack-index in an alternate' '
+	git clone --shared . alt-client &&
+	(
+		cd alt-client &&
+		git -c core.multiPackIndex=false rev-list --objects --all >expect &&
+		git -C .. multi-pack-index write &&
+		git -c core.multiPackIndex=true rev-list --objects --all >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_done
@@ -0,0 +1,136 @@
+#!/bin/sh
+
+test_description='bitmap layers written by incremental repacks'
+. ./test-lib.sh
+
+count_bitmaps () {
+	ls .git/objects/pack/*.bitmap 2>/dev/null | wc -l
+}
+
+# commits <prefix> <n>: make <n> commits, tagged <prefix>-1 to <prefix>-<n>
+commits () {
+	for i in $(test_seq $2)
+	do
+		test_commit $1-$i || return 1
+	done
+}
+
+# check_rev_list <rev-list args>: a bitmap walk must list the same
+# objects as the traversal
+check_rev_list () {
+	git rev-list --objects "$@" >out &&
+	cut -d" " -f1 <out | sort >expect &&
+	git rev-list --objects --use-bitmap-index "$@" >out &&
+	cut -d" " -f1 <out | sort >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup bitmapped pack' '
+	commits base 10 &&
+	git config repack.writebitmaps true &&
+	git repack -ad &&
+	test 1 = $(count_bitmaps)
+'
+
+test_expect_success 'incremental repack writes a bitmap layer' '
+	commits one 5 &&
+	ls .git/objects/pack/*.bitmap >before &&
+	git repack -d &&
+	ls .git/objects/pack/*.bitmap >after &&
+	comm -13 before after >first-layer &&
+	test_line_count = 1 first-layer &&
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "Bitmap v2 test" err &&
+	grep "OK!" err &&
+	git count-objects -v >count &&
+	grep "^count: 0" count
+'
+
+test_expect_success 'layers stack' '
+	git checkout -b side base-5 &&
+	commits side 5 &&
+	git checkout master &&
+	git merge side &&
+	git repack -d &&
+	test 3 = $(count_bitmaps) &&
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "OK!" err &&
+	git rev-list --test-bitmap side 2>err &&
+	grep "OK!" err
+'
+
+test_expect_success 'bitmap walks through layers' '
+	check_rev_list HEAD &&
+	check_rev_list HEAD~3..HEAD &&
+	check_rev_list side ^one-3 &&
+	check_rev_list HEAD ^base-8 &&
+	git rev-list --count HEAD >expect &&
+	git rev-list --count --use-bitmap-index HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'walk with objects beyond the layers' '
+	test_commit loose &&
+	check_rev_list HEAD &&
+	check_rev_list HEAD ^side
+'
+
+test_expect_success 'clone from layered bitmaps' '
+	git clone --no-local --bare . clone.git &&
+	git -C clone.git fsck &&
+	git rev-parse master side >expect &&
+	git -C clone.git rev-parse master side >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'packs without bitmaps are folded into a layer' '
+	unreachable=$(echo unreachable | git hash-object -w --stdin) &&
+	echo $unreachable | git pack-objects .git/objects/pack/pack &&
+	git prune-packed &&
+	test_commit two &&
+	git repack -d &&
+	test 4 = $(count_bitmaps) &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 4 packs &&
+	git cat-file -e $unreachable &&
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "OK!" err
+'
+
+test_expect_success 'layers without their base are ignored' '
+	cp -R .git broken.git &&
+	rm -f broken.git/objects/pack/$(basename $(cat first-layer)) &&
+	git --git-dir=broken.git rev-list --use-bitmap-index --objects HEAD >out 2>err &&
+	test_i18ngrep "ignoring extra bitmap file" err &&
+	cut -d" " -f1 <out | sort >actual &&
+	git --git-dir=broken.git rev-list --objects HEAD >out &&
+	cut -d" " -f1 <out | sort >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'full repack collapses the layers' '
+	git repack -ad &&
+	test 1 = $(count_bitmaps) &&
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "Bitmap v1 test" err &&
+	grep "OK!" err &&
+	check_rev_list HEAD ^one-3
+'
+
+test_expect_success 'incremental repack without bitmaps writes them in full' '
+	git init fresh &&
+	(
+		cd fresh &&
+		test_commit one &&
+		git repack -d &&
+		test_commit two &&
+		git repack -db &&
+		test 1 = $(count_bitmaps) &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 1 packs &&
+		git rev-list --test-bitmap HEAD 2>err &&
+		grep "Bitmap v1 test" err
+	)
+'
+
+test_done
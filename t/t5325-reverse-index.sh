@@ -0,0 +1,106 @@
+#!/bin/sh
+
+test_description='on-disk reverse index'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	test_commit base &&
+	test_seq 1 1000 >big &&
+	git add big &&
+	git commit -m big &&
+	test_seq 1 1001 >big &&
+	git commit -m bigger big &&
+	test_commit tip &&
+	git repack -ad &&
+	pack=$(ls $packdir/pack-*.pack) &&
+	git cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objectsize:disk)" >expect
+'
+
+test_expect_success 'index-pack does not write a reverse index by default' '
+	rm -f $packdir/*.rev &&
+	git index-pack $pack &&
+	test_path_is_missing ${pack%.pack}.rev
+'
+
+test_expect_success 'index-pack --rev-index writes a reverse index' '
+	git index-pack --rev-index $pack &&
+	test_path_is_file ${pack%.pack}.rev
+'
+
+test_expect_success 'index-pack with pack.writeReverseIndex' '
+	rm -f $packdir/*.rev &&
+	git -c pack.writeReverseIndex=true index-pack $pack &&
+	test_path_is_file ${pack%.pack}.rev &&
+	rm -f $packdir/*.rev &&
+	git -c pack.writeReverseIndex=true index-pack --no-rev-index $pack &&
+	test_path_is_missing ${pack%.pack}.rev
+'
+
+test_expect_success 'reverse index is used instead of sorting in memory' '
+	git index-pack --rev-index $pack &&
+	GIT_TEST_REV_INDEX_DIE_IN_MEMORY=1 \
+	git cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objectsize:disk)" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'index-pack --stdin writes a reverse index' '
+	git init --bare stdin.git &&
+	git -C stdin.git index-pack --stdin --rev-index <$pack &&
+	ls stdin.git/objects/pack/*.rev >revs &&
+	test_line_count = 1 revs
+'
+
+test_expect_success 'repack writes and removes reverse indexes' '
+	test_commit more &&
+	git -c pack.writeReverseIndex=true repack -ad &&
+	ls $packdir/*.rev >revs &&
+	test_line_count = 1 revs &&
+	new=$(ls $packdir/pack-*.pack) &&
+	test_path_is_file ${new%.pack}.rev &&
+	test_commit even-more &&
+	git repack -ad &&
+	test_path_is_missing ${new%.pack}.rev
+'
+
+test_expect_success 'bitmap walks read the reverse index' '
+	git -c pack.writeReverseIndex=true repack -adb &&
+	git rev-list --objects --all >out &&
+	cut -d" " -f1 <out | sort >expect &&
+	GIT_TEST_REV_INDEX_DIE_IN_MEMORY=1 \
+	git rev-list --objects --all --use-bitmap-index >out &&
+	cut -d" " -f1 <out | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'corrupt reverse index is ignored' '
+	rev=$(ls $packdir/pack-*.rev) &&
+	chmod +w $rev &&
+	printf "xxxx" | dd of=$rev bs=1 seek=0 conv=notrunc &&
+	git cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objectsize:disk)" >actual 2>err &&
+	test_i18ngrep "reverse index file .* is corrupt" err &&
+	git -c pack.writeReverseIndex=false repack -ad &&
+	git cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objectsize:disk)" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'reverse index with an out-of-range entry is ignored' '
+	git -c pack.writeReverseIndex=true repack -ad &&
+	git cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objectsize:disk)" >expect &&
+	rev=$(ls $packdir/pack-*.rev) &&
+	chmod +w $rev &&
+	printf "\\377\\377\\377\\377" |
+		dd of=$rev bs=1 seek=12 conv=notrunc &&
+	git cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objectsize:disk)" >actual 2>err &&
+	test_i18ngrep "reverse index file .* has out-of-range entry" err &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,121 @@
+#!/bin/sh
+
+test_description='upload-pack pack cache'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m annotated annotated-two &&
+	git config uploadpack.packCache true
+'
+
+cached_packs () {
+	ls .git/upload-pack-cache/*.pack 2>/dev/null | wc -l
+}
+
+# clone_traced <dst> <clone args>: clone with pack cache tracing to
+# "trace"
+clone_traced () {
+	dst=$1 &&
+	shift &&
+	rm -rf "$dst" trace &&
+	GIT_TRACE_PACK_CACHE="$(pwd)/trace" \
+		git clone --no-local "$@" . "$dst" &&
+	git -C "$dst" fsck
+}
+
+test_expect_success 'first clone fills the cache' '
+	clone_traced dst.git --bare &&
+	grep "pack cache miss" trace &&
+	grep "pack cache store" trace &&
+	test 1 = $(cached_packs)
+'
+
+test_expect_success 'identical clone is served from the cache' '
+	clone_traced dst2.git --bare &&
+	grep "pack cache hit" trace &&
+	! grep "pack cache store" trace &&
+	git -C dst.git for-each-ref >expect &&
+	git -C dst2.git for-each-ref >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'protocol v2 shares the cache' '
+	rm -rf dst-v2.git trace &&
+	GIT_TRACE_PACK_CACHE="$(pwd)/trace" GIT_TRACE_PACKET="$(pwd)/packets" \
+		git -c protocol.version=2 clone --no-local --bare . dst-v2.git &&
+	grep "clone< version 2" packets &&
+	grep "pack cache hit" trace &&
+	git -C dst-v2.git fsck
+'
+
+test_expect_success 'different request misses' '
+	clone_traced shallow.git --bare --depth=1 &&
+	grep "pack cache miss" trace &&
+	clone_traced shallow.git --bare --depth=1 &&
+	grep "pack cache hit" trace
+'
+
+test_expect_success 'new history changes the key' '
+	test_commit three &&
+	clone_traced dst3.git --bare &&
+	grep "pack cache miss" trace &&
+	git -C dst3.git rev-parse three
+'
+
+# fetch_master: fetch master (and the tags pointing into it) into a new
+# repository, tracing to "trace"
+fetch_master () {
+	rm -rf fresh trace &&
+	git init fresh &&
+	git -C fresh remote add -t master origin .. &&
+	GIT_TRACE_PACK_CACHE="$(pwd)/trace" git -C fresh fetch origin
+}
+
+test_expect_success 'new tags change the key of tag-following fetches' '
+	fetch_master &&
+	fetch_master &&
+	grep "pack cache hit" trace &&
+	git tag -a -m annotated annotated-three three &&
+	fetch_master &&
+	grep "pack cache miss" trace &&
+	git -C fresh rev-parse annotated-three
+'
+
+test_expect_success 'expired packs are not used and get evicted' '
+	clone_traced dst4.git --bare &&
+	test-chmtime =-7200 .git/upload-pack-cache/*.pack &&
+	clone_traced dst4.git --bare &&
+	grep "pack cache miss" trace &&
+	grep "pack cache evict" trace &&
+	test 1 = $(cached_packs)
+'
+
+test_expect_success 'cache size limit evicts old packs' '
+	rm -rf .git/upload-pack-cache &&
+	clone_traced dst5.git --bare &&
+	old=$(ls .git/upload-pack-cache/*.pack) &&
+	test-chmtime =-10 $old &&
+	test_config uploadpack.packCacheMaxSize $(wc -c <$old) &&
+	clone_traced dst5.git --bare --depth=1 &&
+	grep "pack cache evict .*$(basename $old)" trace &&
+	test 1 = $(cached_packs)
+'
+
+test_expect_success 'packs over the size limit are not cached' '
+	test_config uploadpack.packCacheMaxSize 1 &&
+	clone_traced dst6.git --bare &&
+	grep "pack cache miss" trace &&
+	! grep "pack cache store" trace
+'
+
+test_expect_success 'cache is off by default' '
+	rm -rf .git/upload-pack-cache &&
+	test_unconfig uploadpack.packCache &&
+	clone_traced dst7.git --bare &&
+	! test -s trace &&
+	! test -d .git/upload-pack-cache
+'
+
+test_done
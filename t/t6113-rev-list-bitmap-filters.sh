@@ -0,0 +1,70 @@
+#!/bin/sh
+
+test_description='rev-list combining bitmaps and filters'
+. ./test-lib.sh
+
+test_expect_success 'set up bitmapped repo' '
+	# one commit will have bitmaps, the other will not
+	test_commit one &&
+	test_commit much-larger-blob-one &&
+	test_seq 1 1000 >big &&
+	git add big &&
+	git commit -m big &&
+	git repack -adb &&
+	test_commit two &&
+	test_commit much-larger-blob-two &&
+	test_seq 1 1001 >big &&
+	git commit -m bigger big &&
+	blob=$(echo loose-blob | git hash-object -w --stdin) &&
+	git tag tagged-blob $blob
+'
+
+# check_filter <filter> <rev-list args>: the bitmap walk must list the
+# same objects as the traversal
+check_filter () {
+	filter=$1 &&
+	shift &&
+	git rev-list --objects --filter="$filter" "$@" >out &&
+	cut -d" " -f1 <out | sort >expect &&
+	git rev-list --objects --use-bitmap-index --filter="$filter" "$@" >out &&
+	cut -d" " -f1 <out | sort >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'filters fallback to non-bitmap traversal' '
+	# use a sparse filter, which bitmaps do not support
+	git rev-list --objects --filter=sparse:oid=HEAD:one.t HEAD >expect &&
+	git rev-list --use-bitmap-index \
+		--objects --filter=sparse:oid=HEAD:one.t HEAD >actual &&
+	test_cmp expect actual
+'
+
+for filter in blob:none blob:limit=0 blob:limit=1k blob:limit=3k blob:limit=1m
+do
+	test_expect_success "$filter filter" '
+		check_filter $filter HEAD
+	'
+
+	test_expect_success "$filter filter with a range" '
+		check_filter $filter HEAD^..HEAD &&
+		check_filter $filter HEAD ^one
+	'
+
+	test_expect_success "$filter filter with a tagged blob" '
+		check_filter $filter HEAD tagged-blob
+	'
+done
+
+test_expect_success 'pack-objects --filter uses bitmaps' '
+	git rev-list --objects --filter=blob:none HEAD >out &&
+	cut -d" " -f1 <out | sort >expect &&
+	echo HEAD |
+	git pack-objects --revs --stdout --delta-base-offset --filter=blob:none \
+		--use-bitmap-index --progress >filtered.pack 2>err &&
+	grep "pack-reused [1-9]" err &&
+	git index-pack filtered.pack &&
+	git show-index <filtered.idx | cut -d" " -f2 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_done
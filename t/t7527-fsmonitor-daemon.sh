@@ -0,0 +1,116 @@
+#!/bin/sh
+
+test_description='git status with the built-in fsmonitor daemon'
+
+. ./test-lib.sh
+
+test -n "$HAVE_FSMONITOR_DAEMON" || {
+	skip_all='skipping fsmonitor--daemon tests, not built in'
+	test_done
+}
+
+# don't leave a stale daemon running
+trap 'code=$?; git fsmonitor--daemon --stop 2>/dev/null; (exit $code); die' EXIT
+
+# Compare "git status" with the daemon to what it says without any
+# fsmonitor at all; the latter works on a copy of the index so as not
+# to drop the fsmonitor extension from it.
+test_status_matches () {
+	rm -f trace &&
+	cp .git/index .git/index.nofsmonitor &&
+	GIT_INDEX_FILE=.git/index.nofsmonitor \
+	git -c core.useBuiltinFSMonitor=false status --porcelain=v2 \
+		--untracked-files=all "$@" >expect &&
+	GIT_TRACE_FSMONITOR="$(pwd)/trace" git status --porcelain=v2 \
+		--untracked-files=all "$@" >actual &&
+	test_cmp expect actual &&
+	grep "fsmonitor--daemon returned success" trace
+}
+
+test_expect_success 'setup' '
+	for dir in . dir1 dir1/sub dir2
+	do
+		mkdir -p $dir &&
+		echo 1 >$dir/modified &&
+		echo 1 >$dir/unchanged &&
+		echo 1 >$dir/deleted || return 1
+	done &&
+	cat >.gitignore <<-\EOF &&
+	expect*
+	actual*
+	trace*
+	EOF
+	git add . &&
+	git commit -m initial &&
+	git config core.useBuiltinFSMonitor true
+'
+
+test_expect_success 'status starts the daemon' '
+	git status &&
+	test -S .git/fsmonitor--daemon/ipc &&
+	test_status_matches
+'
+
+test_expect_success 'modified and deleted files' '
+	for dir in . dir1 dir1/sub dir2
+	do
+		echo 2 >$dir/modified &&
+		rm $dir/deleted || return 1
+	done &&
+	test_status_matches &&
+	# a busy daemon may answer that anything could have changed
+	if ! grep "fsmonitor invalidated all entries" trace
+	then
+		grep "fsmonitor_refresh_callback .dir1/sub/modified." trace &&
+		! grep "fsmonitor_refresh_callback .dir1/sub/unchanged." trace
+	fi
+'
+
+test_expect_success 'changes are picked up after the index was written' '
+	git add -A &&
+	git commit -m second &&
+	test_status_matches &&
+	echo 3 >dir2/modified &&
+	test_status_matches
+'
+
+test_expect_success 'new directories and untracked files' '
+	mkdir -p new/deeper &&
+	echo 1 >new/deeper/file &&
+	echo 1 >dir1/untracked &&
+	test_status_matches
+'
+
+test_expect_success 'renamed directories' '
+	git add -A &&
+	git commit -m third &&
+	mv dir1 dir3 &&
+	test_status_matches &&
+	echo 2 >dir3/sub/unchanged &&
+	test_status_matches &&
+	mv dir3 dir1 &&
+	test_status_matches
+'
+
+test_expect_success 'status with the untracked cache' '
+	git update-index --untracked-cache &&
+	test_status_matches &&
+	echo 1 >dir2/more &&
+	test_status_matches &&
+	rm dir2/more &&
+	test_status_matches
+'
+
+test_expect_success '--stop stops the daemon' '
+	git fsmonitor--daemon --stop &&
+	! test -S .git/fsmonitor--daemon/ipc &&
+	test_must_fail git fsmonitor--daemon --stop
+'
+
+test_expect_success 'the daemon is restarted as needed' '
+	echo 4 >dir2/modified &&
+	test_status_matches &&
+	test -S .git/fsmonitor--daemon/ipc
+'
+
+test_done
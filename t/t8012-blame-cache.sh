@@ -0,0 +1,131 @@
+#!/bin/sh
+
+test_description='git blame with blame.cache'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_seq 1 10 >file &&
+	git add file &&
+	test_tick &&
+	git commit -m base &&
+
+	git checkout -b side &&
+	sed -e "2s/$/ side/" file >file.new &&
+	mv file.new file &&
+	test_tick &&
+	git commit -a -m side &&
+
+	git checkout master &&
+	sed -e "9s/$/ master/" file >file.new &&
+	mv file.new file &&
+	test_tick &&
+	git commit -a -m master &&
+	test_tick &&
+	git merge -m merge side &&
+
+	git mv file renamed &&
+	echo 11 >>renamed &&
+	test_tick &&
+	git commit -m renamed &&
+	sed -e "5s/$/ tip/" renamed >renamed.new &&
+	mv renamed.new renamed &&
+	test_tick &&
+	git commit -a -m tip
+'
+
+test_expect_success 'blame.cache does not change the blame' '
+	git blame --porcelain HEAD -- renamed >expect &&
+	git -c blame.cache=true blame --porcelain HEAD -- renamed >actual &&
+	test_cmp expect actual &&
+	test_path_is_dir .git/blame-cache &&
+	git -c blame.cache=true blame --porcelain HEAD -- renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cached blame is reused' '
+	git -c blame.cache=true blame --show-stats HEAD -- renamed >out &&
+	grep "^num get patch: 0" out
+'
+
+test_expect_success 'blame of a new commit resumes from its cached parent' '
+	sed -e "7s/$/ new/" renamed >renamed.new &&
+	mv renamed.new renamed &&
+	test_tick &&
+	git commit -a -m new &&
+	git blame --porcelain HEAD -- renamed >expect &&
+	git -c blame.cache=true blame --porcelain --show-stats HEAD -- renamed >actual &&
+	grep "^num get patch: 1" actual &&
+	grep -v "^num " actual >actual.blame &&
+	test_cmp expect actual.blame
+'
+
+test_expect_success 'incremental output from the cache' '
+	git blame --incremental HEAD -- renamed >expect &&
+	git -c blame.cache=true blame --incremental HEAD -- renamed >actual &&
+	sort expect >expect.sorted &&
+	sort actual >actual.sorted &&
+	test_cmp expect.sorted actual.sorted
+'
+
+test_expect_success 'blaming some lines only does not fill the cache' '
+	rm -rf .git/blame-cache &&
+	git -c blame.cache=true blame -L 2,4 HEAD -- renamed &&
+	test_path_is_missing .git/blame-cache
+'
+
+test_expect_success 'blaming a range of history does not use the cache' '
+	git -c blame.cache=true blame HEAD~2..HEAD -- renamed >expect &&
+	test_path_is_missing .git/blame-cache &&
+	git -c blame.cache=true blame HEAD -- renamed &&
+	git -c blame.cache=true blame HEAD~2..HEAD -- renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blame -w does not use the entries of plain blame' '
+	git blame --porcelain HEAD -- renamed >/dev/null &&
+	git -c blame.cache=true blame --porcelain HEAD -- renamed >/dev/null &&
+	find .git/blame-cache -type f >before &&
+	git -c blame.cache=true blame -w --porcelain HEAD -- renamed >actual &&
+	git blame -w --porcelain HEAD -- renamed >expect &&
+	test_cmp expect actual &&
+	find .git/blame-cache -type f >after &&
+	! test_cmp before after
+'
+
+test_expect_success 'the cache is not used with grafts or replace refs' '
+	rm -rf .git/blame-cache &&
+	commit=$(git rev-parse HEAD~1) &&
+	parent=$(git rev-parse HEAD~3) &&
+	git replace --graft $commit $parent &&
+	git -c blame.cache=true blame HEAD -- renamed &&
+	test_path_is_missing .git/blame-cache &&
+	git replace -d $commit &&
+	echo "$commit $parent" >.git/info/grafts &&
+	git -c blame.cache=true blame HEAD -- renamed &&
+	test_path_is_missing .git/blame-cache &&
+	rm .git/info/grafts
+'
+
+test_expect_success 'corrupt cache is ignored' '
+	git blame --porcelain HEAD -- renamed >expect &&
+	for f in $(find .git/blame-cache -type f)
+	do
+		echo garbage >"$f" || return 1
+	done &&
+	git -c blame.cache=true blame --porcelain HEAD -- renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'gc prunes the entries that went unused' '
+	git -c blame.cache=true blame HEAD -- renamed &&
+	git -c blame.cache=true blame HEAD~2 -- renamed &&
+	test-chmtime -2000000 $(find .git/blame-cache -type f) &&
+	git -c blame.cache=true blame HEAD -- renamed &&
+	git gc &&
+	find .git/blame-cache -type f >entries &&
+	test_line_count = 1 entries &&
+	git -c gc.blameCacheExpire=now gc &&
+	test_path_is_missing .git/blame-cache
+'
+
+test_done
@@ -15,6 +15,9 @@
 #include "submodule.h"
 #include "submodule-config.h"
 #include "fsmonitor.h"
+#include "parallel-checkout.h"
+#include "sparse-index.h"
+#include "promisor-remote.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -332,6 +335,35 @@ static struct progress *get_progress(struct unpack_trees_options *o)
 	return start_delayed_progress(_("Checking out files"), total);
 }
 
+/*
+ * In a partial clone, fetch the blobs of all the entries about to be
+ * checked out that we do not have yet in one go, instead of letting
+ * checkout_entry() fetch them one at a time.
+ */
+static void prefetch_missing_blobs(struct index_state *index)
+{
+	struct oid_array to_fetch = OID_ARRAY_INIT;
+	int i;
+
+	if (!has_promisor_remote())
+		return;
+
+	for (i = 0; i < index->cache_nr; i++) {
+		const struct cache_entry *ce = index->cache[i];
+
+		if (!(ce->ce_flags & CE_UPDATE) || S_ISGITLINK(ce->ce_mode))
+			continue;
+		if (has_object_file_with_flags(&ce->oid,
+					       OBJECT_INFO_SKIP_FETCH_OBJECT |
+					       OBJECT_INFO_QUICK))
+			continue;
+		oid_array_append(&to_fetch, &ce->oid);
+	}
+	if (to_fetch.nr)
+		promisor_remote_get_direct(to_fetch.oid, to_fetch.nr);
+	oid_array_clear(&to_fetch);
+}
+
 static int check_updates(struct unpack_trees_options *o)
 {
 	unsigned cnt = 0;
@@ -339,7 +371,7 @@ static int check_updates(struct unpack_trees_options *o)
 	struct progress *progress = NULL;
 	struct index_state *index = &o->result;
 	struct checkout state = CHECKOUT_INIT;
-	int i;
+	int i, pc_workers, pc_threshold;
 
 	state.force = 1;
 	state.quiet = 1;
@@ -348,6 +380,9 @@ static int check_updates(struct unpack_trees_options *o)
 
 	progress = get_progress(o);
 
+	if (o->update && !o->dry_run)
+		prefetch_missing_blobs(index);
+
 	if (o->update)
 		git_attr_set_direction(GIT_ATTR_CHECKOUT, index);
 
@@ -369,7 +404,14 @@ static int check_updates(struct unpack_trees_options *o)
 	if (should_update_submodules() && o->update && !o->dry_run)
 		load_gitmodules_file(index, &state);
 
+	if (o->update && !o->dry_run)
+		get_parallel_checkout_configs(&pc_workers, &pc_threshold);
+	else
+		pc_workers = 1;
+
 	enable_delayed_checkout(&state);
+	if (pc_workers > 1)
+		init_parallel_checkout();
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
@@ -384,6 +426,8 @@ static int check_updates(struct unpack_trees_options *o)
 			}
 		}
 	}
+	if (pc_workers > 1)
+		errs |= run_parallel_checkout(&state, pc_workers, pc_threshold);
 	stop_progress(&progress);
 	errs |= finish_delayed_checkout(&state);
 	if (o->update)
@@ -1065,10 +1109,16 @@ static int clear_ce_flags_dir(struct cache_entry **cache, int nr,
 {
 	struct cache_entry **cache_end;
 	int dtype = DT_DIR;
-	int ret = is_excluded_from_list(prefix->buf, prefix->len,
-					basename, &dtype, el, &the_index);
+	int cone = -1;
+	int ret;
 	int rc;
 
+	if (el->use_cone_patterns)
+		ret = cone = is_dir_in_cone(prefix->buf, prefix->len, el);
+	else
+		ret = is_excluded_from_list(prefix->buf, prefix->len,
+					    basename, &dtype, el, &the_index);
+
 	strbuf_addch(prefix, '/');
 
 	/* If undecided, use matching result of parent dir in defval */
@@ -1082,16 +1132,25 @@ static int clear_ce_flags_dir(struct cache_entry **cache, int nr,
 	}
 
 	/*
-	 * TODO: check el, if there are no patterns that may conflict
-	 * with ret (iow, we know in advance the incl/excl
-	 * decision for the entire directory), clear flag here without
-	 * calling clear_ce_flags_1(). That function will call
-	 * the expensive is_excluded_from_list() on every entry.
+	 * Cone patterns decide for the entire directory in advance
+	 * unless it is a "parent" directory; clear the flag here
+	 * without calling the per-entry matching in clear_ce_flags_1().
+	 *
+	 * TODO: do the same for other pattern lists when there are no
+	 * patterns that may conflict with ret.
 	 */
-	rc = clear_ce_flags_1(cache, cache_end - cache,
-			      prefix,
-			      select_mask, clear_mask,
-			      el, ret);
+	if (cone >= 0) {
+		struct cache_entry **ce;
+
+		for (ce = cache; cone && ce != cache_end; ce++)
+			if (!select_mask || ((*ce)->ce_flags & select_mask))
+				(*ce)->ce_flags &= ~clear_mask;
+		rc = cache_end - cache;
+	} else
+		rc = clear_ce_flags_1(cache, cache_end - cache,
+				      prefix,
+				      select_mask, clear_mask,
+				      el, ret);
 	strbuf_setlen(prefix, prefix->len - 1);
 	return rc;
 }
@@ -1244,11 +1303,16 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	if (len > MAX_UNPACK_TREES)
 		die("unpack_trees takes at most %d trees", MAX_UNPACK_TREES);
 
+	/* only "diff-index --cached" knows to skip sparse directories */
+	if (!o->diff_index_cached)
+		ensure_full_index(o->src_index);
+
 	memset(&el, 0, sizeof(el));
 	if (!core_apply_sparse_checkout || !o->update)
 		o->skip_sparse_checkout = 1;
 	if (!o->skip_sparse_checkout) {
 		char *sparse = git_pathdup("info/sparse-checkout");
+		el.use_cone_patterns = core_sparse_checkout_cone;
 		if (add_excludes_from_file_to_list(sparse, "", 0, &el, NULL) < 0)
 			o->skip_sparse_checkout = 1;
 		else
@@ -15,15 +15,13 @@
 #include "sigchain.h"
 #include "version.h"
 #include "string-list.h"
-#include "parse-options.h"
 #include "argv-array.h"
 #include "prio-queue.h"
 #include "protocol.h"
-
-static const char * const upload_pack_usage[] = {
-	N_("git upload-pack [<options>] <dir>"),
-	NULL
-};
+#include "upload-pack.h"
+#include "sha1-array.h"
+#include "tempfile.h"
+#include "dir.h"
 
 /* Remember to update object flag allocation in object.h */
 #define THEY_HAVE	(1u << 11)
@@ -61,10 +59,14 @@ static int keepalive = 5;
  * otherwise maximum packet size (up to 65520 bytes).
  */
 static int use_sideband;
-static int advertise_refs;
 static int stateless_rpc;
 static const char *pack_objects_hook;
 
+static int pack_cache;
+static unsigned long pack_cache_max_size = 256 * 1024 * 1024;
+static unsigned long pack_cache_max_age = 3600;
+static struct trace_key trace_pack_cache = TRACE_KEY_INIT(PACK_CACHE);
+
 static void reset_timeout(void)
 {
 	alarm(timeout);
@@ -89,12 +91,220 @@ static void send_client_data(int fd, const char *data, ssize_t sz)
 
 static int write_one_shallow(const struct commit_graft *graft, void *cb_data)
 {
-	FILE *fp = cb_data;
+	struct strbuf *buf = cb_data;
 	if (graft->nr_parent == -1)
-		fprintf(fp, "--shallow %s\n", oid_to_hex(&graft->oid));
+		strbuf_addf(buf, "--shallow %s\n", oid_to_hex(&graft->oid));
+	return 0;
+}
+
+/*
+ * The pack cache keeps the packs we sent, named after a hash of
+ * everything that went into generating them: the pack-objects options
+ * and the wants, haves and shallow commits we fed it.  A request that
+ * hashes the same gets the cached pack instead of a new pack-objects.
+ */
+static const char *pack_cache_dir(void)
+{
+	return git_path("upload-pack-cache");
+}
+
+static int hash_tag_ref(const char *refname, const struct object_id *oid,
+			int flags, void *cb_data)
+{
+	git_SHA_CTX *ctx = cb_data;
+	git_SHA1_Update(ctx, refname, strlen(refname) + 1);
+	git_SHA1_Update(ctx, oid->hash, GIT_SHA1_RAWSZ);
 	return 0;
 }
 
+static void pack_cache_key(struct object_id *key, const struct strbuf *input)
+{
+	git_SHA_CTX ctx;
+	struct strbuf opts = STRBUF_INIT;
+
+	strbuf_addf(&opts, "upload-pack-cache v1\n"
+		    "thin %d\nofs-delta %d\ninclude-tag %d\nshallow %d\n",
+		    use_thin_pack, use_ofs_delta, use_include_tag, !!shallow_nr);
+	if (pack_objects_hook)
+		strbuf_addf(&opts, "hook %s\n", pack_objects_hook);
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, opts.buf, opts.len);
+	git_SHA1_Update(&ctx, input->buf, input->len);
+	/*
+	 * The tags pack-objects adds for --include-tag depend on the
+	 * refs of the moment, not only on what was asked for.
+	 */
+	if (use_include_tag)
+		for_each_tag_ref(hash_tag_ref, &ctx);
+	git_SHA1_Final(key->hash, &ctx);
+
+	strbuf_release(&opts);
+}
+
+static int open_cached_pack(const char *path)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) ||
+	    st.st_mtime + pack_cache_max_age < time(NULL)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void send_cached_pack(int fd)
+{
+	char data[8192];
+	ssize_t sz;
+
+	while ((sz = xread(fd, data, sizeof(data))) > 0) {
+		reset_timeout();
+		send_client_data(1, data, sz);
+	}
+	if (sz < 0)
+		die_errno("git upload-pack: unable to read cached pack");
+	close(fd);
+	if (use_sideband)
+		packet_flush(1);
+}
+
+struct cached_pack {
+	char *path;
+	time_t mtime;
+	off_t size;
+};
+
+static int cached_pack_mtime_cmp(const void *a_, const void *b_)
+{
+	const struct cached_pack *a = a_, *b = b_;
+
+	if (a->mtime < b->mtime)
+		return -1;
+	return a->mtime > b->mtime;
+}
+
+static void evict_cached_pack(const char *path)
+{
+	trace_printf_key(&trace_pack_cache, "pack cache evict %s\n", path);
+	unlink_or_warn(path);
+}
+
+/*
+ * Drop the cached packs older than uploadpack.packCacheMaxAge, then the
+ * oldest ones until the rest fit in uploadpack.packCacheMaxSize.
+ */
+static void evict_cached_packs(void)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct cached_pack *packs = NULL;
+	int nr = 0, alloc = 0, i;
+	off_t total = 0;
+	time_t now = time(NULL);
+	struct dirent *de;
+	size_t dirlen;
+	DIR *dir;
+
+	strbuf_addstr(&path, pack_cache_dir());
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+	strbuf_addch(&path, '/');
+	dirlen = path.len;
+
+	while ((de = readdir(dir)) != NULL) {
+		struct stat st;
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, de->d_name);
+		if (lstat(path.buf, &st) || !S_ISREG(st.st_mode))
+			continue;
+
+		if (st.st_mtime + pack_cache_max_age < now) {
+			/* also picks up temporary files left by a crash */
+			evict_cached_pack(path.buf);
+			continue;
+		}
+		if (!ends_with(de->d_name, ".pack"))
+			continue;
+
+		ALLOC_GROW(packs, nr + 1, alloc);
+		packs[nr].path = xstrdup(path.buf);
+		packs[nr].mtime = st.st_mtime;
+		packs[nr].size = st.st_size;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	QSORT(packs, nr, cached_pack_mtime_cmp);
+	for (i = 0; i < nr; i++) {
+		if (total > pack_cache_max_size) {
+			evict_cached_pack(packs[i].path);
+			total -= packs[i].size;
+		}
+		free(packs[i].path);
+	}
+	free(packs);
+	strbuf_release(&path);
+}
+
+static struct tempfile *start_cached_pack(const char *path)
+{
+	struct strbuf tmp = STRBUF_INIT;
+	struct tempfile *tempfile;
+
+	if (safe_create_leading_directories_const(path)) {
+		trace_printf_key(&trace_pack_cache,
+				 "pack cache unable to create %s\n", path);
+		return NULL;
+	}
+	strbuf_addf(&tmp, "%s/tmp_pack_XXXXXX", pack_cache_dir());
+	tempfile = mks_tempfile_m(tmp.buf, 0444);
+	if (!tempfile)
+		trace_printf_key(&trace_pack_cache,
+				 "pack cache unable to create %s\n", tmp.buf);
+	strbuf_release(&tmp);
+	return tempfile;
+}
+
+/*
+ * Save what we sent of the pack; on any error just stop saving, the
+ * client does not care.
+ */
+static void write_cached_pack(struct tempfile **tempfile, off_t *size,
+			      const char *data, ssize_t sz)
+{
+	if (!*tempfile)
+		return;
+	*size += sz;
+	if (*size > pack_cache_max_size ||
+	    write_in_full(get_tempfile_fd(*tempfile), data, sz) < 0)
+		delete_tempfile(tempfile);
+}
+
+static void finish_cached_pack(struct tempfile **tempfile, const char *path)
+{
+	if (!*tempfile)
+		return;
+	if (rename_tempfile(tempfile, path) < 0) {
+		trace_printf_key(&trace_pack_cache,
+				 "pack cache unable to store %s\n", path);
+		return;
+	}
+	adjust_shared_perm(path);
+	trace_printf_key(&trace_pack_cache, "pack cache store %s\n", path);
+	evict_cached_packs();
+}
+
 static void create_pack_file(void)
 {
 	struct child_process pack_objects = CHILD_PROCESS_INIT;
@@ -105,6 +315,47 @@ static void create_pack_file(void)
 	ssize_t sz;
 	int i;
 	FILE *pipe_fd;
+	struct strbuf input = STRBUF_INIT;
+	struct strbuf cache_path = STRBUF_INIT;
+	struct tempfile *cache_file = NULL;
+	off_t cache_size = 0;
+
+	if (shallow_nr)
+		for_each_commit_graft(write_one_shallow, &input);
+
+	for (i = 0; i < want_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&want_obj.objects[i].item->oid));
+	strbuf_addstr(&input, "--not\n");
+	for (i = 0; i < have_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&have_obj.objects[i].item->oid));
+	for (i = 0; i < extra_edge_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&extra_edge_obj.objects[i].item->oid));
+	strbuf_addch(&input, '\n');
+
+	if (pack_cache) {
+		struct object_id key;
+		int fd;
+
+		pack_cache_key(&key, &input);
+		strbuf_addf(&cache_path, "%s/%s.pack",
+			    pack_cache_dir(), oid_to_hex(&key));
+
+		fd = open_cached_pack(cache_path.buf);
+		if (fd >= 0) {
+			trace_printf_key(&trace_pack_cache,
+					 "pack cache hit %s\n", cache_path.buf);
+			send_cached_pack(fd);
+			strbuf_release(&cache_path);
+			strbuf_release(&input);
+			return;
+		}
+		trace_printf_key(&trace_pack_cache,
+				 "pack cache miss %s\n", cache_path.buf);
+		cache_file = start_cached_pack(cache_path.buf);
+	}
 
 	if (!pack_objects_hook)
 		pack_objects.git_cmd = 1;
@@ -141,23 +392,10 @@ static void create_pack_file(void)
 		die("git upload-pack: unable to fork git-pack-objects");
 
 	pipe_fd = xfdopen(pack_objects.in, "w");
-
-	if (shallow_nr)
-		for_each_commit_graft(write_one_shallow, pipe_fd);
-
-	for (i = 0; i < want_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&want_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "--not\n");
-	for (i = 0; i < have_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&have_obj.objects[i].item->oid));
-	for (i = 0; i < extra_edge_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&extra_edge_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "\n");
+	fwrite(input.buf, 1, input.len, pipe_fd);
 	fflush(pipe_fd);
 	fclose(pipe_fd);
+	strbuf_release(&input);
 
 	/* We read from pack_objects.err to capture stderr output for
 	 * progress bar, and pack_objects.out to capture the pack data.
@@ -250,6 +488,7 @@ static void create_pack_file(void)
 			else
 				buffered = -1;
 			send_client_data(1, data, sz);
+			write_cached_pack(&cache_file, &cache_size, data, sz);
 		}
 
 		/*
@@ -277,13 +516,17 @@ static void create_pack_file(void)
 	if (0 <= buffered) {
 		data[0] = buffered;
 		send_client_data(1, data, 1);
+		write_cached_pack(&cache_file, &cache_size, data, 1);
 		fprintf(stderr, "flushed.\n");
 	}
 	if (use_sideband)
 		packet_flush(1);
+	finish_cached_pack(&cache_file, cache_path.buf);
+	strbuf_release(&cache_path);
 	return;
 
  fail:
+	delete_tempfile(&cache_file);
 	send_client_data(3, abort_msg, sizeof(abort_msg));
 	die("git upload-pack: %s", abort_msg);
 }
@@ -716,7 +959,6 @@ static void deepen(int depth, int deepen_relative,
 	}
 
 	send_unshallow(shallows);
-	packet_flush(1);
 }
 
 static void deepen_by_rev_list(int ac, const char **av,
@@ -728,7 +970,126 @@ static void deepen_by_rev_list(int ac, const char **av,
 	send_shallow(result);
 	free_commit_list(result);
 	send_unshallow(shallows);
-	packet_flush(1);
+}
+
+/*
+ * Send the shallow and unshallow lines the client needs for the given
+ * deepen request, without terminating them. Return 1 if any lines
+ * could have been sent, 0 otherwise.
+ */
+static int send_shallow_list(int depth, int deepen_rev_list,
+			     timestamp_t deepen_since,
+			     struct string_list *deepen_not,
+			     struct object_array *shallows)
+{
+	int ret = 0;
+
+	if (depth > 0 && deepen_rev_list)
+		die("git upload-pack: deepen and deepen-since (or deepen-not) cannot be used together");
+	if (depth > 0) {
+		deepen(depth, deepen_relative, shallows);
+		ret = 1;
+	} else if (deepen_rev_list) {
+		struct argv_array av = ARGV_ARRAY_INIT;
+		int i;
+
+		argv_array_push(&av, "rev-list");
+		if (deepen_since)
+			argv_array_pushf(&av, "--max-age=%"PRItime, deepen_since);
+		if (deepen_not->nr) {
+			argv_array_push(&av, "--not");
+			for (i = 0; i < deepen_not->nr; i++) {
+				struct string_list_item *s = deepen_not->items + i;
+				argv_array_push(&av, s->string);
+			}
+			argv_array_push(&av, "--not");
+		}
+		for (i = 0; i < want_obj.nr; i++) {
+			struct object *o = want_obj.objects[i].item;
+			argv_array_push(&av, oid_to_hex(&o->oid));
+		}
+		deepen_by_rev_list(av.argc, av.argv, shallows);
+		argv_array_clear(&av);
+		ret = 1;
+	} else {
+		if (shallows->nr > 0) {
+			int i;
+			for (i = 0; i < shallows->nr; i++)
+				register_shallow(&shallows->objects[i].item->oid);
+		}
+	}
+
+	shallow_nr += shallows->nr;
+	return ret;
+}
+
+static int process_shallow(const char *line, struct object_array *shallows)
+{
+	const char *arg;
+	if (skip_prefix(line, "shallow ", &arg)) {
+		struct object_id oid;
+		struct object *object;
+		if (get_oid_hex(arg, &oid))
+			die("invalid shallow line: %s", line);
+		object = parse_object(&oid);
+		if (!object)
+			return 1;
+		if (object->type != OBJ_COMMIT)
+			die("invalid shallow object %s", oid_to_hex(&oid));
+		if (!(object->flags & CLIENT_SHALLOW)) {
+			object->flags |= CLIENT_SHALLOW;
+			add_object_array(object, NULL, shallows);
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+static int process_deepen(const char *line, int *depth)
+{
+	const char *arg;
+	if (skip_prefix(line, "deepen ", &arg)) {
+		char *end = NULL;
+		*depth = (int)strtol(arg, &end, 0);
+		if (!end || *end || *depth <= 0)
+			die("Invalid deepen: %s", line);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int process_deepen_since(const char *line, timestamp_t *deepen_since, int *deepen_rev_list)
+{
+	const char *arg;
+	if (skip_prefix(line, "deepen-since ", &arg)) {
+		char *end = NULL;
+		*deepen_since = parse_timestamp(arg, &end, 0);
+		if (!end || *end || !*deepen_since ||
+		    /* revisions.c's max_age -1 is special */
+		    *deepen_since == -1)
+			die("Invalid deepen-since: %s", line);
+		*deepen_rev_list = 1;
+		return 1;
+	}
+	return 0;
+}
+
+static int process_deepen_not(const char *line, struct string_list *deepen_not, int *deepen_rev_list)
+{
+	const char *arg;
+	if (skip_prefix(line, "deepen-not ", &arg)) {
+		char *ref = NULL;
+		struct object_id oid;
+		if (expand_ref(arg, strlen(arg), &oid, &ref) != 1)
+			die("git upload-pack: ambiguous deepen-not: %s", line);
+		string_list_append(deepen_not, ref);
+		free(ref);
+		*deepen_rev_list = 1;
+		return 1;
+	}
+	return 0;
 }
 
 static void receive_needs(void)
@@ -752,49 +1113,15 @@ static void receive_needs(void)
 		if (!line)
 			break;
 
-		if (skip_prefix(line, "shallow ", &arg)) {
-			struct object_id oid;
-			struct object *object;
-			if (get_oid_hex(arg, &oid))
-				die("invalid shallow line: %s", line);
-			object = parse_object(&oid);
-			if (!object)
-				continue;
-			if (object->type != OBJ_COMMIT)
-				die("invalid shallow object %s", oid_to_hex(&oid));
-			if (!(object->flags & CLIENT_SHALLOW)) {
-				object->flags |= CLIENT_SHALLOW;
-				add_object_array(object, NULL, &shallows);
-			}
+		if (process_shallow(line, &shallows))
 			continue;
-		}
-		if (skip_prefix(line, "deepen ", &arg)) {
-			char *end = NULL;
-			depth = strtol(arg, &end, 0);
-			if (!end || *end || depth <= 0)
-				die("Invalid deepen: %s", line);
+		if (process_deepen(line, &depth))
 			continue;
-		}
-		if (skip_prefix(line, "deepen-since ", &arg)) {
-			char *end = NULL;
-			deepen_since = parse_timestamp(arg, &end, 0);
-			if (!end || *end || !deepen_since ||
-			    /* revisions.c's max_age -1 is special */
-			    deepen_since == -1)
-				die("Invalid deepen-since: %s", line);
-			deepen_rev_list = 1;
+		if (process_deepen_since(line, &deepen_since, &deepen_rev_list))
 			continue;
-		}
-		if (skip_prefix(line, "deepen-not ", &arg)) {
-			char *ref = NULL;
-			struct object_id oid;
-			if (expand_ref(arg, strlen(arg), &oid, &ref) != 1)
-				die("git upload-pack: ambiguous deepen-not: %s", line);
-			string_list_append(&deepen_not, ref);
-			free(ref);
-			deepen_rev_list = 1;
+		if (process_deepen_not(line, &deepen_not, &deepen_rev_list))
 			continue;
-		}
+
 		if (!skip_prefix(line, "want ", &arg) ||
 		    get_oid_hex(arg, &oid_buf))
 			die("git upload-pack: protocol error, "
@@ -855,40 +1182,10 @@ static void receive_needs(void)
 
 	if (depth == 0 && !deepen_rev_list && shallows.nr == 0)
 		return;
-	if (depth > 0 && deepen_rev_list)
-		die("git upload-pack: deepen and deepen-since (or deepen-not) cannot be used together");
-	if (depth > 0)
-		deepen(depth, deepen_relative, &shallows);
-	else if (deepen_rev_list) {
-		struct argv_array av = ARGV_ARRAY_INIT;
-		int i;
-
-		argv_array_push(&av, "rev-list");
-		if (deepen_since)
-			argv_array_pushf(&av, "--max-age=%"PRItime, deepen_since);
-		if (deepen_not.nr) {
-			argv_array_push(&av, "--not");
-			for (i = 0; i < deepen_not.nr; i++) {
-				struct string_list_item *s = deepen_not.items + i;
-				argv_array_push(&av, s->string);
-			}
-			argv_array_push(&av, "--not");
-		}
-		for (i = 0; i < want_obj.nr; i++) {
-			struct object *o = want_obj.objects[i].item;
-			argv_array_push(&av, oid_to_hex(&o->oid));
-		}
-		deepen_by_rev_list(av.argc, av.argv, &shallows);
-		argv_array_clear(&av);
-	}
-	else
-		if (shallows.nr > 0) {
-			int i;
-			for (i = 0; i < shallows.nr; i++)
-				register_shallow(&shallows.objects[i].item->oid);
-		}
 
-	shallow_nr += shallows.nr;
+	if (send_shallow_list(depth, deepen_rev_list, deepen_since,
+			      &deepen_not, &shallows))
+		packet_flush(1);
 	object_array_clear(&shallows);
 }
 
@@ -977,33 +1274,6 @@ static int find_symref(const char *refname, const struct object_id *oid,
 	return 0;
 }
 
-static void upload_pack(void)
-{
-	struct string_list symref = STRING_LIST_INIT_DUP;
-
-	head_ref_namespaced(find_symref, &symref);
-
-	if (advertise_refs || !stateless_rpc) {
-		reset_timeout();
-		head_ref_namespaced(send_ref, &symref);
-		for_each_namespaced_ref(send_ref, &symref);
-		advertise_shallow_grafts(1);
-		packet_flush(1);
-	} else {
-		head_ref_namespaced(check_ref, NULL);
-		for_each_namespaced_ref(check_ref, NULL);
-	}
-	string_list_clear(&symref, 1);
-	if (advertise_refs)
-		return;
-
-	receive_needs();
-	if (want_obj.nr) {
-		get_common_commits();
-		create_pack_file();
-	}
-}
-
 static int upload_pack_config(const char *var, const char *value, void *unused)
 {
 	if (!strcmp("uploadpack.allowtipsha1inwant", var)) {
@@ -1025,6 +1295,12 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 		keepalive = git_config_int(var, value);
 		if (!keepalive)
 			keepalive = -1;
+	} else if (!strcmp("uploadpack.packcache", var)) {
+		pack_cache = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcachemaxsize", var)) {
+		pack_cache_max_size = git_config_ulong(var, value);
+	} else if (!strcmp("uploadpack.packcachemaxage", var)) {
+		pack_cache_max_age = git_config_ulong(var, value);
 	} else if (current_config_scope() != CONFIG_SCOPE_REPO) {
 		if (!strcmp("uploadpack.packobjectshook", var))
 			return git_config_string(&pack_objects_hook, var, value);
@@ -1032,58 +1308,351 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 	return parse_hide_refs_config(var, value, "uploadpack");
 }
 
-int cmd_main(int argc, const char **argv)
+void upload_pack(struct upload_pack_options *options)
 {
-	const char *dir;
-	int strict = 0;
-	struct option options[] = {
-		OPT_BOOL(0, "stateless-rpc", &stateless_rpc,
-			 N_("quit after a single request/response exchange")),
-		OPT_BOOL(0, "advertise-refs", &advertise_refs,
-			 N_("exit immediately after initial ref advertisement")),
-		OPT_BOOL(0, "strict", &strict,
-			 N_("do not try <directory>/.git/ if <directory> is no Git directory")),
-		OPT_INTEGER(0, "timeout", &timeout,
-			    N_("interrupt transfer after <n> seconds of inactivity")),
-		OPT_END()
-	};
+	struct string_list symref = STRING_LIST_INIT_DUP;
+
+	stateless_rpc = options->stateless_rpc;
+	timeout = options->timeout;
+	daemon_mode = options->daemon_mode;
+
+	git_config(upload_pack_config, NULL);
+
+	head_ref_namespaced(find_symref, &symref);
+
+	if (options->advertise_refs || !stateless_rpc) {
+		reset_timeout();
+		head_ref_namespaced(send_ref, &symref);
+		for_each_namespaced_ref(send_ref, &symref);
+		advertise_shallow_grafts(1);
+		packet_flush(1);
+	} else {
+		head_ref_namespaced(check_ref, NULL);
+		for_each_namespaced_ref(check_ref, NULL);
+	}
+	string_list_clear(&symref, 1);
+	if (options->advertise_refs)
+		return;
+
+	receive_needs();
+	if (want_obj.nr) {
+		get_common_commits();
+		create_pack_file();
+	}
+}
 
-	packet_trace_identity("upload-pack");
-	check_replace_refs = 0;
+struct upload_pack_data {
+	struct oid_array haves;
 
-	argc = parse_options(argc, argv, NULL, options, upload_pack_usage, 0);
+	struct object_array shallows;
+	struct string_list deepen_not;
+	int depth;
+	timestamp_t deepen_since;
+	int deepen_rev_list;
+	int has_non_tip;
 
-	if (argc != 1)
-		usage_with_options(upload_pack_usage, options);
+	unsigned done : 1;
+};
 
-	if (timeout)
-		daemon_mode = 1;
+#define UPLOAD_PACK_DATA_INIT { OID_ARRAY_INIT, OBJECT_ARRAY_INIT, STRING_LIST_INIT_DUP, 0, 0, 0, 0, 0 }
 
-	setup_path();
+static void upload_pack_data_clear(struct upload_pack_data *data)
+{
+	oid_array_clear(&data->haves);
+	object_array_clear(&data->shallows);
+	string_list_clear(&data->deepen_not, 0);
+}
 
-	dir = argv[0];
+static int parse_want(const char *line, struct upload_pack_data *data)
+{
+	const char *arg;
+	if (skip_prefix(line, "want ", &arg)) {
+		struct object_id oid;
+		struct object *o;
 
-	if (!enter_repo(dir, strict))
-		die("'%s' does not appear to be a git repository", dir);
+		if (get_oid_hex(arg, &oid))
+			die("git upload-pack: protocol error, "
+			    "expected to get oid, not '%s'", line);
+
+		o = parse_object(&oid);
+		if (!o) {
+			packet_write_fmt(1,
+					 "ERR upload-pack: not our ref %s",
+					 oid_to_hex(&oid));
+			die("git upload-pack: not our ref %s",
+			    oid_to_hex(&oid));
+		}
+
+		if (!(o->flags & WANTED)) {
+			o->flags |= WANTED;
+			if (!((allow_unadvertised_object_request & ALLOW_ANY_SHA1) == ALLOW_ANY_SHA1
+			      || is_our_ref(o)))
+				data->has_non_tip = 1;
+			add_object_array(o, NULL, &want_obj);
+		}
+
+		return 1;
+	}
+
+	return 0;
+}
+
+static int parse_have(const char *line, struct oid_array *haves)
+{
+	const char *arg;
+	if (skip_prefix(line, "have ", &arg)) {
+		struct object_id oid;
+
+		if (get_oid_hex(arg, &oid))
+			die("git upload-pack: expected SHA1 object, got '%s'", arg);
+		oid_array_append(haves, &oid);
+		return 1;
+	}
+
+	return 0;
+}
+
+static void process_args(struct packet_reader *request,
+			 struct upload_pack_data *data)
+{
+	while (packet_reader_read(request) != PACKET_READ_FLUSH) {
+		const char *arg = request->line;
+
+		/* process want */
+		if (parse_want(arg, data))
+			continue;
+		/* process have line */
+		if (parse_have(arg, &data->haves))
+			continue;
+
+		/* process args like thin-pack */
+		if (!strcmp(arg, "thin-pack")) {
+			use_thin_pack = 1;
+			continue;
+		}
+		if (!strcmp(arg, "ofs-delta")) {
+			use_ofs_delta = 1;
+			continue;
+		}
+		if (!strcmp(arg, "no-progress")) {
+			no_progress = 1;
+			continue;
+		}
+		if (!strcmp(arg, "include-tag")) {
+			use_include_tag = 1;
+			continue;
+		}
+		if (!strcmp(arg, "done")) {
+			data->done = 1;
+			continue;
+		}
+
+		/* Shallow related arguments */
+		if (process_shallow(arg, &data->shallows))
+			continue;
+		if (process_deepen(arg, &data->depth))
+			continue;
+		if (process_deepen_since(arg, &data->deepen_since,
+					 &data->deepen_rev_list))
+			continue;
+		if (process_deepen_not(arg, &data->deepen_not,
+				       &data->deepen_rev_list))
+			continue;
+		if (!strcmp(arg, "deepen-relative")) {
+			deepen_relative = 1;
+			continue;
+		}
+
+		/* ignore unknown lines maybe? */
+		die("unexpected line: '%s'", arg);
+	}
+}
+
+static void process_haves(struct oid_array *haves, struct oid_array *common)
+{
+	int i;
+
+	/* Process haves */
+	for (i = 0; i < haves->nr; i++) {
+		const struct object_id *oid = &haves->oid[i];
+		struct object *o;
+		int we_knew_they_have = 0;
+
+		if (!has_object_file(oid))
+			continue;
+
+		oid_array_append(common, oid);
+
+		o = parse_object(oid);
+		if (!o)
+			die("oops (%s)", oid_to_hex(oid));
+		if (o->type == OBJ_COMMIT) {
+			struct commit_list *parents;
+			struct commit *commit = (struct commit *)o;
+			if (o->flags & THEY_HAVE)
+				we_knew_they_have = 1;
+			else
+				o->flags |= THEY_HAVE;
+			if (!oldest_have || (commit->date < oldest_have))
+				oldest_have = commit->date;
+			for (parents = commit->parents;
+			     parents;
+			     parents = parents->next)
+				parents->item->object.flags |= THEY_HAVE;
+		}
+		if (!we_knew_they_have)
+			add_object_array(o, NULL, &have_obj);
+	}
+}
+
+static int send_acks(struct oid_array *acks, struct strbuf *response)
+{
+	int i;
+
+	packet_buf_write(response, "acknowledgments\n");
+
+	/* Send Acks */
+	if (!acks->nr)
+		packet_buf_write(response, "NAK\n");
+
+	for (i = 0; i < acks->nr; i++) {
+		packet_buf_write(response, "ACK %s\n",
+				 oid_to_hex(&acks->oid[i]));
+	}
+
+	if (ok_to_give_up()) {
+		/* Send Ready */
+		packet_buf_write(response, "ready\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Process the "have" lines of the request and, unless the client said
+ * "done", send the acknowledgments section. Return 1 if the packfile
+ * should be sent in this response, 0 if the client is expected to send
+ * another round of "have" lines.
+ */
+static int process_haves_and_send_acks(struct upload_pack_data *data)
+{
+	struct oid_array common = OID_ARRAY_INIT;
+	struct strbuf response = STRBUF_INIT;
+	int ret = 0;
+
+	process_haves(&data->haves, &common);
+	if (data->done) {
+		ret = 1;
+	} else if (send_acks(&common, &response)) {
+		packet_buf_delim(&response);
+		ret = 1;
+	} else {
+		/* Add Flush */
+		packet_buf_flush(&response);
+		ret = 0;
+	}
+
+	/* Send response */
+	write_or_die(1, response.buf, response.len);
+	strbuf_release(&response);
+
+	oid_array_clear(&data->haves);
+	oid_array_clear(&common);
+	return ret;
+}
+
+static void send_shallow_info(struct upload_pack_data *data)
+{
+	/* No shallow info needs to be sent */
+	if (!data->depth && !data->deepen_rev_list && !data->shallows.nr &&
+	    !is_repository_shallow())
+		return;
+
+	packet_write_fmt(1, "shallow-info\n");
+
+	if (!send_shallow_list(data->depth, data->deepen_rev_list,
+			       data->deepen_since, &data->deepen_not,
+			       &data->shallows) && is_repository_shallow())
+		deepen(INFINITE_DEPTH, deepen_relative, &data->shallows);
+
+	packet_delim(1);
+}
+
+enum fetch_state {
+	FETCH_PROCESS_ARGS = 0,
+	FETCH_SEND_ACKS,
+	FETCH_SEND_PACK,
+	FETCH_DONE,
+};
+
+int upload_pack_v2(struct repository *r, struct argv_array *keys,
+		   struct packet_reader *request)
+{
+	enum fetch_state state = FETCH_PROCESS_ARGS;
+	struct upload_pack_data data = UPLOAD_PACK_DATA_INIT;
 
 	git_config(upload_pack_config, NULL);
 
-	switch (determine_protocol_version_server()) {
-	case protocol_v1:
-		/*
-		 * v1 is just the original protocol with a version string,
-		 * so just fall through after writing the version string.
-		 */
-		if (advertise_refs || !stateless_rpc)
-			packet_write_fmt(1, "version 1\n");
-
-		/* fallthrough */
-	case protocol_v0:
-		upload_pack();
-		break;
-	case protocol_unknown_version:
-		BUG("unknown protocol version");
+	/*
+	 * Every request is self-contained: the client may have chosen
+	 * its wants from the ref list of a different process, so they
+	 * are checked like in the stateless RPC mode of version 0.
+	 */
+	stateless_rpc = 1;
+	use_sideband = LARGE_PACKET_MAX;
+	head_ref_namespaced(check_ref, NULL);
+	for_each_namespaced_ref(check_ref, NULL);
+
+	while (state != FETCH_DONE) {
+		switch (state) {
+		case FETCH_PROCESS_ARGS:
+			process_args(request, &data);
+			if (data.has_non_tip)
+				check_non_tip();
+
+			if (!want_obj.nr) {
+				/*
+				 * Request didn't contain any 'want' lines,
+				 * guess they didn't want a packfile.
+				 */
+				state = FETCH_DONE;
+			} else if (data.haves.nr || !data.done) {
+				/*
+				 * Request had 'have' lines (or the client
+				 * is still negotiating), so let's ACK them.
+				 */
+				state = FETCH_SEND_ACKS;
+			} else {
+				state = FETCH_SEND_PACK;
+			}
+			break;
+		case FETCH_SEND_ACKS:
+			if (process_haves_and_send_acks(&data))
+				state = FETCH_SEND_PACK;
+			else
+				state = FETCH_DONE;
+			break;
+		case FETCH_SEND_PACK:
+			send_shallow_info(&data);
+
+			packet_write_fmt(1, "packfile\n");
+			create_pack_file();
+			state = FETCH_DONE;
+			break;
+		case FETCH_DONE:
+			continue;
+		}
 	}
 
+	upload_pack_data_clear(&data);
 	return 0;
 }
+
+int upload_pack_advertise(struct repository *r,
+			  struct strbuf *value)
+{
+	if (value)
+		strbuf_addstr(value, "shallow");
+	return 1;
+}
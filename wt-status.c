@@ -17,6 +17,7 @@
 #include "utf8.h"
 #include "worktree.h"
 #include "lockfile.h"
+#include "sparse-index.h"
 
 static const char cut_line[] =
 "------------------------ >8 ------------------------\n";
@@ -613,6 +614,9 @@ static void wt_status_collect_changes_initial(struct wt_status *s)
 {
 	int i;
 
+	/* every path is a new file here, including those in sparse directories */
+	ensure_full_index(&the_index);
+
 	for (i = 0; i < active_nr; i++) {
 		struct string_list_item *it;
 		struct wt_status_change_data *d;